@@ -50,6 +50,9 @@
 /* If available, contains the Python version number currently in use. */
 #define HAVE_PYTHON "2.7"
 
+/* Defined if you have POSIX threads support */
+#define HAVE_PTHREAD 1
+
 /* Define to 1 if you have the <stdint.h> header file. */
 #define HAVE_STDINT_H 1
 
@@ -119,3 +122,9 @@
 
 /* TODO */
 #define ZL_VERSION "Not specified"
+
+/* Number of bits in a file offset, on hosts where this is settable. */
+/* #undef _FILE_OFFSET_BITS */
+
+/* Define for large files, on AIX-style hosts. */
+/* #undef _LARGE_FILES */
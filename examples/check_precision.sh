@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compares the hydrographs computed with the solution history stored in double and in single precision
+# (--float-history). The global file must write its hydrographs to a .dat file.
+#
+# Usage: check_precision.sh <global file> <.dat output file> [processes] [tolerance]
+#
+# Exits with a nonzero status if the largest difference, relative to the largest magnitude of each state, is
+# above the tolerance (1e-3 by default).
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <global file> <.dat output file> [processes] [tolerance]"
+    exit 2
+fi
+
+GBL=$1
+DAT=$2
+NP=${3:-1}
+TOL=${4:-1e-3}
+ASYNCH=${ASYNCH:-asynch}
+
+mpirun -np $NP $ASYNCH $GBL > /dev/null || exit 2
+cp $DAT $DAT.double
+mpirun -np $NP $ASYNCH $GBL --float-history > /dev/null || exit 2
+cp $DAT $DAT.float
+
+# The first lines give the number of links and of outputs, then each link has a "id num_points" line followed by
+# one line per point
+awk -v tol=$TOL '
+    FNR == 1 { file++; row = 0; header = 2 }
+    NF == 0 { next }
+    header > 0 { header--; next }
+    left == 0 { left = $2; next }
+    {
+        left--
+        row++
+        for (i = 2; i <= NF; i++) {
+            if (file == 1) { ref[row, i] = $i; v = ($i < 0) ? -$i : $i; if (v > scale[i]) scale[i] = v }
+            else { d = $i - ref[row, i]; if (d < 0) d = -d; if (d > diff[i]) diff[i] = d }
+        }
+        if (NF > cols) cols = NF
+    }
+    END {
+        worst = 0
+        for (i = 2; i <= cols; i++) {
+            rel = (scale[i] > 0) ? diff[i] / scale[i] : diff[i]
+            printf "Output %d: max abs difference %e, relative %e\n", i - 1, diff[i], rel
+            if (rel > worst) worst = rel
+        }
+        if (worst > tol) { printf "Above the tolerance %s\n", tol; exit 1 }
+        printf "Within the tolerance %s\n", tol
+    }' $DAT.double $DAT.float
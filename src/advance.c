@@ -8,36 +8,1143 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <math.h>
+#include <time.h>
+
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <minmax.h>
+#include <partition.h>
 #include <processdata.h>
+#include <rebalance.h>
 #include <rksteppers.h>
 #include <structs.h>
+#include <system.h>
+
+
+//Returns the time in seconds from a monotonic clock, to measure the cost of the links. Unlike MPI_Wtime, it may be
+//called from the solver threads.
+static double Cost_Clock(void)
+{
+#if defined(HAVE_UNISTD_H)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+//Computes as many steps as possible for the link current, up to maxtime. Also updates the ready flag of current.
+//Assumes current->current_iterations < current->iter_limit.
+static void Solve_Link(
+    Link* current,
+    double maxtime,
+    GlobalVars* globals,
+    int* assignments,
+    bool print_flag,
+    FILE* outputfile,
+    ConnData* db_connections,
+    Forcing* forcings,
+    Workspace* workspace)
+{
+    short int parentsval;
+    double start = globals->cost_save_filename ? Cost_Clock() : 0.0;
+
+    //Solve a few steps of the current link
+    if (current->num_parents == 0)	//Leaf
+    {
+        while (current->last_t + current->h < maxtime && current->current_iterations < current->iter_limit)
+        {
+            for (unsigned int i = 0; i < globals->num_forcings; i++)		//!!!! Put this in solver !!!!
+                if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                    current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+            current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+        }
+
+        if (current->last_t + current->h >= maxtime  && current->current_iterations < current->iter_limit && current->last_t < maxtime)	//If less than a full step is needed, just finish up
+        {
+            for (unsigned int i = 0; i < globals->num_forcings; i++)
+                if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                    current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+            current->h = min(current->h, maxtime - current->last_t);
+            assert(current->h > 0);
+            current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+
+            while (current->rejected == 0)
+            {
+                for (unsigned int i = 0; i < globals->num_forcings; i++)
+                    if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                        current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+                current->h = min(current->h, maxtime - current->last_t);
+                assert(current->h > 0);
+                current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+            }
+        }
+    }
+    else	//Has parents
+    {
+        parentsval = 0;
+        for (unsigned int i = 0; i < current->num_parents; i++)
+            parentsval += (current->last_t + current->h <= current->parents[i]->last_t);
+
+        while (parentsval == current->num_parents && current->current_iterations < current->iter_limit)
+        {
+            for (unsigned int i = 0; i < globals->num_forcings; i++)
+                if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                    current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+
+            if (current->discont_count > 0 && current->h > current->discont[current->discont_start] - current->last_t)
+            {
+#if defined (ASYNCH_HAVE_IMPLICIT_SOLVER)
+                current->h_old = current->h;
+#endif
+                current->h = current->discont[current->discont_start] - current->last_t;
+                assert(current->h > 0);
+            }
+
+            current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+
+            parentsval = 0;
+            for (unsigned int i = 0; i < current->num_parents; i++)
+                parentsval += (current->last_t + current->h <= current->parents[i]->last_t);
+        }
+
+        parentsval = 0;
+        for (unsigned int i = 0; i < current->num_parents; i++)
+            parentsval += (current->parents[i]->last_t >= maxtime);
+
+        if (parentsval == current->num_parents && current->current_iterations < current->iter_limit && current->last_t < maxtime)		//If all parents are done, then current should finish up too
+        {
+            current->h = min(current->h, maxtime - current->last_t);
+            assert(current->h > 0);
+            for (unsigned int i = 0; i < globals->num_forcings; i++)
+                if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                    current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+            if (current->discont_count > 0 && current->h > current->discont[current->discont_start] - current->last_t)
+            {
+#if defined (ASYNCH_HAVE_IMPLICIT_SOLVER)
+                current->h_old = current->h;
+#endif
+                current->h = current->discont[current->discont_start] - current->last_t;
+                assert(current->h > 0);
+            }
+
+            current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+            assert(current->h > 0);
+
+            while (current->last_t < maxtime && current->current_iterations < current->iter_limit)
+            {
+                for (unsigned int i = 0; i < globals->num_forcings; i++)
+                    if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                        current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+
+                if (current->discont_count > 0 && current->h > current->discont[current->discont_start] - current->last_t)
+                {
+#if defined (ASYNCH_HAVE_IMPLICIT_SOLVER)
+                    current->h_old = current->h;
+#endif
+                    current->h = current->discont[current->discont_start] - current->last_t;
+
+                }
+
+                current->h = min(current->h, maxtime - current->last_t);
+                current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+            }
+        }
+
+        if (current->current_iterations < current->iter_limit)
+            current->ready = 0;
+    }
+
+    //See if current has parents that hit their limit
+    for (unsigned int i = 0; i < current->num_parents; i++)
+    {
+        if (current->parents[i]->current_iterations >= current->parents[i]->iter_limit)
+            current->h = min(current->h, current->parents[i]->last_t - current->last_t);
+
+        // TODO improve on this
+        if(current->h + current->last_t > current->parents[i]->last_t)
+            current->h *= .999;
+    }
+
+    parentsval = 0;
+    for (unsigned int i = 0; i < current->num_parents; i++)
+        parentsval += (current->last_t + current->h <= current->parents[i]->last_t);
+    if (parentsval == current->num_parents && current->current_iterations < current->iter_limit)
+        current->ready = 1;
+
+    if (current->current_iterations > current->my->peak_iterations)
+        current->my->peak_iterations = current->current_iterations;
+
+    if (globals->cost_save_filename)
+        current->my->solve_time += Cost_Clock() - start;
+
+    //If current is a root link, trash its data
+    if (current->child == NULL)
+    {
+        RKSolutionNode *roottail = current->my->list.tail;
+        while (current->my->list.head != roottail)
+        {
+            Remove_Head_Node(&current->my->list);
+            (current->current_iterations)--;
+        }
+    }
+}
+
+//Notifies the child of current that current made progress
+static void Notify_Child(Link* current, double maxtime, int* assignments)
+{
+    short int parentsval;
+    Link* child = current->child;
+    if (child != NULL && assignments[child->location] == my_rank)
+    {
+        assert(child->h > 0);
+
+        //Make sure the child can take a step if current has reached limit
+        if ((current->current_iterations >= current->iter_limit) && (current->last_t > child->last_t))
+            child->h = min(child->h, current->last_t - child->last_t);
+
+        // TODO improve on this
+        if(child->h + child->last_t > current->last_t)
+            child->h *= .999;
+
+        assert(child->h > 0.0);
+
+        double next_t = child->last_t + child->h;
+        parentsval = 0;
+        for (unsigned int i = 0; i < child->num_parents; i++)
+            parentsval += (child->parents[i]->last_t >= next_t) || (child->parents[i]->last_t >= maxtime);
+
+        if (parentsval == child->num_parents)
+            child->ready = 1;
+        else
+            child->ready = 0;
+    }
+}
+
+//Computes as many steps as possible for the link current, up to maxtime. Also updates the ready flags of current and its child.
+//Assumes current->current_iterations < current->iter_limit.
+static void Advance_Link(
+    Link* current,
+    double maxtime,
+    GlobalVars* globals,
+    int* assignments,
+    bool print_flag,
+    FILE* outputfile,
+    ConnData* db_connections,
+    Forcing* forcings,
+    Workspace* workspace)
+{
+    Solve_Link(current, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
+    Notify_Child(current, maxtime, assignments);
+}
+
+//Returns true if the steps of link should be handed to the communication thread right after they are computed,
+//instead of when this process runs out of links to solve: the thread is running and the child is on another process.
+static bool Pack_Now(const TransData* my_data, const Link* link, const int* assignments)
+{
+    return my_data->progress != NULL && link->child != NULL && assignments[link->child->location] != my_rank;
+}
+
+//Groups of leaves (by index in my_sys) that take their steps together with ExplicitRKSolverBatch
+typedef struct LeafBatches
+{
+    unsigned int num_batches;
+    unsigned int* starts;       //!< Batch b holds the leaves members[starts[b]] to members[starts[b + 1] - 1] [num_batches + 1]
+    unsigned int* members;      //!< Indices in my_sys of the batched leaves [my_N]
+    unsigned int* batch_of;     //!< batch_of[i] is the batch of my_sys[i], or num_batches if it is not batched [my_N]
+    Link** lanes;               //!< Leaves taking a step together [width]
+    BatchWorkspace workspace;
+} LeafBatches;
+
+//Groups the leaves solved by ExplicitRKSolver into batches of at most width leaves with the same RK method and dimension
+static void LeafBatches_Init(LeafBatches* batches, Link** my_sys, unsigned int my_N, unsigned int width, GlobalVars* globals)
+{
+    unsigned int count = 0;
+
+    batches->num_batches = 0;
+    batches->starts = (unsigned int*)malloc((my_N + 1) * sizeof(unsigned int));
+    batches->members = (unsigned int*)malloc(my_N * sizeof(unsigned int));
+    batches->batch_of = (unsigned int*)malloc(my_N * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < my_N; i++)
+    {
+        Link* link = my_sys[i];
+        batches->batch_of[i] = my_N;
+        if (link->num_parents != 0 || !Is_ExplicitRKSolver(link))
+            continue;
+
+        //Start a new batch if the last one is full or solves a different system
+        if (batches->num_batches > 0)
+        {
+            unsigned int start = batches->starts[batches->num_batches - 1];
+            Link* first = my_sys[batches->members[start]];
+            if (count - start == width || first->method != link->method || first->dim != link->dim)
+                batches->starts[batches->num_batches++] = count;
+        }
+        else
+            batches->starts[batches->num_batches++] = count;
+
+        batches->batch_of[i] = batches->num_batches - 1;
+        batches->members[count++] = i;
+    }
+    batches->starts[batches->num_batches] = count;
+
+    for (unsigned int i = 0; i < my_N; i++)
+        if (batches->batch_of[i] == my_N)
+            batches->batch_of[i] = batches->num_batches;
+
+    batches->lanes = (Link**)malloc(width * sizeof(Link*));
+    Create_BatchWorkspace(&batches->workspace, width, globals->max_dim, globals->max_rk_stages);
+}
+
+static void LeafBatches_Free(LeafBatches* batches)
+{
+    free(batches->starts);
+    free(batches->members);
+    free(batches->batch_of);
+    free(batches->lanes);
+    Destroy_BatchWorkspace(&batches->workspace);
+}
+
+//Computes as many steps as possible for the leaves of batch b, up to maxtime. The leaves that can take a full step
+//take it together. Also updates the ready flags of the leaves and their children.
+static void Advance_Batch(
+    LeafBatches* batches,
+    unsigned int b,
+    Link** my_sys,
+    double maxtime,
+    GlobalVars* globals,
+    int* assignments,
+    bool print_flag,
+    FILE* outputfile,
+    ConnData* db_connections,
+    Forcing* forcings,
+    Workspace* workspace)
+{
+    unsigned int num_lanes;
+
+    do
+    {
+        num_lanes = 0;
+        for (unsigned int i = batches->starts[b]; i < batches->starts[b + 1]; i++)
+        {
+            Link* current = my_sys[batches->members[i]];
+            if (current->last_t + current->h < maxtime && current->current_iterations < current->iter_limit)
+            {
+                for (unsigned int j = 0; j < globals->num_forcings; j++)
+                    if (forcings[j].active && current->last_t < current->my->forcing_change_times[j])
+                        current->h = min(current->h, current->my->forcing_change_times[j] - current->last_t);
+                batches->lanes[num_lanes++] = current;
+            }
+        }
+
+        if (num_lanes > 0)
+        {
+            double start = globals->cost_save_filename ? Cost_Clock() : 0.0;
+            ExplicitRKSolverBatch(batches->lanes, num_lanes, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace, &batches->workspace);
+
+            //The leaves of the batch share the cost of the step
+            if (globals->cost_save_filename)
+            {
+                double share = (Cost_Clock() - start) / num_lanes;
+                for (unsigned int i = 0; i < num_lanes; i++)
+                    batches->lanes[i]->my->solve_time += share;
+            }
+        }
+    } while (num_lanes > 0);
+
+    //Finish up one leaf at a time
+    for (unsigned int i = batches->starts[b]; i < batches->starts[b + 1]; i++)
+        Advance_Link(my_sys[batches->members[i]], maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
+}
+
+//Unbranched reaches (by index in my_sys) solved as one coupled system with ExplicitRKSolverChain. The first link of a
+//chain is its head: the schedulers only solve the head, which takes the steps of the whole chain.
+typedef struct Chains
+{
+    unsigned int num_chains;
+    unsigned int* starts;       //!< Chain c holds the links members[starts[c]] to members[starts[c + 1] - 1] [num_chains + 1]
+    unsigned int* members;      //!< Indices in my_sys of the links in chains, from upstream to downstream [my_N]
+    Link** links;               //!< links[i] is my_sys[members[i]] [my_N]
+    unsigned int* chain_of;     //!< chain_of[i] is the chain of my_sys[i], or num_chains if it is not in a chain [my_N]
+    BatchWorkspace workspace;
+} Chains;
+
+//Returns true if link has one parent, assigned to this proc, and both can be solved in the same chain
+static bool Continues_Parent(Link* link, int* assignments)
+{
+    if (link == NULL || link->num_parents != 1 || !Is_ExplicitRKSolver(link) || assignments[link->location] != my_rank)
+        return false;
+
+    Link* parent = link->parents[0];
+    return assignments[parent->location] == my_rank && parent->num_parents == 1 && Is_ExplicitRKSolver(parent) && parent->method == link->method;
+}
+
+//Finds the chains of at most max_length links with a single parent each
+static void Chains_Init(Chains* chains, Link** my_sys, unsigned int my_N, unsigned int N, unsigned int max_length, int* assignments, GlobalVars* globals)
+{
+    unsigned int count = 0, longest = 0;
+    unsigned int* local_idx = (unsigned int*)malloc(N * sizeof(unsigned int));
+
+    chains->num_chains = 0;
+    chains->starts = (unsigned int*)malloc((my_N + 1) * sizeof(unsigned int));
+    chains->members = (unsigned int*)malloc(my_N * sizeof(unsigned int));
+    chains->links = (Link**)malloc(my_N * sizeof(Link*));
+    chains->chain_of = (unsigned int*)malloc(my_N * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < my_N; i++)
+    {
+        local_idx[my_sys[i]->location] = i;
+        chains->chain_of[i] = my_N;
+    }
+
+    for (unsigned int i = 0; i < my_N; i++)
+    {
+        Link* next = my_sys[i];
+
+        //Start from the most upstream link of each unbranched reach
+        if (next->num_parents != 1 || !Is_ExplicitRKSolver(next) || Continues_Parent(next, assignments) || !Continues_Parent(next->child, assignments))
+            continue;
+
+        //Cut the reach in chains of at most max_length links
+        while (next != NULL)
+        {
+            unsigned int start = count;
+            do
+            {
+                chains->members[count] = local_idx[next->location];
+                chains->links[count++] = next;
+                next = next->child;
+            } while (count - start < max_length && Continues_Parent(next, assignments));
+
+            if (!Continues_Parent(next, assignments))
+                next = NULL;
+
+            if (count - start < 2)
+                count = start;
+            else
+            {
+                for (unsigned int j = start; j < count; j++)
+                    chains->chain_of[chains->members[j]] = chains->num_chains;
+                chains->starts[chains->num_chains++] = start;
+                longest = max(longest, count - start);
+            }
+        }
+    }
+    chains->starts[chains->num_chains] = count;
+
+    for (unsigned int i = 0; i < my_N; i++)
+        if (chains->chain_of[i] == my_N)
+            chains->chain_of[i] = chains->num_chains;
+
+    Create_BatchWorkspace(&chains->workspace, max(longest, 1), globals->max_dim, globals->max_rk_stages);
+    free(local_idx);
+}
+
+static void Chains_Free(Chains* chains)
+{
+    free(chains->starts);
+    free(chains->members);
+    free(chains->links);
+    free(chains->chain_of);
+    Destroy_BatchWorkspace(&chains->workspace);
+}
+
+//Sets the step size of every link of the chain to the smallest one, so that no link steps over a change in its
+//forcings or a discontinuity. The step is also limited to maxtime.
+static void Chain_Step_Size(Link** chain, unsigned int length, double maxtime, GlobalVars* globals, Forcing* forcings)
+{
+    Link* head = chain[0];
+    double h = maxtime - head->last_t;
+
+    for (unsigned int j = 0; j < length; j++)
+    {
+        Link* current = chain[j];
+        h = min(h, current->h);
+        for (unsigned int i = 0; i < globals->num_forcings; i++)
+            if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
+                h = min(h, current->my->forcing_change_times[i] - current->last_t);
+        if (current->discont_count > 0)
+            h = min(h, current->discont[current->discont_start] - current->last_t);
+    }
+
+    assert(h > 0);
+    for (unsigned int j = 0; j < length; j++)
+        chain[j]->h = h;
+}
+
+//Computes as many steps as possible for the chain c, up to maxtime. Also updates the ready flags of the head of the
+//chain and of the child of the last link.
+static void Advance_Chain(
+    Chains* chains,
+    unsigned int c,
+    double maxtime,
+    GlobalVars* globals,
+    int* assignments,
+    bool print_flag,
+    FILE* outputfile,
+    ConnData* db_connections,
+    Forcing* forcings,
+    Workspace* workspace)
+{
+    Link** chain = &chains->links[chains->starts[c]];
+    unsigned int length = chains->starts[c + 1] - chains->starts[c];
+    Link* head = chain[0];
+    Link* tail = chain[length - 1];
+    short int parentsval;
+    double start = globals->cost_save_filename ? Cost_Clock() : 0.0;
+
+    if (head->last_t < maxtime)
+    {
+        //Solve a few steps of the chain
+        Chain_Step_Size(chain, length, maxtime, globals, forcings);
+        parentsval = 0;
+        for (unsigned int i = 0; i < head->num_parents; i++)
+            parentsval += (head->last_t + head->h <= head->parents[i]->last_t);
+
+        while (parentsval == head->num_parents && tail->current_iterations < tail->iter_limit && head->last_t < maxtime)
+        {
+            head->rejected = ExplicitRKSolverChain(chain, length, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace, &chains->workspace);
+            if (head->last_t >= maxtime)
+                break;
+
+            Chain_Step_Size(chain, length, maxtime, globals, forcings);
+            parentsval = 0;
+            for (unsigned int i = 0; i < head->num_parents; i++)
+                parentsval += (head->last_t + head->h <= head->parents[i]->last_t);
+        }
+
+        //If all parents are done, then the chain should finish up too
+        parentsval = 0;
+        for (unsigned int i = 0; i < head->num_parents; i++)
+            parentsval += (head->parents[i]->last_t >= maxtime);
+
+        while (parentsval == head->num_parents && tail->current_iterations < tail->iter_limit && head->last_t < maxtime)
+        {
+            Chain_Step_Size(chain, length, maxtime, globals, forcings);
+            head->rejected = ExplicitRKSolverChain(chain, length, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace, &chains->workspace);
+        }
+    }
+
+    //The links of the chain share the cost of its steps
+    if (globals->cost_save_filename)
+    {
+        double share = (Cost_Clock() - start) / length;
+        for (unsigned int i = 0; i < length; i++)
+            chain[i]->my->solve_time += share;
+    }
+
+    if (tail->current_iterations < tail->iter_limit)
+        head->ready = 0;
+
+    //See if the head has parents that hit their limit
+    for (unsigned int i = 0; i < head->num_parents; i++)
+    {
+        if (head->parents[i]->current_iterations >= head->parents[i]->iter_limit)
+            head->h = min(head->h, head->parents[i]->last_t - head->last_t);
+
+        if (head->h + head->last_t > head->parents[i]->last_t)
+            head->h *= .999;
+    }
+
+    parentsval = 0;
+    for (unsigned int i = 0; i < head->num_parents; i++)
+        parentsval += (head->last_t + head->h <= head->parents[i]->last_t);
+    if (parentsval == head->num_parents && tail->current_iterations < tail->iter_limit)
+        head->ready = 1;
+
+    if (tail->current_iterations > tail->my->peak_iterations)
+        tail->my->peak_iterations = tail->current_iterations;
+
+    //If the chain ends at a root link, trash its data
+    if (tail->child == NULL)
+    {
+        RKSolutionNode *roottail = tail->my->list.tail;
+        while (tail->my->list.head != roottail)
+        {
+            Remove_Head_Node(&tail->my->list);
+            (tail->current_iterations)--;
+        }
+    }
+
+    Notify_Child(tail, maxtime, assignments);
+}
+
+//Queue of links (by index in my_sys) that can take a step. Each link appears at most once.
+typedef struct ReadyQueue
+{
+    unsigned int* links;        //!< Ring buffer of indices in my_sys [my_N]
+    unsigned int head;          //!< Position of the next link to pop
+    unsigned int count;         //!< Number of links in the queue
+    unsigned int size;          //!< Capacity of links
+    short int* queued;          //!< queued[i] is 1 if my_sys[i] is in the queue [my_N]
+    unsigned int* local_idx;    //!< local_idx[loc] is the index in my_sys of the link at sys location loc [N]
+    Chains* chains;             //!< Links in a chain are queued as the head of their chain. NULL if no chain is fused.
+} ReadyQueue;
+
+static void ReadyQueue_Init(ReadyQueue* queue, Link** my_sys, unsigned int my_N, unsigned int N)
+{
+    queue->links = (unsigned int*)malloc(my_N * sizeof(unsigned int));
+    queue->queued = (short int*)calloc(my_N, sizeof(short int));
+    queue->local_idx = (unsigned int*)malloc(N * sizeof(unsigned int));
+    queue->head = 0;
+    queue->count = 0;
+    queue->size = my_N;
+    queue->chains = NULL;
+
+    for (unsigned int i = 0; i < N; i++)
+        queue->local_idx[i] = my_N;
+    for (unsigned int i = 0; i < my_N; i++)
+        queue->local_idx[my_sys[i]->location] = i;
+}
+
+static void ReadyQueue_Free(ReadyQueue* queue)
+{
+    free(queue->links);
+    free(queue->queued);
+    free(queue->local_idx);
+}
+
+//Adds link to the queue if it is assigned to this proc, not done for this pass, and able to take a step
+static void ReadyQueue_Push(ReadyQueue* queue, Link* link, short int* done)
+{
+    unsigned int idx = queue->local_idx[link->location];
+
+    //A chain can take a step if its last link is not at the limit
+    if (queue->chains != NULL && idx < queue->size && queue->chains->chain_of[idx] < queue->chains->num_chains)
+    {
+        Chains* chains = queue->chains;
+        unsigned int c = chains->chain_of[idx];
+        Link* tail = chains->links[chains->starts[c + 1] - 1];
+        if (tail->current_iterations >= tail->iter_limit)
+            return;
+        idx = chains->members[chains->starts[c]];
+        link = chains->links[chains->starts[c]];
+    }
+
+    if (idx == queue->size || queue->queued[idx] || done[idx])
+        return;
+    if (link->ready == 0 || link->current_iterations >= link->iter_limit)
+        return;
+
+    queue->links[(queue->head + queue->count) % queue->size] = idx;
+    queue->count++;
+    queue->queued[idx] = 1;
+}
+
+static unsigned int ReadyQueue_Pop(ReadyQueue* queue)
+{
+    unsigned int idx = queue->links[queue->head];
+
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+    queue->queued[idx] = 0;
+
+    return idx;
+}
+
+//Queues the links whose state may have changed after communication with other procs:
+//children of links with received data, and links whose data was sent.
+static void ReadyQueue_Push_Boundary(ReadyQueue* queue, TransData* my_data, short int* done)
+{
+    for (int i = 0; i < np; i++)
+    {
+        for (unsigned int j = 0; j < my_data->receive_size[i]; j++)
+        {
+            Link* child = my_data->receive_data[i][j]->child;
+            if (child != NULL)
+                ReadyQueue_Push(queue, child, done);
+        }
+
+        for (unsigned int j = 0; j < my_data->send_size[i]; j++)
+            ReadyQueue_Push(queue, my_data->send_data[i][j], done);
+    }
+}
+
+
+#if defined(HAVE_PTHREAD)
+
+//Links (by index in my_sys) waiting to be computed by a thread. The owner thread works at the bottom,
+//the other threads steal from the top.
+typedef struct WorkDeque
+{
+    pthread_mutex_t mutex;
+    unsigned int* links;        //!< Ring buffer of indices in my_sys [my_N]
+    unsigned int top;           //!< Position of the next link to steal
+    unsigned int count;         //!< Number of links in the deque
+    unsigned int size;          //!< Capacity of links
+} WorkDeque;
+
+//Data shared by the threads computing the links of this proc.
+//A thread computing a link holds the busy flags of the link and its parents. If the forcings of the link
+//change before maxtime, the discontinuity may be propagated downstream, so the flags of the downstream
+//links are held too. The flag of the child is held only while the child is notified.
+typedef struct WorkerPool
+{
+    unsigned int num_threads;
+    WorkDeque* deques;          //!< One deque per thread [num_threads]
+    Workspace* workspaces;      //!< One workspace per thread [num_threads]. The first one belongs to the caller of Advance.
+    char* busy;                 //!< busy[loc] is set while a thread uses the link at sys location loc [N]
+    char* queued;               //!< queued[i] is set while my_sys[i] is in a deque [my_N]
+    char* done;                 //!< done[i] is set when my_sys[i] is done with the current pass [my_N]
+    unsigned int* local_idx;    //!< local_idx[loc] is the index in my_sys of the link at sys location loc, my_N if not assigned to this proc [N]
+    Link** boundary;            //!< Links used by Transfer_Data [num_boundary]
+    unsigned int num_boundary;
+    unsigned int alldone;       //!< Number of links done with the current pass
+
+    //Arguments of the current pass
+    Link* sys;
+    Link** my_sys;
+    unsigned int my_N;
+    double maxtime;
+    GlobalVars* globals;
+    int* assignments;
+    bool print_flag;
+    FILE* outputfile;
+    ConnData* db_connections;
+    Forcing* forcings;
+    TransData* my_data;
+} WorkerPool;
+
+typedef struct WorkerArgs
+{
+    WorkerPool* pool;
+    unsigned int id;
+} WorkerArgs;
+
+static bool Try_Lock_Link(WorkerPool* pool, Link* link)
+{
+    return !__atomic_test_and_set(&pool->busy[link->location], __ATOMIC_ACQUIRE);
+}
+
+static void Unlock_Link(WorkerPool* pool, Link* link)
+{
+    __atomic_clear(&pool->busy[link->location], __ATOMIC_RELEASE);
+}
+
+static void Unlock_Links(WorkerPool* pool, Link** locked, unsigned int num_locked)
+{
+    for (unsigned int i = 0; i < num_locked; i++)
+        Unlock_Link(pool, locked[i]);
+}
+
+//Tries to take the busy flags of every link in links. Either all flags are taken or none.
+static bool Try_Lock_Links(WorkerPool* pool, Link** links, unsigned int num_links)
+{
+    for (unsigned int i = 0; i < num_links; i++)
+    {
+        if (!Try_Lock_Link(pool, links[i]))
+        {
+            Unlock_Links(pool, links, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//Builds the list of links a thread must hold to compute current. Returns the number of links.
+static unsigned int Links_To_Lock(WorkerPool* pool, Link* current, Link** links)
+{
+    GlobalVars* globals = pool->globals;
+    unsigned int num_links = 0;
+
+    links[num_links++] = current;
+    for (unsigned int i = 0; i < current->num_parents; i++)
+        links[num_links++] = current->parents[i];
+
+    //Check if a discontinuity may be propagated downstream
+    bool propagates = false;
+    for (unsigned int i = 0; i < globals->num_forcings; i++)
+        if (pool->forcings[i].active && current->my->forcing_data[i].num_points > 0 && current->my->forcing_change_times[i] <= pool->maxtime + 1e-8)
+            propagates = true;
+
+    if (propagates)
+    {
+        Link* next = current->child;
+        for (unsigned int i = 0; i < globals->max_localorder && next != NULL && pool->assignments[next->location] == my_rank; i++)
+        {
+            links[num_links++] = next;
+            next = next->child;
+        }
+    }
+
+    return num_links;
+}
+
+static void WorkDeque_Init(WorkDeque* deque, unsigned int size)
+{
+    pthread_mutex_init(&deque->mutex, NULL);
+    deque->links = (unsigned int*)malloc(size * sizeof(unsigned int));
+    deque->top = 0;
+    deque->count = 0;
+    deque->size = size;
+}
+
+static void WorkDeque_Free(WorkDeque* deque)
+{
+    pthread_mutex_destroy(&deque->mutex);
+    free(deque->links);
+}
+
+//Adds a link at the bottom of the deque, or at the top if at_top is set
+static void WorkDeque_Push(WorkDeque* deque, unsigned int idx, bool at_top)
+{
+    pthread_mutex_lock(&deque->mutex);
+    if (at_top)
+    {
+        deque->top = (deque->top + deque->size - 1) % deque->size;
+        deque->links[deque->top] = idx;
+    }
+    else
+        deque->links[(deque->top + deque->count) % deque->size] = idx;
+    deque->count++;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+//Removes a link from the bottom of the deque, or from the top if at_top is set. Returns false if the deque is empty.
+static bool WorkDeque_Pop(WorkDeque* deque, unsigned int* idx, bool at_top)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->count > 0)
+    {
+        deque->count--;
+        if (at_top)
+        {
+            *idx = deque->links[deque->top];
+            deque->top = (deque->top + 1) % deque->size;
+        }
+        else
+            *idx = deque->links[(deque->top + deque->count) % deque->size];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return found;
+}
+
+//Adds link to the deque of thread id if it is assigned to this proc, not done for this pass, and able to take a step
+static void Worker_Push(WorkerPool* pool, unsigned int id, Link* link, bool at_top)
+{
+    unsigned int idx = pool->local_idx[link->location];
+
+    if (idx == pool->my_N || __atomic_load_n(&pool->done[idx], __ATOMIC_ACQUIRE))
+        return;
+    if (__atomic_load_n(&link->ready, __ATOMIC_RELAXED) == 0 || __atomic_load_n(&link->current_iterations, __ATOMIC_RELAXED) >= link->iter_limit)
+        return;
+    if (__atomic_test_and_set(&pool->queued[idx], __ATOMIC_ACQ_REL))
+        return;
+
+    WorkDeque_Push(&pool->deques[id], idx, at_top);
+}
+
+static void Add_Boundary_Link(WorkerPool* pool, Link* link, char* mark, unsigned int* size_boundary)
+{
+    if (mark[link->location])
+        return;
+    mark[link->location] = 1;
+
+    if (pool->num_boundary == *size_boundary)
+    {
+        *size_boundary *= 2;
+        pool->boundary = (Link**)realloc(pool->boundary, *size_boundary * sizeof(Link*));
+    }
+    pool->boundary[pool->num_boundary++] = link;
+}
+
+static void WorkerPool_Init(WorkerPool* pool, unsigned int num_threads, Link* sys, unsigned int N, Link** my_sys, unsigned int my_N, GlobalVars* globals, int* assignments, TransData* my_data, Workspace* workspace)
+{
+    pool->num_threads = num_threads;
+    pool->sys = sys;
+    pool->my_sys = my_sys;
+    pool->my_N = my_N;
+    pool->globals = globals;
+    pool->assignments = assignments;
+    pool->my_data = my_data;
+
+    pool->deques = (WorkDeque*)malloc(num_threads * sizeof(WorkDeque));
+    pool->workspaces = (Workspace*)malloc(num_threads * sizeof(Workspace));
+    for (unsigned int i = 0; i < num_threads; i++)
+        WorkDeque_Init(&pool->deques[i], max(my_N, 1));
+    pool->workspaces[0] = *workspace;
+    for (unsigned int i = 1; i < num_threads; i++)
+        Create_Workspace(&pool->workspaces[i], globals->max_dim, globals->max_rk_stages, globals->max_parents);
+
+    pool->busy = (char*)calloc(N, sizeof(char));
+    pool->queued = (char*)calloc(my_N, sizeof(char));
+    pool->done = (char*)calloc(my_N, sizeof(char));
+    pool->local_idx = (unsigned int*)malloc(N * sizeof(unsigned int));
+    for (unsigned int i = 0; i < N; i++)
+        pool->local_idx[i] = my_N;
+    for (unsigned int i = 0; i < my_N; i++)
+        pool->local_idx[my_sys[i]->location] = i;
+
+    //Transfer_Data uses the links sent and received, the children of the received links with their
+    //parents, and the downstream links where discontinuities are inserted
+    char* mark = (char*)calloc(N, sizeof(char));
+    unsigned int size_boundary = 16;
+    pool->boundary = (Link**)malloc(size_boundary * sizeof(Link*));
+    pool->num_boundary = 0;
+    for (int i = 0; i < np; i++)
+    {
+        for (unsigned int j = 0; j < my_data->send_size[i]; j++)
+            Add_Boundary_Link(pool, my_data->send_data[i][j], mark, &size_boundary);
+
+        for (unsigned int j = 0; j < my_data->receive_size[i]; j++)
+        {
+            Link* link = my_data->receive_data[i][j];
+            Add_Boundary_Link(pool, link, mark, &size_boundary);
+            if (link->child == NULL)
+                continue;
+
+            for (unsigned int k = 0; k < link->child->num_parents; k++)
+                Add_Boundary_Link(pool, link->child->parents[k], mark, &size_boundary);
+
+            Link* next = link->child;
+            for (unsigned int k = 0; k < globals->max_localorder && next != NULL && assignments[next->location] == my_rank; k++)
+            {
+                Add_Boundary_Link(pool, next, mark, &size_boundary);
+                next = next->child;
+            }
+        }
+    }
+    free(mark);
+}
+
+static void WorkerPool_Free(WorkerPool* pool)
+{
+    for (unsigned int i = 0; i < pool->num_threads; i++)
+        WorkDeque_Free(&pool->deques[i]);
+    for (unsigned int i = 1; i < pool->num_threads; i++)
+        Destroy_Workspace(&pool->workspaces[i], pool->globals->max_rk_stages, pool->globals->max_parents);
+    free(pool->deques);
+    free(pool->workspaces);
+    free(pool->busy);
+    free(pool->queued);
+    free(pool->done);
+    free(pool->local_idx);
+    free(pool->boundary);
+}
 
+//Exchanges data with other processes. Called by the main thread only.
+static void Worker_Communicate(WorkerPool* pool)
+{
+    TransData* my_data = pool->my_data;
+
+    //Wait for the threads to release the links used by Transfer_Data
+    while (!Try_Lock_Links(pool, pool->boundary, pool->num_boundary))
+        sched_yield();
+
+    Transfer_Data(my_data, pool->sys, pool->assignments, pool->globals);
+
+    Unlock_Links(pool, pool->boundary, pool->num_boundary);
+
+    for (int i = 0; i < np; i++)
+    {
+        for (unsigned int j = 0; j < my_data->receive_size[i]; j++)
+        {
+            Link* child = my_data->receive_data[i][j]->child;
+            if (child != NULL)
+                Worker_Push(pool, 0, child, false);
+        }
+
+        for (unsigned int j = 0; j < my_data->send_size[i]; j++)
+            Worker_Push(pool, 0, my_data->send_data[i][j], false);
+    }
+}
+
+//Main loop of a thread
+static void* Worker_Run(void* arg)
+{
+    WorkerPool* pool = ((WorkerArgs*)arg)->pool;
+    unsigned int id = ((WorkerArgs*)arg)->id;
+    GlobalVars* globals = pool->globals;
+    Link** locked = (Link**)malloc((1 + globals->max_parents + globals->max_localorder) * sizeof(Link*));
+
+    while (__atomic_load_n(&pool->alldone, __ATOMIC_ACQUIRE) < pool->my_N)
+    {
+        //Take a link from this thread, or steal one from another thread
+        unsigned int idx;
+        bool found = WorkDeque_Pop(&pool->deques[id], &idx, false);
+        for (unsigned int i = 1; i < pool->num_threads && !found; i++)
+            found = WorkDeque_Pop(&pool->deques[(id + i) % pool->num_threads], &idx, true);
+
+        if (!found)
+        {
+            //Nothing to compute, so communicate with other processes
+            if (id == 0 && np > 1)
+                Worker_Communicate(pool);
+            else
+                sched_yield();
+            continue;
+        }
+
+        __atomic_clear(&pool->queued[idx], __ATOMIC_RELEASE);
+        Link* current = pool->my_sys[idx];
+
+        unsigned int num_locked = Links_To_Lock(pool, current, locked);
+        if (!Try_Lock_Links(pool, locked, num_locked))
+        {
+            //A neighbor is being computed. Try again later.
+            Worker_Push(pool, id, current, true);
+            sched_yield();
+            continue;
+        }
+
+        if (!pool->done[idx] && current->ready && current->current_iterations < current->iter_limit)
+        {
+            Solve_Link(current, pool->maxtime, globals, pool->assignments, pool->print_flag, pool->outputfile, pool->db_connections, pool->forcings, &pool->workspaces[id]);
+
+            //The child is held only if it is not already
+            Link* child = current->child;
+            bool lock_child = (child != NULL) && (pool->assignments[child->location] == my_rank);
+            for (unsigned int i = 0; i < num_locked && lock_child; i++)
+                lock_child = (locked[i] != child);
+            if (lock_child)
+            {
+                while (!Try_Lock_Link(pool, child))
+                    sched_yield();
+            }
+            Notify_Child(current, pool->maxtime, pool->assignments);
+            if (lock_child)
+                Unlock_Link(pool, child);
+
+            //Check if current is done
+            if (current->last_t >= pool->maxtime)
+            {
+                current->last_t = pool->maxtime;	//In case of roundoff errors
+                __atomic_store_n(&pool->done[idx], 1, __ATOMIC_RELEASE);
+                __atomic_add_fetch(&pool->alldone, 1, __ATOMIC_ACQ_REL);
+            }
+        }
+
+        Unlock_Links(pool, locked, num_locked);
+
+        //Queue the links that may be able to take a step now
+        Worker_Push(pool, id, current, false);
+        if (current->child != NULL)
+            Worker_Push(pool, id, current->child, false);
+        for (unsigned int i = 0; i < current->num_parents; i++)
+            Worker_Push(pool, id, current->parents[i], false);
+    }
+
+    free(locked);
+
+    return NULL;
+}
+
+//Computes every link of this proc up to maxtime with the threads of pool
+static void WorkerPool_Run(WorkerPool* pool, double maxtime, bool print_flag, FILE* outputfile, ConnData* db_connections, Forcing* forcings)
+{
+    pthread_t* threads = (pthread_t*)malloc(pool->num_threads * sizeof(pthread_t));
+    WorkerArgs* args = (WorkerArgs*)malloc(pool->num_threads * sizeof(WorkerArgs));
+
+    pool->maxtime = maxtime;
+    pool->print_flag = print_flag;
+    pool->outputfile = outputfile;
+    pool->db_connections = db_connections;
+    pool->forcings = forcings;
+    pool->alldone = 0;
+    memset(pool->done, 0, pool->my_N * sizeof(char));
+
+    //Give each thread a contiguous range of links to start with
+    for (unsigned int i = 0; i < pool->my_N; i++)
+        Worker_Push(pool, (unsigned int)((unsigned long long)i * pool->num_threads / pool->my_N), pool->my_sys[i], false);
+
+    for (unsigned int i = 0; i < pool->num_threads; i++)
+    {
+        args[i].pool = pool;
+        args[i].id = i;
+    }
+    for (unsigned int i = 1; i < pool->num_threads; i++)
+        pthread_create(&threads[i], NULL, Worker_Run, &args[i]);
+    Worker_Run(&args[0]);
+    for (unsigned int i = 1; i < pool->num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(args);
+}
+
+#endif //HAVE_PTHREAD
 
 void Advance(
     Link *sys, unsigned int N,
-    Link **my_sys, unsigned int my_N,
+    Link ***my_sys_ref, unsigned int *my_N_ref,
     GlobalVars* globals,
     int* assignments, short int* getting, unsigned int* res_list, unsigned int res_size, const Lookup * const id_to_loc,
     Workspace* workspace,
     Forcing* forcings,
     ConnData* db_connections,
     TransData* my_data,
+    RKMethod* rk_methods,
+    ErrorData* errors,
+    AsynchModel* model,
+    void* external,
     int print_level,
     FILE* outputfile)
 {
     //Initialize remaining data
+    Link **my_sys = *my_sys_ref;
+    unsigned int my_N = *my_N_ref;
     short int* done = (short int*)malloc(my_N * sizeof(short int));
-    short int parentsval;
     Link* current;
     unsigned int last_idx, curr_idx, around;
     unsigned int two_my_N = 2 * my_N;
     int error_code;
 	bool print_flag = false;
+    bool first_pass = true;
 
 	if (print_level >= 1)
 		print_flag = true;
+
+    ReadyQueue queue;
+    if (globals->scheduler_flag == ASYNCH_SCHEDULER_QUEUE)
+        ReadyQueue_Init(&queue, my_sys, my_N, N);
+
+    //Leaves are batched only when a single thread solves the links
+    LeafBatches batches;
+    bool batch_leaves = globals->leaf_batch > 1 && globals->num_threads <= 1;
+    if (batch_leaves)
+        LeafBatches_Init(&batches, my_sys, my_N, globals->leaf_batch, globals);
+
+    //Unbranched reaches are fused only when a single thread solves the links
+    Chains chains;
+    bool fuse_chains = globals->chain_length > 1 && globals->num_threads <= 1;
+    if (fuse_chains)
+    {
+        Chains_Init(&chains, my_sys, my_N, N, globals->chain_length, assignments, globals);
+        if (globals->scheduler_flag == ASYNCH_SCHEDULER_QUEUE)
+            queue.chains = &chains;
+    }
+
+#if defined(HAVE_PTHREAD)
+    WorkerPool pool;
+    if (globals->num_threads > 1)
+        WorkerPool_Init(&pool, globals->num_threads, sys, N, my_sys, my_N, globals, assignments, my_data, workspace);
+#endif
+
+    //Count the steps of each link from here, to measure the work of the processes at every pass
+    unsigned int* last_steps = NULL;
+    bool rebalance = globals->rebalance_threshold > 0.0 && np > 1;
+    if (rebalance && !Rebalance_Supported(globals, forcings, rk_methods))
+    {
+        if (my_rank == 0)
+            printf("Warning: links cannot be moved between processes with an .rkd file, grid cell forcings or an implicit method. Not rebalancing.\n");
+        rebalance = false;
+    }
+    if (rebalance)
+    {
+        last_steps = (unsigned int*)calloc(N, sizeof(unsigned int));
+        for (unsigned int i = 0; i < my_N; i++)
+            last_steps[my_sys[i]->location] = my_sys[i]->my->num_accepted + my_sys[i]->my->num_rejected;
+    }
 	
     //Initialize values for forcing data
 	if ((print_level >= 2) && (my_rank == 0))
@@ -161,15 +1268,141 @@ void Advance(
 			fflush(stdout);
 		}
         
+        //Adapt the capacity of the lists to how full they got during the last pass. No other thread is running here.
+        if (globals->adaptive_lists && !first_pass)
+            for (unsigned int i = 0; i < my_N; i++)
+                Adapt_List(my_sys[i], assignments, globals);
+        first_pass = false;
+
         for (unsigned int i = 0; i < my_N; i++)
         {
             my_sys[i]->h = InitialStepSize(my_sys[i]->last_t, my_sys[i], globals, workspace);
             assert(my_sys[i]->h > 1e-12);
         }
 
-        //This might be needed. Sometimes some procs get stuck in Finish for communication, but makes runs much slower.
-        MPI_Barrier(MPI_COMM_WORLD);
-        if (globals->t < globals->maxtime)
+        //Let a dedicated thread progress the messages while solving
+        if (globals->comm_thread && np > 1)
+            Start_Comm_Progress(my_data);
+
+#if defined(HAVE_PTHREAD)
+        if (globals->t < globals->maxtime && globals->num_threads > 1)
+        {
+            WorkerPool_Run(&pool, maxtime, print_flag, outputfile, db_connections, forcings);
+        }
+        else
+#endif
+        if (globals->t < globals->maxtime && globals->scheduler_flag == ASYNCH_SCHEDULER_QUEUE)
+        {
+            unsigned int alldone = 0;
+
+            for (unsigned int i = 0; i < my_N; i++)
+                ReadyQueue_Push(&queue, my_sys[i], done);
+
+            while (alldone < my_N)
+            {
+                //Nothing to compute, so communicate with other processes
+                if (queue.count == 0)
+                {
+                    Transfer_Data(my_data, sys, assignments, globals);
+                    ReadyQueue_Push_Boundary(&queue, my_data, done);
+                    continue;
+                }
+
+                curr_idx = ReadyQueue_Pop(&queue);
+                current = my_sys[curr_idx];
+
+                //Solve the whole chain from its head
+                if (fuse_chains && chains.chain_of[curr_idx] < chains.num_chains)
+                {
+                    unsigned int c = chains.chain_of[curr_idx];
+                    Link* tail = chains.links[chains.starts[c + 1] - 1];
+                    Advance_Chain(&chains, c, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
+
+                    for (unsigned int i = chains.starts[c]; i < chains.starts[c + 1]; i++)
+                    {
+                        unsigned int idx = chains.members[i];
+                        if (!done[idx] && my_sys[idx]->last_t >= maxtime)
+                        {
+                            alldone++;
+                            done[idx] = 1;
+                            my_sys[idx]->last_t = maxtime;	//In case of roundoff errors
+                        }
+                    }
+
+                    if (Pack_Now(my_data, tail, assignments))
+                    {
+                        Transfer_Data(my_data, sys, assignments, globals);
+                        ReadyQueue_Push_Boundary(&queue, my_data, done);
+                    }
+
+                    //Queue the links that may be able to take a step now
+                    ReadyQueue_Push(&queue, current, done);
+                    if (tail->child != NULL)
+                        ReadyQueue_Push(&queue, tail->child, done);
+                    for (unsigned int i = 0; i < current->num_parents; i++)
+                        ReadyQueue_Push(&queue, current->parents[i], done);
+                    continue;
+                }
+
+                //Solve the whole batch of a leaf
+                if (batch_leaves && batches.batch_of[curr_idx] < batches.num_batches)
+                {
+                    unsigned int b = batches.batch_of[curr_idx];
+                    Advance_Batch(&batches, b, my_sys, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
+
+                    bool pack_now = false;
+                    for (unsigned int i = batches.starts[b]; i < batches.starts[b + 1]; i++)
+                    {
+                        unsigned int idx = batches.members[i];
+                        Link* leaf = my_sys[idx];
+                        if (!done[idx] && leaf->last_t >= maxtime)
+                        {
+                            alldone++;
+                            done[idx] = 1;
+                            leaf->last_t = maxtime;	//In case of roundoff errors
+                        }
+
+                        ReadyQueue_Push(&queue, leaf, done);
+                        if (leaf->child != NULL)
+                            ReadyQueue_Push(&queue, leaf->child, done);
+                        pack_now |= Pack_Now(my_data, leaf, assignments);
+                    }
+
+                    if (pack_now)
+                    {
+                        Transfer_Data(my_data, sys, assignments, globals);
+                        ReadyQueue_Push_Boundary(&queue, my_data, done);
+                    }
+                    continue;
+                }
+
+                Advance_Link(current, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
+
+                //Check if current is done
+                if (current->last_t >= maxtime)
+                {
+                    alldone++;
+                    done[curr_idx] = 1;
+                    current->last_t = maxtime;	//In case of roundoff errors
+                }
+
+                if (Pack_Now(my_data, current, assignments))
+                {
+                    Transfer_Data(my_data, sys, assignments, globals);
+                    ReadyQueue_Push_Boundary(&queue, my_data, done);
+                }
+
+                //Queue the links that may be able to take a step now
+                ReadyQueue_Push(&queue, current, done);
+                if (current->child != NULL)
+                    ReadyQueue_Push(&queue, current->child, done);
+                for (unsigned int i = 0; i < current->num_parents; i++)
+                    ReadyQueue_Push(&queue, current->parents[i], done);
+
+                assert(current->h > 0);
+            }
+        }
+        else if (globals->t < globals->maxtime)
         {
             unsigned int alldone = 0;
             while (alldone < my_N)
@@ -191,174 +1424,65 @@ void Advance(
                 }
                 else	//Compute an iteration
                 {
-                    //If the current link is not too far ahead, it can compute some iterations
-                    if (current->current_iterations < globals->iter_limit)
+                    //Solve the whole chain from its head. The other links of a chain are never solved alone.
+                    if (fuse_chains && chains.chain_of[curr_idx] < chains.num_chains)
                     {
-						// adlz
-						// if ((print_level >= 2) && (my_rank == 0))
-						//	printf("       ...computting iteration %i (max %i).\n", current->current_iterations, globals->iter_limit);
-                        //Solve a few steps of the current link
-                        if (current->num_parents == 0)	//Leaf
+                        unsigned int c = chains.chain_of[curr_idx];
+                        if (chains.members[chains.starts[c]] != curr_idx)
+                            current->ready = 0;
+                        else if (chains.links[chains.starts[c + 1] - 1]->current_iterations < chains.links[chains.starts[c + 1] - 1]->iter_limit)
                         {
-							// adlz
-							// if ((print_level >= 2) && (my_rank == 0))
-							//	printf("       ...solving a leaf...\n");
-                            while (current->last_t + current->h < maxtime && current->current_iterations < globals->iter_limit)
-                            {
-								// adlz
-								// if ((print_level >= 2) && (my_rank == 0))
-								// {
-								//	printf("       ...iterating 1 (%i of %i)...\n", current->current_iterations, globals->iter_limit);
-								//	printf("         as %f + %f (%f) < %f.\n", current->last_t, current->h, current->last_t + current->h, maxtime);
-								// }
-                                for (unsigned int i = 0; i < globals->num_forcings; i++)		//!!!! Put this in solver !!!!
-                                    if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
-                                        current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
-                                current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
-                            }
+                            Advance_Chain(&chains, c, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
 
-							// adlz
-							//if ((print_level >= 2) && (my_rank == 0))
-							//	printf("       ...iterating 1 done.\n");
-
-                            if (current->last_t + current->h >= maxtime  && current->current_iterations < globals->iter_limit && current->last_t < maxtime)	//If less than a full step is needed, just finish up
+                            for (unsigned int i = chains.starts[c]; i < chains.starts[c + 1]; i++)
                             {
-                                for (unsigned int i = 0; i < globals->num_forcings; i++)
-                                    if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
-                                        current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
-                                current->h = min(current->h, maxtime - current->last_t);
-                                assert(current->h > 0);
-                                current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
-
-                                while (current->rejected == 0)
+                                unsigned int idx = chains.members[i];
+                                if (!done[idx] && my_sys[idx]->last_t >= maxtime)
                                 {
-									for (unsigned int i = 0; i < globals->num_forcings; i++)
-                                        if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
-                                            current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
-                                    current->h = min(current->h, maxtime - current->last_t);
-                                    assert(current->h > 0);
-                                    current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
+                                    alldone++;
+                                    done[idx] = 1;
+                                    my_sys[idx]->last_t = maxtime;	//In case of roundoff errors
                                 }
                             }
-                        }
-                        else	//Has parents
-                        {
-							parentsval = 0;
-                            for (unsigned int i = 0; i < current->num_parents; i++)
-                                parentsval += (current->last_t + current->h <= current->parents[i]->last_t);
 
-                            while (parentsval == current->num_parents && current->current_iterations < globals->iter_limit)
-                            {
-                                for (unsigned int i = 0; i < globals->num_forcings; i++)
-                                    if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
-                                        current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
+                            if (Pack_Now(my_data, chains.links[chains.starts[c + 1] - 1], assignments))
+                                Transfer_Data(my_data, sys, assignments, globals);
 
-                                if (current->discont_count > 0 && current->h > current->discont[current->discont_start] - current->last_t)
-                                {
-#if defined (ASYNCH_HAVE_IMPLICIT_SOLVER)
-                                    current->h_old = current->h;
-#endif
-                                    current->h = current->discont[current->discont_start] - current->last_t;
-                                    assert(current->h > 0);
-                                }
-
-                                current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
-
-                                parentsval = 0;
-                                for (unsigned int i = 0; i < current->num_parents; i++)
-                                    parentsval += (current->last_t + current->h <= current->parents[i]->last_t);
-                            }
-
-                            parentsval = 0;
-                            for (unsigned int i = 0; i < current->num_parents; i++)
-                                parentsval += (current->parents[i]->last_t >= maxtime);
-
-                            if (parentsval == current->num_parents && current->current_iterations < globals->iter_limit && current->last_t < maxtime)		//If all parents are done, then current should finish up too
-                            {
-                                current->h = min(current->h, maxtime - current->last_t);
-                                assert(current->h > 0);
-                                for (unsigned int i = 0; i < globals->num_forcings; i++)
-                                    if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
-                                        current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
-                                if (current->discont_count > 0 && current->h > current->discont[current->discont_start] - current->last_t)
-                                {
-#if defined (ASYNCH_HAVE_IMPLICIT_SOLVER)
-                                    current->h_old = current->h;
-#endif
-                                    current->h = current->discont[current->discont_start] - current->last_t;
-                                    assert(current->h > 0);
-                                }
-
-                                current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
-                                assert(current->h > 0);
-
-                                while (current->last_t < maxtime && current->current_iterations < globals->iter_limit)
-                                {
-                                    for (unsigned int i = 0; i < globals->num_forcings; i++)
-                                        if (forcings[i].active && current->last_t < current->my->forcing_change_times[i])
-                                            current->h = min(current->h, current->my->forcing_change_times[i] - current->last_t);
-
-                                    if (current->discont_count > 0 && current->h > current->discont[current->discont_start] - current->last_t)
-                                    {
-#if defined (ASYNCH_HAVE_IMPLICIT_SOLVER)
-                                        current->h_old = current->h;
-#endif
-                                        current->h = current->discont[current->discont_start] - current->last_t;
-
-                                    }
-
-                                    current->h = min(current->h, maxtime - current->last_t);
-                                    current->rejected = current->solver(current, globals, assignments, print_flag, outputfile, &db_connections[ASYNCH_DB_LOC_HYDRO_OUTPUT], forcings, workspace);
-                                }
-                            }
-
-                            if (current->current_iterations < globals->iter_limit)
-                                current->ready = 0;
+                            //Reduce last_idx, if possible
+                            while (done[last_idx] == 1 && last_idx > 0)
+                                last_idx--;
                         }
+                    }
+                    //Solve the whole batch of a leaf
+                    else if (batch_leaves && batches.batch_of[curr_idx] < batches.num_batches)
+                    {
+                        unsigned int b = batches.batch_of[curr_idx];
+                        Advance_Batch(&batches, b, my_sys, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
 
-                        //Notify the child that a parent made progress
-                        Link* child = current->child;
-                        if (child != NULL && assignments[child->location] == my_rank)
+                        bool pack_now = false;
+                        for (unsigned int i = batches.starts[b]; i < batches.starts[b + 1]; i++)
                         {
-                            assert(child->h > 0);
-
-                            //Make sure the child can take a step if current has reached limit
-                            if ((current->current_iterations >= globals->iter_limit) && (current->last_t > child->last_t))
-                                child->h = min(child->h, current->last_t - child->last_t);
-
-                            // TODO improve on this
-                            if(child->h + child->last_t > current->last_t)
-                                child->h *= .999;
-
-                            assert(child->h > 0.0);
-
-                            double next_t = child->last_t + child->h;
-                            parentsval = 0;
-                            for (unsigned int i = 0; i < child->num_parents; i++)
-                                parentsval += (child->parents[i]->last_t >= next_t) || (child->parents[i]->last_t >= maxtime);
-
-                            if (parentsval == child->num_parents)
-                                child->ready = 1;
-                            else
-                                child->ready = 0;
+                            unsigned int idx = batches.members[i];
+                            if (!done[idx] && my_sys[idx]->last_t >= maxtime)
+                            {
+                                alldone++;
+                                done[idx] = 1;
+                                my_sys[idx]->last_t = maxtime;	//In case of roundoff errors
+                            }
+                            pack_now |= Pack_Now(my_data, my_sys[idx], assignments);
                         }
 
-                        //See if current has parents that hit their limit
-                        for (unsigned int i = 0; i < current->num_parents; i++)
-                        {
-                            if (current->parents[i]->current_iterations >= globals->iter_limit)
-                                current->h = min(current->h, current->parents[i]->last_t - current->last_t);
+                        if (pack_now)
+                            Transfer_Data(my_data, sys, assignments, globals);
 
-                            // TODO improve on this
-                            if(current->h + current->last_t > current->parents[i]->last_t)
-                                current->h *= .999;
-                        }
-
-                        parentsval = 0;
-                        for (unsigned int i = 0; i < current->num_parents; i++)
-                            parentsval += (current->last_t + current->h <= current->parents[i]->last_t);
-                        if (parentsval == current->num_parents && current->current_iterations < globals->iter_limit)
-                            current->ready = 1;
+                        //Reduce last_idx, if possible
+                        while (done[last_idx] == 1 && last_idx > 0)
+                            last_idx--;
+                    }
+                    //If the current link is not too far ahead, it can compute some iterations
+                    else if (current->current_iterations < current->iter_limit)
+                    {
+                        Advance_Link(current, maxtime, globals, assignments, print_flag, outputfile, db_connections, forcings, workspace);
 
                         //Check if current is done
                         if (current->last_t >= maxtime)
@@ -368,24 +1492,12 @@ void Advance(
                             current->last_t = maxtime;	//In case of roundoff errors
                         }
 
+                        if (Pack_Now(my_data, current, assignments))
+                            Transfer_Data(my_data, sys, assignments, globals);
+
                         //Reduce last_idx, if possible
                         while (done[last_idx] == 1 && last_idx > 0)
                             last_idx--;
-
-						// adlz
-						//if ((print_level >= 2) && (my_rank == 0))
-						//	printf("       about to trash...\n");
-
-                        //If current is a root link, trash its data
-                        if (current->child == NULL)
-                        {
-                            RKSolutionNode *roottail = current->my->list.tail;
-                            while (current->my->list.head != roottail)
-                            {
-                                Remove_Head_Node(&current->my->list);
-                                (current->current_iterations)--;
-                            }
-                        }
                     }
                 }
 
@@ -399,11 +1511,48 @@ void Advance(
 			fflush(stdout);
 		}
 
+        Stop_Comm_Progress(my_data, sys, assignments, globals);
+        //Send the remaining data and wait for all the data other processes sent to this one
         Transfer_Data_Finish(my_data, sys, assignments, globals);
 
-        //Ensure all data is received !!!! This is sloppy. Transfer_Data_Finish should handle this. !!!!
-        MPI_Barrier(MPI_COMM_WORLD);
-        Transfer_Data_Finish(my_data, sys, assignments, globals);
+        //Move links between processes if the work of this pass was imbalanced. The scheduling structures are built
+        //again for the new links of this process.
+        if (rebalance && maxtime < globals->maxtime
+            && Rebalance_System(sys, N, my_sys_ref, my_N_ref, assignments, getting, my_data, globals, forcings, rk_methods, errors, model, external, last_steps))
+        {
+            my_sys = *my_sys_ref;
+            my_N = *my_N_ref;
+            two_my_N = 2 * my_N;
+            done = (short int*)realloc(done, my_N * sizeof(short int));
+
+            if (globals->scheduler_flag == ASYNCH_SCHEDULER_QUEUE)
+            {
+                ReadyQueue_Free(&queue);
+                ReadyQueue_Init(&queue, my_sys, my_N, N);
+            }
+            if (batch_leaves)
+            {
+                LeafBatches_Free(&batches);
+                LeafBatches_Init(&batches, my_sys, my_N, globals->leaf_batch, globals);
+            }
+            if (fuse_chains)
+            {
+                Chains_Free(&chains);
+                Chains_Init(&chains, my_sys, my_N, N, globals->chain_length, assignments, globals);
+                if (globals->scheduler_flag == ASYNCH_SCHEDULER_QUEUE)
+                    queue.chains = &chains;
+            }
+#if defined(HAVE_PTHREAD)
+            if (globals->num_threads > 1)
+            {
+                WorkerPool_Free(&pool);
+                WorkerPool_Init(&pool, globals->num_threads, sys, N, my_sys, my_N, globals, assignments, my_data, workspace);
+            }
+#endif
+
+            if ((print_level >= 2) && (my_rank == 0))
+                printf("[%i] Moved links between processes to balance the work.\n", my_rank);
+        }
 
         //if((rain_flag == 2 || rain_flag == 3) && my_rank == 0)
 //		if(my_rank == 0)
@@ -419,6 +1568,20 @@ void Advance(
     if (my_rank == 0)
         printf("\n");
 
+    if (globals->cost_save_filename)
+        Save_Link_Costs(globals->cost_save_filename, my_sys, my_N);
+
     //Cleanup
     free(done);
+    free(last_steps);
+    if (globals->scheduler_flag == ASYNCH_SCHEDULER_QUEUE)
+        ReadyQueue_Free(&queue);
+    if (batch_leaves)
+        LeafBatches_Free(&batches);
+    if (fuse_chains)
+        Chains_Free(&chains);
+#if defined(HAVE_PTHREAD)
+    if (globals->num_threads > 1)
+        WorkerPool_Free(&pool);
+#endif
 }
@@ -14,13 +14,17 @@
 
 void Advance(
     Link *sys, unsigned int N,
-    Link **my_sys, unsigned int my_N,
+    Link ***my_sys, unsigned int *my_N,
     GlobalVars* globals,
     int* assignments, short int* getting, unsigned int* res_list, unsigned int res_size, const Lookup * const id_to_loc,
     Workspace* workspace,
     Forcing* forcings,
     ConnData* db_connections,
     TransData* my_data,
+    RKMethod* rk_methods,
+    ErrorData* errors,
+    AsynchModel* model,
+    void* external,
     int print_level,
     FILE* outputfile);
 
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <string.h>
 
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
@@ -73,25 +74,25 @@ int main(int argc, char* argv[])
     int res;
 	int print_level = 1;
 
-    //Initialize MPI stuff
-    res = MPI_Init(&argc, &argv);
-    if (res == MPI_SUCCESS)
-        atexit(asynch_onexit);
-    else
-    {
-        print_err("Failed to initialize MPI");
-        exit(EXIT_FAILURE);
-    }
-
-    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &np);
-
     //Command line options
     bool stdout_nobuf = false;
     bool debug = false;    
     bool help = false;
     bool version = false;
 	bool more = false;
+    unsigned short scheduler = ASYNCH_SCHEDULER_SCAN;
+    unsigned int num_threads = 1;
+    bool comm_thread = false;
+    bool shared_memory = false;
+    unsigned int leaf_batch = 0;
+    unsigned int chain_length = 0;
+    bool arena = false;
+    bool adaptive_lists = false;
+    bool float_history = false;
+    bool prefetch_forcings = false;
+    bool partition_subtrees = false;
+    char *save_costs = NULL, *load_costs = NULL;
+    double rebalance = 0.0;
 
     //Parse command line
     struct optparse options;
@@ -102,6 +103,20 @@ int main(int argc, char* argv[])
         { "help", 'h', OPTPARSE_NONE },
         { "version", 'v', OPTPARSE_NONE },
 		{ "more", 'm', OPTPARSE_NONE },
+        { "scheduler", 's', OPTPARSE_REQUIRED },
+        { "threads", 't', OPTPARSE_REQUIRED },
+        { "comm-thread", 'c', OPTPARSE_NONE },
+        { "shared-memory", 'n', OPTPARSE_NONE },
+        { "leaf-batch", 'l', OPTPARSE_REQUIRED },
+        { "chain-length", 'f', OPTPARSE_REQUIRED },
+        { "arena", 'a', OPTPARSE_NONE },
+        { "adaptive-lists", 'g', OPTPARSE_NONE },
+        { "float-history", 'p', OPTPARSE_NONE },
+        { "prefetch-forcings", 'w', OPTPARSE_NONE },
+        { "partition", 'r', OPTPARSE_REQUIRED },
+        { "save-costs", 'o', OPTPARSE_REQUIRED },
+        { "load-costs", 'i', OPTPARSE_REQUIRED },
+        { "rebalance", 'e', OPTPARSE_REQUIRED },
         { 0 }
     };
     int option;
@@ -122,12 +137,89 @@ int main(int argc, char* argv[])
 		case 'm':
 			more = true;
 			break;
+        case 's':
+            if (strcmp(options.optarg, "scan") == 0)
+                scheduler = ASYNCH_SCHEDULER_SCAN;
+            else if (strcmp(options.optarg, "queue") == 0)
+                scheduler = ASYNCH_SCHEDULER_QUEUE;
+            else
+            {
+                print_err("%s: unknown scheduler '%s' (expected scan or queue)\n", argv[0], options.optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            num_threads = (unsigned int)atoi(options.optarg);
+            if (num_threads == 0)
+            {
+                print_err("%s: invalid number of threads '%s'\n", argv[0], options.optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            comm_thread = true;
+            break;
+        case 'n':
+            shared_memory = true;
+            break;
+        case 'l':
+            leaf_batch = (unsigned int)atoi(options.optarg);
+            break;
+        case 'f':
+            chain_length = (unsigned int)atoi(options.optarg);
+            break;
+        case 'a':
+            arena = true;
+            break;
+        case 'g':
+            adaptive_lists = true;
+            break;
+        case 'p':
+            float_history = true;
+            break;
+        case 'w':
+            prefetch_forcings = true;
+            break;
+        case 'r':
+            if (strcmp(options.optarg, "leaves") == 0)
+                partition_subtrees = false;
+            else if (strcmp(options.optarg, "subtrees") == 0)
+                partition_subtrees = true;
+            else
+            {
+                print_err("%s: unknown partitioning '%s' (expected leaves or subtrees)\n", argv[0], options.optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            save_costs = options.optarg;
+            break;
+        case 'i':
+            load_costs = options.optarg;
+            break;
+        case 'e':
+            rebalance = atof(options.optarg);
+            break;
         case '?':
             print_err("%s: %s\n", argv[0], options.errmsg);
             exit(EXIT_FAILURE);
         }
     }
 
+    //Initialize MPI stuff. Only the main thread makes MPI calls, unless a communication thread is requested.
+    int provided;
+    res = MPI_Init_thread(&argc, &argv, comm_thread ? MPI_THREAD_SERIALIZED : MPI_THREAD_FUNNELED, &provided);
+    if (res == MPI_SUCCESS)
+        atexit(asynch_onexit);
+    else
+    {
+        print_err("Failed to initialize MPI");
+        exit(EXIT_FAILURE);
+    }
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &np);
+
     if (version) print_out("This is %s\n", PACKAGE_STRING);
 	if ((version) && (more))
 	{
@@ -146,7 +238,21 @@ int main(int argc, char* argv[])
             "  -d [--debug]   : Wait for the user input at the begining of the program (useful" \
             "                   for attaching a debugger)\n" \
             "  -v [--version] : Print the current version of ASYNCH\n" \
-			"  -m [--more]    : Print extra information regarding the process steps.\n");
+			"  -m [--more]    : Print extra information regarding the process steps.\n" \
+            "  -s [--scheduler] <scan|queue> : How the next link to compute is picked (default scan)\n" \
+            "  -t [--threads] <n> : Number of threads solving the links of each process (default 1)\n" \
+            "  -c [--comm-thread] : Progress the MPI communication on a dedicated thread\n" \
+            "  -n [--shared-memory] : Exchange the data between processes of the same node in shared memory\n" \
+            "  -l [--leaf-batch] <n> : Number of leaves taking their steps together (default 0, one at a time)\n" \
+            "  -f [--chain-length] <n> : Number of links of an unbranched reach solved as one system (default 0, one at a time)\n" \
+            "  -a [--arena] : Allocate the storage of the links of each process in one block\n" \
+            "  -g [--adaptive-lists] : Size the solution list of each link from its role and how full it gets\n" \
+            "  -p [--float-history] : Store the dense output of the solution history in single precision\n" \
+            "  -w [--prefetch-forcings] : Read the forcing files of the next pass in the background\n" \
+            "  -r [--partition] <leaves|subtrees> : Split the leaves evenly, or balance the work of whole subtrees (default leaves)\n" \
+            "  -o [--save-costs] <file> : Write the cost of computing each link to a file at the end of the run\n" \
+            "  -i [--load-costs] <file> : Partition the network on the costs of each link saved by a previous run\n" \
+            "  -e [--rebalance] <threshold> : Move links between processes after a forcing pass when the work is imbalanced by more than threshold (e.g. 0.1)\n");
         exit(EXIT_SUCCESS);
     }
     if (version || help) exit(EXIT_SUCCESS);
@@ -164,6 +270,12 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
+    if (num_threads > 1 && provided < MPI_THREAD_FUNNELED)
+    {
+        print_err("Warning: The MPI library does not support threads. Using 1 thread per process.\n");
+        num_threads = 1;
+    }
+
     if (stdout_nobuf)
         //Disable stdout buffering
         setvbuf(stdout, NULL, _IONBF, 0);
@@ -201,6 +313,35 @@ int main(int argc, char* argv[])
     
 	print_out("Reading global file...");
     Asynch_Parse_GBL(asynch, global_filename);
+    Asynch_Set_Scheduler(asynch, scheduler);
+    Asynch_Set_Num_Threads(asynch, num_threads);
+    Asynch_Set_Comm_Thread(asynch, comm_thread);
+    Asynch_Set_Shared_Transfer(asynch, shared_memory);
+    Asynch_Set_Leaf_Batch(asynch, leaf_batch);
+    Asynch_Set_Chain_Length(asynch, chain_length);
+    Asynch_Set_Link_Arena(asynch, arena);
+    Asynch_Set_Adaptive_Lists(asynch, adaptive_lists);
+    Asynch_Set_Float_History(asynch, float_history);
+    Asynch_Set_Forcing_Prefetch(asynch, prefetch_forcings);
+    if (Asynch_Set_Rebalance_Threshold(asynch, rebalance))
+    {
+        print_err("%s: rebalance threshold must not be negative\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (partition_subtrees)
+    {
+        Asynch_Custom_Partitioning(asynch, Partition_System_By_Subtrees);
+    }
+    if (save_costs && Asynch_Set_Cost_Save_File(asynch, save_costs))
+    {
+        print_err("%s: cost file name '%s' is too long\n", argv[0], save_costs);
+        exit(EXIT_FAILURE);
+    }
+    if (load_costs && Asynch_Set_Cost_Load_File(asynch, load_costs))
+    {
+        print_err("%s: cost file name '%s' is too long\n", argv[0], load_costs);
+        exit(EXIT_FAILURE);
+    }
 	if (more)
 	{
 		current = MPI_Wtime();
@@ -339,6 +480,10 @@ int main(int argc, char* argv[])
     total_time += stop - start;
     print_out("\nComputations complete. Total time for calculations: %f\n", stop - start);
 
+    unsigned long long accepted, rejected;
+    Asynch_Get_Step_Counts(asynch, &accepted, &rejected);
+    print_out("Steps accepted: %llu, rejected: %llu (%.2f%%)\n", accepted, rejected, (accepted + rejected) ? 100.0 * rejected / (accepted + rejected) : 0.0);
+
     //Take a snapshot
     Asynch_Take_System_Snapshot(asynch, NULL);
 
@@ -144,6 +144,18 @@ void Asynch_Load_Network(AsynchSolver* asynch)
     MPI_Barrier(asynch->comm);
 }
 
+int Asynch_Save_Network_Bundle(const AsynchSolver * const asynch, const char *filename)
+{
+    if (!asynch->setup_topo)
+    {
+        if (my_rank == 0)
+            printf("Error: network topology must be loaded before saving a network bundle.\n");
+        return 1;
+    }
+
+    return Save_Network_Bundle(filename, asynch->sys, asynch->N, asynch->id_to_loc, asynch->globals, asynch->db_connections);
+}
+
 void Asynch_Save_Network_Dot(const AsynchSolver * const asynch, const char *filename)
 {
     FILE *dot_file = fopen(filename, "w");
@@ -175,7 +187,7 @@ void Asynch_Partition_Network(AsynchSolver* asynch)
         MPI_Abort(asynch->comm, 1);
     }
 
-    i = Partition_Network(asynch->sys, asynch->N, asynch->globals, &(asynch->my_sys), &(asynch->my_N), &(asynch->assignments), &(asynch->my_data), &(asynch->getting), asynch->model);
+    i = Partition_Network(asynch->sys, asynch->N, asynch->globals, &(asynch->my_sys), &(asynch->my_N), &(asynch->assignments), &(asynch->my_data), &(asynch->getting), asynch->id_to_loc, asynch->model);
     if (i)	MPI_Abort(asynch->comm, 1);
     asynch->setup_partition = 1;
     MPI_Barrier(asynch->comm);
@@ -473,8 +485,9 @@ void Asynch_Advance(AsynchSolver* asynch, int print_level)
         printf("[%i]: Warning: Solver advance requested with data output enabled, but not all outputs are initialized. Continuing solver without outputing data.\n", my_rank);
         print_level = 0;
     }
-    Advance(asynch->sys, asynch->N, asynch->my_sys, asynch->my_N, asynch->globals, asynch->assignments, asynch->getting, asynch->res_list, asynch->res_size,
-        asynch->id_to_loc, &asynch->workspace, asynch->forcings, asynch->db_connections, asynch->my_data, print_level, asynch->outputfile);
+    Advance(asynch->sys, asynch->N, &asynch->my_sys, &asynch->my_N, asynch->globals, asynch->assignments, asynch->getting, asynch->res_list, asynch->res_size,
+        asynch->id_to_loc, &asynch->workspace, asynch->forcings, asynch->db_connections, asynch->my_data,
+        asynch->rk_methods, &asynch->errors_tol, asynch->model, asynch->ExternalInterface, print_level, asynch->outputfile);
 }
 
 
@@ -497,6 +510,233 @@ void Asynch_Set_Model_Type(AsynchSolver* asynch, unsigned short type)
     asynch->globals->model_uid = type;
 }
 
+unsigned short Asynch_Get_Scheduler(AsynchSolver* asynch)
+{
+    return asynch->globals->scheduler_flag;
+}
+
+int Asynch_Set_Scheduler(AsynchSolver* asynch, unsigned short scheduler)
+{
+    if (scheduler != ASYNCH_SCHEDULER_SCAN && scheduler != ASYNCH_SCHEDULER_QUEUE)
+        return 1;
+
+    asynch->globals->scheduler_flag = scheduler;
+    return 0;
+}
+
+unsigned int Asynch_Get_Num_Threads(AsynchSolver* asynch)
+{
+    return asynch->globals->num_threads;
+}
+
+int Asynch_Set_Num_Threads(AsynchSolver* asynch, unsigned int num_threads)
+{
+    if (num_threads == 0)
+        return 1;
+
+#if !defined(HAVE_PTHREAD)
+    if (num_threads > 1)
+    {
+        if (my_rank == 0)
+            printf("Warning: Asynch was built without thread support. Using 1 thread per process.\n");
+        num_threads = 1;
+    }
+#endif
+
+    asynch->globals->num_threads = num_threads;
+    return 0;
+}
+
+unsigned short Asynch_Get_Comm_Thread(AsynchSolver* asynch)
+{
+    return asynch->globals->comm_thread;
+}
+
+int Asynch_Set_Comm_Thread(AsynchSolver* asynch, unsigned short comm_thread)
+{
+    if (comm_thread > 1)
+        return 1;
+
+    if (comm_thread)
+    {
+#if defined(HAVE_PTHREAD)
+        int provided;
+        MPI_Query_thread(&provided);
+        if (provided < MPI_THREAD_SERIALIZED)
+        {
+            if (my_rank == 0)
+                printf("Warning: The MPI library was not initialized with MPI_THREAD_SERIALIZED. Not using a communication thread.\n");
+            comm_thread = 0;
+        }
+#else
+        if (my_rank == 0)
+            printf("Warning: Asynch was built without thread support. Not using a communication thread.\n");
+        comm_thread = 0;
+#endif
+    }
+
+    asynch->globals->comm_thread = comm_thread;
+    return 0;
+}
+
+unsigned short Asynch_Get_Shared_Transfer(AsynchSolver* asynch)
+{
+    return asynch->globals->shared_transfer;
+}
+
+int Asynch_Set_Shared_Transfer(AsynchSolver* asynch, unsigned short shared_transfer)
+{
+    if (shared_transfer > 1)
+        return 1;
+
+#if !defined(ASYNCH_HAVE_SHARED_TRANSFER)
+    if (shared_transfer)
+    {
+        if (my_rank == 0)
+            printf("Warning: Asynch was built without MPI-3 shared memory support. Sending the data as messages.\n");
+        shared_transfer = 0;
+    }
+#endif
+
+    asynch->globals->shared_transfer = shared_transfer;
+    return 0;
+}
+
+unsigned int Asynch_Get_Leaf_Batch(AsynchSolver* asynch)
+{
+    return asynch->globals->leaf_batch;
+}
+
+int Asynch_Set_Leaf_Batch(AsynchSolver* asynch, unsigned int width)
+{
+    asynch->globals->leaf_batch = width;
+    return 0;
+}
+
+unsigned int Asynch_Get_Chain_Length(AsynchSolver* asynch)
+{
+    return asynch->globals->chain_length;
+}
+
+int Asynch_Set_Chain_Length(AsynchSolver* asynch, unsigned int length)
+{
+    asynch->globals->chain_length = length;
+    return 0;
+}
+
+unsigned short Asynch_Get_Float_History(AsynchSolver* asynch)
+{
+    return asynch->globals->float_history;
+}
+
+int Asynch_Set_Float_History(AsynchSolver* asynch, unsigned short float_history)
+{
+    if (float_history > 1)
+        return 1;
+
+    asynch->globals->float_history = float_history;
+    return 0;
+}
+
+unsigned short Asynch_Get_Forcing_Prefetch(AsynchSolver* asynch)
+{
+    return asynch->globals->prefetch_forcings;
+}
+
+int Asynch_Set_Forcing_Prefetch(AsynchSolver* asynch, unsigned short prefetch)
+{
+    if (prefetch > 1)
+        return 1;
+
+    asynch->globals->prefetch_forcings = prefetch;
+    return 0;
+}
+
+//Copies filename to *dest, allocating it if needed. A NULL filename frees *dest.
+//Returns 0 if filename was copied, 1 if it is too long.
+static int Set_Filename(char** dest, const char* filename)
+{
+    if (filename == NULL)
+    {
+        free(*dest);
+        *dest = NULL;
+        return 0;
+    }
+
+    if (strlen(filename) >= ASYNCH_MAX_PATH_LENGTH)
+        return 1;
+    if (*dest == NULL)
+        *dest = (char*)malloc(ASYNCH_MAX_PATH_LENGTH * sizeof(char));
+    strcpy(*dest, filename);
+    return 0;
+}
+
+int Asynch_Get_Cost_Save_File(AsynchSolver* asynch, char* filename)
+{
+    if (asynch->globals->cost_save_filename == NULL)	return 1;
+    strcpy(filename, asynch->globals->cost_save_filename);
+    return 0;
+}
+
+int Asynch_Set_Cost_Save_File(AsynchSolver* asynch, const char* filename)
+{
+    return Set_Filename(&asynch->globals->cost_save_filename, filename);
+}
+
+int Asynch_Get_Cost_Load_File(AsynchSolver* asynch, char* filename)
+{
+    if (asynch->globals->cost_load_filename == NULL)	return 1;
+    strcpy(filename, asynch->globals->cost_load_filename);
+    return 0;
+}
+
+int Asynch_Set_Cost_Load_File(AsynchSolver* asynch, const char* filename)
+{
+    return Set_Filename(&asynch->globals->cost_load_filename, filename);
+}
+
+unsigned short Asynch_Get_Adaptive_Lists(AsynchSolver* asynch)
+{
+    return asynch->globals->adaptive_lists;
+}
+
+int Asynch_Set_Adaptive_Lists(AsynchSolver* asynch, unsigned short adaptive_lists)
+{
+    if (adaptive_lists > 1)
+        return 1;
+
+    asynch->globals->adaptive_lists = adaptive_lists;
+    return 0;
+}
+
+unsigned short Asynch_Get_Link_Arena(AsynchSolver* asynch)
+{
+    return asynch->globals->arena_flag;
+}
+
+int Asynch_Set_Link_Arena(AsynchSolver* asynch, unsigned short arena_flag)
+{
+    if (arena_flag > 1)
+        return 1;
+
+    asynch->globals->arena_flag = arena_flag;
+    return 0;
+}
+
+double Asynch_Get_Rebalance_Threshold(AsynchSolver* asynch)
+{
+    return asynch->globals->rebalance_threshold;
+}
+
+int Asynch_Set_Rebalance_Threshold(AsynchSolver* asynch, double threshold)
+{
+    if (threshold < 0.0)
+        return 1;
+
+    asynch->globals->rebalance_threshold = threshold;
+    return 0;
+}
+
 unsigned short Asynch_Get_Num_Links(AsynchSolver* asynch)
 {
     if (!asynch)
@@ -518,6 +758,22 @@ unsigned int Asynch_Get_Num_Links_Proc(AsynchSolver* asynch)
     return asynch->my_N;
 }
 
+void Asynch_Get_Step_Counts(AsynchSolver* asynch, unsigned long long* accepted, unsigned long long* rejected)
+{
+    unsigned long long counts[2] = { 0, 0 }, totals[2];
+
+    for (unsigned int i = 0; i < asynch->my_N; i++)
+    {
+        Link* current = asynch->my_sys[i];
+        counts[0] += current->my->num_accepted;
+        counts[1] += current->my->num_rejected;
+    }
+
+    MPI_Allreduce(counts, totals, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    *accepted = totals[0];
+    *rejected = totals[1];
+}
+
 Link* Asynch_Get_Links_Proc(AsynchSolver* asynch)
 {
     if (!asynch)
@@ -1075,7 +1331,10 @@ int Asynch_Check_Peakflow_Output(AsynchSolver* asynch, char* name)
 int Asynch_Delete_Temporary_Files(AsynchSolver* asynch)
 {
     if (asynch->outputfile)
+    {
         fclose(asynch->outputfile);
+        asynch->outputfile = NULL;
+    }
 
     int ret_val = RemoveTemporaryFiles(asynch->globals, asynch->my_save_size, NULL);
     //if(ret_val == 1)	printf("[%i]: Error deleting temp file. File does not exist.\n");
@@ -89,6 +89,11 @@ int Asynch_Custom_Partitioning(
     AsynchSolver *asynch,
     PartitionFunc *partition);
 
+/// Partitions the network into pieces of about the same estimated work, each made of whole subtrees and a stretch
+/// of the links downstream of them, with few links sending their solution to another process.
+/// Pass it to Asynch_Custom_Partitioning to use it instead of the default partitioning by leaves.
+PartitionFunc Partition_System_By_Subtrees;
+
 //Routines to intialize network and model
 
 /// This routine opens and processes a global file. It reads all specified database connection files,
@@ -108,6 +113,17 @@ void Asynch_Parse_GBL(AsynchSolver* asynch, char* filename);
 /// \param asynch A pointer to a AsynchSolver object to use.
 void Asynch_Load_Network(AsynchSolver* asynch);
 
+/// This routine saves the network topology, the link id lookup and the parameters of every link, read from the
+/// sources given in the global file, as a network bundle (.nbd). The bundle can then be given as both the topology
+/// (flag 2) and the parameter (flag 2) source of a global file. Every process maps it and reads its own links, with
+/// no broadcast. Only process 0 writes the bundle.
+///
+/// \pre This routine must be called after *Asynch_Load_Network*.
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param filename The path to the output .nbd file.
+/// \return 0 if the bundle was saved successfully. 1 otherwise.
+int Asynch_Save_Network_Bundle(const AsynchSolver * const asynch, const char *filename);
+
 /// This routine save the network tolpolgy as a graphviz .dot file.
 ///
 /// \pre This routine must be called after *Asynch_Load_Network*.
@@ -421,6 +437,226 @@ unsigned short Asynch_Get_Model_Type(AsynchSolver* asynch);
 /// \param type    The model type.
 void Asynch_Set_Model_Type(AsynchSolver* asynch, unsigned short type);
 
+/// This routine returns how the solver picks the next link to compute.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return ASYNCH_SCHEDULER_SCAN or ASYNCH_SCHEDULER_QUEUE.
+unsigned short Asynch_Get_Scheduler(AsynchSolver* asynch);
+
+/// This routine sets how the solver picks the next link to compute. With ASYNCH_SCHEDULER_SCAN (the default),
+/// the links of the process are scanned until one is ready. With ASYNCH_SCHEDULER_QUEUE, links are queued when
+/// their parents make progress, and data is exchanged with other processes as soon as the queue is empty.
+/// Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param scheduler ASYNCH_SCHEDULER_SCAN or ASYNCH_SCHEDULER_QUEUE.
+/// \return 0 if the scheduler was set successfully. 1 otherwise.
+int Asynch_Set_Scheduler(AsynchSolver* asynch, unsigned short scheduler);
+
+/// This routine returns the number of threads used to solve the links of each process.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return The number of threads per process.
+unsigned int Asynch_Get_Num_Threads(AsynchSolver* asynch);
+
+/// This routine sets the number of threads used to solve the links of each process. With more than one
+/// thread, each thread takes ready links from its own queue and steals from the others when it runs out.
+/// Links that share a parent, a child or a downstream discontinuity are never solved at the same time.
+/// MPI communication is done by the thread that called Asynch_Advance, so MPI must be initialized with
+/// at least MPI_THREAD_FUNNELED. Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param num_threads Number of threads per process (1 by default).
+/// \return 0 if the number of threads was set successfully. 1 otherwise.
+int Asynch_Set_Num_Threads(AsynchSolver* asynch, unsigned int num_threads);
+
+/// This routine returns whether a dedicated thread progresses the MPI communication.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return 1 if the communication thread is enabled, 0 if not.
+unsigned short Asynch_Get_Comm_Thread(AsynchSolver* asynch);
+
+/// This routine enables or disables the communication thread. When enabled and more than one process is used,
+/// a thread is started on each process for every pass of Asynch_Advance. It posts the sends and receives of
+/// boundary data while the solver threads only pack and unpack messages. With one solver thread, the steps of a link
+/// whose child is on another process are packed as soon as they are computed. The messages received are still
+/// unpacked only when the solver threads communicate. MPI must be initialized with at least
+/// MPI_THREAD_SERIALIZED, as only one thread makes MPI calls at a time. Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param comm_thread 1 to enable the communication thread, 0 to disable it (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Comm_Thread(AsynchSolver* asynch, unsigned short comm_thread);
+
+/// This routine returns whether the processes on the same node exchange their data in shared memory.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return 1 if the data goes through shared memory on a node, 0 if it is always sent as messages.
+unsigned short Asynch_Get_Shared_Transfer(AsynchSolver* asynch);
+
+/// This routine sets whether the processes on the same node exchange their data in shared memory. When set, each
+/// process allocates a ring of message slots for every process of its node it receives steps from, in an MPI-3
+/// shared memory window. The sender packs its steps directly in a free slot and the receiver unpacks them in place,
+/// with only the head and tail of the ring synchronized. Processes on other nodes still exchange messages. Must be
+/// called after Asynch_Parse_GBL and before Asynch_Finalize_Network.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param shared_transfer 1 to use shared memory on a node, 0 to always send messages (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Shared_Transfer(AsynchSolver* asynch, unsigned short shared_transfer);
+
+/// This routine returns the maximum number of leaves that take their steps together.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return The maximum number of leaves in a batch. 0 or 1 if leaves are solved one at a time.
+unsigned int Asynch_Get_Leaf_Batch(AsynchSolver* asynch);
+
+/// This routine sets the maximum number of leaves that take their steps together. Leaves (links without parents)
+/// solved with the explicit RK solver are grouped in batches of leaves sharing the same RK method and number of
+/// states. The internal stages of a batch are combined in a structure-of-arrays layout that the compiler can
+/// vectorize, and each leaf still accepts or rejects its own step. Batches are only used with one thread per process.
+/// Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param width Maximum number of leaves in a batch (0 by default, to solve leaves one at a time).
+/// \return 0 if the batch width was set successfully. 1 otherwise.
+int Asynch_Set_Leaf_Batch(AsynchSolver* asynch, unsigned int width);
+
+/// This routine returns the maximum number of links of an unbranched reach solved as one system.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return The maximum length of a fused chain. 0 or 1 if links are solved one at a time.
+unsigned int Asynch_Get_Chain_Length(AsynchSolver* asynch);
+
+/// This routine sets the maximum number of links of an unbranched reach solved as one system. A chain is a sequence
+/// of links assigned to the same process, each with a single parent, solved with the explicit RK solver and the same
+/// RK method. The links of a chain share their step size and evaluate their parent at the same stage instead of
+/// through its dense output. Chains are only used with one thread per process. Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param length Maximum number of links in a chain (0 by default, to solve links one at a time).
+/// \return 0 if the chain length was set successfully. 1 otherwise.
+int Asynch_Set_Chain_Length(AsynchSolver* asynch, unsigned int length);
+
+/// This routine returns whether the solution history is stored in single precision.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return 1 if the history is stored in float, 0 if it is stored in double.
+unsigned short Asynch_Get_Float_History(AsynchSolver* asynch);
+
+/// This routine sets whether the solution history is stored in single precision. When set, the dense output
+/// coefficients kept for each step, which parents are interpolated with and hydrographs are written from, are stored
+/// and sent between processes as floats. The internal stages are then only kept until the step is accepted. The
+/// state of each link and the stages of the step being computed stay in double precision. Must be called after
+/// Asynch_Parse_GBL and before Asynch_Initialize_Model.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param float_history 1 to store the history in float, 0 to store it in double (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Float_History(AsynchSolver* asynch, unsigned short float_history);
+
+/// This routine returns whether the forcing data of the next pass is read ahead.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return 1 if the forcings are read ahead, 0 otherwise.
+unsigned short Asynch_Get_Forcing_Prefetch(AsynchSolver* asynch);
+
+/// This routine sets whether the forcing data of the next pass is read ahead. When set, the files (or the database
+/// rows) of the next pass of the binary, gzipped binary, grid cell and database forcings are read by a background
+/// thread while the current pass is integrated. The data is distributed to the links at the pass boundary, as
+/// without prefetching. Irregular database forcings are always read at the pass boundary. Has no effect if asynch
+/// was built without pthreads. Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param prefetch 1 to read the forcings ahead, 0 to read them at the pass boundary (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Forcing_Prefetch(AsynchSolver* asynch, unsigned short prefetch);
+
+/// This routine copies the name of the file where the cost of each link is saved.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param filename A buffer of at least ASYNCH_MAX_PATH_LENGTH characters that receives the name.
+/// \return 0 if the name was copied. 1 if no cost file is set.
+int Asynch_Get_Cost_Save_File(AsynchSolver* asynch, char* filename);
+
+/// This routine sets a file where Asynch_Advance writes the cost of each link once it is done: the accepted and
+/// rejected steps, the evaluations of the equations and the time spent computing the steps. The file can be given to
+/// Asynch_Set_Cost_Load_File in a later run. The time is only measured when a cost file is set.
+/// Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param filename The name of the cost file, or NULL to stop saving the costs.
+/// \return 0 if the file was set successfully. 1 otherwise.
+int Asynch_Set_Cost_Save_File(AsynchSolver* asynch, const char* filename);
+
+/// This routine copies the name of the file with the costs used to partition the network.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param filename A buffer of at least ASYNCH_MAX_PATH_LENGTH characters that receives the name.
+/// \return 0 if the name was copied. 1 if no cost file is set.
+int Asynch_Get_Cost_Load_File(AsynchSolver* asynch, char* filename);
+
+/// This routine sets a file with the costs of the links saved by a previous run (see Asynch_Set_Cost_Save_File).
+/// Asynch_Partition_Network then uses the measured time of each link as its work, and splits the network with
+/// Partition_System_By_Subtrees unless another routine was set with Asynch_Custom_Partitioning. Links missing from
+/// the file get the mean work of the others. Must be called after Asynch_Parse_GBL and before
+/// Asynch_Partition_Network.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param filename The name of the cost file, or NULL to partition without costs.
+/// \return 0 if the file was set successfully. 1 otherwise.
+int Asynch_Set_Cost_Load_File(AsynchSolver* asynch, const char* filename);
+
+/// This routine returns whether the capacity of the solution lists is adapted to each link.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return 1 if the lists are adaptive, 0 if every list holds iter_limit steps.
+unsigned short Asynch_Get_Adaptive_Lists(AsynchSolver* asynch);
+
+/// This routine sets whether the capacity of the solution lists is adapted to each link. When set, the lists of
+/// links whose steps are exchanged with another process hold iter_limit steps, while the other lists start from a
+/// fraction of it that depends on the role of the link (root, leaf or interior). Between two forcing updates, a list
+/// that filled up doubles, up to iter_limit, and a list that stayed below a quarter of its capacity halves. Must be
+/// called after Asynch_Parse_GBL and before Asynch_Initialize_Model.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param adaptive_lists 1 to adapt the lists, 0 to give every list iter_limit steps (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Adaptive_Lists(AsynchSolver* asynch, unsigned short adaptive_lists);
+
+/// This routine returns whether the per link storage is carved from one arena.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return 1 if the link storage is carved from an arena, 0 if not.
+unsigned short Asynch_Get_Link_Arena(AsynchSolver* asynch);
+
+/// This routine sets whether the per link storage is carved from one arena. When set, the solution lists, forcing
+/// arrays, discontinuity lists and peak values of the links of a process are allocated in a single block, laid out
+/// in the order the links are solved, instead of with separate allocations for each link. Must be called after
+/// Asynch_Parse_GBL and before Asynch_Initialize_Model.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param arena_flag 1 to use an arena, 0 to allocate the arrays of every link separately (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Link_Arena(AsynchSolver* asynch, unsigned short arena_flag);
+
+/// This routine returns the imbalance above which links are moved between processes.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \return The imbalance threshold, 0 if links are never moved.
+double Asynch_Get_Rebalance_Threshold(AsynchSolver* asynch);
+
+/// This routine sets the imbalance above which links are moved between processes. After each forcing pass, the
+/// number of steps taken by every link is used to estimate the work of each process. When the busiest process did
+/// more than (1 + threshold) times the mean work, the network is partitioned again by subtrees and the links are
+/// moved to their new processes before the next pass. Links with saved output, dams, reservoirs or user data stay
+/// where they are. Must be called after Asynch_Parse_GBL.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param threshold The imbalance threshold, for example 0.1 for 10%, or 0 to never move links (the default).
+/// \return 0 if the option was set successfully. 1 otherwise.
+int Asynch_Set_Rebalance_Threshold(AsynchSolver* asynch, double threshold);
+
 /// This routine returns the begin timestamp of the simulation as defined in Section[sec:simulation period].
 ///
 /// \param asynch A pointer to a AsynchSolver object to use.
@@ -470,6 +706,14 @@ unsigned int Asynch_Get_Num_Links_Proc(AsynchSolver* asynch);
 
 Link* Asynch_Get_Links_Proc(AsynchSolver* asynch);
 
+/// This routine returns the number of steps accepted and rejected by the step size controllers of all the links in the
+/// network of *asynch*, since the links were loaded. This routine must be called by all MPI processes.
+///
+/// \param asynch A pointer to a AsynchSolver object to use.
+/// \param accepted Set to the total number of accepted steps.
+/// \param rejected Set to the total number of rejected steps.
+void Asynch_Get_Step_Counts(AsynchSolver* asynch, unsigned long long* accepted, unsigned long long* rejected);
+
 /// This routine sets a new database for an input or output. If information for a database has already been set,
 /// it is released, and the new connection information is set.
 /// Database information includes hostname, username, password, etc. This is the same information that is available
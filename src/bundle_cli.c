@@ -0,0 +1,57 @@
+#if !defined(_MSC_VER)
+#include <config.h>
+#else
+#include <config_msvc.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <mpi.h>
+
+#include "asynch_interface.h"
+
+// Global variables
+int my_rank = 0;
+int np = 0;
+
+//Builds a network bundle (.nbd) from the topology and parameter sources of a global file
+int main(int argc, char* argv[])
+{
+    int res;
+
+    res = MPI_Init(&argc, &argv);
+    if (res != MPI_SUCCESS)
+    {
+        fprintf(stderr, "Failed to initialize MPI");
+        exit(EXIT_FAILURE);
+    }
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &np);
+
+    if (argc < 3)
+    {
+        if (my_rank == 0)
+            printf("Usage: asynch_bundle <global file> <network bundle (.nbd)>\n");
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+
+    //Read the network from the sources of the global file
+    AsynchSolver* asynch = Asynch_Init(MPI_COMM_WORLD, false);
+    Asynch_Parse_GBL(asynch, argv[1]);
+    Asynch_Load_Network(asynch);
+
+    //Write the bundle
+    res = Asynch_Save_Network_Bundle(asynch, argv[2]);
+    if (res == 0 && my_rank == 0)
+        printf("Wrote network bundle %s.\n", argv[2]);
+
+    //Clean up
+    Asynch_Free(asynch);
+    MPI_Finalize();
+
+    return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include <config_msvc.h>
 #endif
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,243 +13,729 @@
 #include <libpq-fe.h>
 #endif
 
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include <comm.h>
 #include <minmax.h>
+#include <rksteppers.h>
 
 
 // **********  MPI related routines  **********
 
 
-//Tranfers data amongst processes. Uses asynchronous communication scheme.
-//TransData* my_data: Contains information about how the processes will communicate.
-//Link** sys: The river system.
-//UnivVars* GlobalVars: Contains all the information that is shared by every link in the system.
-//Note: a few "silly" initializations take place before the loops. This prevents Valgrind from complaining on some systems about pointless errors.
-void Transfer_Data(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
+//Copies bytes bytes of data into buffer at position, and moves position past them.
+static inline void Pack_Bytes(char* buffer, int* position, const void* data, size_t bytes)
 {
-    int i, j, m, n, sender, steps_to_transfer = 0, curr_idx = 0, parval, dim, flag, position, total_links, count, removed = 0, order = 0, num_times = 0;
-    unsigned int loc = 0, l, num_dense;
-    double discont_time = 0.0;
-    RKSolutionNode* node = NULL;
-    Link *current, *next, *prev;
-    MPI_Status status;
+    memcpy(buffer + *position, data, bytes);
+    *position += (int)bytes;
+}
 
-    //If sending
-    for (i = 0; i < np; i++)
+//Copies bytes bytes at position in buffer into data, and moves position past them.
+static inline void Unpack_Bytes(const char* buffer, int* position, void* data, size_t bytes)
+{
+    memcpy(data, buffer + *position, bytes);
+    *position += (int)bytes;
+}
+
+//Packs the steps, discontinuities and removed iterations destined to process i into buffer, which holds
+//buffer_size bytes. Returns the number of bytes packed. total_links is set to the number of links with steps packed.
+//data_packed is incremented by the number of steps and iteration counts packed.
+//The messages are exchanged as MPI_BYTE between processes of the same architecture, in the layout
+//  for each link with steps:   location (int), steps (int),
+//                              steps * [ t (double), y_approx (dim doubles), k (num_stages * num_dense doubles) or
+//                                        dense_f ((dense_degree + 1) * num_dense floats), state (int) ],
+//                              discontinuities (int), discontinuities * [ time (double), order (int) ]
+//  for each link with removed iterations: location (unsigned int), iterations removed (int)
+static int Pack_Data(TransData* my_data, int i, char* buffer, unsigned int buffer_size, GlobalVars* GlobalVars, int* total_links, unsigned int* data_packed)
+{
+    int m, steps_to_transfer, position = 0;
+    unsigned int l;
+    size_t y_bytes, history_bytes;
+    RKSolutionNode* node;
+    Link* current;
+
+    //Pack data
+    *total_links = 0;
+    for (l = 0; l < my_data->send_size[i]; l++)
     {
-        if (my_data->send_size[i] != 0 || my_data->receive_size[i] != 0)
+        current = my_data->send_data[i][l];
+
+        //Figure out how many steps will be sent.
+        steps_to_transfer = 0;
+        node = current->my->list.head->next;
+
+        while (steps_to_transfer < current->current_iterations - 1 && steps_to_transfer < GlobalVars->max_transfer_steps && steps_to_transfer + current->steps_on_diff_proc < GlobalVars->iter_limit)
         {
-            if (my_data->sent_flag[i])	MPI_Test(my_data->send_requests[i], &flag, MPI_STATUS_IGNORE);
-            if (!my_data->sent_flag[i] || flag)
+            steps_to_transfer++;
+            node = node->next;
+        }
+
+        //Pack all the data for each step and each discontinuity time
+        if (steps_to_transfer > 0 || current->discont_send_count > 0)
+        {
+            *data_packed += steps_to_transfer;
+            (*total_links)++;
+            node = current->my->list.head->next;
+            y_bytes = current->dim * sizeof(double);
+            if (current->my->list.dense_f_storage)
+                history_bytes = (current->my->list.dense_degree + 1) * current->num_dense * sizeof(float);
+            else
+                history_bytes = current->my->list.num_stages * current->num_dense * sizeof(double);
+            current->steps_on_diff_proc += steps_to_transfer;
+
+            //Pack the steps
+            Pack_Bytes(buffer, &position, &(current->location), sizeof(int));
+            Pack_Bytes(buffer, &position, &steps_to_transfer, sizeof(int));
+            for (m = 0; m < steps_to_transfer; m++)
             {
-                position = 0;
+                Pack_Bytes(buffer, &position, &(node->t), sizeof(double));
+                Pack_Bytes(buffer, &position, node->y_approx, y_bytes);
+                Pack_Bytes(buffer, &position, node->dense_f ? (void*)node->dense_f : (void*)node->k, history_bytes);
+                Pack_Bytes(buffer, &position, &(node->state), sizeof(int));
+
+                Remove_Head_Node(&current->my->list);
+                node = node->next;
+                (current->current_iterations)--;
+            }
 
-                //Pack data
-                total_links = 0;
-                for (l = 0; l < my_data->send_size[i]; l++)
-                {
-                    current = my_data->send_data[i][l];
-                    curr_idx = current->location;
+            //Pack the discontinuity times
+            Pack_Bytes(buffer, &position, &(current->discont_send_count), sizeof(int));
+            for (m = 0; (unsigned int)m < current->discont_send_count; m++)
+            {
+                Pack_Bytes(buffer, &position, &(current->discont_send[m]), sizeof(double));
+                Pack_Bytes(buffer, &position, &(current->discont_order_send[m]), sizeof(int));
+            }
 
-                    //Figure out how many steps will be sent.
-                    steps_to_transfer = 0;
-                    node = current->my->list.head->next;
+            current->discont_send_count = 0;
+        }
+    }
 
-                    while (steps_to_transfer < current->current_iterations - 1 && steps_to_transfer < GlobalVars->max_transfer_steps && steps_to_transfer + current->steps_on_diff_proc < GlobalVars->iter_limit)
-                    {
-                        steps_to_transfer++;
-                        node = node->next;
-                    }
+    //Pack iterations
+    for (l = 0; l < my_data->receive_size[i]; l++)
+    {
+        current = my_data->receive_data[i][l];
+        if (current->iters_removed > 0)
+        {
+            (*data_packed)++;
+            Pack_Bytes(buffer, &position, &(current->location), sizeof(unsigned int));
+            Pack_Bytes(buffer, &position, &(current->iters_removed), sizeof(int));
+            current->iters_removed = 0;
+        }
+    }
 
-                    //Pack all the data for each step and each discontinuity time
-                    if (steps_to_transfer > 0 || current->discont_send_count > 0)
-                    {
-                        total_links++;
-                        node = current->my->list.head->next;
-                        unsigned short num_stages = current->my->list.num_stages;
-                        dim = current->dim;
-                        num_dense = current->num_dense;
-                        current->steps_on_diff_proc += steps_to_transfer;
-
-                        //Pack the steps
-                        MPI_Pack(&(current->location), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                        MPI_Pack(&steps_to_transfer, 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                        for (m = 0; m < steps_to_transfer; m++)
-                        {
-                            MPI_Pack(&(node->t), 1, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            MPI_Pack(node->y_approx, dim, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-
-                            MPI_Pack(node->k, num_stages * num_dense, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            
-                            MPI_Pack(&(node->state), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-
-                            Remove_Head_Node(&current->my->list);
-                            node = node->next;
-                            (current->current_iterations)--;
-                        }
-
-                        //Pack the discontinuity times
-                        MPI_Pack(&(current->discont_send_count), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                        for (m = 0; (unsigned int)m < current->discont_send_count; m++)
-                        {
-                            MPI_Pack(&(current->discont_send[m]), 1, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            MPI_Pack(&(current->discont_order_send[m]), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                        }
-
-                        current->discont_send_count = 0;
-                    }
-                }
+    assert((unsigned int)position <= buffer_size);
+    return position;
+}
+
+//Unpacks a message of count bytes with data about total_links links and puts the steps in place.
+static void Unpack_Data(char* buffer, int count, int total_links, Link* sys, int* assignments, GlobalVars* GlobalVars)
+{
+    int j, m, n, steps_to_transfer = 0, curr_idx = 0, parval, position = 0, removed = 0, order = 0, num_times = 0;
+    unsigned int loc = 0;
+    size_t y_bytes, history_bytes;
+    double discont_time = 0.0;
+    RKSolutionNode* node = NULL;
+    Link *current, *next, *prev;
+
+    //Unpack data
+    for (j = 0; j < total_links; j++)
+    {
+        Unpack_Bytes(buffer, &position, &curr_idx, sizeof(int));
+
+        //Unpack the steps
+        Unpack_Bytes(buffer, &position, &steps_to_transfer, sizeof(int));
+        current = &sys[curr_idx];
+        y_bytes = current->dim * sizeof(double);
+        if (current->my->list.dense_f_storage)
+            history_bytes = (current->my->list.dense_degree + 1) * current->num_dense * sizeof(float);
+        else
+            history_bytes = current->my->list.num_stages * current->num_dense * sizeof(double);
+
+        for (m = 0; m < steps_to_transfer; m++)
+        {
+            node = New_Step(&current->my->list);
+            Unpack_Bytes(buffer, &position, &(node->t), sizeof(double));
+            Unpack_Bytes(buffer, &position, node->y_approx, y_bytes);
+            Unpack_Bytes(buffer, &position, node->dense_f ? (void*)node->dense_f : (void*)node->k, history_bytes);
+            Unpack_Bytes(buffer, &position, &(node->state), sizeof(int));
+
+            //The dense output is sent as is when it is stored in float, otherwise it is rebuilt from the k values
+            if (!node->dense_f)
+                store_dense(node, current->method, current->dense_indices, current->num_dense);
+        }
 
-                //Pack iterations
-                for (l = 0; l < my_data->receive_size[i]; l++)
+        if (steps_to_transfer > 0)
+        {
+            //Put the steps in place
+            current->current_iterations += steps_to_transfer;
+            current->last_t = node->t;
+            parval = 0;
+            for (n = 0; n < current->child->num_parents; n++)
+                parval += (current->child->last_t < current->child->parents[n]->last_t);
+            if (parval == current->child->num_parents)
+                current->child->ready = 1;
+
+            //Make sure the child can take a step if current has reached limit
+            if (current->current_iterations >= current->iter_limit)
+                current->child->h = min(current->child->h, current->last_t - current->child->last_t);
+            if (current->child->h + current->child->last_t > current->last_t)
+                current->child->h *= .999;
+        }
+
+        //Unpack the discontinuity times
+        Unpack_Bytes(buffer, &position, &num_times, sizeof(int));
+        for (m = 0; m < num_times; m++)
+        {
+            Unpack_Bytes(buffer, &position, &discont_time, sizeof(double));
+            Unpack_Bytes(buffer, &position, &order, sizeof(int));
+            prev = current;
+            next = current->child;
+            for (n = order; (unsigned int)n < GlobalVars->max_localorder && next != NULL; n++)
+            {
+                if (my_rank == assignments[next->location] && n < next->method->localorder)
                 {
-                    current = my_data->receive_data[i][l];
-                    if (current->iters_removed > 0)
-                    {
-                        MPI_Pack(&(current->location), 1, MPI_UNSIGNED, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                        MPI_Pack(&(current->iters_removed), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                        current->iters_removed = 0;
-                    }
+                    next->discont_end = Insert_Discontinuity(discont_time, next->discont_start, next->discont_end, &(next->discont_count), GlobalVars->discont_size, next->discont, next->ID);
                 }
-
-                //If there's information to send, send it!
-                if (position != 0)
+                else if (my_rank != assignments[next->location])
                 {
-                    my_data->sent_flag[i] = 1;
-                    (my_data->num_sent[i])++;
-                    MPI_Isend(my_data->send_buffer[i], position, MPI_PACKED, i, total_links, MPI_COMM_WORLD, my_data->send_requests[i]);
+                    Insert_SendDiscontinuity(discont_time, n, &(prev->discont_send_count), GlobalVars->discont_size, prev->discont_send, prev->discont_order_send, prev->ID);
+                    break;
                 }
-            } //End if(flag)
+
+                prev = next;
+                next = next->child;
+            }
         }
-    } //End loop over processes (i)
+    }
 
-    //Check if any incoming messages have been completely received
+    //Unpack iterations (need this for rainfall so the last step will get sent)
+    while (position < count)
+    {
+        Unpack_Bytes(buffer, &position, &loc, sizeof(unsigned int));
+        Unpack_Bytes(buffer, &position, &removed, sizeof(int));
+        sys[loc].steps_on_diff_proc -= removed;
+    }
+}
+
+
+#if defined(ASYNCH_HAVE_SHARED_TRANSFER)
+
+#define ASYNCH_SHARED_SLOTS 4
+#define ASYNCH_CACHE_LINE 64
+
+//A ring of messages from a process to another one on the same node, placed in the shared memory of the receiver.
+//head is written by the receiver only and tail by the sender only, each on its own cache line. The slots follow.
+typedef struct SharedChannel
+{
+    unsigned int head;          //!< Next slot to unpack
+    char pad_head[ASYNCH_CACHE_LINE - sizeof(unsigned int)];
+    unsigned int tail;          //!< Next free slot
+    char pad_tail[ASYNCH_CACHE_LINE - sizeof(unsigned int)];
+    unsigned int slot_size;     //!< Number of bytes of data a slot can hold
+    unsigned int slot_stride;   //!< Distance in bytes between two slots
+    char pad_size[ASYNCH_CACHE_LINE - 2 * sizeof(unsigned int)];
+} SharedChannel;
+
+//Header of a message in a channel. The packed data follows.
+typedef struct SharedSlot
+{
+    int count;  //!< Number of bytes packed
+    int tag;    //!< Number of links with steps in the message
+} SharedSlot;
+
+static size_t Round_To_Cache_Line(size_t bytes)
+{
+    return (bytes + ASYNCH_CACHE_LINE - 1) / ASYNCH_CACHE_LINE * ASYNCH_CACHE_LINE;
+}
+
+static size_t Shared_Channel_Size(unsigned int slot_size)
+{
+    return sizeof(SharedChannel) + ASYNCH_SHARED_SLOTS * Round_To_Cache_Line(sizeof(SharedSlot) + slot_size);
+}
+
+static SharedSlot* Shared_Slot(SharedChannel* channel, unsigned int index)
+{
+    return (SharedSlot*)((char*)(channel + 1) + (size_t)(index % ASYNCH_SHARED_SLOTS) * channel->slot_stride);
+}
+
+//Creates the channels between this process and the processes of the same node it exchanges data with. Each process
+//allocates the channels it receives from in its part of a shared window, after a directory of their offsets by node
+//rank, so the senders can find them. Collective over the processes of the node.
+static void Setup_Shared_Channels(TransData* data)
+{
+    int i, node_size, my_node_rank, disp_unit;
+    size_t bytes, directory_bytes, *directory;
+    char* base;
+    MPI_Aint size;
+
+    //Find the processes on this node
+    if (data->node_comm == MPI_COMM_NULL)
+    {
+        MPI_Group world_group, node_group;
+        int* world_ranks = (int*)malloc(np * sizeof(int));
+
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &data->node_comm);
+        MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+        MPI_Comm_group(data->node_comm, &node_group);
+        for (i = 0; i < np; i++)
+            world_ranks[i] = i;
+        data->node_rank = (int*)malloc(np * sizeof(int));
+        MPI_Group_translate_ranks(world_group, np, world_ranks, node_group, data->node_rank);
+        MPI_Group_free(&world_group);
+        MPI_Group_free(&node_group);
+        free(world_ranks);
+    }
+    MPI_Comm_size(data->node_comm, &node_size);
+    MPI_Comm_rank(data->node_comm, &my_node_rank);
+
+    //Allocate the channels from the other processes of the node
+    directory_bytes = Round_To_Cache_Line(node_size * sizeof(size_t));
+    bytes = directory_bytes;
+    for (i = 0; i < np; i++)
+        if (i != my_rank && data->node_rank[i] != MPI_UNDEFINED && data->receive_buffer_size[i])
+            bytes += Shared_Channel_Size(data->receive_buffer_size[i]);
+
+    MPI_Win_allocate_shared((MPI_Aint)bytes, 1, MPI_INFO_NULL, data->node_comm, &base, &data->shared_win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, data->shared_win);
+    memset(base, 0, bytes);
+
+    directory = (size_t*)base;
+    bytes = directory_bytes;
     for (i = 0; i < np; i++)
     {
+        if (i != my_rank && data->node_rank[i] != MPI_UNDEFINED && data->receive_buffer_size[i])
+        {
+            SharedChannel* channel = (SharedChannel*)(base + bytes);
+            channel->slot_size = data->receive_buffer_size[i];
+            channel->slot_stride = (unsigned int)Round_To_Cache_Line(sizeof(SharedSlot) + channel->slot_size);
+            directory[data->node_rank[i]] = bytes;
+            data->shared_receive[i] = channel;
+            bytes += Shared_Channel_Size(channel->slot_size);
+        }
+    }
+
+    //Wait for every directory to be written
+    MPI_Win_sync(data->shared_win);
+    MPI_Barrier(data->node_comm);
+    MPI_Win_sync(data->shared_win);
+
+    //Find the channels to the other processes of the node
+    for (i = 0; i < np; i++)
+    {
+        if (i != my_rank && data->node_rank[i] != MPI_UNDEFINED && data->send_buffer_size[i])
+        {
+            MPI_Win_shared_query(data->shared_win, data->node_rank[i], &size, &disp_unit, &base);
+            directory = (size_t*)base;
+            if (directory[my_node_rank])
+            {
+                data->shared_send[i] = (SharedChannel*)(base + directory[my_node_rank]);
+                assert(data->send_buffer_size[i] <= data->shared_send[i]->slot_size);
+            }
+        }
+    }
+}
+
+#endif //defined(ASYNCH_HAVE_SHARED_TRANSFER)
+
+//Frees the shared window of the channels set by Setup_Shared_Channels. Collective over the processes of the node.
+static void Free_Shared_Channels(TransData* data)
+{
+#if defined(ASYNCH_HAVE_SHARED_TRANSFER)
+    if (data->shared_win != MPI_WIN_NULL)
+    {
+        MPI_Win_unlock_all(data->shared_win);
+        MPI_Win_free(&data->shared_win);
+    }
+#endif
+    for (int i = 0; i < np; i++)
+        data->shared_send[i] = data->shared_receive[i] = NULL;
+}
+
+//Packs the data destined to process i, on the same node, in the next free slot of the channel to it.
+//data_packed is incremented as in Pack_Data. Returns 0 if the channel was full or there was nothing to send.
+static int Send_Shared(TransData* my_data, int i, GlobalVars* GlobalVars, unsigned int* data_packed)
+{
+#if defined(ASYNCH_HAVE_SHARED_TRANSFER)
+    SharedChannel* channel = my_data->shared_send[i];
+    unsigned int tail = channel->tail;
+    SharedSlot* slot;
+    int total_links;
+
+    if (tail - __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE) >= ASYNCH_SHARED_SLOTS)
+        return 0;
+
+    slot = Shared_Slot(channel, tail);
+    slot->count = Pack_Data(my_data, i, (char*)(slot + 1), channel->slot_size, GlobalVars, &total_links, data_packed);
+    if (slot->count == 0)
+        return 0;
+    slot->tag = total_links;
+    (my_data->num_sent[i])++;
+    __atomic_store_n(&channel->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+//Unpacks the messages waiting in the channels from the processes on the same node. They are read in place.
+static void Receive_Shared(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
+{
+#if defined(ASYNCH_HAVE_SHARED_TRANSFER)
+    for (int i = 0; i < np; i++)
+    {
+        SharedChannel* channel = my_data->shared_receive[i];
+        if (channel == NULL)
+            continue;
+
+        unsigned int head = channel->head;
+        while (head != __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE))
+        {
+            SharedSlot* slot = Shared_Slot(channel, head);
+            Unpack_Data((char*)(slot + 1), slot->count, slot->tag, sys, assignments, GlobalVars);
+            __atomic_store_n(&channel->head, ++head, __ATOMIC_RELEASE);
+            (my_data->num_recv[i])++;
+        }
+    }
+#endif
+}
+
+
+//Completes the receives posted by a previous call and unpacks them, then posts the persistent receive of every
+//process this one exchanges messages with again. The messages of the processes on the same node are unpacked too.
+static void Receive_Data(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
+{
+    int i, flag, count;
+    MPI_Status status;
+
+    for (i = 0; i < np; i++)
+    {
+        //Check if the incoming message has been completely received
         if (my_data->receiving_flag[i])
         {
             MPI_Test(my_data->receive_requests[i], &flag, &status);
             if (flag)
             {
-                sender = status.MPI_SOURCE;
-                total_links = status.MPI_TAG;
-                MPI_Get_count(&status, MPI_PACKED, &count);
-                position = 0;
+                MPI_Get_count(&status, MPI_BYTE, &count);
+                Unpack_Data(my_data->receive_buffer[i], count, status.MPI_TAG, sys, assignments, GlobalVars);
+                my_data->receiving_flag[i] = 0;
+                (my_data->num_recv[i])++;
+            }
+        }
 
-                //Unpack data
-                for (j = 0; j < total_links; j++)
-                {
-                    MPI_Unpack(my_data->receive_buffer[i], count, &position, &curr_idx, 1, MPI_INT, MPI_COMM_WORLD);
+        //Begin receiving the next message
+        if (!my_data->receiving_flag[i] && *my_data->receive_requests[i] != MPI_REQUEST_NULL)
+        {
+            MPI_Start(my_data->receive_requests[i]);
+            my_data->receiving_flag[i] = 1;
+        }
+    }
 
-                    //Unpack the steps
-                    MPI_Unpack(my_data->receive_buffer[i], count, &position, &steps_to_transfer, 1, MPI_INT, MPI_COMM_WORLD);
-                    current = &sys[curr_idx];
-                    unsigned short num_stages = current->my->list.num_stages;
-                    dim = current->dim;
-                    num_dense = current->num_dense;
+    Receive_Shared(my_data, sys, assignments, GlobalVars);
+}
 
-                    for (m = 0; m < steps_to_transfer; m++)
-                    {
-                        node = New_Step(&current->my->list);
-                        node->t = 0.0; node->state = 0;
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &(node->t), 1, MPI_DOUBLE, MPI_COMM_WORLD);
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, node->y_approx, dim, MPI_DOUBLE, MPI_COMM_WORLD);
-                        
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, node->k, num_stages * num_dense, MPI_DOUBLE, MPI_COMM_WORLD);
-                        
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &(node->state), 1, MPI_INT, MPI_COMM_WORLD);
-                    }
+#if defined(HAVE_PTHREAD)
 
-                    if (steps_to_transfer > 0)
-                    {
-                        //Put the steps in place
-                        current->current_iterations += steps_to_transfer;
-                        current->last_t = node->t;
-                        parval = 0;
-                        for (n = 0; n < current->child->num_parents; n++)
-                            parval += (current->child->last_t < current->child->parents[n]->last_t);
-                        if (parval == current->child->num_parents)
-                            current->child->ready = 1;
-
-                        //Make sure the child can take a step if current has reached limit
-                        if (current->current_iterations >= GlobalVars->iter_limit)
-                            current->child->h = min(current->child->h, current->last_t - current->child->last_t);
-                        if (current->child->h + current->child->last_t > current->last_t)
-                            current->child->h *= .999;
-                    }
+//A message handed between the compute thread and the communication thread
+typedef struct CommMessage
+{
+    int rank;           //!< Process the message is sent to or received from
+    int count;          //!< Number of packed bytes
+    int tag;            //!< Number of links with steps in the message
+} CommMessage;
 
-                    //Unpack the discontinuity times
-                    MPI_Unpack(my_data->receive_buffer[i], count, &position, &num_times, 1, MPI_INT, MPI_COMM_WORLD);
-                    for (m = 0; m < num_times; m++)
-                    {
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &discont_time, 1, MPI_DOUBLE, MPI_COMM_WORLD);
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &order, 1, MPI_INT, MPI_COMM_WORLD);
-                        prev = current;
-                        next = current->child;
-                        for (n = order; (unsigned int)n < GlobalVars->max_localorder && next != NULL; n++)
-                        {
-                            if (my_rank == assignments[next->location] && n < next->method->localorder)
-                            {
-                                next->discont_end = Insert_Discontinuity(discont_time, next->discont_start, next->discont_end, &(next->discont_count), GlobalVars->discont_size, next->discont, next->ID);
-                            }
-                            else if (my_rank != assignments[next->location])
-                            {
-                                Insert_SendDiscontinuity(discont_time, n, &(prev->discont_send_count), GlobalVars->discont_size, prev->discont_send, prev->discont_order_send, prev->ID);
-                                break;
-                            }
-
-                            prev = next;
-                            next = next->child;
-                        }
-                    }
-                }
+//Lock-free ring with a single producer and a single consumer
+typedef struct CommRing
+{
+    CommMessage* messages;
+    unsigned int size;
+    unsigned int head;  //!< Next message to pop. Written by the consumer only.
+    unsigned int tail;  //!< Next free slot. Written by the producer only.
+} CommRing;
+
+//State of the communication progress thread.
+//While the thread runs, it owns the MPI requests, sent_flag and receiving_flag of the TransData. The buffers are
+//handed back and forth through the flags: send_buffer[i] belongs to the compute thread while sent_flag[i] is 0,
+//receive_buffer[i] belongs to the compute thread while receiving_flag[i] is 2.
+struct CommProgress
+{
+    pthread_t thread;
+    TransData* my_data;
+    CommRing outbound;  //!< Packed messages ready to be sent (compute -> comm)
+    CommRing inbound;   //!< Received messages ready to be unpacked (comm -> compute)
+    char* posted;       //!< posted[i] is 1 while the send to process i is posted. Used by the comm thread only.
+    int stop;           //!< Set by the compute thread when the pass is over
+};
+
+static void CommRing_Init(CommRing* ring, unsigned int size)
+{
+    ring->messages = (CommMessage*)malloc(size * sizeof(CommMessage));
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+static void CommRing_Push(CommRing* ring, CommMessage* message)
+{
+    unsigned int tail = ring->tail;
+
+    //Never more than one message per process is in flight, so the ring cannot overflow
+    assert(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) < ring->size);
+    ring->messages[tail % ring->size] = *message;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool CommRing_Pop(CommRing* ring, CommMessage* message)
+{
+    unsigned int head = ring->head;
+
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return false;
+    *message = ring->messages[head % ring->size];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//Body of the communication thread. Posts the sends queued by the compute thread, completes them, and receives
+//incoming messages until asked to stop and no send is left in flight. The receives still posted then are tested
+//by the compute thread.
+static void* Comm_Progress_Run(void* arg)
+{
+    struct CommProgress* progress = (struct CommProgress*)arg;
+    TransData* my_data = progress->my_data;
+    CommMessage message;
+    MPI_Status status;
+    int i, flag;
+    unsigned int in_flight = 0;
+
+    while (true)
+    {
+        bool stop = __atomic_load_n(&progress->stop, __ATOMIC_ACQUIRE);
+        bool worked = false;
+
+        //Send the packed messages
+        while (CommRing_Pop(&progress->outbound, &message))
+        {
+            MPI_Isend(my_data->send_buffer[message.rank], message.count, MPI_BYTE, message.rank, message.tag, my_data->comm, my_data->send_requests[message.rank]);
+            progress->posted[message.rank] = 1;
+            in_flight++;
+            worked = true;
+        }
 
-                //Unpack iterations
-                while (position < count)
+        for (i = 0; i < np; i++)
+        {
+            //Give the send buffer back once the message is out
+            if (progress->posted[i])
+            {
+                MPI_Test(my_data->send_requests[i], &flag, MPI_STATUS_IGNORE);
+                if (flag)
                 {
-                    MPI_Unpack(my_data->receive_buffer[i], count, &position, &loc, 1, MPI_UNSIGNED, MPI_COMM_WORLD);
-                    MPI_Unpack(my_data->receive_buffer[i], count, &position, &removed, 1, MPI_INT, MPI_COMM_WORLD);
-                    sys[loc].steps_on_diff_proc -= removed;
+                    progress->posted[i] = 0;
+                    __atomic_store_n(&my_data->sent_flag[i], 0, __ATOMIC_RELEASE);
+                    in_flight--;
+                    worked = true;
                 }
+            }
 
-                my_data->receiving_flag[i] = 0;
-                (my_data->num_recv[i])++;
+            //Hand completed receives to the compute thread
+            short int receiving = __atomic_load_n(&my_data->receiving_flag[i], __ATOMIC_ACQUIRE);
+            if (receiving == 1)
+            {
+                MPI_Test(my_data->receive_requests[i], &flag, &status);
+                if (flag)
+                {
+                    message.rank = i;
+                    message.tag = status.MPI_TAG;
+                    MPI_Get_count(&status, MPI_BYTE, &message.count);
+                    __atomic_store_n(&my_data->receiving_flag[i], 2, __ATOMIC_RELEASE);
+                    CommRing_Push(&progress->inbound, &message);
+                    worked = true;
+                }
+            }
+            else if (receiving == 0 && !stop && *my_data->receive_requests[i] != MPI_REQUEST_NULL)
+            {
+                //Begin receiving the next message
+                MPI_Start(my_data->receive_requests[i]);
+                __atomic_store_n(&my_data->receiving_flag[i], 1, __ATOMIC_RELEASE);
+                worked = true;
             }
         }
+
+        if (stop && in_flight == 0 && progress->outbound.head == __atomic_load_n(&progress->outbound.tail, __ATOMIC_ACQUIRE))
+            break;
+
+        if (!worked)
+            sched_yield();
     }
 
-    //Begin receiving messages
+    return NULL;
+}
+
+#endif //defined(HAVE_PTHREAD)
+
+
+//Starts a thread dedicated to progressing the MPI communication of my_data. Until Stop_Comm_Progress is called,
+//Transfer_Data only packs and unpacks messages, and the thread posts, tests and receives them. The packing and
+//unpacking stay with the solver, which owns the lists of the links, so the thread makes the only MPI calls.
+//Returns 0 if the thread is running, 1 otherwise (the caller should keep using Transfer_Data as usual).
+int Start_Comm_Progress(TransData* my_data)
+{
+#if defined(HAVE_PTHREAD)
+    int i;
+    struct CommProgress* progress;
+
+    if (my_data->progress != NULL)
+        return 0;
+
+    //Only the compute thread may hold requests when the thread starts
     for (i = 0; i < np; i++)
     {
-        if (!(my_data->receiving_flag[i]))
+        if (my_data->sent_flag[i])
         {
-            MPI_Iprobe(i, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
-            if (flag)
+            MPI_Wait(my_data->send_requests[i], MPI_STATUS_IGNORE);
+            my_data->sent_flag[i] = 0;
+        }
+    }
+
+    progress = (struct CommProgress*)malloc(sizeof(struct CommProgress));
+    progress->my_data = my_data;
+    progress->stop = 0;
+    CommRing_Init(&progress->outbound, np);
+    CommRing_Init(&progress->inbound, np);
+    progress->posted = (char*)calloc(np, sizeof(char));
+
+    if (pthread_create(&progress->thread, NULL, Comm_Progress_Run, progress))
+    {
+        printf("[%i]: Warning: Could not create the communication thread.\n", my_rank);
+        free(progress->outbound.messages);
+        free(progress->inbound.messages);
+        free(progress->posted);
+        free(progress);
+        return 1;
+    }
+
+    my_data->progress = progress;
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+//Unpacks the messages received by the communication thread.
+static void Unpack_Inbound(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
+{
+#if defined(HAVE_PTHREAD)
+    CommMessage message;
+
+    while (CommRing_Pop(&my_data->progress->inbound, &message))
+    {
+        Unpack_Data(my_data->receive_buffer[message.rank], message.count, message.tag, sys, assignments, GlobalVars);
+        (my_data->num_recv[message.rank])++;
+        __atomic_store_n(&my_data->receiving_flag[message.rank], 0, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+//Stops the communication thread started by Start_Comm_Progress. The messages queued are sent and the messages
+//already being received are unpacked before returning. Afterwards Transfer_Data progresses the communication itself.
+void Stop_Comm_Progress(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
+{
+#if defined(HAVE_PTHREAD)
+    struct CommProgress* progress = my_data->progress;
+
+    if (progress == NULL)
+        return;
+
+    __atomic_store_n(&progress->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(progress->thread, NULL);
+    Unpack_Inbound(my_data, sys, assignments, GlobalVars);
+
+    free(progress->outbound.messages);
+    free(progress->inbound.messages);
+    free(progress->posted);
+    free(progress);
+    my_data->progress = NULL;
+#endif
+}
+
+//Tranfers data amongst processes. Uses asynchronous communication scheme.
+//TransData* my_data: Contains information about how the processes will communicate.
+//Link** sys: The river system.
+//UnivVars* GlobalVars: Contains all the information that is shared by every link in the system.
+//Note: a few "silly" initializations take place before the loops. This prevents Valgrind from complaining on some systems about pointless errors.
+void Transfer_Data(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
+{
+    int i, flag, position, total_links;
+    unsigned int data_packed = 0;
+
+#if defined(HAVE_PTHREAD)
+    //The communication thread sends and receives, only pack and unpack here
+    if (my_data->progress != NULL)
+    {
+        for (i = 0; i < np; i++)
+        {
+            if (my_data->shared_send[i])
+                Send_Shared(my_data, i, GlobalVars, &data_packed);
+            else if ((my_data->send_size[i] != 0 || my_data->receive_size[i] != 0) && __atomic_load_n(&my_data->sent_flag[i], __ATOMIC_ACQUIRE) == 0)
             {
-                total_links = status.MPI_TAG;
-                MPI_Get_count(&status, MPI_PACKED, &count);
-                MPI_Irecv(my_data->receive_buffer[i], count, MPI_PACKED, i, total_links, MPI_COMM_WORLD, my_data->receive_requests[i]);
-                my_data->receiving_flag[i] = 1;
+                position = Pack_Data(my_data, i, my_data->send_buffer[i], my_data->send_buffer_size[i], GlobalVars, &total_links, &data_packed);
+                if (position != 0)
+                {
+                    CommMessage message = { i, position, total_links };
+                    (my_data->num_sent[i])++;
+                    __atomic_store_n(&my_data->sent_flag[i], 1, __ATOMIC_RELEASE);
+                    CommRing_Push(&my_data->progress->outbound, &message);
+                }
             }
         }
+
+        Unpack_Inbound(my_data, sys, assignments, GlobalVars);
+        Receive_Shared(my_data, sys, assignments, GlobalVars);
+        return;
     }
+#endif
+
+    //If sending
+    for (i = 0; i < np; i++)
+    {
+        if (my_data->shared_send[i])
+            Send_Shared(my_data, i, GlobalVars, &data_packed);
+        else if (my_data->send_size[i] != 0 || my_data->receive_size[i] != 0)
+        {
+            if (my_data->sent_flag[i])	MPI_Test(my_data->send_requests[i], &flag, MPI_STATUS_IGNORE);
+            if (!my_data->sent_flag[i] || flag)
+            {
+                position = Pack_Data(my_data, i, my_data->send_buffer[i], my_data->send_buffer_size[i], GlobalVars, &total_links, &data_packed);
+
+                //If there's information to send, send it!
+                if (position != 0)
+                {
+                    my_data->sent_flag[i] = 1;
+                    (my_data->num_sent[i])++;
+                    MPI_Isend(my_data->send_buffer[i], position, MPI_BYTE, i, total_links, my_data->comm, my_data->send_requests[i]);
+                }
+            } //End if(flag)
+        }
+    } //End loop over processes (i)
+
+    Receive_Data(my_data, sys, assignments, GlobalVars);
 }
 
 //Tranfers data amongst processes. Use for asynchronous communication scheme.
-//Use for asynchronous communication and only after this process has finished all calculations. Sends all remaining data.
+//Use for asynchronous communication and only after this process has finished all calculations. Sends all remaining data,
+//then receives every message the other processes sent to this one before they called Transfer_Data_Finish.
 //TransData* my_data: Contains information about how the processes will communicate.
 //Link** sys: The river system.
 //UnivVars* GlobalVars: Contains all the information that is shared by every link in the system.
 void Transfer_Data_Finish(TransData* my_data, Link* sys, int* assignments, GlobalVars* GlobalVars)
 {
-    int i, j, m, n, steps_to_transfer = 0, curr_idx = 0, dim, flag, position, total_links, sender, count, removed = 0, order = 0, num_times = 0;
-    unsigned int loc = 0, parval, l, num_dense;
+    int i, flag, position, total_links, remaining;
+    unsigned int l;
     unsigned int data_to_send = 0;
     unsigned int data_sent = 0;
-    double discont_time = 0.0;
-    RKSolutionNode* node = NULL;
-    Link *current, *next, *prev;
-    MPI_Status status;
+    MPI_Request request;
 
     //Check how much data still must be sent
     //Note: There should never be discontinuities to send AND no steps for a given link
@@ -271,204 +758,51 @@ void Transfer_Data_Finish(TransData* my_data, Link* sys, int* assignments, Globa
     {
         for (i = 0; i < np; i++)
         {
-            if (my_data->send_size[i] != 0 || my_data->receive_size[i] != 0)
+            if (my_data->shared_send[i])
+                Send_Shared(my_data, i, GlobalVars, &data_sent);
+            else if (my_data->send_size[i] != 0 || my_data->receive_size[i] != 0)
             {
                 if (my_data->sent_flag[i])	MPI_Test(my_data->send_requests[i], &flag, MPI_STATUS_IGNORE);
                 if (!my_data->sent_flag[i] || flag)
                 {
-                    position = 0;
-
-                    //Pack data
-                    total_links = 0;
-                    for (l = 0; l < my_data->send_size[i]; l++)
-                    {
-                        current = my_data->send_data[i][l];
-                        curr_idx = current->location;
-
-                        //Figure out how many steps will be sent.
-                        steps_to_transfer = 0;
-                        node = current->my->list.head->next;
-
-                        while (steps_to_transfer < current->current_iterations - 1 && steps_to_transfer < GlobalVars->max_transfer_steps && steps_to_transfer + current->steps_on_diff_proc < GlobalVars->iter_limit)
-                        {
-                            steps_to_transfer++;
-                            node = node->next;
-                        }
-
-                        //Pack all the data for each step.
-                        if (steps_to_transfer > 0 || current->discont_send_count > 0)
-                        {
-                            data_sent += steps_to_transfer;
-                            total_links++;
-                            node = current->my->list.head->next;
-                            unsigned short num_stages = current->my->list.num_stages;
-                            dim = current->dim;
-                            num_dense = current->num_dense;
-                            current->steps_on_diff_proc += steps_to_transfer;
-
-                            //Pack the steps
-                            MPI_Pack(&(current->location), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            MPI_Pack(&steps_to_transfer, 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            for (m = 0; m < steps_to_transfer; m++)
-                            {
-                                MPI_Pack(&(node->t), 1, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                                MPI_Pack(node->y_approx, dim, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-
-                                MPI_Pack(node->k, num_stages * num_dense, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                                MPI_Pack(&(node->state), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-
-                                Remove_Head_Node(&current->my->list);
-                                node = node->next;
-                                (current->current_iterations)--;
-                            }
-
-                            //Pack the discontinuity times
-                            MPI_Pack(&(current->discont_send_count), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            for (m = 0; (unsigned int)m < current->discont_send_count; m++)
-                            {
-                                MPI_Pack(&(current->discont_send[m]), 1, MPI_DOUBLE, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                                MPI_Pack(&(current->discont_order_send[m]), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            }
-
-                            current->discont_send_count = 0;
-                        }
-                    }
-
-                    //Pack iterations
-                    for (l = 0; l < my_data->receive_size[i]; l++)
-                    {
-                        current = my_data->receive_data[i][l];
-                        if (current->iters_removed > 0)
-                        {
-                            data_sent++;	//See Note2 above
-                            MPI_Pack(&(current->location), 1, MPI_UNSIGNED, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            MPI_Pack(&(current->iters_removed), 1, MPI_INT, my_data->send_buffer[i], my_data->send_buffer_size[i], &position, MPI_COMM_WORLD);
-                            current->iters_removed = 0;
-                        }
-                    }
+                    position = Pack_Data(my_data, i, my_data->send_buffer[i], my_data->send_buffer_size[i], GlobalVars, &total_links, &data_sent);
 
                     //If there's information to send, send it!
                     if (position != 0)
                     {
                         my_data->sent_flag[i] = 1;
                         (my_data->num_sent[i])++;
-                        MPI_Isend(my_data->send_buffer[i], position, MPI_PACKED, i, total_links, MPI_COMM_WORLD, my_data->send_requests[i]);
+                        MPI_Isend(my_data->send_buffer[i], position, MPI_BYTE, i, total_links, my_data->comm, my_data->send_requests[i]);
                     }
                 } //End if(flag)
             }
         } //End loop over processes (i)
 
-        //Check if any incoming messages have been completely received
-        for (i = 0; i < np; i++)
-        {
-            if (my_data->receiving_flag[i])
-            {
-                MPI_Test(my_data->receive_requests[i], &flag, &status);
-                if (flag)
-                {
-                    sender = status.MPI_SOURCE;
-                    total_links = status.MPI_TAG;
-                    MPI_Get_count(&status, MPI_PACKED, &count);
-                    position = 0;
-
-                    //Unpack data
-                    for (j = 0; j < total_links; j++)
-                    {
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &curr_idx, 1, MPI_INT, MPI_COMM_WORLD);
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &steps_to_transfer, 1, MPI_INT, MPI_COMM_WORLD);
-                        current = &sys[curr_idx];
-                        unsigned short num_stages = current->my->list.num_stages;
-                        dim = current->dim;
-                        num_dense = current->num_dense;
-
-                        for (m = 0; m < steps_to_transfer; m++)
-                        {
-                            node = New_Step(&current->my->list);
-                            node->t = 0.0; node->state = 0;
-                            MPI_Unpack(my_data->receive_buffer[i], count, &position, &(node->t), 1, MPI_DOUBLE, MPI_COMM_WORLD);
-                            MPI_Unpack(my_data->receive_buffer[i], count, &position, node->y_approx, dim, MPI_DOUBLE, MPI_COMM_WORLD);
-                            MPI_Unpack(my_data->receive_buffer[i], count, &position, node->k, num_stages * num_dense, MPI_DOUBLE, MPI_COMM_WORLD);
-
-                            //MPI_Unpack(my_data->receive_buffer[i],count,&position,node->k[n].ve,dim,MPI_DOUBLE,MPI_COMM_WORLD);
-                            MPI_Unpack(my_data->receive_buffer[i], count, &position, &(node->state), 1, MPI_INT, MPI_COMM_WORLD);
-                        }
-
-                        if (steps_to_transfer > 0)
-                        {
-                            //Put the steps in place
-                            current->current_iterations += steps_to_transfer;
-                            current->last_t = node->t;
-                            parval = 0;
-                            for (n = 0; n < current->child->num_parents; n++)
-                                parval += (current->child->last_t < current->child->parents[n]->last_t);
-                            if (parval == current->child->num_parents)
-                                current->child->ready = 1;
-
-                            //Make sure the child can take a step if current has reached limit
-                            if (current->current_iterations >= GlobalVars->iter_limit)
-                                current->child->h = min(current->child->h, current->last_t - current->child->last_t);
-                            if (current->child->h + current->child->last_t > current->last_t)
-                                current->child->h *= .999;
-                        }
-
-                        //Unpack the discontinuity times
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &num_times, 1, MPI_INT, MPI_COMM_WORLD);
-                        for (m = 0; m < num_times; m++)
-                        {
-                            MPI_Unpack(my_data->receive_buffer[i], count, &position, &discont_time, 1, MPI_DOUBLE, MPI_COMM_WORLD);
-                            MPI_Unpack(my_data->receive_buffer[i], count, &position, &order, 1, MPI_INT, MPI_COMM_WORLD);
-
-                            prev = current;
-                            next = current->child;
-                            for (n = order; (unsigned int)n < GlobalVars->max_localorder && next != NULL; n++)
-                            {
-                                if (my_rank == assignments[next->location] && n < next->method->localorder)
-                                    next->discont_end = Insert_Discontinuity(discont_time, next->discont_start, next->discont_end, &(next->discont_count), GlobalVars->discont_size, next->discont, next->ID);
-                                else if (my_rank != assignments[next->location])
-                                {
-                                    Insert_SendDiscontinuity(discont_time, n, &(prev->discont_send_count), GlobalVars->discont_size, prev->discont_send, prev->discont_order_send, prev->ID);
-                                    break;
-                                }
-
-                                prev = next;
-                                next = next->child;
-                            }
-                        }
-                    }
-
-                    //Unpack iterations (need this for rainfall so the last step will get sent)
-                    while (position < count)
-                    {
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &loc, 1, MPI_UNSIGNED, MPI_COMM_WORLD);
-                        MPI_Unpack(my_data->receive_buffer[i], count, &position, &removed, 1, MPI_INT, MPI_COMM_WORLD);
-                        sys[loc].steps_on_diff_proc -= removed;
-                    }
+        Receive_Data(my_data, sys, assignments, GlobalVars);
+    } //End while
 
-                    my_data->receiving_flag[i] = 0;
-                    (my_data->num_recv[i])++;
-                }
-            }
-        }
+    //Find out how many messages every other process sent to this one. Receiving continues while the counts are
+    //exchanged, as the other processes may still be waiting on this one to send their last steps.
+    MPI_Ialltoall(my_data->num_sent, 1, MPI_UNSIGNED, my_data->totals, 1, MPI_UNSIGNED, my_data->comm, &request);
+    do
+    {
+        Receive_Data(my_data, sys, assignments, GlobalVars);
+        MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+    } while (!flag);
 
-        //Begin receiving messages
+    //Receive the messages still on their way
+    do
+    {
+        remaining = 0;
         for (i = 0; i < np; i++)
-        {
-            if (!my_data->receiving_flag[i])
-            {
-                MPI_Iprobe(i, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
-                if (flag)
-                {
-                    total_links = status.MPI_TAG;
-                    MPI_Get_count(&status, MPI_PACKED, &count);
-                    MPI_Irecv(my_data->receive_buffer[i], count, MPI_PACKED, i, total_links, MPI_COMM_WORLD, my_data->receive_requests[i]);
-                    my_data->receiving_flag[i] = 1;
-                }
-            }
-        }
-    } //End while
+            remaining += (my_data->num_recv[i] < my_data->totals[i]);
+        if (remaining)
+            Receive_Data(my_data, sys, assignments, GlobalVars);
+    } while (remaining);
 }
 
 
+
 void Exchange_InitState_At_Forced(
     Link* system, unsigned int N,
     int* assignments, short int* getting,
@@ -514,7 +848,7 @@ void Exchange_InitState_At_Forced(
 }
 
 
-//Allocate space for a transmitting scheme
+//Allocate space for a transmitting scheme. Collective, as the messages get their own communicator.
 //Returns a pointer to a newly allocated TransData
 TransData* Initialize_TransData()
 {
@@ -533,6 +867,8 @@ TransData* Initialize_TransData()
     {
         data->send_requests[i] = (MPI_Request*)malloc(sizeof(MPI_Request));
         data->receive_requests[i] = (MPI_Request*)malloc(sizeof(MPI_Request));
+        *data->send_requests[i] = MPI_REQUEST_NULL;
+        *data->receive_requests[i] = MPI_REQUEST_NULL;
     }
     data->sent_flag = (short int*)calloc(np, sizeof(short int));
     data->receiving_flag = (short int*)calloc(np, sizeof(short int));
@@ -541,6 +877,13 @@ TransData* Initialize_TransData()
     data->num_sent = (unsigned int*)calloc(np, sizeof(unsigned int));
     data->num_recv = (unsigned int*)calloc(np, sizeof(unsigned int));
     data->totals = (unsigned int*)malloc(np * sizeof(unsigned int));
+    data->progress = NULL;
+    MPI_Comm_dup(MPI_COMM_WORLD, &data->comm);
+    data->node_comm = MPI_COMM_NULL;
+    data->node_rank = NULL;
+    data->shared_win = MPI_WIN_NULL;
+    data->shared_send = (struct SharedChannel**)calloc(np, sizeof(struct SharedChannel*));
+    data->shared_receive = (struct SharedChannel**)calloc(np, sizeof(struct SharedChannel*));
 
     return data;
 }
@@ -552,37 +895,63 @@ TransData* Initialize_TransData()
 void Flush_TransData(TransData* data)
 {
     int i, j;
-    MPI_Status status;
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(data->comm);
+
+    //See how many messages remain to be received
+    for (i = 0; i < np; i++)
+        MPI_Scatter(data->num_sent, 1, MPI_INT, &(data->totals[i]), 1, MPI_INT, i, data->comm);
+
+    //Make sure all sends are complete
+    for (i = 0; i < np; i++)
+    {
+        if (data->sent_flag[i])
+        {
+            MPI_Wait(data->send_requests[i], MPI_STATUS_IGNORE);
+            data->sent_flag[i] = 0;
+        }
+    }
 
-    //Receive all outstanding messages where a recv has been posted
+    //Receive any remaining messages. The messages in shared memory are all there already.
     for (i = 0; i < np; i++)
     {
-        if (data->receiving_flag[i])
+#if defined(ASYNCH_HAVE_SHARED_TRANSFER)
+        if (data->shared_receive[i])
+        {
+            __atomic_store_n(&data->shared_receive[i]->head, __atomic_load_n(&data->shared_receive[i]->tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+            continue;
+        }
+#endif
+        for (j = data->num_recv[i]; (unsigned int)j < data->totals[i]; j++)
         {
+            if (!data->receiving_flag[i])
+                MPI_Start(data->receive_requests[i]);
             MPI_Wait(data->receive_requests[i], MPI_STATUS_IGNORE);
             data->receiving_flag[i] = 0;
-            (data->num_recv[i])++;
         }
     }
 
-    /*
-        //Make sure all sends are complete
-        for(i=0;i<np;i++)
+    //The persistent receives may still be posted. Each process closes the receives of the others with an empty
+    //message, as the messages with data are never empty and arrive before it.
+    for (i = 0; i < np; i++)
+    {
+        if (data->send_buffer[i] && data->shared_send[i] == NULL)
         {
-            if(data->sent_flag[i])
-            {
-                MPI_Wait(data->send_requests[i],MPI_STATUS_IGNORE);
-                data->sent_flag[i] = 0;
-            }
+            MPI_Isend(NULL, 0, MPI_BYTE, i, 0, data->comm, data->send_requests[i]);
+            data->sent_flag[i] = 1;
         }
-    */
+    }
 
-    //See how many messages remain to be received
     for (i = 0; i < np; i++)
-        MPI_Scatter(data->num_sent, 1, MPI_INT, &(data->totals[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
+    {
+        if (*data->receive_requests[i] != MPI_REQUEST_NULL)
+        {
+            if (!data->receiving_flag[i])
+                MPI_Start(data->receive_requests[i]);
+            MPI_Wait(data->receive_requests[i], MPI_STATUS_IGNORE);
+            data->receiving_flag[i] = 0;
+        }
+    }
 
-    //Make sure all sends are complete
     for (i = 0; i < np; i++)
     {
         if (data->sent_flag[i])
@@ -592,20 +961,89 @@ void Flush_TransData(TransData* data)
         }
     }
 
-    //Receive any remaining messages
     for (i = 0; i < np; i++)
     {
-        for (j = data->num_recv[i]; (unsigned int)j < data->totals[i]; j++)
-            MPI_Recv(data->receive_buffer[i], data->receive_buffer_size[i], MPI_PACKED, i, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        data->num_recv[i] = 0;
+        data->num_sent[i] = 0;
     }
 
+    MPI_Barrier(data->comm);
+}
+
+//Allocates the send and receive buffers of data, sized for the links in its lists.
+//Need space for nodes, number of iterations, discontinuities
+//Data: ( size(double)*(max_rk_stages*max_dim + max_dim + time)*# steps to transfer + size(int)(for stage)*# steps to transfer + size(int)*(location + # steps to transfer) ) * # of sending links
+//Upstream: + size(int) * (location + # of iterations) * # of receiving links
+//Discontinuities: + (size(int) + size(double)*discont_size + size(int)*discont_size) * # of sending links
+void Allocate_TransData_Buffers(TransData* data, const GlobalVars* globals)
+{
+    unsigned int j;
+    int i;
+    Link* current;
+
+    //With the history stored in float, the dense output coefficients are sent instead of the k values
+    unsigned int bytes2 = 2 * sizeof(int);
+    unsigned int bytes3 = sizeof(int) + (sizeof(int) + sizeof(double))*globals->discont_size;
     for (i = 0; i < np; i++)
     {
-        data->num_recv[i] = 0;
-        data->num_sent[i] = 0;
+        data->send_buffer_size[i] = bytes2 * data->receive_size[i] + bytes3 * data->send_size[i];
+        for (j = 0; j < data->send_size[i]; j++)
+        {
+            current = data->send_data[i][j];
+            unsigned int history_bytes = globals->float_history ? sizeof(float) * (current->method->dense_degree + 1) * current->num_dense : sizeof(double) * current->method->num_stages * current->num_dense;
+            data->send_buffer_size[i] += (history_bytes + sizeof(double)*(current->dim + 1) + sizeof(int))*globals->max_transfer_steps + sizeof(int) * 2;
+        }
+
+        data->receive_buffer_size[i] = bytes2 * data->send_size[i] + bytes3 * data->receive_size[i];
+        for (j = 0; j < data->receive_size[i]; j++)
+        {
+            current = data->receive_data[i][j];
+            unsigned int history_bytes = globals->float_history ? sizeof(float) * (current->method->dense_degree + 1) * current->num_dense : sizeof(double) * current->method->num_stages * current->num_dense;
+            data->receive_buffer_size[i] += (history_bytes + sizeof(double)*(current->dim + 1) + sizeof(int))*globals->max_transfer_steps + sizeof(int) * 2;
+        }
+
+        if (data->send_buffer_size[i])	data->send_buffer[i] = (char*)malloc(data->send_buffer_size[i] * sizeof(char));
+        else					data->send_buffer[i] = NULL;
+
+        if (data->receive_buffer_size[i])	data->receive_buffer[i] = (char*)malloc(data->receive_buffer_size[i] * sizeof(char));
+        else					data->receive_buffer[i] = NULL;
+    }
+
+#if defined(ASYNCH_HAVE_SHARED_TRANSFER)
+    //The processes on the same node exchange their data in shared memory
+    if (globals->shared_transfer && np > 1)
+        Setup_Shared_Channels(data);
+#endif
+
+    //The processes exchanging data do not change until the buffers are allocated again, so the receives are
+    //set once and only started by Transfer_Data. They stay posted between the passes, as nothing else is sent on
+    //data->comm. The sends are not persistent: their length and tag (the number of links packed) change with
+    //every message.
+    for (i = 0; i < np; i++)
+    {
+        if (data->receive_buffer[i] && data->shared_receive[i] == NULL)
+            MPI_Recv_init(data->receive_buffer[i], data->receive_buffer_size[i], MPI_BYTE, i, MPI_ANY_TAG, data->comm, data->receive_requests[i]);
     }
+}
 
-    MPI_Barrier(MPI_COMM_WORLD);
+//Empties the lists and frees the buffers of data, so the links exchanged can be set again.
+//Assumes no message is in flight (see Flush_TransData). Collective if the data goes through shared memory.
+void Clear_TransData(TransData* data)
+{
+    Free_Shared_Channels(data);
+    for (int i = 0; i < np; i++)
+    {
+        if (*data->receive_requests[i] != MPI_REQUEST_NULL)
+            MPI_Request_free(data->receive_requests[i]);
+        free(data->send_data[i]);
+        free(data->receive_data[i]);
+        free(data->send_buffer[i]);
+        free(data->receive_buffer[i]);
+        data->send_data[i] = data->receive_data[i] = NULL;
+        data->send_buffer[i] = data->receive_buffer[i] = NULL;
+        data->send_size[i] = data->receive_size[i] = 0;
+        data->send_buffer_size[i] = data->receive_buffer_size[i] = 0;
+    }
 }
 
 //Free space for a transmitting scheme
@@ -614,9 +1052,22 @@ void TransData_Free(TransData* data)
 {
     int i;
 
+    if (!data)
+        return;
+
     //Clean out any left over messages.
     MPI_Finalized(&i);
-    if (!i)	Flush_TransData(data);
+    if (!i)
+    {
+        Flush_TransData(data);
+        for (i = 0; i < np; i++)
+            if (*data->receive_requests[i] != MPI_REQUEST_NULL)
+                MPI_Request_free(data->receive_requests[i]);
+        Free_Shared_Channels(data);
+        if (data->node_comm != MPI_COMM_NULL)
+            MPI_Comm_free(&data->node_comm);
+        MPI_Comm_free(&data->comm);
+    }
 
     //Free memory
     for (i = 0; i < np; i++)	free(data->send_data[i]);
@@ -644,5 +1095,8 @@ void TransData_Free(TransData* data)
     free(data->num_sent);
     free(data->num_recv);
     free(data->totals);
+    free(data->node_rank);
+    free(data->shared_send);
+    free(data->shared_receive);
     free(data);
 }
@@ -18,12 +18,21 @@
 
 #define ASYNCH_MAX_NUMBER_OF_PROCESS 256
 
+//The data exchanged between processes of the same node can go through MPI-3 shared memory windows
+#if MPI_VERSION >= 3 && defined(__GNUC__)
+#define ASYNCH_HAVE_SHARED_TRANSFER
+#endif
+
 //MPI Related Methods
 void Transfer_Data(TransData* my_data,Link* sys,int* assignments,GlobalVars* GlobalVars);
 void Transfer_Data_Finish(TransData* my_data,Link* sys,int* assignments,GlobalVars* GlobalVars);
+int Start_Comm_Progress(TransData* my_data);
+void Stop_Comm_Progress(TransData* my_data,Link* sys,int* assignments,GlobalVars* GlobalVars);
 void Exchange_InitState_At_Forced(Link* system, unsigned int N, int* assignments, short int* getting, unsigned int* res_list, unsigned int res_size, const Lookup * const id_to_loc, GlobalVars* globals);
 TransData* Initialize_TransData();
 void Flush_TransData(TransData* data);
+void Allocate_TransData_Buffers(TransData* data, const GlobalVars* globals);
+void Clear_TransData(TransData* data);
 void TransData_Free(TransData* data);
 
 #endif //!defined(ASYNCH_COMM_H)
@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 
 #if defined(HAVE_LIBZ)
@@ -75,6 +76,81 @@ int uncompress_gzfile(FILE *source, FILE *dest)
     return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
 }
 
+/* inflate the gzip file source into the buffer dest of capacity bytes. The number of bytes written is stored in
+   size. Returns Z_DATA_ERROR if the file holds more than capacity bytes. */
+int uncompress_gzfile_buffer(FILE *source, void *dest, size_t capacity, size_t *size)
+{
+    int ret;
+    z_stream strm;
+    unsigned char in[CHUNK];
+
+    /* allocate inflate state */
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    ret = inflateInit2(&strm,16+MAX_WBITS);
+    if (ret != Z_OK)
+        return ret;
+
+    assert(capacity <= UINT_MAX);
+    strm.next_out = dest;
+    strm.avail_out = (uInt)capacity;
+
+    /* decompress until deflate stream ends, dest is full or end of file */
+    do {
+        strm.avail_in = fread(in, 1, CHUNK, source);
+        if (ferror(source)) {
+            (void)inflateEnd(&strm);
+            return Z_ERRNO;
+        }
+        if (strm.avail_in == 0)
+            break;
+        strm.next_in = in;
+
+        /* inflate() returns once the input is used or dest is full */
+        ret = inflate(&strm, Z_NO_FLUSH);
+        assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+        switch (ret) {
+        case Z_NEED_DICT:
+            ret = Z_DATA_ERROR;     /* and fall through */
+        case Z_DATA_ERROR:
+        case Z_MEM_ERROR:
+            (void)inflateEnd(&strm);
+            return ret;
+        }
+    } while (ret != Z_STREAM_END && strm.avail_out > 0);
+    *size = capacity - strm.avail_out;
+
+    /* dest is full: the stream must end without another byte */
+    if (ret != Z_STREAM_END && strm.avail_out == 0) {
+        unsigned char extra;
+        do {
+            if (strm.avail_in == 0) {
+                strm.avail_in = fread(in, 1, CHUNK, source);
+                if (ferror(source)) {
+                    (void)inflateEnd(&strm);
+                    return Z_ERRNO;
+                }
+                if (strm.avail_in == 0)
+                    break;
+                strm.next_in = in;
+            }
+            strm.next_out = &extra;
+            strm.avail_out = 1;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+        } while ((ret == Z_OK || ret == Z_BUF_ERROR) && strm.avail_out == 1);
+        if (strm.avail_out == 0)
+            ret = Z_DATA_ERROR;
+    }
+
+    /* clean up and return */
+    (void)inflateEnd(&strm);
+    return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
+}
+
 /* report a zlib or i/o error */
 void zerr(int ret)
 {
@@ -6,6 +6,7 @@
 #endif // _MSC_VER > 1000
 
 int uncompress_gzfile(FILE *source, FILE *dest);
+int uncompress_gzfile_buffer(FILE *source, void *dest, size_t capacity, size_t *size);
 void zerr(int ret);
 
 #endif
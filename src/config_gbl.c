@@ -67,6 +67,7 @@ GlobalVars* Read_Global_Data(
     GlobalVars* globals = (GlobalVars*)malloc(sizeof(GlobalVars));
     memset(globals, 0, sizeof(GlobalVars));
 
+    globals->num_threads = 1;
     globals->string_size = ASYNCH_MAX_PATH_LENGTH;
     char db_filename[ASYNCH_MAX_PATH_LENGTH];
     globals->query_size = ASYNCH_MAX_QUERY_LENGTH;
@@ -195,7 +196,7 @@ GlobalVars* Read_Global_Data(
     }
 
     //Set dim and other sizes
-    if (model)
+    if (model && model->set_param_sizes)
         model->set_param_sizes(globals, external);
     else
         SetParamSizes(globals, external);
@@ -228,6 +229,13 @@ GlobalVars* Read_Global_Data(
         if (ReadLineError(valsread, 1, "filename for topology data"))	return NULL;
         if (!CheckFilenameExtension(globals->rvr_filename, ".rvr"))	return NULL;
     }
+    else if (globals->rvr_flag == 2)	//Reading from a network bundle
+    {
+        globals->rvr_filename = (char*)malloc(ASYNCH_MAX_PATH_LENGTH * sizeof(char));
+        valsread = sscanf(line_buffer, "%*u %s", globals->rvr_filename);
+        if (ReadLineError(valsread, 1, "network bundle for topology data"))	return NULL;
+        if (!CheckFilenameExtension(globals->rvr_filename, ".nbd"))	return NULL;
+    }
     else	//Reading from database
     {
         valsread = sscanf(line_buffer, "%*u %u %s", &(globals->outletlink), db_filename);
@@ -248,6 +256,13 @@ GlobalVars* Read_Global_Data(
         if (ReadLineError(valsread, 1, ".prm filename"))	return NULL;
         if (!CheckFilenameExtension(globals->prm_filename, ".prm"))	return NULL;
     }
+    else if (globals->prm_flag == 2)
+    {
+        globals->prm_filename = (char*)malloc(ASYNCH_MAX_PATH_LENGTH * sizeof(char));
+        valsread = sscanf(line_buffer, "%*u %s", globals->prm_filename);
+        if (ReadLineError(valsread, 1, "network bundle for parameters"))	return NULL;
+        if (!CheckFilenameExtension(globals->prm_filename, ".nbd"))	return NULL;
+    }
     else
     {
         valsread = sscanf(line_buffer, "%*u %s", db_filename);
@@ -297,7 +312,7 @@ GlobalVars* Read_Global_Data(
     }
 
     //Grab the forcing parameters
-    //0 for no rain, 1 for .str file, 2 for regular binary files, 3 for database, 4 for uniform rain (.ustr), 5 for irregular binary files, 6 for gzipped binary files, 7 for monthly recurrent, 8 for grid cell
+    //0 for no rain, 1 for .str (or .bstr) file, 2 for regular binary files, 3 for database, 4 for uniform rain (.ustr), 5 for irregular binary files, 6 for gzipped binary files, 7 for monthly recurrent, 8 for grid cell
     globals->hydro_table = globals->peak_table = NULL;
     for (i = 0; i < globals->num_forcings; i++)
     {
@@ -310,7 +325,12 @@ GlobalVars* Read_Global_Data(
             forcings[i].filename = (char*)malloc(ASYNCH_MAX_PATH_LENGTH * sizeof(char));
             valsread = sscanf(line_buffer, "%*i %s", forcings[i].filename);
             if (ReadLineError(valsread, 1, "forcing data filename"))	return NULL;
-            if (forcings[i].flag == 1 && !CheckFilenameExtension(forcings[i].filename, ".str"))	return NULL;
+            if (forcings[i].flag == 1)
+            {
+                size_t len = strlen(forcings[i].filename);
+                forcings[i].binary_storm = (len >= 5 && strcmp(&forcings[i].filename[len - 5], ".bstr") == 0);
+                if (!forcings[i].binary_storm && !CheckFilenameExtension(forcings[i].filename, ".str"))	return NULL;
+            }
             if (forcings[i].flag == 4 && !CheckFilenameExtension(forcings[i].filename, ".ustr")) return NULL;
 
             if ((forcings[i].flag == 2) || (forcings[i].flag == 5) || (forcings[i].flag == 6))
@@ -609,8 +629,18 @@ GlobalVars* Read_Global_Data(
 
     //Grab adapative data
     ReadLineFromTextFile(globalfile, line_buffer, line_buffer_len);
-    valsread = sscanf(line_buffer, "%lf %lf %lf", &errors->facmin, &errors->facmax, &errors->fac);
+    //The step size controller and its exponents are optional
+    errors->controller = 0;
+    errors->alpha = 0.7;
+    errors->beta = 0.4;
+    valsread = sscanf(line_buffer, "%lf %lf %lf %hu %lf %lf", &errors->facmin, &errors->facmax, &errors->fac, &errors->controller, &errors->alpha, &errors->beta);
     if (ReadLineError(valsread, 3, "facmin, facmax, fac"))	return NULL;
+    if (valsread == 5 && ReadLineError(valsread, 6, "step size controller alpha, beta"))	return NULL;
+    if (errors->controller > 2)
+    {
+        if (my_rank == 0)	printf("Error: Step size controller %hu is not defined. Use 0 (standard), 1 (PI) or 2 (predictive).\n", errors->controller);
+        return NULL;
+    }
 
     //Read in the flag for the error tolerances
     ReadLineFromTextFile(globalfile, line_buffer, line_buffer_len);
@@ -43,4 +43,7 @@
 
 #define ASYNCH_LINK_MAX_PARENTS 8
 
+#define ASYNCH_SCHEDULER_SCAN 0         //!< Scan the links of a process for one ready to compute
+#define ASYNCH_SCHEDULER_QUEUE 1        //!< Keep a queue of links ready to compute
+
 #endif //ASYNCH_CONSTANTS_H
\ No newline at end of file
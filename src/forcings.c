@@ -42,8 +42,19 @@ void Forcing_Free(Forcing* forcing)
             free(forcing->num_links_in_grid);
         if (forcing->received)
             free(forcing->received);
-        if (forcing->intensities)
-            free(forcing->intensities);
+        if (forcing->cell_data)
+            free(forcing->cell_data);
+        if (forcing->cell_series)
+            free(forcing->cell_series);
+        if (forcing->owned_runs)
+            free(forcing->owned_runs);
+        ForcingWindow_Free(&forcing->window);
+        if (forcing->scatter_links)
+        {
+            free(forcing->scatter_links);
+            free(forcing->scatter_counts);
+            free(forcing->scatter_displs);
+        }
         if (forcing->fileident)
             free(forcing->fileident);
     }
@@ -134,6 +145,17 @@ unsigned int PassesRecurring(Forcing* forcing, double maxtime, ConnData* conninf
 //GetNextForcing ********************************************************************************
 //Forcings (0 = none, 1 = .str, 2 = binary, 3 = database, 4 = .ustr, 5 = forcasting, 6 = .gz binary, 7 = recurring)
 
+//Starts reading the files of pass iteration of a binary forcing (flag = 2,6,8) in the background, if forcings are
+//prefetched
+static void Prefetch_Files(Forcing* forcing, unsigned int iteration, const GlobalVars * const globals)
+{
+    if (!globals->prefetch_forcings || iteration >= forcing->passes)
+        return;
+
+    int maxfileindex = (int)min((double)forcing->first_file + (iteration + 1)*forcing->increment, (double)(forcing->last_file + 1));
+    ForcingWindow_Prefetch(&forcing->window, forcing->first_file + iteration*forcing->increment, maxfileindex);
+}
+
 //For flag = 0,1,4
 double NextForcingOther(Link* sys, unsigned int N, Link **my_sys, unsigned int my_N, int* assignments, const GlobalVars * const globals, Forcing* forcing, ConnData* db_connections, const Lookup * const id_to_loc, unsigned int forcing_idx)
 {
@@ -153,6 +175,7 @@ double NextForcingBinaryFiles(Link* sys, unsigned int N, Link **my_sys, unsigned
     int maxfileindex = (int)min((double)forcing->first_file + (iteration + 1)*forcing->increment, (double)(forcing->last_file + 1));
 
     Create_Rain_Data_Par(sys, N, my_sys, my_N, globals, assignments, forcing->filename, forcing->first_file + iteration*forcing->increment, maxfileindex, iteration*forcing->file_time*forcing->increment, forcing->file_time, forcing, id_to_loc, forcing->increment + 1, forcing_idx);
+    Prefetch_Files(forcing, iteration + 1, globals);
 
     (forcing->iteration)++;
     return maxtime;
@@ -192,6 +215,7 @@ double NextForcingGZBinaryFiles(Link* sys, unsigned int N, Link **my_sys, unsign
     int maxfileindex = (int)min((double)forcing->first_file + (iteration + 1)*forcing->increment, (double)(forcing->last_file + 1));
 
     Create_Rain_Data_GZ(sys, N, my_sys, my_N, globals, assignments, forcing->filename, forcing->first_file + iteration*forcing->increment, maxfileindex, iteration*forcing->file_time*forcing->increment, forcing->file_time, forcing, id_to_loc, forcing->increment + 1, forcing_idx);
+    Prefetch_Files(forcing, iteration + 1, globals);
 
     (forcing->iteration)++;
     return maxtime;
@@ -209,11 +233,24 @@ double NextForcingGridCell(Link* sys, unsigned int N, Link **my_sys, unsigned in
     int maxfileindex = (int)min((double)forcing->first_file + (iteration + 1)*forcing->increment, (double)(forcing->last_file + 1));
 
     Create_Rain_Data_Grid(sys, N, my_sys, my_N, globals, assignments, forcing->fileident, forcing->first_file + iteration*forcing->increment, maxfileindex, iteration*forcing->file_time*forcing->increment, forcing->file_time, forcing, id_to_loc, forcing->increment + 1, forcing_idx);
+    Prefetch_Files(forcing, iteration + 1, globals);
 
     (forcing->iteration)++;
     return maxtime;
 }
 
+//Finds the unix times read by pass iteration of a database forcing (flag = 3). Returns the last time.
+static int Database_Window(const Forcing* forcing, unsigned int iteration, unsigned int* first_timestamp)
+{
+    *first_timestamp = forcing->first_file + (unsigned int)(iteration*forcing->file_time*60.0*forcing->increment + 0.01);
+
+    //If first_timestamp is off from the database increment, then read one previous timestamp
+    if ((int)(*first_timestamp - forcing->good_timestamp) % (int)(forcing->file_time * 60 + 0.01))
+        *first_timestamp -= (unsigned int)(forcing->file_time*60.0 + 0.01);
+
+    return (int)min((double)forcing->first_file + (iteration + 1) * 60 * forcing->file_time*forcing->increment, (double)forcing->last_file);
+}
+
 //For flag = 3
 double NextForcingDatabase(Link* sys, unsigned int N, Link **my_sys, unsigned int my_N, int* assignments, const GlobalVars * const globals, Forcing* forcing, ConnData* db_connections, const Lookup * const id_to_loc, unsigned int forcing_idx)
 {
@@ -229,15 +266,15 @@ double NextForcingDatabase(Link* sys, unsigned int N, Link **my_sys, unsigned in
             maxtime = globals->maxtime;	//!!!! Is this really needed? !!!!
         else
             maxtime = min(globals->maxtime, (iteration + 1)*forcing->file_time*forcing->increment);
-        int maxfileindex = (int)min((double)forcing->first_file + (iteration + 1) * 60 * forcing->file_time*forcing->increment, (double)forcing->last_file);
-
-        first_timestamp = forcing->first_file + (unsigned int)(iteration*forcing->file_time*60.0*forcing->increment + 0.01);
-
-        //If first_timestamp is off from the database increment, then read one previous timestamp
-        if ((int)(first_timestamp - forcing->good_timestamp) % (int)(forcing->file_time * 60 + 0.01))
-            first_timestamp -= (unsigned int)(forcing->file_time*60.0 + 0.01);
+        int maxfileindex = Database_Window(forcing, iteration, &first_timestamp);
 
         Create_Rain_Database(sys, N, my_sys, my_N, globals, assignments, &db_connections[ASYNCH_DB_LOC_FORCING_START + forcing_idx], first_timestamp, maxfileindex, forcing, id_to_loc, globals->maxtime, forcing_idx);
+        if (globals->prefetch_forcings && iteration + 1 < passes)
+        {
+            unsigned int next_timestamp;
+            maxfileindex = Database_Window(forcing, iteration + 1, &next_timestamp);
+            ForcingWindow_Prefetch(&forcing->window, next_timestamp, maxfileindex);
+        }
         (forcing->iteration)++;
     }
     else
@@ -5,11 +5,18 @@
 #endif
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 
+#if defined(HAVE_UNISTD_H)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #if defined(HAVE_POSTGRESQL)
 #include <libpq-fe.h>
 #endif
@@ -28,8 +35,234 @@
 #include <forcings_io.h>
 
 
+//Makes room for size bytes in the values of window. Returns NULL if the memory cannot be allocated.
+static void* ForcingWindow_Reserve(ForcingWindow* window, size_t size)
+{
+    if (size > window->capacity)
+    {
+        free(window->values);
+        window->values = malloc(size);
+        window->capacity = window->values ? size : 0;
+    }
+    return window->values;
+}
+
+static void ForcingWindow_Read(ForcingWindow* window)
+{
+    window->status = window->Read(window);
+    window->valid = (window->status == 0);
+}
+
+#if defined(HAVE_PTHREAD)
+static void* ForcingWindow_Thread(void* arg)
+{
+    ForcingWindow_Read((ForcingWindow*)arg);
+    return NULL;
+}
+#endif
+
+//Waits for the thread reading window, if any.
+static void ForcingWindow_Wait(ForcingWindow* window)
+{
+#if defined(HAVE_PTHREAD)
+    if (window->reading)
+    {
+        pthread_join(window->thread, NULL);
+        window->reading = false;
+    }
+#endif
+}
+
+void ForcingWindow_Get(ForcingWindow* window, unsigned int first, unsigned int last)
+{
+    ForcingWindow_Wait(window);
+    if (!window->valid || window->first != first || window->last != last)
+    {
+        window->first = first;
+        window->last = last;
+        ForcingWindow_Read(window);
+    }
+
+    if (window->status)
+    {
+        printf("[%i]: %s\n", my_rank, window->error);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    //The values are consumed by the caller
+    window->valid = false;
+}
+
+void ForcingWindow_Prefetch(ForcingWindow* window, unsigned int first, unsigned int last)
+{
+#if defined(HAVE_PTHREAD)
+    ForcingWindow_Wait(window);
+    window->first = first;
+    window->last = last;
+    window->valid = false;
+    if (pthread_create(&window->thread, NULL, ForcingWindow_Thread, window) == 0)
+        window->reading = true;
+#endif
+}
+
+void ForcingWindow_Free(ForcingWindow* window)
+{
+    ForcingWindow_Wait(window);
+    free(window->values);
+    window->values = NULL;
+    window->capacity = 0;
+    window->valid = false;
+}
+
+
+void Repartition_Forcing(Forcing* forcing)
+{
+    ForcingWindow_Free(&forcing->window);
+
+    free(forcing->owned_runs);
+    forcing->owned_runs = NULL;
+    forcing->num_owned_runs = 0;
+    if (forcing->scatter_links)
+    {
+        free(forcing->scatter_links);
+        free(forcing->scatter_counts);
+        free(forcing->scatter_displs);
+        forcing->scatter_links = NULL;
+        forcing->scatter_counts = NULL;
+        forcing->scatter_displs = NULL;
+    }
+}
+
+//Finds the runs of consecutive links assigned to this process. forcing->owned_runs holds pairs (first link, number
+//of links).
+static void Find_Owned_Runs(Forcing* forcing, unsigned int N, int* assignments)
+{
+    unsigned int i, num_runs = 0;
+
+    for (i = 0; i < N; i++)
+        if (assignments[i] == my_rank && (i == 0 || assignments[i - 1] != my_rank))
+            num_runs++;
+
+    forcing->owned_runs = malloc(2 * num_runs * sizeof(unsigned int));
+    forcing->num_owned_runs = 0;
+    for (i = 0; i < N; i++)
+    {
+        if (assignments[i] != my_rank)
+            continue;
+
+        if (i == 0 || assignments[i - 1] != my_rank)
+        {
+            forcing->owned_runs[2 * forcing->num_owned_runs] = i;
+            forcing->owned_runs[2 * forcing->num_owned_runs + 1] = 0;
+            forcing->num_owned_runs++;
+        }
+        forcing->owned_runs[2 * forcing->num_owned_runs - 1]++;
+    }
+}
+
+//Reads the values of the links assigned to this process from a binary file of N floats, one run at a time. The
+//values of the runs are stored one after the other in values. Returns 0 if ok, 1 if the file cannot be read.
+static int Read_Owned_Runs(const char* filename, const Forcing* forcing, uint32_t* values)
+{
+    unsigned int r;
+
+#if defined(HAVE_UNISTD_H)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    for (r = 0; r < forcing->num_owned_runs; r++)
+    {
+        char* dest = (char*)values;
+        size_t bytes = forcing->owned_runs[2 * r + 1] * sizeof(float);
+        off_t offset = (off_t)forcing->owned_runs[2 * r] * sizeof(float);
+
+        while (bytes > 0)
+        {
+            ssize_t got = pread(fd, dest, bytes, offset);
+            if (got <= 0)
+            {
+                close(fd);
+                return 1;
+            }
+            dest += got;
+            bytes -= got;
+            offset += got;
+        }
+        values += forcing->owned_runs[2 * r + 1];
+    }
+
+    close(fd);
+#else
+    FILE* stormdata = fopen(filename, "rb");
+    if (!stormdata)
+        return 1;
+
+    for (r = 0; r < forcing->num_owned_runs; r++)
+    {
+        if (fseek(stormdata, (long)forcing->owned_runs[2 * r] * sizeof(float), SEEK_SET) != 0 ||
+            fread(values, sizeof(float), forcing->owned_runs[2 * r + 1], stormdata) != forcing->owned_runs[2 * r + 1])
+        {
+            fclose(stormdata);
+            return 1;
+        }
+        values += forcing->owned_runs[2 * r + 1];
+    }
+
+    fclose(stormdata);
+#endif
+
+    return 0;
+}
+
+//Reverses the byte order of n values. The loop is simple enough to be vectorized.
+static void Swap_Bytes(uint32_t* values, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+    {
+        uint32_t holder = values[i];
+        holder = (((holder & 0x0000ffff) << 16) | ((holder & 0xffff0000) >> 16));
+        values[i] = (((holder & 0x00ff00ff) << 8) | ((holder & 0xff00ff00) >> 8));
+    }
+}
+
+//Reads the runs of links assigned to this process from each binary file of the window. The values of file k are
+//stored, byte swapped, in row k of the window.
+static int Read_Window_Par(ForcingWindow* window)
+{
+    const Forcing* forcing = window->forcing;
+    unsigned int numfiles = window->last - window->first + 1, my_N = 0, k, r;
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+
+    for (r = 0; r < forcing->num_owned_runs; r++)
+        my_N += forcing->owned_runs[2 * r + 1];
+
+    uint32_t* values = ForcingWindow_Reserve(window, (size_t)numfiles * my_N * sizeof(uint32_t));
+    if (!values)
+    {
+        sprintf(window->error, "Error: cannot allocate memory for %u forcing files.", numfiles);
+        return 1;
+    }
+
+    for (k = 0; k < numfiles; k++)
+    {
+        sprintf(filename, "%s%i", window->prefix, window->first + k);
+        if (Read_Owned_Runs(filename, forcing, &values[k * my_N]))
+        {
+            sprintf(window->error, "Error reading file %s", filename);
+            return 1;
+        }
+
+        //This assumes different endianness
+        Swap_Bytes(&values[k * my_N], my_N);
+    }
+
+    return 0;
+}
+
 //This reads in a set of binary files for the rainfall at each link.
 //Assumes the file is full of floats. Assumes no IDs are in the file and that IDs are consecutive starting from 0
+//Only the runs of links assigned to this process are read from each file.
 //Link** sys: An array of links.
 //int N: The number of links in sys.
 //int my_N: The number of links assigned to this process.
@@ -54,13 +287,10 @@ int Create_Rain_Data_Par(
     double t_0, double increment,
     Forcing* forcing, const Lookup * const id_to_loc, unsigned int max_files, unsigned int forcing_idx)
 {
-    unsigned int i, j, curr_idx;
+    unsigned int i, j, r, curr_idx;
     unsigned int k;
     Link* current;
     float forcing_buffer;
-    unsigned int holder;
-    char filename[ASYNCH_MAX_PATH_LENGTH];
-    FILE* stormdata = NULL;
     unsigned int numfiles = last - first + 1;
 
     //This is a time larger than any time in which the integrator is expected to get
@@ -68,49 +298,38 @@ int Create_Rain_Data_Par(
     if (my_sys[0]->last_t > ceil_time * 0.1)
         printf("[%i]: Warning: integrator time is extremely large (about %e). Loss of precision may occur.\n", my_rank, my_sys[0]->last_t);
 
+    //The series are kept from one call to the next, as max_files does not change
     for (i = 0; i < my_N; i++)
     {
-        my_sys[i]->my->forcing_data[forcing_idx].data = malloc((numfiles + 1) * sizeof(DataPoint));
+        if (!my_sys[i]->my->forcing_data[forcing_idx].data)
+            my_sys[i]->my->forcing_data[forcing_idx].data = malloc((max_files + 1) * sizeof(DataPoint));
         my_sys[i]->my->forcing_data[forcing_idx].num_points = numfiles + 1;
     }
 
-    //Read through the files.
-    for (k = 0; k < numfiles; k++)
+    if (!forcing->owned_runs)
     {
-        //sprintf(filename,"%s%i",strfilename,first+k);		//This is the usual one to use
-        sprintf(filename, "%s%i", strfilename, first + k);
-        //sprintf(filename,"%srain%i",strfilename,first+k);
-        //sprintf(filename,"%sfile-%i",strfilename,first+k);
-        stormdata = fopen(filename, "r");
-        if (stormdata == NULL)	printf("[%i]: Error opening file %s\n", my_rank, filename);
+        Find_Owned_Runs(forcing, N, assignments);
+        forcing->window.Read = &Read_Window_Par;
+        forcing->window.forcing = forcing;
+        forcing->window.prefix = strfilename;
+    }
 
-        for (i = 0; i < N; i++)
-        {
-            //Find the location of ID i (should be i by assumption)
-            //curr_idx = id_to_loc[i][1];
-            curr_idx = i;
+    //Read through the files, unless they were read ahead
+    ForcingWindow_Get(&forcing->window, first, last);
+    uint32_t* value = forcing->window.values;
 
-            //Read the index
-            if (assignments[curr_idx] == my_rank)	//If information about the link is needed on this process
+    for (k = 0; k < numfiles; k++)
+    {
+        //Store the data. Links are in the same order as in the runs.
+        for (r = 0; r < forcing->num_owned_runs; r++)
+        {
+            for (curr_idx = forcing->owned_runs[2 * r]; curr_idx < forcing->owned_runs[2 * r] + forcing->owned_runs[2 * r + 1]; curr_idx++)
             {
-                //Read in the storm data for this link
-                fread(&forcing_buffer, sizeof(float), 1, stormdata);
-
-                //This assumes different endianness
-                holder = *(unsigned int*)&forcing_buffer;	//Pointers are fun
-                holder = (((holder & 0x0000ffff) << 16) | ((holder & 0xffff0000) >> 16));
-                holder = (((holder & 0x00ff00ff) << 8) | ((holder & 0xff00ff00) >> 8));
-                forcing_buffer = *(float*)&holder;
-
-                //Store the data
+                memcpy(&forcing_buffer, value++, sizeof(float));
                 sys[curr_idx].my->forcing_data[forcing_idx].data[k].time = (float) (t_0 + k*increment);
                 sys[curr_idx].my->forcing_data[forcing_idx].data[k].value = forcing_buffer;
             }
-            else		//This link data is not needed on this process.
-                fread(&forcing_buffer, sizeof(float), 1, stormdata);
         }
-
-        fclose(stormdata);
     }
 
     if (my_rank == 0)
@@ -427,10 +646,94 @@ int Create_Rain_Data_Par_IBin(
     return 0;
 }
 
-#define ASYNCH_BUFFER_SIZE sizeof(unsigned int) + sizeof(float)
+//Orders the links by the process they are assigned to, for scattering the values of a file. forcing->scatter_links
+//holds the links of each process in increasing order, starting at scatter_displs[p] with scatter_counts[p] links.
+static void Find_Scatter_Order(Forcing* forcing, unsigned int N, int* assignments)
+{
+    unsigned int i;
+    int p;
+
+    forcing->scatter_links = malloc(N * sizeof(unsigned int));
+    forcing->scatter_counts = calloc(np, sizeof(int));
+    forcing->scatter_displs = malloc(np * sizeof(int));
+
+    for (i = 0; i < N; i++)
+        forcing->scatter_counts[assignments[i]]++;
+    forcing->scatter_displs[0] = 0;
+    for (p = 1; p < np; p++)
+        forcing->scatter_displs[p] = forcing->scatter_displs[p - 1] + forcing->scatter_counts[p - 1];
+
+    int* next = malloc(np * sizeof(int));
+    memcpy(next, forcing->scatter_displs, np * sizeof(int));
+    for (i = 0; i < N; i++)
+        forcing->scatter_links[next[assignments[i]]++] = i;
+    free(next);
+}
+
+//Inflates the gzip files of the window assigned to this process, files round * np + my_rank. Row round of the window
+//holds the values of the file, byte swapped and in the order of scatter_links.
+static int Read_Window_GZ(ForcingWindow* window)
+{
+    const Forcing* forcing = window->forcing;
+    unsigned int numfiles = window->last - window->first + 1, N = window->N, i, k, round;
+    unsigned int num_rounds = (numfiles + np - 1) / np;
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    size_t size;
+
+    uint32_t* values = ForcingWindow_Reserve(window, (size_t)num_rounds * N * sizeof(uint32_t));
+    uint32_t* file_values = malloc(N * sizeof(uint32_t));
+    if (!values || !file_values)
+    {
+        free(file_values);
+        sprintf(window->error, "Error: cannot allocate memory for %u forcing files.", numfiles);
+        return 1;
+    }
+
+    for (round = 0; round < num_rounds; round++)
+    {
+        k = round * np + my_rank;
+        if (k >= numfiles)
+            break;
+
+        sprintf(filename, "%s%i.gz", window->prefix, window->first + k);
+        FILE* compfile = fopen(filename, "rb");
+        if (!compfile)
+        {
+            sprintf(window->error, "Error opening file %s.", filename);
+            free(file_values);
+            return 1;
+        }
+
+        int ret = uncompress_gzfile_buffer(compfile, file_values, N * sizeof(uint32_t), &size);
+        fclose(compfile);
+        if (ret != Z_OK)
+        {
+            zerr(ret);
+            sprintf(window->error, "Error inflating file %s.", filename);
+            free(file_values);
+            return 1;
+        }
+        if (size != N * sizeof(uint32_t))
+        {
+            sprintf(window->error, "Error: file %s holds %zu values, %u expected.", filename, size / sizeof(uint32_t), N);
+            free(file_values);
+            return 1;
+        }
+
+        //This assumes the files have a different endianness from the system
+        Swap_Bytes(file_values, N);
+        for (i = 0; i < N; i++)
+            values[round * N + i] = file_values[forcing->scatter_links[i]];
+    }
+
+    free(file_values);
+    return 0;
+}
 
 /// This reads in a set of gzip compressed binary files for the rainfall at each link.
 /// Assumes the file is full of floats. Assumes no IDs are in the file and that IDs are consecutive starting from 0
+/// The files are inflated in memory, each by one process in turn, and the values of each file are scattered to the
+/// processes in one collective.
 ///
 /// \param sys An array of links.
 /// \param N   The number of links in sys.
@@ -456,111 +759,60 @@ int Create_Rain_Data_GZ(
     unsigned int forcing_idx)
 {
     unsigned int i, j, curr_idx;
-    unsigned int k;
+    unsigned int k, round;
     Link* current;
     float rainfall_buffer;
-    unsigned int holder;
-    char filename[128];
-    FILE* stormdata = NULL;
     unsigned int numfiles = last - first + 1;
-    FILE* compfile = NULL;
-    char transferbuffer[ASYNCH_BUFFER_SIZE];
 
     //This is a time larger than any time in which the integrator is expected to get
     double ceil_time = 1e300;
     if (my_sys[0]->last_t > ceil_time*0.1)
         printf("[%i]: Warning: integrator time is extremely large (about %e). Loss of precision may occur.\n", my_rank, my_sys[0]->last_t);
 
-    //Check that space for rain data has been allocated.
+    //The series are kept from one call to the next, as max_files does not change
     for (i = 0; i < my_N; i++)
     {
-        my_sys[i]->my->forcing_data[forcing_idx].data = malloc((numfiles + 1) * sizeof(DataPoint));
+        if (!my_sys[i]->my->forcing_data[forcing_idx].data)
+            my_sys[i]->my->forcing_data[forcing_idx].data = malloc((max_files + 1) * sizeof(DataPoint));
         my_sys[i]->my->forcing_data[forcing_idx].num_points = numfiles + 1;
     }
 
-    //Read through the files.
-    MPI_Barrier(MPI_COMM_WORLD);
-    for (k = 0; k < numfiles; k++)
+    if (!forcing->scatter_links)
     {
-        if (my_rank == 0)
-        {
-            //For compressed file
-            sprintf(filename, "%s%i.gz", strfilename, first + k);
-            compfile = fopen(filename, "r");
-            if (!compfile)
-            {
-                printf("[%i]: Error opening file %s.\n", my_rank, filename);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-            }
-
-            sprintf(filename, "%s%i_%i", strfilename, first + k, my_rank);
-            stormdata = fopen(filename, "w");
-            if (!stormdata)	printf("[%i]: Error opening file %s.\n", my_rank, filename);
-
-            int ret = uncompress_gzfile(compfile, stormdata);
-            if (ret != Z_OK)		zerr(ret);
-            fclose(compfile);
-            fclose(stormdata);
-
-            sprintf(filename, "%s%i_%i", strfilename, first + k, my_rank);
-            stormdata = fopen(filename, "r");
-            if (!stormdata)	printf("[%i]: Error opening file %s.\n", my_rank, filename);
-
-            for (i = 0; i < N; i++)
-            {
-                //Find the location of ID i (should be i by assumption)
-                //curr_idx = id_to_loc[i][1];
-                curr_idx = i;
+        Find_Scatter_Order(forcing, N, assignments);
+        forcing->window.Read = &Read_Window_GZ;
+        forcing->window.forcing = forcing;
+        forcing->window.prefix = strfilename;
+        forcing->window.N = N;
+    }
 
-                fread(&rainfall_buffer, sizeof(float), 1, stormdata);
+    //Inflate the files, unless they were read ahead
+    ForcingWindow_Get(&forcing->window, first, last);
+    uint32_t* values = forcing->window.values;
+    uint32_t* my_values = malloc(my_N * sizeof(uint32_t));
+    unsigned int* my_links = &forcing->scatter_links[forcing->scatter_displs[my_rank]];
 
-                if (assignments[curr_idx] == my_rank)	//Data needed on proc 0; don't send
-                {
-                    //This assumes the files have a different endianness from the system
-                    holder = *(unsigned int*)&rainfall_buffer;	//Pointers are fun!
-                    holder = (((holder & 0x0000ffff) << 16) | ((holder & 0xffff0000) >> 16));
-                    holder = (((holder & 0x00ff00ff) << 8) | ((holder & 0xff00ff00) >> 8));
-                    rainfall_buffer = *(float*)&holder;
-
-                    //Store the data
-                    sys[curr_idx].my->forcing_data[forcing_idx].data[k].time = t_0 + k*increment;
-                    sys[curr_idx].my->forcing_data[forcing_idx].data[k].value = rainfall_buffer;
-                }
-                else	//Send it to the correct proc
-                {
-                    int pos = 0;
-                    MPI_Pack(&curr_idx, 1, MPI_INT, transferbuffer, ASYNCH_BUFFER_SIZE, &pos, MPI_COMM_WORLD);
-                    MPI_Pack(&rainfall_buffer, 1, MPI_FLOAT, transferbuffer, ASYNCH_BUFFER_SIZE, &pos, MPI_COMM_WORLD);
-                    MPI_Send(transferbuffer, ASYNCH_BUFFER_SIZE, MPI_PACKED, assignments[curr_idx], N, MPI_COMM_WORLD);		//N = tag, as typical communication should not send this many links.
-                }
-            }
-
-            fclose(stormdata);
-            remove(filename);
-        }
-        else
+    //Each file is scattered from the process that inflated it
+    for (round = 0; round * np < numfiles; round++)
+    {
+        for (int root = 0; root < np && round * np + root < numfiles; root++)
         {
-            //MPI_Status status;
+            k = round * np + root;
+            MPI_Scatterv((root == my_rank) ? &values[round * N] : NULL, forcing->scatter_counts, forcing->scatter_displs, MPI_FLOAT, my_values, my_N, MPI_FLOAT, root, MPI_COMM_WORLD);
+
+            //Store the data
             for (i = 0; i < my_N; i++)
             {
-                int pos = 0;
-                MPI_Recv(transferbuffer, ASYNCH_BUFFER_SIZE, MPI_PACKED, 0, N, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Unpack(transferbuffer, ASYNCH_BUFFER_SIZE, &pos, &curr_idx, 1, MPI_INT, MPI_COMM_WORLD);
-                MPI_Unpack(transferbuffer, ASYNCH_BUFFER_SIZE, &pos, &rainfall_buffer, 1, MPI_FLOAT, MPI_COMM_WORLD);
-
-                //This assumes the files have a different endianness from the system
-                holder = *(unsigned int*)&rainfall_buffer;	//Pointers are fun!
-                holder = (((holder & 0x0000ffff) << 16) | ((holder & 0xffff0000) >> 16));
-                holder = (((holder & 0x00ff00ff) << 8) | ((holder & 0xff00ff00) >> 8));
-                rainfall_buffer = *(float*)&holder;
-
-                //Store the data
+                curr_idx = my_links[i];
+                memcpy(&rainfall_buffer, &my_values[i], sizeof(float));
                 sys[curr_idx].my->forcing_data[forcing_idx].data[k].time = t_0 + k*increment;
                 sys[curr_idx].my->forcing_data[forcing_idx].data[k].value = rainfall_buffer;
             }
         }
     }
 
+    free(my_values);
+
     if (my_rank == 0)
         printf("Read %i binary files.\n", numfiles);
 
@@ -608,6 +860,111 @@ int Create_Rain_Data_GZ(
 }
 
 
+//Reads the grid cell files of the window on process 0. Row k of the window holds the intensity of each cell in file k.
+//The other processes only make room for the rows.
+static int Read_Window_Grid(ForcingWindow* window)
+{
+    Forcing* forcing = window->forcing;
+    unsigned int numfiles = window->last - window->first + 1, i, k, holder, endianness, cell;
+    short unsigned int intensity;
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    FILE* stormdata = NULL;
+    size_t result;
+
+    float* values = ForcingWindow_Reserve(window, (size_t)numfiles * forcing->num_cells * sizeof(float));
+    if (!values)
+    {
+        sprintf(window->error, "Error: cannot allocate memory for %u forcing files.", numfiles);
+        return 1;
+    }
+    if (my_rank != 0)
+        return 0;
+
+    for (k = 0; k < numfiles; k++)
+    {
+        float* intensities = &values[k * forcing->num_cells];
+
+        sprintf(filename, "%s%i", window->prefix, window->first + k);
+        stormdata = fopen(filename, "r");
+        if (stormdata)
+        {
+            for (i = 0; i < forcing->num_cells; i++)
+                forcing->received[i] = 0;
+
+            //Check endianness
+            fread(&i, sizeof(unsigned int), 1, stormdata);
+            if (i == 0x1)			endianness = 0;
+            else if (i == 0x80000000)	endianness = 1;
+            else
+            {
+                sprintf(window->error, "Error: Cannot read endianness flag in binary file %s.", filename);
+                fclose(stormdata);
+                return 1;
+            }
+
+            //Read file
+            if (endianness)
+            {
+                while (!feof(stormdata))
+                {
+                    //Read intensity
+                    result = fread(&cell, sizeof(unsigned int), 1, stormdata);
+                    if (!result)	break;
+                    fread(&intensity, sizeof(short unsigned int), 1, stormdata);
+
+                    //Swap byte order
+                    holder = (((cell & 0x0000ffff) << 16) | ((cell & 0xffff0000) >> 16));
+                    cell = (((holder & 0x00ff00ff) << 8) | ((holder & 0xff00ff00) >> 8));
+                    intensity = (((intensity & 0x00ff00ff) << 8) | ((intensity & 0xff00ff00) >> 8));
+
+                    if (cell < forcing->num_cells)
+                    {
+                        if (forcing->received[cell])
+                            printf("Warning: Received multiple intensities for cell %u in file %s.\n", cell, filename);
+                        forcing->received[cell] = 1;
+                        intensities[cell] = (float)(intensity * forcing->factor);
+                    }
+                    else
+                        printf("Warning: bad grid cell id in file %s.\n", filename);
+                }
+            }
+            else
+            {
+                while (!feof(stormdata))
+                {
+                    //Read intensity
+                    result = fread(&cell, sizeof(unsigned int), 1, stormdata);
+                    if (!result)	break;
+                    fread(&intensity, sizeof(short unsigned int), 1, stormdata);
+
+                    if (cell < forcing->num_cells)
+                    {
+                        if (forcing->received[cell])
+                            printf("Warning: Received multiple intensities for cell %u in file %s.\n", cell, filename);
+                        forcing->received[cell] = 1;
+                        intensities[cell] = (float)(intensity * forcing->factor);
+                    }
+                    else
+                        printf("Warning: bad grid cell id in file %s.\n", filename);
+                }
+            }
+
+            fclose(stormdata);
+
+            //Store 0's for remaining cells
+            for (i = 0; i < forcing->num_cells; i++)
+                if (!forcing->received[i])	intensities[i] = 0.0;
+        }
+        else	//No file, no rain
+        {
+            for (i = 0; i < forcing->num_cells; i++)
+                intensities[i] = 0.0;
+        }
+    }
+
+    return 0;
+}
+
 //This reads in a set of binary files for the rainfall at each link.
 //The data is given as intensities per grid cell.
 //Link** sys: An array of links.
@@ -624,176 +981,182 @@ int Create_Rain_Data_GZ(
 //int** id_to_loc (set by this method): Will be an array with N rows and 2 columns, sorted by first col. First col is a link id and second is
 //				the location of the id in sys.
 //unsigned int max_files: The maximum number of files to be read.
+//The links of a cell share the series of the cell in forcing->cell_data. Links in no cell share a series with no rain.
 
 int Create_Rain_Data_Grid(
     Link *sys, unsigned int N,
     Link **my_sys, unsigned int my_N,
     const GlobalVars * const globals, int* assignments, char strfilename[], unsigned int first, unsigned int last, double t_0, double increment, Forcing* forcing, const Lookup * const id_to_loc, unsigned int max_files, unsigned int forcing_idx)
 {
-    unsigned int i, j, curr_idx, k, holder, endianness, cell;
-    short unsigned int intensity;
+    unsigned int i, j, curr_idx, k, cell, s;
     Link* current;
-    char filename[128];
     float forcing_buffer;
-    FILE* stormdata = NULL;
     unsigned int numfiles = last - first + 1;
-    size_t result;
+    DataPoint* series;
 
     //This is a time larger than any time in which the integrator is expected to get
     double ceil_time = 1e300;
     if (my_sys[0]->last_t > ceil_time*0.1)
         printf("[%i]: Warning: integrator time is extremely large (about %e). Loss of precision may occur.\n", my_rank, my_sys[0]->last_t);
 
-    //Check that space for rain data has been allocated.
-    for (i = 0; i < my_N; i++)
+    //Allocate one series per cell with links on this process, and point the links to it
+    if (!forcing->cell_data)
     {
-        my_sys[i]->my->forcing_data[forcing_idx].data = malloc((numfiles + 1) * sizeof(DataPoint));
-        my_sys[i]->my->forcing_data[forcing_idx].num_points = numfiles + 1;
-    }
-
-    //Read through the files.
-    for (k = 0; k < numfiles; k++)
-    {
-        if (my_rank == 0)
-        {
-            sprintf(filename, "%s%i", strfilename, first + k);
-            stormdata = fopen(filename, "r");
-            if (stormdata)
-            {
-                for (i = 0; i < forcing->num_cells; i++)
-                    forcing->received[i] = 0;
-
-                //Check endianness
-                fread(&i, sizeof(unsigned int), 1, stormdata);
-                if (i == 0x1)			endianness = 0;
-                else if (i == 0x80000000)	endianness = 1;
-                else
-                {
-                    printf("Error: Cannot read endianness flag in binary file %s.\n", filename);
-                    MPI_Abort(MPI_COMM_WORLD, 1);
-                }
+        forcing->cell_series = malloc(forcing->num_cells * sizeof(unsigned int));
+        forcing->num_series = 0;
+        for (cell = 0; cell < forcing->num_cells; cell++)
+            forcing->cell_series[cell] = forcing->num_links_in_grid[cell] ? forcing->num_series++ : (unsigned int)-1;
 
-                //Read file
-                if (endianness)
-                {
-                    while (!feof(stormdata))
-                    {
-                        //Read intensity
-                        result = fread(&cell, sizeof(unsigned int), 1, stormdata);
-                        if (!result)	break;
-                        fread(&intensity, sizeof(short unsigned int), 1, stormdata);
-
-                        //Swap byte order
-                        holder = (((cell & 0x0000ffff) << 16) | ((cell & 0xffff0000) >> 16));
-                        cell = (((holder & 0x00ff00ff) << 8) | ((holder & 0xff00ff00) >> 8));
-                        intensity = (((intensity & 0x00ff00ff) << 8) | ((intensity & 0xff00ff00) >> 8));
-
-                        if (cell < forcing->num_cells)
-                        {
-                            if (forcing->received[cell])
-                                printf("Warning: Received multiple intensities for cell %u in file %s.\n", cell, filename);
-                            forcing->received[cell] = 1;
-                            forcing->intensities[cell] = (float)(intensity * forcing->factor);
-                        }
-                        else
-                            printf("Warning: bad grid cell id in file %s.\n", filename);
-                    }
-                }
-                else
-                {
-                    while (!feof(stormdata))
-                    {
-                        //Read intensity
-                        result = fread(&cell, sizeof(unsigned int), 1, stormdata);
-                        if (!result)	break;
-                        fread(&intensity, sizeof(short unsigned int), 1, stormdata);
-
-                        if (cell < forcing->num_cells)
-                        {
-                            if (forcing->received[cell])
-                                printf("Warning: Received multiple intensities for cell %u in file %s.\n", cell, filename);
-                            forcing->received[cell] = 1;
-                            forcing->intensities[cell] = (float)(intensity * forcing->factor);
-                        }
-                        else
-                            printf("Warning: bad grid cell id in file %s.\n", filename);
-                    }
-                }
+        forcing->window.Read = &Read_Window_Grid;
+        forcing->window.forcing = forcing;
+        forcing->window.prefix = strfilename;
 
-                fclose(stormdata);
+        forcing->series_length = max_files + 1;
+        forcing->cell_data = malloc((forcing->num_series + 1) * forcing->series_length * sizeof(DataPoint));
 
-                //Store 0's for remaining cells
-                for (i = 0; i < forcing->num_cells; i++)
-                    if (!forcing->received[i])	forcing->intensities[i] = 0.0;
-            }
-            else	//No file, no rain
+        for (i = 0; i < my_N; i++)
+            my_sys[i]->my->forcing_data[forcing_idx].data = &forcing->cell_data[forcing->num_series * forcing->series_length];
+        for (cell = 0; cell < forcing->num_cells; cell++)
+        {
+            for (i = 0; i < forcing->num_links_in_grid[cell]; i++)
             {
-                for (i = 0; i < forcing->num_cells; i++)
-                    forcing->intensities[i] = 0.0;
+                curr_idx = forcing->grid_to_linkid[cell][i];
+                assert(assignments[curr_idx] == my_rank);
+                sys[curr_idx].my->forcing_data[forcing_idx].data = &forcing->cell_data[forcing->cell_series[cell] * forcing->series_length];
             }
         }
+    }
+    assert(forcing->series_length == max_files + 1);
 
-        MPI_Bcast(forcing->intensities, forcing->num_cells, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    for (i = 0; i < my_N; i++)
+        my_sys[i]->my->forcing_data[forcing_idx].num_points = numfiles + 1;
+
+    //Read through the files, unless they were read ahead, and send the intensities to every process
+    ForcingWindow_Get(&forcing->window, first, last);
+    float* values = forcing->window.values;
+    MPI_Bcast(values, numfiles * forcing->num_cells, MPI_FLOAT, 0, MPI_COMM_WORLD);
+
+    for (k = 0; k < numfiles; k++)
+    {
+        float* intensities = &values[k * forcing->num_cells];
 
         //Load the data
         for (cell = 0; cell < forcing->num_cells; cell++)
         {
-            for (i = 0; i < forcing->num_links_in_grid[cell]; i++)	//!!!! Assuming only links on this proc !!!!
-            {
-                curr_idx = forcing->grid_to_linkid[cell][i];
-                assert(assignments[curr_idx] == my_rank);
-                
-                sys[curr_idx].my->forcing_data[forcing_idx].data[k].time = t_0 + k*increment;
-                sys[curr_idx].my->forcing_data[forcing_idx].data[k].value = forcing->intensities[cell];
-            }
+            if (forcing->cell_series[cell] == (unsigned int)-1)
+                continue;
+
+            series = &forcing->cell_data[forcing->cell_series[cell] * forcing->series_length];
+            series[k].time = t_0 + k*increment;
+            series[k].value = intensities[cell];
         }
+        series = &forcing->cell_data[forcing->num_series * forcing->series_length];
+        series[k].time = t_0 + k*increment;
+        series[k].value = 0.0;
     }
 
-    //Add in terms for no rainfall if max_files > numfiles
-    for (i = 0; i < my_N; i++)
+    for (s = 0; s <= forcing->num_series; s++)
     {
-        curr_idx = my_sys[i]->location;
+        series = &forcing->cell_data[s * forcing->series_length];
+
+        //Add in terms for no rainfall if max_files > numfiles
         for (j = numfiles; j < max_files; j++)
         {
-            sys[curr_idx].my->forcing_data[forcing_idx].data[j].time = sys[curr_idx].my->forcing_data[forcing_idx].data[j - 1].time + .0001;
-            sys[curr_idx].my->forcing_data[forcing_idx].data[j].value = 0.0;
+            series[j].time = series[j - 1].time + .0001;
+            series[j].value = 0.0;
         }
+
+        //Add a ceiling term
+        series[max_files].time = ceil_time;
+        series[max_files].value = -1.0;
     }
 
-    //Add a ceiling term
-    for (i = 0; i < my_N; i++)
+    //Calculate the first rain change time of each series
+    double* change_times = malloc((forcing->num_series + 1) * sizeof(double));
+    for (s = 0; s <= forcing->num_series; s++)
     {
-        curr_idx = my_sys[i]->location;
-        //sys[curr_idx].my->forcing_data[forcing_idx]->rainfall[max_files].time = GlobalVars->maxtime + 1.0;
-        sys[curr_idx].my->forcing_data[forcing_idx].data[max_files].time = ceil_time;
-        sys[curr_idx].my->forcing_data[forcing_idx].data[max_files].value = -1.0;
+        series = &forcing->cell_data[s * forcing->series_length];
+        forcing_buffer = series[0].value;
+
+        for (j = 1; j < numfiles + 1; j++)
+        {
+            if (fabs(forcing_buffer - series[j].value) > 1e-14)
+                break;
+        }
+        change_times[s] = (j < numfiles + 1) ? series[j].time : series[j - 1].time;
     }
 
-    //Calculate the first rain change time and set rain_value
+    //Set rain_value and the first rain change time
     for (i = 0; i < my_N; i++)
     {
         current = my_sys[i];
-        forcing_buffer = current->my->forcing_data[forcing_idx].data[0].value;
-        current->my->forcing_values[forcing_idx] = forcing_buffer;
+        series = current->my->forcing_data[forcing_idx].data;
+        s = (unsigned int)((series - forcing->cell_data) / forcing->series_length);
+        current->my->forcing_values[forcing_idx] = series[0].value;
         current->my->forcing_indices[forcing_idx] = 0;
+        current->my->forcing_change_times[forcing_idx] = change_times[s];
+    }
 
-        for (j = 1; j < current->my->forcing_data[forcing_idx].num_points; j++)
-        {
-            if (fabs(forcing_buffer - current->my->forcing_data[forcing_idx].data[j].value) > 1e-14)
-            {
-                current->my->forcing_change_times[forcing_idx] = current->my->forcing_data[forcing_idx].data[j].time;
-                break;
-            }
-        }
-        if (j == current->my->forcing_data[forcing_idx].num_points)
-        {
-            current->my->forcing_change_times[forcing_idx] = current->my->forcing_data[forcing_idx].data[j - 1].time;
-        }
+    free(change_times);
+
+    return 0;
+}
+
+#if defined(HAVE_POSTGRESQL)
+
+//Queries the rainfall of the window from the database on process 0. The window holds the unix times, then the
+//intensities, then the link ids of the rows.
+static int Read_Window_Database(ForcingWindow* window)
+{
+    ConnData* conninfo = window->conninfo;
+    unsigned int i, tuple_count;
+    PGresult *res;
+
+    window->count = 0;
+    if (my_rank != 0)
+        return 0;
+
+    //Connect to the database
+    ConnectPGDB(conninfo);
+
+    if (window->outletlink == 0)
+        sprintf(conninfo->query, conninfo->queries[0], window->first, window->last);
+    else
+        sprintf(conninfo->query, conninfo->queries[1], window->outletlink, window->first, window->last);
+    res = PQexec(conninfo->conn, conninfo->query);
+    CheckResError(res, "downloading rainfall data");
+    tuple_count = PQntuples(res);
+
+    //Disconnect
+    DisconnectPGDB(conninfo);
+
+    unsigned int* db_unix_time = ForcingWindow_Reserve(window, (size_t)tuple_count * 3 * sizeof(unsigned int));
+    if (tuple_count && !db_unix_time)
+    {
+        PQclear(res);
+        sprintf(window->error, "Error: cannot allocate memory for %u rainfall rows.", tuple_count);
+        return 1;
+    }
+    float* db_rain_intens = (float*)&db_unix_time[tuple_count];
+    unsigned int* db_link_id = &db_unix_time[2 * tuple_count];
+
+    //Load up the buffers
+    for (i = 0; i < tuple_count; i++)
+    {
+        db_unix_time[i] = atoi(PQgetvalue(res, i, 0));
+        db_rain_intens[i] = (float) atof(PQgetvalue(res, i, 1));
+        db_link_id[i] = atoi(PQgetvalue(res, i, 2));
     }
+    window->count = tuple_count;
+
+    //Clean up
+    PQclear(res);
 
     return 0;
 }
 
+#endif //HAVE_POSTGRESQL
+
 //This reads in rainfall data at each link from an SQL database.
 //Link** sys: An array of links.
 //int N: The number of links in sys.
@@ -819,8 +1182,6 @@ int Create_Rain_Database(
     Link* current;
     float forcing_buffer;
     int received_time;
-    char* query = conninfo->query;
-    PGresult *res;
     unsigned int *db_unix_time = NULL, *db_link_id = NULL;
     float *db_rain_intens = NULL;
 
@@ -848,68 +1209,38 @@ int Create_Rain_Database(
 
     //GlobalVars->outletlink = 318213;
 
-        //Query the database
-    if (my_rank == 0)
+    //Query the database, unless the rows were read ahead
+    if (!forcing->window.Read)
     {
-        //Connect to the database
-        ConnectPGDB(conninfo);
-
-        if (globals->outletlink == 0)
-            sprintf(query, conninfo->queries[0], first, last);
-        else
-            sprintf(query, conninfo->queries[1], globals->outletlink, first, last);
-        //printf("*************************\n");
-        //printf("First = %u Last = %u t = %e increment = %u\n",first,last,my_sys[0]->last_t,forcing->increment);
-        //printf("*************************\n");
-        //printf("Gmax = %e maxtime = %e\n",GlobalVars->maxtime,maxtime);
-        //printf("query: %s\n",query);
-        //printf("*************************\n");
-        res = PQexec(conninfo->conn, query);
-        CheckResError(res, "downloading rainfall data");
-        tuple_count = PQntuples(res);
-        //printf("Received %u intensities.\n", tuple_count);
-        
-        //Disconnect
-        DisconnectPGDB(conninfo);
+        forcing->window.Read = &Read_Window_Database;
+        forcing->window.forcing = forcing;
+        forcing->window.conninfo = conninfo;
+        forcing->window.outletlink = globals->outletlink;
+    }
+    ForcingWindow_Get(&forcing->window, first, last);
+    tuple_count = forcing->window.count;
 
+    MPI_Bcast(&tuple_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        db_unix_time = forcing->window.values;
+        db_rain_intens = (float*)&db_unix_time[tuple_count];
+        db_link_id = &db_unix_time[2 * tuple_count];
+    }
+    else if (tuple_count)
+    {
         //Allocate space
-        MPI_Bcast(&tuple_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
         db_unix_time = malloc(tuple_count * sizeof(unsigned int));
         db_rain_intens = malloc(tuple_count * sizeof(float));
         db_link_id = malloc(tuple_count * sizeof(unsigned int));
+    }
 
-        //Load up the buffers
-        for (i = 0; i < tuple_count; i++)
-        {
-            db_unix_time[i] = atoi(PQgetvalue(res, i, 0));
-            db_rain_intens[i] = (float) atof(PQgetvalue(res, i, 1));
-            db_link_id[i] = atoi(PQgetvalue(res, i, 2));
-        }
-
-        //Broadcast the data
+    //Broadcast the data
+    if (tuple_count)
+    {
         MPI_Bcast(db_unix_time, tuple_count, MPI_INT, 0, MPI_COMM_WORLD);
         MPI_Bcast(db_rain_intens, tuple_count, MPI_FLOAT, 0, MPI_COMM_WORLD);
         MPI_Bcast(db_link_id, tuple_count, MPI_INT, 0, MPI_COMM_WORLD);
-
-        //Clean up
-        PQclear(res);
-    }
-    else
-    {
-        //Allocate space
-        MPI_Bcast(&tuple_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-        if (tuple_count)
-        {
-            db_unix_time = malloc(tuple_count * sizeof(unsigned int));
-            db_rain_intens = malloc(tuple_count * sizeof(float));
-            db_link_id = malloc(tuple_count * sizeof(unsigned int));
-
-            //Receive the data
-            MPI_Bcast(db_unix_time, tuple_count, MPI_INT, 0, MPI_COMM_WORLD);
-            MPI_Bcast(db_rain_intens, tuple_count, MPI_FLOAT, 0, MPI_COMM_WORLD);
-            MPI_Bcast(db_link_id, tuple_count, MPI_INT, 0, MPI_COMM_WORLD);
-        }
     }
 
     MPI_Barrier(MPI_COMM_WORLD);
@@ -1039,11 +1370,14 @@ int Create_Rain_Database(
             current->my->forcing_change_times[forcing_idx] = current->my->forcing_data[forcing_idx].data[j - 1].time;
     }
 
-    //Clean up
+    //Clean up. On process 0 the rows belong to the window.
     free(total_times);
-    free(db_unix_time);
-    free(db_link_id);
-    free(db_rain_intens);
+    if (my_rank != 0)
+    {
+        free(db_unix_time);
+        free(db_link_id);
+        free(db_rain_intens);
+    }
 
 #else //HAVE_POSTGRESQL
 
@@ -9,6 +9,20 @@
 
 #include "structs.h"
 
+//Reads the window of forcing data first to last, unless a thread read it ahead, in which case it waits for the thread.
+//Aborts if the data cannot be read.
+void ForcingWindow_Get(ForcingWindow* window, unsigned int first, unsigned int last);
+
+//Starts reading the window of forcing data first to last in a background thread. Does nothing without pthreads.
+void ForcingWindow_Prefetch(ForcingWindow* window, unsigned int first, unsigned int last);
+
+//Waits for the thread reading the window, if any, and frees its data.
+void ForcingWindow_Free(ForcingWindow* window);
+
+//Drops the window of forcing and the layout of its files, which depend on the links assigned to this process, after
+//the links were moved between processes. They are set again by the next read.
+void Repartition_Forcing(Forcing* forcing);
+
 
 int Create_Rain_Data_Par(
     Link *sys, unsigned int N,
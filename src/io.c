@@ -139,6 +139,11 @@ unsigned int WriteStep(Output *output, unsigned int num_outputs, FILE* outputfil
 
     long int total_written = 0;
 
+#if defined(HAVE_PTHREAD)
+    //Links may be solved by several threads
+    flockfile(outputfile);
+#endif
+
     //Set file to current position
     //fsetpos(outputfile,pos);
     if (pos_offset)
@@ -177,6 +182,10 @@ unsigned int WriteStep(Output *output, unsigned int num_outputs, FILE* outputfil
 
     if (pos_offset)
         *pos_offset += total_written;
+
+#if defined(HAVE_PTHREAD)
+    funlockfile(outputfile);
+#endif
     
     return total_written;
 }
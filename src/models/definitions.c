@@ -1549,6 +1549,10 @@ void InitRoutines(
 	 */
 	else
 		printf("Warning: No ODE selected for link ID %u.\n", link->ID);
+
+    //Use the version of the explicit solver built for this RK method and number of states, if there is one
+    if (link->solver == &ExplicitRKSolver)
+        link->solver = Select_ExplicitRKSolver(link);
 }
 
 //Perform precalculations needed for the differential equation.  These should be stored in params after the DEM
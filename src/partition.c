@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <math.h>
 
 #include <mpi.h>
 
@@ -410,6 +411,407 @@ int* Partition_System_By_Leaves_2(Link *sys, unsigned int N, Link **leaves, unsi
 }
 
 
+//Estimates the work of a step at a link, relative to a link without parents. Every stage evaluates the equations of
+//the link and interpolates the dense output of each parent, which costs about a quarter of an evaluation for the
+//built in models. Once the model has set the number of states of the link, the estimate scales with it.
+double Estimate_Step_Work(const Link* link)
+{
+    double work = 1.0 + 0.25 * link->num_parents;
+
+    if (link->dim > 0)
+        work *= link->dim;
+
+    return work;
+}
+
+//Estimates the work of a link. If it was measured in a previous run (see Load_Link_Costs), that is used instead.
+static double Estimate_Link_Work(const Link* link)
+{
+    if (link->work > 0.0)
+        return link->work;
+
+    return Estimate_Step_Work(link);
+}
+
+//Assigns the links of a river system to np pieces of about the same work. The links are put in an order where every
+//subtree is contiguous and comes right before the link downstream of it (the parent with the most upstream work is
+//visited first). The order is cut into np pieces, each cut placed within 5% of the ideal work where the fewest links
+//have their child on the other side. Along any path downstream the process numbers never decrease, so a main stem
+//passes through each process at most once and no process waits for data from a process it sends to.
+//double* work: work[i] is the work of the link in location i of the system.
+//int* assignments (set by this method, N entries): the process each link is assigned to.
+void Assign_Subtrees(Link *sys, unsigned int N, const double* work, int* assignments)
+{
+    unsigned int i, j, p, stack_size = 0;
+    int k;
+    Link *current, *child;
+
+    double* upstream_work = (double*)malloc(N * sizeof(double));
+    unsigned int* pending = (unsigned int*)malloc(N * sizeof(unsigned int));
+    Link** stack = (Link**)malloc(N * sizeof(Link*));
+    Link** order = (Link**)malloc(N * sizeof(Link*));
+
+    //Sum the work upstream of each link, starting from the leaves
+    for (i = 0; i < N; i++)
+    {
+        upstream_work[i] = work[i];
+        pending[i] = sys[i].num_parents;
+        if (pending[i] == 0)
+            stack[stack_size++] = &sys[i];
+    }
+    while (stack_size > 0)
+    {
+        current = stack[--stack_size];
+        child = current->child;
+        if (child != NULL)
+        {
+            upstream_work[child->location] += upstream_work[current->location];
+            if (--pending[child->location] == 0)
+                stack[stack_size++] = child;
+        }
+    }
+
+    //Order the links. The links are popped outlet first, each followed by its parents from the lightest subtree
+    //to the heaviest, and order is filled from the end, so the heaviest subtree of a link comes first.
+    p = N;
+    for (i = 0; i < N; i++)
+    {
+        if (sys[i].child != NULL)
+            continue;
+
+        stack[0] = &sys[i];
+        stack_size = 1;
+        while (stack_size > 0)
+        {
+            current = stack[--stack_size];
+            order[--p] = current;
+
+            //Push the parents from the heaviest to the lightest
+            for (j = 0; j < current->num_parents; j++)
+            {
+                Link* parent = current->parents[j];
+                unsigned int l = stack_size++;
+                while (l > stack_size - 1 - j && upstream_work[stack[l - 1]->location] < upstream_work[parent->location])
+                {
+                    stack[l] = stack[l - 1];
+                    l--;
+                }
+                stack[l] = parent;
+            }
+        }
+    }
+
+    //Place the cuts. The number of edges cut in front of position p changes by one for the child of the link at p,
+    //minus its parents.
+    double total_work = 0.0;
+    for (i = 0; i < N; i++)
+        total_work += work[i];
+    double target = total_work / np, tolerance = 0.05 * target;
+    double before = 0.0;                //Work of the links in front of position p
+    unsigned int edges_cut = 0;         //Edges cut in front of position p
+    unsigned int start = 0;             //Position of the first link of process k
+
+    p = 0;
+    for (k = 0; k < np - 1; k++)
+    {
+        double ideal = (k + 1) * target;
+
+        //Move to the first cut with at least ideal - tolerance work in front of it
+        while (p < N && before < ideal - tolerance)
+        {
+            before += work[order[p]->location];
+            edges_cut += (order[p]->child != NULL) - order[p]->num_parents;
+            p++;
+        }
+
+        //Look further for a cut with fewer edges, then closer to the ideal work, without going past the tolerance
+        unsigned int best = p, best_cut = edges_cut;
+        double best_distance = fabs(before - ideal);
+        double scan_before = before;
+        unsigned int scan_cut = edges_cut;
+        for (j = p; j < N; j++)
+        {
+            scan_before += work[order[j]->location];
+            scan_cut += (order[j]->child != NULL) - order[j]->num_parents;
+            if (scan_before > ideal + tolerance)
+                break;
+
+            double distance = fabs(scan_before - ideal);
+            if (scan_cut < best_cut || (scan_cut == best_cut && distance < best_distance))
+            {
+                best = j + 1;
+                best_cut = scan_cut;
+                best_distance = distance;
+            }
+        }
+
+        //Give the links in front of the cut to process k
+        for (; start < best; start++)
+            assignments[order[start]->location] = k;
+        for (; p < best; p++)
+        {
+            before += work[order[p]->location];
+            edges_cut += (order[p]->child != NULL) - order[p]->num_parents;
+        }
+    }
+    for (; start < N; start++)
+        assignments[order[start]->location] = np - 1;
+
+    //Clean up
+    free(upstream_work);
+    free(pending);
+    free(stack);
+    free(order);
+}
+
+//Sets the links of this process and the links it exchanges with the other processes, from the process each link is
+//assigned to. my_sys is sorted by distance, and both processes of an exchange list the links in the order of the
+//system. The sizes in my_data must be 0, and its lists are allocated here.
+//The arguments are as in Partition_System_By_Leaves.
+void Distribute_System(Link *sys, unsigned int N, const int* assignments, Link ***my_sys, unsigned int *my_N, TransData *my_data, short int *getting)
+{
+    unsigned int i;
+    int k;
+    Link *child;
+
+    //Set the links of this process
+    *my_N = 0;
+    for (i = 0; i < N; i++)
+        if (assignments[i] == my_rank)
+            (*my_N)++;
+    *my_sys = (Link**)malloc(*my_N * sizeof(Link*));
+    *my_N = 0;
+    for (i = 0; i < N; i++)
+        if (assignments[i] == my_rank)
+            (*my_sys)[(*my_N)++] = &sys[i];
+    merge_sort_by_distance(*my_sys, *my_N);
+
+    //Find the links sent to the process of their child
+    for (i = 0; i < N; i++)
+    {
+        getting[i] = 0;
+        child = sys[i].child;
+        if (child != NULL && assignments[i] != assignments[child->location])
+        {
+            if (my_rank == assignments[child->location])
+            {
+                (my_data->receive_size[assignments[i]])++;
+                getting[i] = 1;
+            }
+            else if (my_rank == assignments[i])
+                (my_data->send_size[assignments[child->location]])++;
+        }
+    }
+
+    for (k = 0; k < np; k++)
+    {
+        my_data->receive_data[k] = (Link**)malloc(my_data->receive_size[k] * sizeof(Link*));
+        my_data->send_data[k] = (Link**)malloc(my_data->send_size[k] * sizeof(Link*));
+    }
+    unsigned int* current_receive_size = (unsigned int*)calloc(np, sizeof(unsigned int));
+    unsigned int* current_send_size = (unsigned int*)calloc(np, sizeof(unsigned int));
+    for (i = 0; i < N; i++)
+    {
+        child = sys[i].child;
+        if (child != NULL && assignments[i] != assignments[child->location])
+        {
+            if (my_rank == assignments[child->location])
+                my_data->receive_data[assignments[i]][current_receive_size[assignments[i]]++] = &sys[i];
+            else if (my_rank == assignments[i])
+                my_data->send_data[assignments[child->location]][current_send_size[assignments[child->location]]++] = &sys[i];
+        }
+    }
+
+    //Clean up
+    free(current_receive_size);
+    free(current_send_size);
+}
+
+//Partitions a river system into pieces of about the same estimated work, with the cuts of Assign_Subtrees.
+//The arguments and the returned array are as in Partition_System_By_Leaves.
+int* Partition_System_By_Subtrees(Link *sys, unsigned int N, Link **leaves, unsigned int numleaves, Link ***my_sys, unsigned int *my_N, TransData *my_data, short int *getting)
+{
+    //The leaves are not needed, but PartitionFunc requires them
+    (void)leaves;
+    (void)numleaves;
+
+    double* work = (double*)malloc(N * sizeof(double));
+    for (unsigned int i = 0; i < N; i++)
+        work[i] = Estimate_Link_Work(&sys[i]);
+
+    int* assignments = (int*)malloc(N * sizeof(int));
+    Assign_Subtrees(sys, N, work, assignments);
+    Distribute_System(sys, N, assignments, my_sys, my_N, my_data, getting);
+
+    free(work);
+
+    return assignments;
+}
+
+
+//Writes the cost of computing each link of the system to filename. The first line holds the number of links, then
+//each line holds a link id, its accepted and rejected steps, the evaluations of its equations and the time spent
+//computing its steps in seconds. Process 0 gathers and writes the costs of every process.
+//Returns 0 if the file was written, 1 if not.
+int Save_Link_Costs(const char* filename, Link** my_sys, unsigned int my_N)
+{
+    const int fields = 5;
+    int i, error = 0;
+    unsigned int j;
+    int* counts = NULL;
+    int* displs = NULL;
+    double* all_costs = NULL;
+    int total = 0;
+
+    //Pack the costs of this process as doubles. Link ids are exact in a double.
+    double* costs = (double*)malloc(fields * my_N * sizeof(double));
+    for (j = 0; j < my_N; j++)
+    {
+        Link* current = my_sys[j];
+        double steps = (double)current->my->num_accepted + current->my->num_rejected;
+        costs[fields * j] = current->ID;
+        costs[fields * j + 1] = current->my->num_accepted;
+        costs[fields * j + 2] = current->my->num_rejected;
+        costs[fields * j + 3] = current->method ? steps * current->method->num_stages : steps;
+        costs[fields * j + 4] = current->my->solve_time;
+    }
+
+    int my_count = fields * my_N;
+    if (my_rank == 0)
+    {
+        counts = (int*)malloc(np * sizeof(int));
+        displs = (int*)malloc(np * sizeof(int));
+    }
+    MPI_Gather(&my_count, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        for (i = 0; i < np; i++)
+        {
+            displs[i] = total;
+            total += counts[i];
+        }
+        all_costs = (double*)malloc(total * sizeof(double));
+    }
+    MPI_Gatherv(costs, my_count, MPI_DOUBLE, all_costs, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (my_rank == 0)
+    {
+        FILE* outputfile = fopen(filename, "w");
+        if (!outputfile)
+        {
+            printf("Error: cannot create cost file %s.\n", filename);
+            error = 1;
+        }
+        else
+        {
+            fprintf(outputfile, "%i\n", total / fields);
+            for (i = 0; i < total; i += fields)
+                fprintf(outputfile, "%u %.0f %.0f %.0f %.6e\n", (unsigned int)all_costs[i], all_costs[i + 1], all_costs[i + 2], all_costs[i + 3], all_costs[i + 4]);
+            if (fclose(outputfile))
+            {
+                printf("Error: cannot write to cost file %s.\n", filename);
+                error = 1;
+            }
+        }
+    }
+    MPI_Bcast(&error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    //Clean up
+    free(costs);
+    free(counts);
+    free(displs);
+    free(all_costs);
+
+    return error;
+}
+
+//Reads a file written by Save_Link_Costs and sets the work of each link of the system to its measured time, or to its
+//evaluations if no time was measured. Links missing from the file get the mean work of the others.
+//Returns 0 if the costs were read, 1 if not.
+int Load_Link_Costs(const char* filename, Link* sys, unsigned int N, const Lookup* id_to_loc)
+{
+    unsigned int i, count = 0;
+    unsigned int* ids = NULL;
+    double* work = NULL;
+
+    if (my_rank == 0)
+    {
+        FILE* inputfile = fopen(filename, "r");
+        if (!inputfile)
+            printf("Error: cannot open cost file %s.\n", filename);
+        else if (fscanf(inputfile, "%u", &count) != 1)
+        {
+            printf("Error: cannot read the number of links from cost file %s.\n", filename);
+            count = 0;
+        }
+        else
+        {
+            double total_time = 0.0;
+            ids = (unsigned int*)malloc(count * sizeof(unsigned int));
+            work = (double*)malloc(2 * count * sizeof(double));
+            for (i = 0; i < count; i++)
+            {
+                double accepted, rejected;
+                if (fscanf(inputfile, "%u %lf %lf %lf %lf", &ids[i], &accepted, &rejected, &work[count + i], &work[i]) != 5)
+                {
+                    printf("Error: cannot read link %u of %u from cost file %s.\n", i + 1, count, filename);
+                    count = 0;
+                    break;
+                }
+                total_time += work[i];
+            }
+
+            //Fall back to the evaluations if the time was too short to measure
+            if (total_time <= 0.0)
+                memcpy(work, work + count, count * sizeof(double));
+        }
+        if (inputfile)
+            fclose(inputfile);
+    }
+
+    MPI_Bcast(&count, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    if (count == 0)
+    {
+        free(ids);
+        free(work);
+        return 1;
+    }
+    if (my_rank != 0)
+    {
+        ids = (unsigned int*)malloc(count * sizeof(unsigned int));
+        work = (double*)malloc(count * sizeof(double));
+    }
+    MPI_Bcast(ids, count, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(work, count, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    for (i = 0; i < N; i++)
+        sys[i].work = 0.0;
+
+    double total = 0.0;
+    unsigned int found = 0;
+    for (i = 0; i < count; i++)
+    {
+        unsigned int loc = find_link_by_idtoloc(ids[i], id_to_loc, N);
+        if (loc < N && work[i] > 0.0)
+        {
+            sys[loc].work = work[i];
+            total += work[i];
+            found++;
+        }
+    }
+
+    double mean = found ? total / found : 1.0;
+    for (i = 0; i < N; i++)
+        if (sys[i].work == 0.0)
+            sys[i].work = mean;
+
+    free(ids);
+    free(work);
+
+    return 0;
+}
+
+
 #if defined(HAVE_METIS)
 
 int* Partition_METIS_ByEqs(Link* sys, unsigned int N, Link** leaves, unsigned int numleaves, Link** my_sys, unsigned int* my_N, TransData* my_data, short int *getting)
@@ -16,6 +16,13 @@ extern int np;
 int* Partition_System_By_Leaves(Link *sys, unsigned int N, Link **leaves, unsigned int numleaves, Link ***my_sys, unsigned int *my_N, TransData *my_data, short int *getting);
 int* Partition_System_By_Leaves_2(Link *sys, unsigned int N, Link **leaves, unsigned int numleaves, Link ***my_sys, unsigned int * my_N, TransData *my_data, short int *getting);
 
+double Estimate_Step_Work(const Link* link);
+void Assign_Subtrees(Link *sys, unsigned int N, const double* work, int* assignments);
+void Distribute_System(Link *sys, unsigned int N, const int* assignments, Link ***my_sys, unsigned int *my_N, TransData *my_data, short int *getting);
+
+int Save_Link_Costs(const char* filename, Link** my_sys, unsigned int my_N);
+int Load_Link_Costs(const char* filename, Link* sys, unsigned int N, const Lookup* id_to_loc);
+
 #if defined(HAVE_METIS)
 
 int* Partition_METIS_ByEqs(Link* sys, unsigned int N, Link** leaves, unsigned int numleaves, Link** my_sys, unsigned int* my_N, TransData* my_data, short int *getting);
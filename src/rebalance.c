@@ -0,0 +1,547 @@
+#if !defined(_MSC_VER)
+#include <config.h>
+#else
+#include <config_msvc.h>
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <comm.h>
+#include <forcings_io.h>
+#include <partition.h>
+#include <rebalance.h>
+#include <system.h>
+#include <models/definitions.h>
+
+
+//Records of links packed for one process
+typedef struct RecordBuffer
+{
+    char* data;
+    int size;       //Capacity of data in bytes
+    int position;   //Number of bytes packed
+} RecordBuffer;
+
+//Packs count items of type, growing the buffer as needed
+static void Pack_Record(const void* items, int count, MPI_Datatype type, RecordBuffer* buffer)
+{
+    int size;
+    MPI_Pack_size(count, type, MPI_COMM_WORLD, &size);
+    if (buffer->position + size > buffer->size)
+    {
+        buffer->size = 2 * buffer->size + size;
+        buffer->data = (char*)realloc(buffer->data, buffer->size);
+    }
+    MPI_Pack((void*)items, count, type, buffer->data, buffer->size, &buffer->position, MPI_COMM_WORLD);
+}
+
+//Returns true if the series of forcing at a link is allocated for the link alone
+static bool Owns_Series(const Forcing* forcing)
+{
+    return forcing->flag != 0 && forcing->flag != 4 && forcing->flag != 7 && forcing->flag != 8;
+}
+
+//Returns true if link must stay on its process. Outputs, dams, reservoirs and custom data are set up for the process
+//of the link when the system is loaded.
+static bool Is_Pinned(const Link* link)
+{
+    return link->save_flag || link->peak_flag || link->has_dam || link->has_res || link->qvs
+        || link->user || link->output_user || link->peakoutput_user;
+}
+
+//Frees the data of a link kept by this process. Storage carved from the arena stays there until the arena is freed.
+static void Release_Link_Data(Link* link, const Forcing* forcings, const GlobalVars* globals)
+{
+    LinkData* my = link->my;
+    bool pooled = my->pooled;
+
+    if (my->forcing_data)
+    {
+        for (unsigned int l = 0; l < globals->num_forcings; l++)
+            if (Owns_Series(&forcings[l]))
+                free(my->forcing_data[l].data);
+        if (!pooled)
+        {
+            free(my->forcing_data);
+            free(my->forcing_values);
+            free(my->forcing_change_times);
+            free(my->forcing_indices);
+        }
+    }
+    Destroy_List(&my->list);
+
+    if (!pooled)
+    {
+        free(link->discont);
+        free(link->discont_send);
+        free(link->discont_order_send);
+        free(link->peak_value);
+    }
+    link->discont = NULL;
+    link->discont_send = NULL;
+    link->discont_order_send = NULL;
+    link->peak_value = NULL;
+    link->discont_count = 0;
+    link->discont_send_count = 0;
+
+    free(my);
+    link->my = NULL;
+}
+
+//Creates the data of a link kept by this process, with a list holding the state y at last_t. Links owned by this
+//process also get their forcing arrays.
+static void Create_Link_Data(Link* link, bool owned, const double* y, const int* assignments, GlobalVars* globals, ErrorData* errors)
+{
+    LinkData* my = (LinkData*)calloc(1, sizeof(LinkData));
+    my->error_data = errors;
+    my->peak_iterations = 1;
+    link->my = my;
+
+    link->iter_limit = List_Length(link, assignments, globals);
+    Init_List(&my->list, link->last_t, (double*)y, link->dim, link->num_dense, link->method->num_stages, link->method->dense_degree, link->iter_limit, globals->float_history, NULL);
+    my->list.head->state = link->state;
+    link->current_iterations = 1;
+
+    if (owned && globals->num_forcings)
+    {
+        my->forcing_data = (TimeSerie*)calloc(globals->num_forcings, sizeof(TimeSerie));
+        my->forcing_values = (double*)calloc(globals->num_forcings, sizeof(double));
+        my->forcing_change_times = (double*)calloc(globals->num_forcings, sizeof(double));
+        my->forcing_indices = (unsigned int*)calloc(globals->num_forcings, sizeof(unsigned int));
+    }
+
+    if (link->num_parents)
+        link->discont = (double*)malloc(globals->discont_size * sizeof(double));
+    link->discont_count = 0;
+    link->discont_start = 0;
+    link->discont_end = globals->discont_size - 1;
+    if (owned && link->child && assignments[link->child->location] != my_rank)
+    {
+        link->discont_send = (double*)malloc(globals->discont_size * sizeof(double));
+        link->discont_order_send = (unsigned int*)malloc(globals->discont_size * sizeof(unsigned int));
+    }
+    link->discont_send_count = 0;
+
+    link->peak_value = (double*)malloc(link->dim * sizeof(double));
+    memcpy(link->peak_value, y, link->dim * sizeof(double));
+}
+
+//Packs what a process needs to take over link. The forcings are only packed for the new owner of the link.
+static void Pack_Link(Link* link, bool owned, const Forcing* forcings, const GlobalVars* globals, MPI_Datatype datapoint_type, RecordBuffer* buffer)
+{
+    LinkData* my = link->my;
+    double scalars[8] = { link->last_t, link->print_time, link->next_save, link->peak_time, my->err_prev[0], my->err_prev[1], my->h_prev, my->solve_time };
+    int counters[2] = { link->state, my->peak_iterations };
+    unsigned int totals[4] = { link->disk_iterations, my->num_accepted, my->num_rejected, link->discont_count };
+
+    Pack_Record(&link->location, 1, MPI_UNSIGNED, buffer);
+    Pack_Record(&link->num_params, 1, MPI_UNSIGNED, buffer);
+    Pack_Record(link->params, link->num_params, MPI_DOUBLE, buffer);
+    Pack_Record(&link->num_dense, 1, MPI_UNSIGNED, buffer);
+    Pack_Record(link->dense_indices, link->num_dense, MPI_UNSIGNED, buffer);
+    Pack_Record(scalars, 8, MPI_DOUBLE, buffer);
+    Pack_Record(counters, 2, MPI_INT, buffer);
+    Pack_Record(totals, 4, MPI_UNSIGNED, buffer);
+    Pack_Record(my->list.tail->y_approx, link->dim, MPI_DOUBLE, buffer);
+    Pack_Record(link->peak_value, link->dim, MPI_DOUBLE, buffer);
+
+    //The discontinuities, from the first to be stepped on
+    for (unsigned int i = 0; i < link->discont_count; i++)
+        Pack_Record(&link->discont[(link->discont_start + i) % globals->discont_size], 1, MPI_DOUBLE, buffer);
+
+    if (!owned || !my->forcing_data)
+        return;
+
+    Pack_Record(my->forcing_values, globals->num_forcings, MPI_DOUBLE, buffer);
+    Pack_Record(my->forcing_change_times, globals->num_forcings, MPI_DOUBLE, buffer);
+    Pack_Record(my->forcing_indices, globals->num_forcings, MPI_UNSIGNED, buffer);
+    for (unsigned int l = 0; l < globals->num_forcings; l++)
+    {
+        if (!Owns_Series(&forcings[l]))
+            continue;
+        unsigned int num_points = my->forcing_data[l].data ? my->forcing_data[l].num_points : 0;
+        Pack_Record(&num_points, 1, MPI_UNSIGNED, buffer);
+        Pack_Record(my->forcing_data[l].data, num_points, datapoint_type, buffer);
+    }
+}
+
+//Unpacks the record of a link at position in buffer and creates the data of the link on this process
+static void Unpack_Link(
+    char* buffer, int count, int* position,
+    Link* sys, const int* assignments,
+    GlobalVars* globals, Forcing* forcings, RKMethod* rk_methods, ErrorData* errors, AsynchModel* model, void* external,
+    MPI_Datatype datapoint_type, double* y)
+{
+    unsigned int loc, num_params;
+    double scalars[8];
+    int counters[2];
+    unsigned int totals[4];
+
+    MPI_Unpack(buffer, count, position, &loc, 1, MPI_UNSIGNED, MPI_COMM_WORLD);
+    Link* link = &sys[loc];
+    bool owned = assignments[loc] == my_rank;
+    if (link->my)
+        Release_Link_Data(link, forcings, globals);
+
+    //Set up the equations if the link is new to this process. The states with dense output include the states
+    //written to the output, so they are taken from the record.
+    MPI_Unpack(buffer, count, position, &num_params, 1, MPI_UNSIGNED, MPI_COMM_WORLD);
+    if (link->params == NULL)
+    {
+        link->num_params = num_params;
+        link->params = (double*)malloc(num_params * sizeof(double));
+        link->method = &rk_methods[globals->method];
+        if (model && model->routines)
+            model->routines(link, globals->model_uid, link->method->exp_imp, link->has_dam, external);
+        else
+            InitRoutines(link, globals->model_uid, link->method->exp_imp, link->has_dam, external);
+    }
+    MPI_Unpack(buffer, count, position, link->params, num_params, MPI_DOUBLE, MPI_COMM_WORLD);
+    MPI_Unpack(buffer, count, position, &link->num_dense, 1, MPI_UNSIGNED, MPI_COMM_WORLD);
+    link->dense_indices = (unsigned int*)realloc(link->dense_indices, link->num_dense * sizeof(unsigned int));
+    MPI_Unpack(buffer, count, position, link->dense_indices, link->num_dense, MPI_UNSIGNED, MPI_COMM_WORLD);
+
+    MPI_Unpack(buffer, count, position, scalars, 8, MPI_DOUBLE, MPI_COMM_WORLD);
+    MPI_Unpack(buffer, count, position, counters, 2, MPI_INT, MPI_COMM_WORLD);
+    MPI_Unpack(buffer, count, position, totals, 4, MPI_UNSIGNED, MPI_COMM_WORLD);
+    MPI_Unpack(buffer, count, position, y, link->dim, MPI_DOUBLE, MPI_COMM_WORLD);
+    link->last_t = scalars[0];
+    link->print_time = scalars[1];
+    link->next_save = scalars[2];
+    link->peak_time = scalars[3];
+    link->state = counters[0];
+    link->disk_iterations = totals[0];
+
+    Create_Link_Data(link, owned, y, assignments, globals, errors);
+    LinkData* my = link->my;
+    my->err_prev[0] = scalars[4];
+    my->err_prev[1] = scalars[5];
+    my->h_prev = scalars[6];
+    my->solve_time = scalars[7];
+    my->peak_iterations = counters[1];
+    my->num_accepted = totals[1];
+    my->num_rejected = totals[2];
+    link->steps_on_diff_proc = 1;
+    link->iters_removed = 0;
+    link->rejected = 0;
+    MPI_Unpack(buffer, count, position, link->peak_value, link->dim, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    //The discontinuities are stored from the start of the buffer
+    for (unsigned int i = 0; i < totals[3]; i++)
+    {
+        double time;
+        MPI_Unpack(buffer, count, position, &time, 1, MPI_DOUBLE, MPI_COMM_WORLD);
+        if (link->discont)
+            link->discont[i] = time;
+    }
+    if (link->discont)
+    {
+        link->discont_count = totals[3];
+        link->discont_end = (totals[3] + globals->discont_size - 1) % globals->discont_size;
+    }
+
+    if (!owned || !my->forcing_data)
+        return;
+
+    MPI_Unpack(buffer, count, position, my->forcing_values, globals->num_forcings, MPI_DOUBLE, MPI_COMM_WORLD);
+    MPI_Unpack(buffer, count, position, my->forcing_change_times, globals->num_forcings, MPI_DOUBLE, MPI_COMM_WORLD);
+    MPI_Unpack(buffer, count, position, my->forcing_indices, globals->num_forcings, MPI_UNSIGNED, MPI_COMM_WORLD);
+    for (unsigned int l = 0; l < globals->num_forcings; l++)
+    {
+        TimeSerie* series = &my->forcing_data[l];
+        if (forcings[l].flag == 4 || forcings[l].flag == 7)
+        {
+            *series = forcings[l].global_forcing;
+            continue;
+        }
+        if (!Owns_Series(&forcings[l]))
+            continue;
+
+        //The series of binary and database forcings are refilled at every pass, up to increment + 1 points
+        unsigned int num_points, capacity;
+        MPI_Unpack(buffer, count, position, &num_points, 1, MPI_UNSIGNED, MPI_COMM_WORLD);
+        capacity = (forcings[l].flag == 1 || num_points > forcings[l].increment + 4) ? num_points : forcings[l].increment + 4;
+        if (capacity == 0)
+            continue;
+        series->data = (DataPoint*)malloc(capacity * sizeof(DataPoint));
+        series->num_points = num_points;
+        MPI_Unpack(buffer, count, position, series->data, num_points, datapoint_type, MPI_COMM_WORLD);
+    }
+}
+
+//Returns true if links can be moved between processes during a run with these settings. Error data read from a .rkd
+//file, grid cell forcings and implicit methods are set up once for the links of each process.
+bool Rebalance_Supported(const GlobalVars* globals, const Forcing* forcings, const RKMethod* rk_methods)
+{
+    if (globals->rkd_flag || rk_methods[globals->method].exp_imp)
+        return false;
+    for (unsigned int l = 0; l < globals->num_forcings; l++)
+        if (forcings[l].flag == 8)
+            return false;
+    return true;
+}
+
+//Moves links between processes if the work of the last pass was imbalanced by more than globals->rebalance_threshold.
+//Must be called at a pass boundary, once Transfer_Data_Finish has returned on every process. The work of a link is
+//the number of steps it took since the last call, times the estimated work of a step (see Estimate_Step_Work).
+//The network is cut again into subtrees of about the same work (see Assign_Subtrees), except for the links that
+//must stay on their process (see Is_Pinned). The links are moved with their state, step size history, pending
+//discontinuities and forcings, then the lists of links exchanged between processes are rebuilt.
+//last_steps has the number of steps taken by each link of this process at the last call, and is updated.
+//Returns 1 if links were moved, in which case my_sys, my_N, assignments, getting and my_data are set again.
+//Returns 0 otherwise.
+int Rebalance_System(
+    Link* sys, unsigned int N,
+    Link*** my_sys, unsigned int* my_N,
+    int* assignments, short int* getting,
+    TransData* my_data,
+    GlobalVars* globals,
+    Forcing* forcings,
+    RKMethod* rk_methods,
+    ErrorData* errors,
+    AsynchModel* model,
+    void* external,
+    unsigned int* last_steps)
+{
+    unsigned int i;
+    int k;
+
+    //Measure the work of the last pass at every link
+    double* work = (double*)calloc(N, sizeof(double));
+    int* pinned = (int*)calloc(N, sizeof(int));
+    for (i = 0; i < *my_N; i++)
+    {
+        Link* current = (*my_sys)[i];
+        unsigned int steps = current->my->num_accepted + current->my->num_rejected;
+        work[current->location] = (steps - last_steps[current->location]) * Estimate_Step_Work(current);
+        pinned[current->location] = Is_Pinned(current);
+        last_steps[current->location] = steps;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, work, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, pinned, N, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+    //Check the balance of the processes
+    double* loads = (double*)calloc(2 * np, sizeof(double));
+    double* new_loads = &loads[np];
+    unsigned int* new_sizes = (unsigned int*)calloc(np, sizeof(unsigned int));
+    double total = 0.0, max_load = 0.0, new_max_load = 0.0;
+    for (i = 0; i < N; i++)
+    {
+        loads[assignments[i]] += work[i];
+        total += work[i];
+    }
+    for (k = 0; k < np; k++)
+        max_load = (loads[k] > max_load) ? loads[k] : max_load;
+
+    int* new_assignments = NULL;
+    bool move = total > 0.0 && max_load > (1.0 + globals->rebalance_threshold) * total / np;
+    if (move)
+    {
+        //Cut the network again. Keep the new cuts only if they do better.
+        new_assignments = (int*)malloc(N * sizeof(int));
+        Assign_Subtrees(sys, N, work, new_assignments);
+        for (i = 0; i < N; i++)
+        {
+            if (pinned[i])
+                new_assignments[i] = assignments[i];
+            new_loads[new_assignments[i]] += work[i];
+            new_sizes[new_assignments[i]]++;
+        }
+        for (k = 0; k < np; k++)
+        {
+            new_max_load = (new_loads[k] > new_max_load) ? new_loads[k] : new_max_load;
+            if (new_sizes[k] == 0)
+                move = false;
+        }
+        if (new_max_load >= max_load)
+            move = false;
+    }
+
+    free(work);
+    free(pinned);
+    free(loads);
+    free(new_sizes);
+    if (!move)
+    {
+        free(new_assignments);
+        return 0;
+    }
+
+    //No message is in flight from here on
+    Flush_TransData(my_data);
+
+    //Only the last state of each link is kept. Every process still has it.
+    for (i = 0; i < N; i++)
+    {
+        Link* current = &sys[i];
+        if (current->my != NULL)
+        {
+            while (current->current_iterations > 1)
+            {
+                Remove_Head_Node(&current->my->list);
+                (current->current_iterations)--;
+            }
+            current->steps_on_diff_proc = 1;
+            current->iters_removed = 0;
+            current->rejected = 0;
+        }
+    }
+
+    //The forcings find the links of this process again at the next pass
+    for (unsigned int l = 0; l < globals->num_forcings; l++)
+        Repartition_Forcing(&forcings[l]);
+
+    //Create an MPI type for struct DataPoint
+    int blocklengths[2] = { 1, 1 };
+    MPI_Datatype types[2] = { MPI_DOUBLE, MPI_FLOAT };
+    MPI_Aint offsets[2] = { offsetof(DataPoint, time), offsetof(DataPoint, value) };
+    MPI_Datatype datapoint_type, resized_type;
+    MPI_Type_create_struct(2, blocklengths, offsets, types, &datapoint_type);
+    MPI_Type_create_resized(datapoint_type, 0, sizeof(DataPoint), &resized_type);
+    MPI_Type_commit(&resized_type);
+
+    //Pack the links leaving this process for their new owner, and for the process of their child if it did not get
+    //them before
+    RecordBuffer* buffers = (RecordBuffer*)calloc(np, sizeof(RecordBuffer));
+    for (i = 0; i < N; i++)
+    {
+        if (assignments[i] != my_rank)
+            continue;
+
+        Link* current = &sys[i];
+        int owner = new_assignments[i];
+        if (owner != my_rank)
+            Pack_Link(current, true, forcings, globals, resized_type, &buffers[owner]);
+        if (current->child)
+        {
+            int receiver = new_assignments[current->child->location];
+            if (receiver != owner && receiver != my_rank && receiver != assignments[current->child->location])
+                Pack_Link(current, false, forcings, globals, resized_type, &buffers[receiver]);
+        }
+    }
+
+    //Exchange the records
+    int* counts = (int*)malloc(4 * np * sizeof(int));
+    int *send_counts = counts, *send_displs = &counts[np], *recv_counts = &counts[2 * np], *recv_displs = &counts[3 * np];
+    int send_total = 0, recv_total = 0;
+    for (k = 0; k < np; k++)
+        send_counts[k] = buffers[k].position;
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (k = 0; k < np; k++)
+    {
+        send_displs[k] = send_total;
+        send_total += send_counts[k];
+        recv_displs[k] = recv_total;
+        recv_total += recv_counts[k];
+    }
+    char* send_buffer = (char*)malloc(send_total + 1);
+    char* recv_buffer = (char*)malloc(recv_total + 1);
+    for (k = 0; k < np; k++)
+    {
+        if (send_counts[k])
+            memcpy(&send_buffer[send_displs[k]], buffers[k].data, send_counts[k]);
+        free(buffers[k].data);
+    }
+    free(buffers);
+    MPI_Alltoallv(send_buffer, send_counts, send_displs, MPI_PACKED, recv_buffer, recv_counts, recv_displs, MPI_PACKED, MPI_COMM_WORLD);
+    free(send_buffer);
+
+    //Drop the links this process does not need anymore. A link that stays as the parent of a link of this process
+    //keeps its last state.
+    double* y = (double*)malloc(globals->max_dim * sizeof(double));
+    for (i = 0; i < N; i++)
+    {
+        Link* current = &sys[i];
+        if (current->my == NULL)
+            continue;
+
+        bool was_owned = assignments[i] == my_rank;
+        bool owned = new_assignments[i] == my_rank;
+        bool ghost = !owned && current->child && new_assignments[current->child->location] == my_rank;
+        if (owned && was_owned)
+        {
+            //The steps of a link sent to another process are bounded by iter_limit
+            int length = List_Length(current, new_assignments, globals);
+            if (length > current->iter_limit)
+            {
+                Resize_List(&current->my->list, current->dim, current->num_dense, 1, length);
+                current->iter_limit = length;
+            }
+            if (current->child && new_assignments[current->child->location] != my_rank && current->discont_send == NULL)
+            {
+                if (current->my->pooled)
+                {
+                    current->discont_send = (double*)Arena_Alloc(&globals->arena, globals->discont_size * sizeof(double));
+                    current->discont_order_send = (unsigned int*)Arena_Alloc(&globals->arena, globals->discont_size * sizeof(unsigned int));
+                }
+                else
+                {
+                    current->discont_send = (double*)malloc(globals->discont_size * sizeof(double));
+                    current->discont_order_send = (unsigned int*)malloc(globals->discont_size * sizeof(unsigned int));
+                }
+            }
+        }
+        else if (ghost && was_owned)
+        {
+            memcpy(y, current->my->list.tail->y_approx, current->dim * sizeof(double));
+            Release_Link_Data(current, forcings, globals);
+            Create_Link_Data(current, false, y, new_assignments, globals, errors);
+            current->steps_on_diff_proc = 1;
+            current->iters_removed = 0;
+        }
+        else if (!ghost)
+        {
+            Release_Link_Data(current, forcings, globals);
+            if (!owned)
+            {
+                free(current->params);
+                free(current->dense_indices);
+                current->params = NULL;
+                current->dense_indices = NULL;
+                current->method = NULL;
+            }
+        }
+    }
+
+    //Take over the links received
+    for (k = 0; k < np; k++)
+    {
+        int position = 0;
+        while (position < recv_counts[k])
+            Unpack_Link(&recv_buffer[recv_displs[k]], recv_counts[k], &position, sys, new_assignments, globals, forcings, rk_methods, errors, model, external, resized_type, y);
+    }
+    free(recv_buffer);
+    free(counts);
+    free(y);
+    MPI_Type_free(&resized_type);
+    MPI_Type_free(&datapoint_type);
+
+    //Set the links of this process and the links it exchanges again
+    memcpy(assignments, new_assignments, N * sizeof(int));
+    free(new_assignments);
+    Clear_TransData(my_data);
+    free(*my_sys);
+    Distribute_System(sys, N, assignments, my_sys, my_N, my_data, getting);
+    Allocate_TransData_Buffers(my_data, globals);
+
+    for (i = 0; i < N; i++)
+    {
+        Link* current = &sys[i];
+        if (current->my != NULL)
+        {
+            current->ready = current->num_parents ? 0 : 1;
+            current->discont_send_count = 0;
+        }
+    }
+    for (i = 0; i < *my_N; i++)
+    {
+        Link* current = (*my_sys)[i];
+        last_steps[current->location] = current->my->num_accepted + current->my->num_rejected;
+    }
+
+    return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef REBALANCE_H
+#define REBALANCE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdbool.h>
+
+#include <structs.h>
+
+extern int my_rank;
+extern int np;
+
+bool Rebalance_Supported(const GlobalVars* globals, const Forcing* forcings, const RKMethod* rk_methods);
+int Rebalance_System(
+    Link* sys, unsigned int N,
+    Link*** my_sys, unsigned int* my_N,
+    int* assignments, short int* getting,
+    TransData* my_data,
+    GlobalVars* globals,
+    Forcing* forcings,
+    RKMethod* rk_methods,
+    ErrorData* errors,
+    AsynchModel* model,
+    void* external,
+    unsigned int* last_steps);
+
+#endif
@@ -11,9 +11,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 #if defined(_MSC_VER)
@@ -48,6 +52,163 @@
 #include <riversys.h>
 
 
+//Version of the network bundles (.nbd)
+#define ASYNCH_NBD_VERSION 1
+
+//Header of a network bundle. The header is followed by the link ids, in the order of the links in the network, the
+//offsets in the parent list of the parents of each link (N + 1 entries), the parent list (link ids) and the lookup
+//table from link id to location, sorted by id. If num_disk_params is not 0, the parameters of each link follow as
+//doubles, in the order of the links, at the next multiple of 8 bytes. Numbers are in the byte order of the machine
+//that wrote the bundle.
+typedef struct NetworkBundleHeader
+{
+    char magic[4];              //ANBD
+    uint32_t version;
+    uint32_t num_links;
+    uint32_t num_parents;       //Number of entries in the parent list
+    uint32_t num_disk_params;   //Number of parameters of each link, 0 if the bundle holds no parameters
+    uint32_t reserved[3];
+} NetworkBundleHeader;
+
+//A network bundle, mapped in memory
+typedef struct NetworkBundle
+{
+    void* base;
+    size_t size;
+    bool mapped;                //true if base is mapped, false if the bundle was read in memory
+    const NetworkBundleHeader* header;
+    const uint32_t* link_ids;
+    const uint32_t* parent_offsets;
+    const uint32_t* parents;
+    const Lookup* lookup;
+    const double* params;
+} NetworkBundle;
+
+//Offset in a network bundle of the parameters
+static size_t Network_Bundle_Params_Offset(uint32_t num_links, uint32_t num_parents)
+{
+    size_t offset = sizeof(NetworkBundleHeader) + (2 * (size_t)num_links + 1 + num_parents) * sizeof(uint32_t) + (size_t)num_links * sizeof(Lookup);
+    return (offset + 7) & ~(size_t)7;
+}
+
+static void Close_Network_Bundle(NetworkBundle* bundle)
+{
+#if defined(HAVE_UNISTD_H)
+    if (bundle->mapped)
+        munmap(bundle->base, bundle->size);
+    else
+#endif
+        free(bundle->base);
+    bundle->base = NULL;
+}
+
+//Maps the network bundle filename read only. Returns 1 if there is an error, 0 otherwise.
+static int Open_Network_Bundle(const char* filename, NetworkBundle* bundle)
+{
+    memset(bundle, 0, sizeof(NetworkBundle));
+
+#if defined(HAVE_UNISTD_H)
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+    {
+        printf("[%i]: Error: cannot open network bundle %s.\n", my_rank, filename);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    bundle->size = (size_t)st.st_size;
+    if (bundle->size >= sizeof(NetworkBundleHeader))
+    {
+        bundle->base = mmap(NULL, bundle->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (bundle->base == MAP_FAILED)
+            bundle->base = NULL;
+        bundle->mapped = true;
+    }
+    close(fd);
+#else
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+    {
+        printf("[%i]: Error: cannot open network bundle %s.\n", my_rank, filename);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    bundle->size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (bundle->size >= sizeof(NetworkBundleHeader))
+    {
+        bundle->base = malloc(bundle->size);
+        if (bundle->base && fread(bundle->base, 1, bundle->size, file) != bundle->size)
+        {
+            free(bundle->base);
+            bundle->base = NULL;
+        }
+    }
+    fclose(file);
+#endif
+
+    const NetworkBundleHeader* header = bundle->base;
+    if (!header || memcmp(header->magic, "ANBD", 4) || header->version != ASYNCH_NBD_VERSION)
+    {
+        printf("[%i]: Error: %s is not a network bundle of version %u, or was written with another byte order.\n", my_rank, filename, ASYNCH_NBD_VERSION);
+        Close_Network_Bundle(bundle);
+        return 1;
+    }
+
+    size_t params_offset = Network_Bundle_Params_Offset(header->num_links, header->num_parents);
+    size_t size = header->num_disk_params ? params_offset + (size_t)header->num_links * header->num_disk_params * sizeof(double) : params_offset;
+    if (bundle->size < size)
+    {
+        printf("[%i]: Error: network bundle %s is truncated (%zu bytes, expected %zu).\n", my_rank, filename, bundle->size, size);
+        Close_Network_Bundle(bundle);
+        return 1;
+    }
+
+    bundle->header = header;
+    bundle->link_ids = (const uint32_t*)&header[1];
+    bundle->parent_offsets = &bundle->link_ids[header->num_links];
+    bundle->parents = &bundle->parent_offsets[header->num_links + 1];
+    bundle->lookup = (const Lookup*)&bundle->parents[header->num_parents];
+    bundle->params = header->num_disk_params ? (const double*)((const char*)bundle->base + params_offset) : NULL;
+
+    if (bundle->parent_offsets[header->num_links] != header->num_parents)
+    {
+        printf("[%i]: Error: network bundle %s is corrupted.\n", my_rank, filename);
+        Close_Network_Bundle(bundle);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+//Broadcasts the topology read by process 0 in compressed sparse row form: the parents of each link are the next
+//num_parents entries of parents. Only the ids of the actual parents are sent.
+static void Broadcast_Topology(unsigned int* N, unsigned int** link_ids, unsigned int** num_parents, unsigned int** parents)
+{
+    unsigned int sizes[2] = { *N, 0 };  //Number of links and size of the parent list
+
+    if (my_rank == 0)
+    {
+        for (unsigned int i = 0; i < *N; i++)
+            sizes[1] += (*num_parents)[i];
+    }
+    MPI_Bcast(sizes, 2, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+
+    if (my_rank != 0)
+    {
+        *N = sizes[0];
+        *link_ids = (unsigned int*)malloc(*N * sizeof(unsigned int));
+        *num_parents = (unsigned int*)malloc(*N * sizeof(unsigned int));
+        *parents = (unsigned int*)malloc(sizes[1] * sizeof(unsigned int));
+    }
+    MPI_Bcast(*link_ids, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(*num_parents, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(*parents, sizes[1], MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+}
+
+
 //Read topo data and build the network.
 //Also creates id_to_loc.
 void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, Lookup** id_to_loc, ConnData* db_connections)
@@ -58,11 +219,12 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
     unsigned int *dbres_parent = NULL;
     unsigned int sizeres = 0;
     unsigned int i, j;
-    unsigned int max_children = 10;
     unsigned int *num_parents = NULL;
+    unsigned int *parents = NULL;   //The ids of the parents of every link, one link after the other
+    unsigned int num_edges = 0, capacity;
     unsigned int **loc_to_children = NULL;
-    unsigned int *loc_to_children_array = NULL;
     unsigned int curr_loc;
+    NetworkBundle bundle = { 0 };
 
     *system = NULL;
     *N = 0;
@@ -87,51 +249,26 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
 
             fscanf(riverdata, "%u", N);
             link_ids = (unsigned int*)malloc(*N * sizeof(unsigned int));
-            loc_to_children_array = (unsigned int*)calloc(*N*max_children, sizeof(unsigned int));
-            loc_to_children = (unsigned int**)malloc(*N * sizeof(unsigned int*));	//This holds the ID of the children
-            for (i = 0; i < *N; i++)	
-                loc_to_children[i] = &(loc_to_children_array[i*max_children]);
             num_parents = (unsigned int*)malloc(*N * sizeof(unsigned int));
+            capacity = *N;
+            parents = (unsigned int*)malloc(capacity * sizeof(unsigned int));
 
             for (i = 0; i < *N; i++)
             {
                 fscanf(riverdata, "%u %u", &(link_ids[i]), &(num_parents[i]));
-                for (j = 0; j < num_parents[i]; j++)
+                if (num_edges + num_parents[i] > capacity)
                 {
-                    unsigned int id;
-                    fscanf(riverdata, "%u", &id);
-                    loc_to_children[i][j] = id;
-                }
-
-                if (num_parents[i] > max_children)
-                {
-                    printf("Error: assumed no link has more than %u parents, but link %u has %u.\n", max_children, link_ids[i], num_parents[i]);
-                    printf("If this is not an error in the input data, modify max_children in riversys.c, function Create_River_Network.\n");
-                    return;
+                    capacity = max(2 * capacity, num_edges + num_parents[i]);
+                    parents = (unsigned int*)realloc(parents, capacity * sizeof(unsigned int));
                 }
+                for (j = 0; j < num_parents[i]; j++)
+                    fscanf(riverdata, "%u", &(parents[num_edges++]));
             }
 
             fclose(riverdata);
-
-            //Broadcast data
-            MPI_Bcast(N, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(link_ids, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(loc_to_children_array, *N*max_children, MPI_UNSIGNED, 0, MPI_COMM_WORLD);	//Yeah, this is probably not the most efficient...
-            MPI_Bcast(num_parents, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-        }
-        else
-        {
-            MPI_Bcast(N, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            link_ids = (unsigned int*)malloc(*N * sizeof(unsigned int));
-            loc_to_children_array = (unsigned int*)malloc(*N*max_children * sizeof(unsigned int));
-            loc_to_children = (unsigned int**)malloc(*N * sizeof(unsigned int*));	//This holds the ID of the children
-            for (i = 0; i < *N; i++)	
-                loc_to_children[i] = &(loc_to_children_array[i*max_children]);
-            num_parents = (unsigned int*)malloc(*N * sizeof(unsigned int));
-            MPI_Bcast(link_ids, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(loc_to_children_array, *N*max_children, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(num_parents, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
         }
+
+        Broadcast_Topology(N, &link_ids, &num_parents, &parents);
     }
     else if (globals->rvr_flag == 1)	//Download topo data from database
     {
@@ -208,11 +345,8 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
             PQclear(res);
 
             //Modify the data format
-            loc_to_children_array = (unsigned int*)calloc(*N*max_children, sizeof(unsigned int));
-            loc_to_children = (unsigned int**)malloc(*N * sizeof(unsigned int*));	//This holds the IDs of the parents. Really needs a better name...
-            for (i = 0; i < *N; i++)	
-                loc_to_children[i] = &(loc_to_children_array[i*max_children]);
             num_parents = (unsigned int*)malloc(*N * sizeof(unsigned int));
+            parents = (unsigned int*)malloc(sizeres * sizeof(unsigned int));
 
             curr_loc = 0;
             for (i = 0; i < sizeres; i += j)
@@ -231,7 +365,7 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
 
                     //Set the information to find the child links
                     for (unsigned int k = 0; k < j; k++)
-                        loc_to_children[curr_loc][k] = dbres_parent[i + k];
+                        parents[num_edges++] = dbres_parent[i + k];
                 }
                 else	//No parents
                 {
@@ -245,29 +379,12 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
             for (; curr_loc < *N; curr_loc++)	//Finish any leaves at the end of link_ids
                 num_parents[curr_loc] = 0;
 
-            //Send sizes and data to other processes
-            MPI_Bcast(N, 1, MPI_INT, 0, MPI_COMM_WORLD);
-            MPI_Bcast(link_ids, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(loc_to_children_array, *N*max_children, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(num_parents, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-
             //Clean up
             free(dbres_link_id);
             free(dbres_parent);
         }
-        else
-        {
-            //Receive data
-            MPI_Bcast(N, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            link_ids = (unsigned int*)malloc(*N * sizeof(unsigned int));
-            loc_to_children_array = (unsigned int*)calloc(*N*max_children, sizeof(unsigned int));
-            loc_to_children = (unsigned int**)malloc(*N * sizeof(unsigned int*));	//This holds the ID of the children
-            for (i = 0; i < *N; i++)	loc_to_children[i] = &(loc_to_children_array[i*max_children]);
-            num_parents = (unsigned int*)calloc(*N, sizeof(unsigned int));
-            MPI_Bcast(link_ids, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(loc_to_children_array, *N*max_children, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-            MPI_Bcast(num_parents, *N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-        }
+
+        Broadcast_Topology(N, &link_ids, &num_parents, &parents);
 
 #else //HAVE_POSTGRESQL
 
@@ -276,6 +393,20 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
 
 #endif //HAVE_POSTGRESQL
     }
+    else if (globals->rvr_flag == 2)	//Read topo data from a network bundle
+    {
+        //Every process maps the bundle, the parents of each link are read in place
+        if (Open_Network_Bundle(globals->rvr_filename, &bundle))
+            return;
+
+        *N = bundle.header->num_links;
+        link_ids = (unsigned int*)malloc(*N * sizeof(unsigned int));
+        memcpy(link_ids, bundle.link_ids, *N * sizeof(unsigned int));
+        num_parents = (unsigned int*)malloc(*N * sizeof(unsigned int));
+        for (i = 0; i < *N; i++)
+            num_parents[i] = bundle.parent_offsets[i + 1] - bundle.parent_offsets[i];
+        parents = (unsigned int*)bundle.parents;
+    }
     else
     {
         if (my_rank == 0)	printf("Error: Bad topology flag %hi in .gbl file.\n", globals->rvr_flag);
@@ -283,14 +414,24 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
         return;
     }
 
+    //Find the parents of each link in the parent list
+    loc_to_children = (unsigned int**)malloc(*N * sizeof(unsigned int*));	//This holds the IDs of the parents
+    for (i = 0, j = 0; i < *N; j += num_parents[i], i++)
+        loc_to_children[i] = &parents[j];
+
     //Make a list of ids and locations, sorted by id
     *id_to_loc = malloc(*N * sizeof(Lookup));
-    for (i = 0; i < *N; i++)
+    if (bundle.base)
+        memcpy(*id_to_loc, bundle.lookup, *N * sizeof(Lookup));
+    else
     {
-        (*id_to_loc)[i].id = link_ids[i];
-        (*id_to_loc)[i].loc = i;
+        for (i = 0; i < *N; i++)
+        {
+            (*id_to_loc)[i].id = link_ids[i];
+            (*id_to_loc)[i].loc = i;
+        }
+        merge_sort_by_ids(*id_to_loc, *N);
     }
-    merge_sort_by_ids(*id_to_loc, *N);
 
     //Check for crapiness
     if (my_rank == 0 && *N < (unsigned int)np)
@@ -361,6 +502,8 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
             {
                 if (my_rank == 0)
                     printf("Error: Invalid id in topology data (%u).\n", loc_to_children[i][j]);
+                if (bundle.base)
+                    Close_Network_Bundle(&bundle);
                 *N = 0;
                 return;
             }
@@ -370,7 +513,7 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
     }
 
     //Set an outletlink id. This only sets one outlet, and only if rvr_flag is not set.
-    if (globals->prm_flag == 1 && globals->rvr_flag == 0)
+    if (globals->prm_flag == 1 && (globals->rvr_flag == 0 || globals->rvr_flag == 2))
     {
         for (i = 0; i < *N; i++)
             if (sys[i].child == NULL)	break;
@@ -378,10 +521,12 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
     }
 
     //Clean up
+    if (bundle.base)
+        Close_Network_Bundle(&bundle);
+    else
+        free(parents);
     if (loc_to_children)
         free(loc_to_children);
-    if (loc_to_children_array)
-        free(loc_to_children_array);
     if (link_ids)
         free(link_ids);
     if (num_parents)
@@ -390,6 +535,178 @@ void Create_River_Network(GlobalVars* globals, Link** system, unsigned int* N, L
 
 
 
+//Reads the parameters of every link from the .prm file or the database of conninfo. db_link_id and db_params have
+//room for N links. Returns 1 if there is an error, 0 otherwise.
+static int Read_Parameters(
+    unsigned int N,
+    const GlobalVars * const globals,
+    ConnData* conninfo,
+    unsigned int* db_link_id, double** db_params)
+{
+    FILE* paramdata;
+
+    if (globals->prm_flag == 0)
+    {
+        paramdata = fopen(globals->prm_filename, "r");
+        if (paramdata == NULL)
+        {
+            printf("Error: file %s not found for .prm file.\n", globals->prm_filename);
+            return 1;
+        }
+        if (CheckWinFormat(paramdata))
+        {
+            printf("Error: File %s appears to be in Windows format. Try converting to unix format using 'dos2unix' at the command line.\n", globals->prm_filename);
+            fclose(paramdata);
+            return 1;
+        }
+
+        unsigned int n;
+        fscanf(paramdata, "%u", &n);
+        if (n != N)
+        {
+            printf("Error: expected %u links in parameter file. Got %u.\n", N, n);
+            return 1;
+        }
+
+        for (unsigned int i = 0; i < N; i++)
+        {
+            fscanf(paramdata, "%u", &(db_link_id[i]));
+            for (unsigned int j = 0; j < globals->num_disk_params; j++)
+            {
+                if (fscanf(paramdata, "%lf", &(db_params[i][j])) == 0)
+                {
+                    printf("Error reading from parameter file %s.\n", globals->prm_filename);
+                    return 1;
+                }
+            }
+        }
+
+        fclose(paramdata);
+    }
+    else if (globals->prm_flag == 1)
+    {
+#if defined(HAVE_POSTGRESQL)
+        int db;
+        PGresult *res;
+
+        if (globals->outletlink == 0)	//Grab entire network
+        {
+            db = ConnectPGDB(conninfo);
+            if (db)
+            {
+                printf("[%i]: Error connecting to the parameter database.\n", my_rank);
+                return 1;
+            }
+            res = PQexec(conninfo->conn, conninfo->queries[0]);
+            if (CheckResError(res, "querying DEM data"))	return 1;
+            DisconnectPGDB(conninfo);
+        }
+        else	//Grab a sub basin
+        {
+            db = ConnectPGDB(conninfo);
+            if (db)
+            {
+                printf("[%i]: Error connecting to the parameter database.\n", my_rank);
+                return 1;
+            }
+
+            //Make the queries
+            sprintf(conninfo->query, conninfo->queries[1], globals->outletlink);
+            res = PQexec(conninfo->conn, conninfo->query);
+            if (CheckResError(res, "querying DEM data"))	return 1;
+            DisconnectPGDB(conninfo);
+        }
+
+        unsigned int n = PQntuples(res);
+        if (n != N)
+        {
+            printf("Error processing link parameters: Got %u, expected %u.\n(Hint: make sure your topology and parameter sources have the same number of links.)\n", n, N);
+            return 1;
+        }
+
+        //Load buffers
+        for (unsigned int i = 0; i < N; i++)
+            db_link_id[i] = atoi(PQgetvalue(res, i, 0));
+        for (unsigned int i = 0; i < N; i++)
+            for (unsigned int j = 0; j < globals->num_disk_params; j++)
+                db_params[i][j] = atof(PQgetvalue(res, i, 1 + j));
+
+        //Cleanup
+        PQclear(res);
+
+#else //HAVE_POSTGRESQL
+
+        if (my_rank == 0)	printf("Error: Asynch was build without PostgreSQL support.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+#endif //HAVE_POSTGRESQL
+    }
+    else
+    {
+        printf("Error: Bad parameter flag %hu in .gbl file.\n", globals->prm_flag);
+        return 1;
+    }
+
+    return 0;
+}
+
+//Sets the parameters of link from its disk_params.
+static void Set_Link_Parameters(Link* link, const double* disk_params, const GlobalVars * const globals, AsynchModel* model, void* external)
+{
+    link->num_params = globals->num_params;
+    link->params = malloc(globals->num_params * sizeof(double));
+    for (unsigned int j = 0; j < globals->num_disk_params; j++)
+        link->params[j] = disk_params[j];
+
+    if (model && model->convert)
+        model->convert(link->params, globals->model_uid, external);
+    else
+        ConvertParams(link->params, globals->model_uid, external);
+}
+
+//Reads the parameters of the links of this process from a network bundle. Every process maps the bundle and only
+//reads the rows it needs.
+static int Load_Local_Parameters_Bundle(
+    Link *system, unsigned int N,
+    int* assignments, short int* getting, const Lookup * const id_to_loc,
+    const GlobalVars * const globals,
+    AsynchModel* model,
+    void* external)
+{
+    NetworkBundle bundle;
+    if (Open_Network_Bundle(globals->prm_filename, &bundle))
+        return 1;
+
+    if (bundle.header->num_links != N || bundle.header->num_disk_params != globals->num_disk_params)
+    {
+        if (my_rank == 0)
+            printf("Error: network bundle %s has %u links with %u parameters. Expected %u links with %u parameters.\n", globals->prm_filename, bundle.header->num_links, bundle.header->num_disk_params, N, globals->num_disk_params);
+        Close_Network_Bundle(&bundle);
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < N; i++)
+    {
+        //The links are usually in the same order as in the network
+        unsigned int id = bundle.link_ids[i];
+        unsigned int curr_loc = (system[i].ID == id) ? i : find_link_by_idtoloc(id, id_to_loc, N);
+        if (curr_loc > N)
+        {
+            if (my_rank == 0)	printf("Error: link id %u appears in the link parameters, but not in the topology data.\n(Hint: make sure your topology and parameter sources are correct.)\n", id);
+            Close_Network_Bundle(&bundle);
+            return 1;
+        }
+
+        if (assignments[curr_loc] == my_rank || getting[curr_loc])
+            Set_Link_Parameters(&system[curr_loc], &bundle.params[(size_t)i * globals->num_disk_params], globals, model, external);
+    }
+
+    Close_Network_Bundle(&bundle);
+
+    return 0;
+}
+
+
 //Read in the local paramters for the network.
 //Returns 1 if there is an error, 0 otherwise.
 //If load_all == 1, then the parameters for every link are available on every proc.
@@ -405,7 +722,6 @@ int Load_Local_Parameters(
 {
     unsigned int *db_link_id, curr_loc;
     double *db_params_array, **db_params;
-    FILE* paramdata;
 
     //Error checking
     if (!assignments || !getting)
@@ -418,6 +734,9 @@ int Load_Local_Parameters(
         return 1;
     }
 
+    if (globals->prm_flag == 2)
+        return Load_Local_Parameters_Bundle(system, N, assignments, getting, id_to_loc, globals, model, external);
+
     //Allocate space
     db_link_id = (unsigned int*)malloc(N * sizeof(unsigned int));
     db_params_array = (double*)malloc(N * globals->num_disk_params * sizeof(double));
@@ -426,105 +745,8 @@ int Load_Local_Parameters(
         db_params[i] = &(db_params_array[i * globals->num_disk_params]);
 
     //Read parameters
-    if (my_rank == 0)
-    {
-        if (globals->prm_flag == 0)
-        {
-            paramdata = fopen(globals->prm_filename, "r");
-            if (paramdata == NULL)
-            {
-                printf("Error: file %s not found for .prm file.\n", globals->prm_filename);
-                return 1;
-            }
-            if (CheckWinFormat(paramdata))
-            {
-                printf("Error: File %s appears to be in Windows format. Try converting to unix format using 'dos2unix' at the command line.\n", globals->prm_filename);
-                fclose(paramdata);
-                return 1;
-            }
-
-            unsigned int n;
-            fscanf(paramdata, "%u", &n);
-            if (n != N)
-            {
-                printf("Error: expected %u links in parameter file. Got %u.\n", N, n);
-                return 1;
-            }
-
-            for (unsigned int i = 0; i < N; i++)
-            {
-                fscanf(paramdata, "%u", &(db_link_id[i]));
-                for (unsigned int j = 0; j < globals->num_disk_params; j++)
-                {
-                    if (fscanf(paramdata, "%lf", &(db_params[i][j])) == 0)
-                    {
-                        printf("Error reading from parameter file %s.\n", globals->prm_filename);
-                        return 1;
-                    }
-                }
-            }
-
-            fclose(paramdata);
-        }
-        else if (globals->prm_flag == 1)
-        {
-#if defined(HAVE_POSTGRESQL)
-            int db;
-            PGresult *res;
-
-            if (globals->outletlink == 0)	//Grab entire network
-            {
-                db = ConnectPGDB(&db_connections[ASYNCH_DB_LOC_PARAMS]);
-                if (db)
-                {
-                    printf("[%i]: Error connecting to the parameter database.\n", my_rank);
-                    return 1;
-                }
-                res = PQexec(db_connections[ASYNCH_DB_LOC_PARAMS].conn, db_connections[ASYNCH_DB_LOC_PARAMS].queries[0]);
-                if (CheckResError(res, "querying DEM data"))	return 1;
-                DisconnectPGDB(&db_connections[ASYNCH_DB_LOC_PARAMS]);
-            }
-            else	//Grab a sub basin
-            {
-                db = ConnectPGDB(&db_connections[ASYNCH_DB_LOC_PARAMS]);
-                if (db)
-                {
-                    printf("[%i]: Error connecting to the parameter database.\n", my_rank);
-                    return 1;
-                }
-
-                //Make the queries
-                sprintf(db_connections[ASYNCH_DB_LOC_PARAMS].query, db_connections[ASYNCH_DB_LOC_PARAMS].queries[1], globals->outletlink);
-                res = PQexec(db_connections[ASYNCH_DB_LOC_PARAMS].conn, db_connections[ASYNCH_DB_LOC_PARAMS].query);
-                if (CheckResError(res, "querying DEM data"))	return 1;
-                DisconnectPGDB(&db_connections[ASYNCH_DB_LOC_PARAMS]);
-            }
-
-            unsigned int n = PQntuples(res);
-            if (n != N)
-            {
-                printf("Error processing link parameters: Got %u, expected %u.\n(Hint: make sure your topology and parameter sources have the same number of links.)\n", n, N);
-                return 1;
-            }
-
-            //Load buffers
-            for (unsigned int i = 0; i < N; i++)
-                db_link_id[i] = atoi(PQgetvalue(res, i, 0));
-            for (unsigned int i = 0; i < N; i++)
-                for (unsigned int j = 0; j < globals->num_disk_params; j++)
-                    db_params[i][j] = atof(PQgetvalue(res, i, 1 + j));
-
-            //Cleanup
-            PQclear(res);
-
-#else //HAVE_POSTGRESQL
-
-            if (my_rank == 0)	printf("Error: Asynch was build without PostgreSQL support.\n");
-            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
-
-#endif //HAVE_POSTGRESQL
-        }
-    }
+    if (my_rank == 0 && Read_Parameters(N, globals, &db_connections[ASYNCH_DB_LOC_PARAMS], db_link_id, db_params))
+        return 1;
 
     //Broadcast data
     MPI_Bcast(db_link_id, N, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
@@ -541,17 +763,7 @@ int Load_Local_Parameters(
         else
         {
             if (assignments[curr_loc] == my_rank || getting[curr_loc])
-            {
-                system[curr_loc].num_params = globals->num_params;
-                system[curr_loc].params = malloc(globals->num_params * sizeof(double));
-                for (unsigned int j = 0; j < globals->num_disk_params; j++)
-                    system[curr_loc].params[j] = db_params[i][j];
-
-                if (model)
-                    model->convert(system[curr_loc].params, globals->model_uid, external);
-                else
-                    ConvertParams(system[curr_loc].params, globals->model_uid, external);
-            }
+                Set_Link_Parameters(&system[curr_loc], db_params[i], globals, model, external);
         }
     }
 
@@ -565,13 +777,139 @@ int Load_Local_Parameters(
 
 
 
+//Writes the network bundle of process 0. Returns 1 if there is an error, 0 otherwise.
+static int Write_Network_Bundle(
+    const char* filename,
+    Link *system, unsigned int N, const Lookup * const id_to_loc,
+    const GlobalVars * const globals,
+    const ConnData* db_connections)
+{
+    unsigned int num_disk_params = globals->num_disk_params;
+    int error = 0;
+
+    //Read the parameters and store them in the order of the links
+    double* params = NULL;
+    if (num_disk_params)
+    {
+        unsigned int* db_link_id = (unsigned int*)malloc(N * sizeof(unsigned int));
+        double* db_params_array = (double*)malloc((size_t)N * num_disk_params * sizeof(double));
+        double** db_params = (double**)malloc(N * sizeof(double*));
+        for (unsigned int i = 0; i < N; i++)
+            db_params[i] = &db_params_array[(size_t)i * num_disk_params];
+
+        params = (double*)malloc((size_t)N * num_disk_params * sizeof(double));
+        if (globals->prm_flag == 2)
+        {
+            printf("Error: the parameters of a network bundle must be read from a .prm file or a database.\n");
+            error = 1;
+        }
+        else
+        {
+            //Connect through a copy, so the connections of the caller are left as they are
+            ConnData conninfo = db_connections[ASYNCH_DB_LOC_PARAMS];
+            error = Read_Parameters(N, globals, &conninfo, db_link_id, db_params);
+        }
+
+        for (unsigned int i = 0; i < N && !error; i++)
+        {
+            unsigned int curr_loc = find_link_by_idtoloc(db_link_id[i], id_to_loc, N);
+            if (curr_loc > N)
+            {
+                printf("Error: link id %u appears in the link parameters, but not in the topology data.\n(Hint: make sure your topology and parameter sources are correct.)\n", db_link_id[i]);
+                error = 1;
+            }
+            else
+                memcpy(&params[(size_t)curr_loc * num_disk_params], db_params[i], num_disk_params * sizeof(double));
+        }
+
+        free(db_link_id);
+        free(db_params_array);
+        free(db_params);
+        if (error)
+        {
+            free(params);
+            return 1;
+        }
+    }
+
+    //Topology
+    NetworkBundleHeader header = { { 'A', 'N', 'B', 'D' }, ASYNCH_NBD_VERSION, N, 0, num_disk_params, { 0 } };
+    uint32_t* link_ids = (uint32_t*)malloc(N * sizeof(uint32_t));
+    uint32_t* parent_offsets = (uint32_t*)malloc((N + 1) * sizeof(uint32_t));
+    for (unsigned int i = 0; i < N; i++)
+    {
+        link_ids[i] = system[i].ID;
+        parent_offsets[i] = header.num_parents;
+        header.num_parents += system[i].num_parents;
+    }
+    parent_offsets[N] = header.num_parents;
+
+    uint32_t* parents = (uint32_t*)malloc(header.num_parents * sizeof(uint32_t));
+    for (unsigned int i = 0; i < N; i++)
+        for (unsigned int j = 0; j < system[i].num_parents; j++)
+            parents[parent_offsets[i] + j] = system[i].parents[j]->ID;
+
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+    {
+        printf("Error: cannot create network bundle %s.\n", filename);
+        error = 1;
+    }
+    else
+    {
+        size_t offset = sizeof(header) + (2 * (size_t)N + 1 + header.num_parents) * sizeof(uint32_t) + (size_t)N * sizeof(Lookup);
+        size_t padding = Network_Bundle_Params_Offset(N, header.num_parents) - offset;
+        const char zeros[8] = { 0 };
+
+        if (fwrite(&header, sizeof(header), 1, file) != 1
+            || fwrite(link_ids, sizeof(uint32_t), N, file) != N
+            || fwrite(parent_offsets, sizeof(uint32_t), N + 1, file) != N + 1
+            || fwrite(parents, sizeof(uint32_t), header.num_parents, file) != header.num_parents
+            || fwrite(id_to_loc, sizeof(Lookup), N, file) != N
+            || (num_disk_params && (fwrite(zeros, 1, padding, file) != padding
+                || fwrite(params, sizeof(double), (size_t)N * num_disk_params, file) != (size_t)N * num_disk_params)))
+            error = 1;
+        if (fclose(file))
+            error = 1;
+        if (error)
+            printf("Error: cannot write to network bundle %s.\n", filename);
+    }
+
+    //Clean up
+    free(link_ids);
+    free(parent_offsets);
+    free(parents);
+    free(params);
+
+    return error;
+}
+
+//Writes the network topology, the link id lookup and the parameters of every link to a network bundle (.nbd),
+//which can then be given as the topology and parameter source in a global file. Only process 0 writes.
+//Returns 1 if there is an error, 0 otherwise.
+int Save_Network_Bundle(
+    const char* filename,
+    Link *system, unsigned int N, const Lookup * const id_to_loc,
+    const GlobalVars * const globals,
+    const ConnData* db_connections)
+{
+    int error = 0;
+    if (my_rank == 0)
+        error = Write_Network_Bundle(filename, system, N, id_to_loc, globals, db_connections);
+    MPI_Bcast(&error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    return error;
+}
+
+
 //Partitions the network amongst different MPI processes.
 //!!!! Perhaps the leaves info could be moved deeper? How about errors here? !!!!
 int Partition_Network(
     Link *system, unsigned int N,
     const GlobalVars * const globals,
     Link*** my_sys, unsigned int* my_N, int** assignments,
-    TransData** my_data, short int** getting, AsynchModel* model)
+    TransData** my_data, short int** getting,
+    const Lookup * const id_to_loc, AsynchModel* model)
 {
     Link *current, *prev;
 
@@ -635,11 +973,26 @@ int Partition_Network(
         }
     }
 
+    //Costs measured in a previous run are used as the work of the links, which only a partitioning by work can use
+    bool measured_costs = false;
+    if (globals->cost_load_filename)
+    {
+        if (Load_Link_Costs(globals->cost_load_filename, system, N, id_to_loc))
+        {
+            free(stack);
+            free(leaves);
+            return 1;
+        }
+        measured_costs = true;
+    }
+
     //Partition the system and assign the links
     *my_data = Initialize_TransData();
     *getting = (short int*)malloc(N * sizeof(short int));
     if (model && model->partition)
         *assignments = model->partition(system, N, leaves, leaves_size, my_sys, my_N, *my_data, *getting);
+    else if (measured_costs)
+        *assignments = Partition_System_By_Subtrees(system, N, leaves, leaves_size, my_sys, my_N, *my_data, *getting);
     else
     {
         *assignments = Partition_System_By_Leaves(system, N, leaves, leaves_size, my_sys, my_N, *my_data, *getting);
@@ -782,6 +1135,9 @@ int Build_RKData(
                 current->my->error_data->facmax = error_data->facmax;
                 current->my->error_data->facmin = error_data->facmin;
                 current->my->error_data->fac = error_data->fac;
+                current->my->error_data->controller = error_data->controller;
+                current->my->error_data->alpha = error_data->alpha;
+                current->my->error_data->beta = error_data->beta;
 
                 for (unsigned int j = 0; j < num_states; j++)
                 {
@@ -810,6 +1166,95 @@ int Build_RKData(
     return 0;
 }
 
+//Reserves the per link storage of link in the arena of the process. Links owned by this process also get their
+//forcing arrays. Returns the number of bytes needed, without reserving anything, if reserve is false.
+static size_t Reserve_Link(Link* link, bool owned, int* assignments, GlobalVars* globals, bool reserve)
+{
+    //List, 4 forcing arrays, discont, discont_send, discont_order_send and peak_value
+    size_t sizes[9] = { 0 };
+    void **ptrs[9] = { NULL };
+    size_t total = 0;
+    unsigned int num = 0;
+
+    sizes[num] = List_Storage_Size(link->dim, link->num_dense, link->method->num_stages, link->method->dense_degree, List_Length(link, assignments, globals), globals->float_history);
+    ptrs[num++] = &link->my->list_storage;
+    if (owned && globals->num_forcings)
+    {
+        sizes[num] = globals->num_forcings * sizeof(TimeSerie);
+        ptrs[num++] = (void**)&link->my->forcing_data;
+        sizes[num] = globals->num_forcings * sizeof(double);
+        ptrs[num++] = (void**)&link->my->forcing_values;
+        sizes[num] = globals->num_forcings * sizeof(double);
+        ptrs[num++] = (void**)&link->my->forcing_change_times;
+        sizes[num] = globals->num_forcings * sizeof(unsigned int);
+        ptrs[num++] = (void**)&link->my->forcing_indices;
+    }
+    if (link->num_parents)
+    {
+        sizes[num] = globals->discont_size * sizeof(double);
+        ptrs[num++] = (void**)&link->discont;
+    }
+    if (link->child && my_rank != assignments[link->child->location])
+    {
+        sizes[num] = globals->discont_size * sizeof(double);
+        ptrs[num++] = (void**)&link->discont_send;
+        sizes[num] = globals->discont_size * sizeof(unsigned int);
+        ptrs[num++] = (void**)&link->discont_order_send;
+    }
+    sizes[num] = link->dim * sizeof(double);
+    ptrs[num++] = (void**)&link->peak_value;
+
+    for (unsigned int i = 0; i < num; i++)
+    {
+        total += Arena_Round(sizes[i]);
+        if (reserve)
+        {
+            *ptrs[i] = Arena_Alloc(&globals->arena, sizes[i]);
+            if (*ptrs[i] == NULL)
+                return 0;
+        }
+    }
+    if (reserve)
+        link->my->pooled = true;
+
+    return total;
+}
+
+//Carves the solution lists, forcing arrays, discontinuity lists and peak values of the links of this process from a
+//single arena. Links are laid out in the order of my_sys, which is the order the scheduler visits them, followed by
+//the links only received from other processes.
+//Returns 0 if everything is ok, 1 if an error occurred.
+static int Reserve_Link_Storage(
+    Link* system, unsigned int N,
+    Link **my_sys, unsigned int my_N,
+    int* assignments, short int* getting,
+    GlobalVars* globals)
+{
+    size_t total = 0;
+    for (unsigned int i = 0; i < my_N; i++)
+        total += Reserve_Link(my_sys[i], true, assignments, globals, false);
+    for (unsigned int i = 0; i < N; i++)
+        if (assignments[i] != my_rank && getting[i])
+            total += Reserve_Link(&system[i], false, assignments, globals, false);
+
+    Arena_Init(&globals->arena, total);
+
+    bool ok = true;
+    for (unsigned int i = 0; i < my_N && ok; i++)
+        ok = Reserve_Link(my_sys[i], true, assignments, globals, true) > 0;
+    for (unsigned int i = 0; i < N && ok; i++)
+        if (assignments[i] != my_rank && getting[i])
+            ok = Reserve_Link(&system[i], false, assignments, globals, true) > 0;
+
+    if (!ok)
+    {
+        printf("[%i]: Error: could not allocate %zu bytes for the link storage.\n", my_rank, total);
+        return 1;
+    }
+
+    return 0;
+}
+
 //Runs the init routine for the model. Also performs precalculations.
 //Returns 0 if everything is ok, 1 if an error occurred.
 int Initialize_Model(
@@ -826,7 +1271,7 @@ int Initialize_Model(
     {
         if (assignments[i] == my_rank || getting[i])
         {
-            if (model)
+            if (model && model->routines)
             {
                 model->routines(&system[i], globals->model_uid, system[i].method->exp_imp, system[i].has_dam, external);
                 model->precalculations(&system[i], globals->global_params, system[i].params, system[i].has_dam, external);
@@ -904,6 +1349,14 @@ int Initialize_Model(
     for (i = 0; i < N; i++)
         MPI_Bcast(&(system[i].num_dense), 1, MPI_UNSIGNED, assignments[i], MPI_COMM_WORLD);
 
+    //The sizes of the per link storage are known now
+    if (globals->arena_flag)
+    {
+        my_error_code = Reserve_Link_Storage(system, N, my_sys, my_N, assignments, getting, globals);
+        MPI_Allreduce(&my_error_code, &error_code, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+        if (error_code)	return 1;
+    }
+
     return 0;
 }
 
@@ -1012,7 +1465,7 @@ static int Load_Initial_Conditions_Ini(
                         system[loc].params, globals->num_params,
                         system[loc].qvs, system[loc].has_dam, y_0, system[loc].dim, globals->model_uid, diff_start, no_ini_start, system[loc].user, external);
 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, system[loc].dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, system[loc].dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, system[loc].my->list_storage);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1080,7 +1533,7 @@ static int Load_Initial_Conditions_Ini(
                         system[loc].params, globals->num_params,
                         system[loc].qvs, system[loc].has_dam, y_0, system[loc].dim, globals->model_uid, diff_start, no_ini_start, system[loc].user, external);
                 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, system[loc].dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, system[loc].dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, system[loc].my->list_storage);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1197,7 +1650,7 @@ static int Load_Initial_Conditions_Uini(
                     system[i].params, globals->num_params,
                     system[i].qvs, system[i].has_dam, y_0, system[i].dim, globals->model_uid, diff_start, no_ini_start, system[i].user, external);
 
-            Init_List(&system[i].my->list, globals->t_0, y_0, system[i].dim, system[i].num_dense, system[i].method->num_stages, globals->iter_limit);
+            Init_List(&system[i].my->list, globals->t_0, y_0, system[i].dim, system[i].num_dense, system[i].method->num_stages, system[i].method->dense_degree, List_Length(&system[i], assignments, globals), globals->float_history, system[i].my->list_storage);
             system[i].my->list.head->state = system[i].state;
             system[i].last_t = globals->t_0;
             //v_copy(y_0_backup,y_0);
@@ -1295,7 +1748,7 @@ static int Load_Initial_Conditions_Rec(
                 if (system[loc].check_state)
                     system[loc].state = system[loc].check_state(y_0, system[loc].dim, globals->global_params, globals->num_global_params, system[loc].params, system[loc].num_params, system[loc].qvs, system[loc].state, system[loc].user);
                 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, system[loc].dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, system[loc].dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, system[loc].my->list_storage);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1347,7 +1800,7 @@ static int Load_Initial_Conditions_Rec(
                 if (system[loc].check_state)
                     system[loc].state = system[loc].check_state(y_0, dim, globals->global_params, globals->num_global_params, system[loc].params, system[loc].num_params, system[loc].qvs, system[loc].state, system[loc].user);
                 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, system[loc].my->list_storage);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1428,7 +1881,8 @@ static int Load_Initial_Conditions_Dbc(
                 if (system[loc].check_state != NULL)
                     system[loc].state = system[loc].check_state(y_0, dim, globals->global_params, globals->num_global_params, system[loc].params, system[loc].num_params, system[loc].qvs, system[loc].state, system[loc].user);
 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                //The storage reserved in the arena only fits lists with the dimension of the model
+                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, (dim == system[loc].dim) ? system[loc].my->list_storage : NULL);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1476,7 +1930,7 @@ static int Load_Initial_Conditions_Dbc(
                 if (system[loc].check_state != NULL)
                     system[loc].state = system[loc].check_state(y_0, dim, globals->global_params, globals->num_global_params, system[loc].params, system[loc].num_params, system[loc].qvs, system[loc].state, system[loc].user);
 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, (dim == system[loc].dim) ? system[loc].my->list_storage : NULL);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1588,7 +2042,7 @@ static int Load_Initial_Conditions_H5(
                 if (system[loc].check_state)
                     system[loc].state = system[loc].check_state(y_0, dim, globals->global_params, globals->num_global_params, system[loc].params, system[loc].num_params, system[loc].qvs, system[loc].state, system[loc].user);
 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, system[loc].my->list_storage);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1642,7 +2096,7 @@ static int Load_Initial_Conditions_H5(
                 if (system[loc].check_state)
                     system[loc].state = system[loc].check_state(y_0, dim, globals->global_params, globals->num_global_params, system[loc].params, system[loc].num_params, system[loc].qvs, system[loc].state, system[loc].user);
 
-                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, globals->iter_limit);
+                Init_List(&system[loc].my->list, globals->t_0, y_0, dim, system[loc].num_dense, system[loc].method->num_stages, system[loc].method->dense_degree, List_Length(&system[loc], assignments, globals), globals->float_history, system[loc].my->list_storage);
                 system[loc].my->list.head->state = system[loc].state;
                 system[loc].last_t = globals->t_0;
             }
@@ -1700,10 +2154,331 @@ int Load_Initial_Conditions(
         res = -1;
     }
 
+    //The lists were just created with their initial capacity
+    if (res == 0)
+    {
+        for (unsigned int i = 0; i < N; i++)
+        {
+            if (system[i].my)
+            {
+                system[i].iter_limit = List_Length(&system[i], assignments, globals);
+                system[i].my->peak_iterations = 1;
+            }
+        }
+    }
+
     return res;
 }
 
 
+//Version of the binary storm files (.bstr)
+#define ASYNCH_BSTR_VERSION 1
+
+//Entry of the index of a binary storm file
+typedef struct BstrEntry
+{
+    uint32_t link_id;
+    uint32_t num_points;
+    uint64_t offset;    //Position in the file of the series of the link
+} BstrEntry;
+
+//Moves to offset bytes from the start of file. The series of a large file may lie past the 2 GB a long can reach.
+static int Seek_Bstr_Offset(FILE* file, uint64_t offset)
+{
+#if defined(_MSC_VER)
+    return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+//Sets the series of forcing l at link from the m points in buffer (the last one is the ceiling).
+static void Set_Storm_Series(Link* link, unsigned int l, const DataPoint* buffer, unsigned int m, const GlobalVars * const globals)
+{
+    TimeSerie *forcing_data = &link->my->forcing_data[l];
+
+    if (!(globals->res_flag) || !(l == globals->res_forcing_idx) || link->has_res)
+    {
+        forcing_data->data = malloc(m * sizeof(DataPoint));
+        forcing_data->num_points = m;
+
+        //Read in the storm data for this link
+        for (unsigned int j = 0; j < m; j++)
+            forcing_data->data[j] = buffer[j];
+
+        double rainfall_buffer = forcing_data->data[0].value;
+        link->my->forcing_values[l] = rainfall_buffer;
+        link->my->forcing_indices[l] = 0;
+        unsigned int j;
+        for (j = 1; j < forcing_data->num_points; j++)
+        {
+            if (fabs(forcing_data->data[j].value - rainfall_buffer) > 1e-8)
+            {
+                link->my->forcing_change_times[l] = forcing_data->data[j].time;
+                break;
+            }
+        }
+        if (j == forcing_data->num_points)
+        {
+            link->my->forcing_change_times[l] = forcing_data->data[j - 1].time;
+            link->my->forcing_indices[l] = j - 1;
+        }
+    }
+    else	//No reservoir here
+    {
+        unsigned int m = 2;	//Init value (assumed 0.0)
+
+        forcing_data->data = malloc(m * sizeof(DataPoint));
+        forcing_data->num_points = m;
+
+        forcing_data->data[0].time = globals->t_0;
+        forcing_data->data[0].value = 0.0;
+        forcing_data->data[1].time = globals->maxtime;
+        forcing_data->data[1].value = -1.0;
+
+        double rainfall_buffer = forcing_data->data[0].value;
+        link->my->forcing_values[l] = rainfall_buffer;
+        link->my->forcing_indices[l] = 0;
+        unsigned int j;
+        for (j = 1; j < forcing_data->num_points; j++)
+        {
+            if (fabs(forcing_data->data[j].value - rainfall_buffer) > 1e-8)
+            {
+                link->my->forcing_change_times[l] = forcing_data->data[j].time;
+                break;
+            }
+        }
+        if (j == forcing_data->num_points)
+            link->my->forcing_change_times[l] = forcing_data->data[j - 1].time;
+    }
+}
+
+
+//Reads a storm file (.str). Process 0 parses the file and sends the series of each link to its process.
+static int Load_Forcing_Str(
+    Link *system, unsigned int N,
+    int* assignments, const Lookup * const id_to_loc,
+    const GlobalVars * const globals,
+    Forcing* forcing, unsigned int l,
+    MPI_Datatype mpi_datapoint_type)
+{
+    unsigned int limit, loc;
+    FILE* forcingfile = NULL;
+
+    if (my_rank == 0)
+    {
+        //Open .str file
+        forcingfile = fopen(forcing->filename, "r");
+        if (!forcingfile)
+        {
+            printf("Error: cannot open forcing file %s.\n", forcing->filename);
+            return 1;
+        }
+        if (CheckWinFormat(forcingfile))
+        {
+            printf("Error: File %s appears to be in Windows format. Try converting to unix format using 'dos2unix' at the command line.\n", forcing->filename);
+            fclose(forcingfile);
+            return 1;
+        }
+        
+        fscanf(forcingfile, "%u", &limit);
+        if (limit != N && (!(globals->res_flag) || l != globals->res_forcing_idx))
+        {
+            printf("Error: Number of links in .str file differs from number of links in network (%u vs %u).\n", limit, N);
+            fclose(forcingfile);
+            return 1;
+        }
+    }
+
+    //Get total number of links with data
+    MPI_Bcast(&limit, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+
+    //Setup buffers at each link
+    for (unsigned int i = 0; i < limit; i++)
+    {
+        DataPoint *buffer = NULL;
+        unsigned int m;
+        if (my_rank == 0)
+        {
+            //Get location
+            unsigned int id;
+            fscanf(forcingfile, "%i", &id);
+            loc = find_link_by_idtoloc(id, id_to_loc, N);
+            if (loc >= N)
+            {
+                printf("Error: forcing data provided for link id %u in forcing %u, but link id is not in the network.\n", id, l);
+                fclose(forcingfile);
+                return 1;
+            }
+
+            //Read values
+            fscanf(forcingfile, "%i", &m);
+            m++;		//Increase this by one to add a "ceiling" term
+            buffer = realloc(buffer, m * sizeof(DataPoint));
+            for (unsigned int j = 0; j < m - 1; j++)
+                fscanf(forcingfile, "%lf %f", &(buffer[j].time), &(buffer[j].value));
+            buffer[m - 1].time = globals->maxtime;
+            buffer[m - 1].value = -1.0f;
+
+            //Send data
+            MPI_Bcast(&loc, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+            if (assignments[loc] != my_rank)
+            {
+                MPI_Send(&m, 1, MPI_UNSIGNED, assignments[loc], 1, MPI_COMM_WORLD);
+                MPI_Send(buffer, m, mpi_datapoint_type, assignments[loc], 1, MPI_COMM_WORLD);
+            }
+        }
+        else
+        {
+            MPI_Bcast(&loc, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+            if (assignments[loc] == my_rank)
+            {
+                MPI_Recv(&m, 1, MPI_UNSIGNED, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                buffer = realloc(buffer, m * sizeof(DataPoint));
+                MPI_Recv(buffer, m, mpi_datapoint_type, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            }
+        }
+
+        if (assignments[loc] == my_rank)
+            Set_Storm_Series(&system[loc], l, buffer, m, globals);
+    }
+
+
+    //Clean up
+    if (forcingfile)
+        fclose(forcingfile);
+
+    return 0;
+}
+
+
+//Reads a binary storm file (.bstr). Process 0 reads the index of the file and broadcasts it, then every process reads
+//the series of its own links. The file starts with a header (the characters BSTR, the version, the number of links
+//and a zero, as 32 bit integers), followed by an entry for each link (link id, number of points and offset in the
+//file of its series) and the series. A series holds the times of the points as doubles, then their values as floats.
+//Numbers are in the byte order of the machine that wrote the file.
+static int Load_Forcing_Bstr(
+    Link *system, unsigned int N,
+    int* assignments, const Lookup * const id_to_loc,
+    const GlobalVars * const globals,
+    Forcing* forcing, unsigned int l)
+{
+    uint32_t header[4] = { 0 };
+    BstrEntry* index = NULL;
+    unsigned int limit = 0, capacity = 0;
+    int error = 0;
+    FILE* forcingfile = NULL;
+
+    if (my_rank == 0)
+    {
+        forcingfile = fopen(forcing->filename, "rb");
+        if (!forcingfile)
+        {
+            printf("Error: cannot open forcing file %s.\n", forcing->filename);
+            error = 1;
+        }
+        else if (fread(header, sizeof(uint32_t), 4, forcingfile) != 4 || memcmp(header, "BSTR", 4) || header[1] != ASYNCH_BSTR_VERSION)
+        {
+            printf("Error: %s is not a binary storm file of version %u, or was written with another byte order.\n", forcing->filename, ASYNCH_BSTR_VERSION);
+            error = 1;
+        }
+        else if ((limit = header[2]) != N && (!(globals->res_flag) || l != globals->res_forcing_idx))
+        {
+            printf("Error: Number of links in .bstr file differs from number of links in network (%u vs %u).\n", limit, N);
+            error = 1;
+        }
+        else
+        {
+            index = malloc(limit * sizeof(BstrEntry));
+            if (fread(index, sizeof(BstrEntry), limit, forcingfile) != limit)
+            {
+                printf("Error: cannot read the index of forcing file %s.\n", forcing->filename);
+                error = 1;
+            }
+        }
+
+        if (forcingfile)
+            fclose(forcingfile);
+    }
+
+    MPI_Bcast(&error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (error)
+    {
+        free(index);
+        return 1;
+    }
+
+    //Get the index
+    MPI_Bcast(&limit, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    if (my_rank != 0)
+        index = malloc(limit * sizeof(BstrEntry));
+    MPI_Bcast(index, limit * sizeof(BstrEntry), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    forcingfile = fopen(forcing->filename, "rb");
+    if (!forcingfile)
+    {
+        printf("[%i]: Error: cannot open forcing file %s.\n", my_rank, forcing->filename);
+        free(index);
+        return 1;
+    }
+
+    //Read the series of the links of this process
+    DataPoint *buffer = NULL;
+    double *times = NULL;
+    float *values = NULL;
+    for (unsigned int i = 0; i < limit && !error; i++)
+    {
+        unsigned int loc = find_link_by_idtoloc(index[i].link_id, id_to_loc, N);
+        if (loc >= N)
+        {
+            if (my_rank == 0)
+                printf("Error: forcing data provided for link id %u in forcing %u, but link id is not in the network.\n", index[i].link_id, l);
+            error = 1;
+            break;
+        }
+        if (assignments[loc] != my_rank)
+            continue;
+
+        unsigned int m = index[i].num_points + 1;  //Add a "ceiling" term
+        if (m > capacity)
+        {
+            capacity = m;
+            buffer = realloc(buffer, capacity * sizeof(DataPoint));
+            times = realloc(times, capacity * sizeof(double));
+            values = realloc(values, capacity * sizeof(float));
+        }
+
+        if (Seek_Bstr_Offset(forcingfile, index[i].offset)
+            || fread(times, sizeof(double), m - 1, forcingfile) != m - 1
+            || fread(values, sizeof(float), m - 1, forcingfile) != m - 1)
+        {
+            printf("[%i]: Error: cannot read the forcing data of link id %u from %s.\n", my_rank, index[i].link_id, forcing->filename);
+            error = 1;
+            break;
+        }
+
+        for (unsigned int j = 0; j < m - 1; j++)
+        {
+            buffer[j].time = times[j];
+            buffer[j].value = values[j];
+        }
+        buffer[m - 1].time = globals->maxtime;
+        buffer[m - 1].value = -1.0f;
+
+        Set_Storm_Series(&system[loc], l, buffer, m, globals);
+    }
+
+    //Clean up
+    fclose(forcingfile);
+    free(buffer);
+    free(times);
+    free(values);
+    free(index);
+
+    return error;
+}
+
+
 //Loads the forcing data specified in the global file.
 int Load_Forcings(
     Link *system, unsigned int N,
@@ -1730,6 +2505,8 @@ int Load_Forcings(
     for (unsigned int i = 0; i < my_N; i++)
     {
         Link *current = my_sys[i];
+        if (current->my->pooled)
+            continue;
         current->my->forcing_data = malloc(globals->num_forcings * sizeof(TimeSerie));
         current->my->forcing_values = calloc(globals->num_forcings, sizeof(double));
         current->my->forcing_change_times = calloc(globals->num_forcings, sizeof(double));
@@ -1764,147 +2541,24 @@ int Load_Forcings(
         }
         else if (forcings[l].flag == 1)	//Storm file
         {
-            unsigned int limit, loc;
-            FILE* forcingfile = NULL;
+            int res;
 
             //Set routines
             forcings[l].GetPasses = &PassesOther;
             forcings[l].GetNextForcing = &NextForcingOther;
 
-            if (my_rank == 0)
-            {
-                //Open .str file
-                forcingfile = fopen(forcings[l].filename, "r");
-                if (!forcingfile)
-                {
-                    printf("Error: cannot open forcing file %s.\n", forcings[l].filename);
-                    return 1;
-                }
-                if (CheckWinFormat(forcingfile))
-                {
-                    printf("Error: File %s appears to be in Windows format. Try converting to unix format using 'dos2unix' at the command line.\n", forcings[l].filename);
-                    fclose(forcingfile);
-                    return 1;
-                }
-                
-                fscanf(forcingfile, "%u", &limit);
-                if (limit != N && (!(globals->res_flag) || l != globals->res_forcing_idx))
-                {
-                    printf("Error: Number of links in .str file differs from number of links in network (%u vs %u).\n", limit, N);
-                    return 1;
-                }
-            }
-
-            //Get total number of links with data
-            MPI_Bcast(&limit, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-
-            //Setup buffers at each link
-            for (unsigned int i = 0; i < limit; i++)
-            {
-                DataPoint *buffer = NULL;
-                unsigned int m;
-                if (my_rank == 0)
-                {
-                    //Get location
-                    unsigned int id;
-                    fscanf(forcingfile, "%i", &id);
-                    loc = find_link_by_idtoloc(id, id_to_loc, N);
-                    if (loc >= N)
-                    {
-                        printf("Error: forcing data provided for link id %u in forcing %u, but link id is not in the network.\n", id, l);
-                        return 1;
-                    }
-
-                    //Read values
-                    fscanf(forcingfile, "%i", &m);
-                    m++;		//Increase this by one to add a "ceiling" term
-                    buffer = realloc(buffer, m * sizeof(DataPoint));
-                    for (unsigned int j = 0; j < m - 1; j++)
-                        fscanf(forcingfile, "%lf %f", &(buffer[j].time), &(buffer[j].value));
-                    buffer[m - 1].time = globals->maxtime;
-                    buffer[m - 1].value = -1.0f;
-
-                    //Send data
-                    MPI_Bcast(&loc, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-                    if (assignments[loc] != my_rank)
-                    {
-                        MPI_Send(&m, 1, MPI_UNSIGNED, assignments[loc], 1, MPI_COMM_WORLD);
-                        MPI_Send(buffer, m, mpi_datapoint_type, assignments[loc], 1, MPI_COMM_WORLD);
-                    }
-                }
-                else
-                {
-                    MPI_Bcast(&loc, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-                    if (assignments[loc] == my_rank)
-                    {
-                        MPI_Recv(&m, 1, MPI_UNSIGNED, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                        buffer = realloc(buffer, m * sizeof(DataPoint));
-                        MPI_Recv(buffer, m, mpi_datapoint_type, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                    }
-                }
-
-                if (assignments[loc] == my_rank)
-                {
-                    //TimeSerie* forcing_data = malloc(sizeof(TimeSerie));
-                    //system[loc].my->forcing_data[l] = forcing_data;
-                    TimeSerie *forcing_data = &system[loc].my->forcing_data[l];
-
-                    if (!(globals->res_flag) || !(l == globals->res_forcing_idx) || system[loc].has_res)
-                    {
-                        forcing_data->data = malloc(m * sizeof(DataPoint));
-                        forcing_data->num_points = m;
-
-                        //Read in the storm data for this link
-                        for (unsigned int j = 0; j < m; j++)
-                            forcing_data->data[j] = buffer[j];
-
-                        double rainfall_buffer = forcing_data->data[0].value;
-                        system[loc].my->forcing_values[l] = rainfall_buffer;
-                        system[loc].my->forcing_indices[l] = 0;
-                        unsigned int j;
-                        for (j = 1; j < forcing_data->num_points; j++)
-                        {
-                            if (fabs(forcing_data->data[j].value - rainfall_buffer) > 1e-8)
-                            {
-                                system[loc].my->forcing_change_times[l] = forcing_data->data[j].time;
-                                break;
-                            }
-                        }
-                        if (j == forcing_data->num_points)
-                        {
-                            system[loc].my->forcing_change_times[l] = forcing_data->data[j - 1].time;
-                            system[loc].my->forcing_indices[l] = j - 1;
-                        }
-                    }
-                    else	//No reservoir here
-                    {
-                        unsigned int m = 2;	//Init value (assumed 0.0)
-
-                        forcing_data->data = malloc(m * sizeof(DataPoint));
-                        forcing_data->num_points = m;
-
-                        forcing_data->data[0].time = globals->t_0;
-                        forcing_data->data[0].value = 0.0;
-                        forcing_data->data[1].time = globals->maxtime;
-                        forcing_data->data[1].value = -1.0;
+            //Setup buffers at each link. Links missing from a reservoir forcing get the default series below.
+            for (unsigned int i = 0; i < N; i++)
+                if (assignments[i] == my_rank)
+                    system[i].my->forcing_data[l].data = NULL;
 
-                        double rainfall_buffer = forcing_data->data[0].value;
-                        system[loc].my->forcing_values[l] = rainfall_buffer;
-                        system[loc].my->forcing_indices[l] = 0;
-                        unsigned int j;
-                        for (j = 1; j < forcing_data->num_points; j++)
-                        {
-                            if (fabs(forcing_data->data[j].value - rainfall_buffer) > 1e-8)
-                            {
-                                system[loc].my->forcing_change_times[l] = forcing_data->data[j].time;
-                                break;
-                            }
-                        }
-                        if (j == forcing_data->num_points)
-                            system[loc].my->forcing_change_times[l] = forcing_data->data[j - 1].time;
-                    }
-                } //if(assigned to me)
-            }
+            //Read the series of the links of this process
+            if (forcings[l].binary_storm)
+                res = Load_Forcing_Bstr(system, N, assignments, id_to_loc, globals, &forcings[l], l);
+            else
+                res = Load_Forcing_Str(system, N, assignments, id_to_loc, globals, &forcings[l], l, mpi_datapoint_type);
+            if (res)
+                return 1;
 
             //Allocate space for links without a reservoir
             if (globals->res_flag && l == globals->res_forcing_idx)
@@ -1915,7 +2569,7 @@ int Load_Forcings(
                     {
                         unsigned int m = 2;	//Init value (assumed 0.0)
 
-                        TimeSerie* forcing_data = &system[loc].my->forcing_data[l];
+                        TimeSerie* forcing_data = &system[i].my->forcing_data[l];
 
                         forcing_data->data = malloc(m * sizeof(DataPoint));
                         forcing_data->num_points = m;
@@ -1942,10 +2596,6 @@ int Load_Forcings(
                     }
                 }
             }
-
-            //Clean up
-            if (forcingfile)
-                fclose(forcingfile);
         }
         else if (forcings[l].flag == 2)	//Binary files
         {
@@ -2128,7 +2778,6 @@ int Load_Forcings(
                 MPI_Bcast(forcings[l].grid_to_linkid[i], forcings[l].num_links_in_grid[i], MPI_UNSIGNED, 0, MPI_COMM_WORLD);
 
             forcings[l].received = (char*)malloc(forcings[l].num_cells * sizeof(char));
-            forcings[l].intensities = (float*)malloc(forcings[l].num_cells * sizeof(float));
 
             //Remove from grid_to_linkid all links not on this proc
             for (i = 0; i < forcings[l].num_cells; i++)
@@ -2996,45 +3645,13 @@ int FinalizeSystem(
     Link **my_sys, unsigned int my_N,
     int* assignments, short int* getting, const Lookup * const id_to_loc, TransData* my_data, GlobalVars* globals, ConnData* db_connections, Workspace* workspace)
 {
-    unsigned int i, j;
-    int ii;
-    Link* current;
+    unsigned int i;
 
     //Initialize workspace
     Create_Workspace(workspace, globals->max_dim, globals->max_rk_stages, globals->max_parents);
 
-    //Need space for nodes, number of iterations, discontinuities
-    //Data: ( size(double)*(max_rk_stages*max_dim + max_dim + time)*# steps to transfer + size(int)(for stage)*# steps to transfer + size(int)*(location + # steps to transfer) ) * # of sending links
-    //Upstream: + size(int) * (location + # of iterations) * # of receiving links
-    //Discontinuities: + (size(int) + size(double)*discont_size + size(int)*discont_size) * # of sending links
-    //unsigned int bytes1 = ( (sizeof(double)*(globals->max_rk_stages*2 + 2 + 1) + sizeof(int) )*globals->max_transfer_steps + sizeof(int)*2);
-    unsigned int bytes2 = 2 * sizeof(int);
-    unsigned int bytes3 = sizeof(int) + (sizeof(int) + sizeof(double))*globals->discont_size;
-    for (ii = 0; ii < np; ii++)
-    {
-        my_data->send_buffer_size[ii] = bytes2 * my_data->receive_size[ii] + bytes3 * my_data->send_size[ii];
-        for (j = 0; j < my_data->send_size[ii]; j++)
-        {
-            current = my_data->send_data[ii][j];
-            my_data->send_buffer_size[ii] += (sizeof(double)*(current->method->num_stages * current->num_dense + current->dim + 1) + sizeof(int))*globals->max_transfer_steps + sizeof(int) * 2;
-        }
-
-        my_data->receive_buffer_size[ii] = bytes2 * my_data->send_size[ii] + bytes3 * my_data->receive_size[ii];
-        for (j = 0; j < my_data->receive_size[ii]; j++)
-        {
-            current = my_data->receive_data[ii][j];
-            my_data->receive_buffer_size[ii] += (sizeof(double)*(current->method->num_stages * current->num_dense + current->dim + 1) + sizeof(int))*globals->max_transfer_steps + sizeof(int) * 2;
-        }
-
-        //(*my_data)->send_buffer_size[ii] = bytes1 * (*my_data)->send_size[ii] + bytes2 * (*my_data)->receive_size[ii] + bytes3 * (*my_data)->send_size[ii];
-        //(*my_data)->receive_buffer_size[ii] = bytes1 * (*my_data)->receive_size[ii] + bytes2*(*my_data)->send_size[ii] + bytes3 * (*my_data)->receive_size[ii];
-
-        if (my_data->send_buffer_size[ii])	my_data->send_buffer[ii] = (char*)malloc(my_data->send_buffer_size[ii] * sizeof(char));
-        else					my_data->send_buffer[ii] = NULL;
-
-        if (my_data->receive_buffer_size[ii])	my_data->receive_buffer[ii] = (char*)malloc(my_data->receive_buffer_size[ii] * sizeof(char));
-        else					my_data->receive_buffer[ii] = NULL;
-    }
+    //Allocate the buffers for the data exchanged with the other processes
+    Allocate_TransData_Buffers(my_data, globals);
 
     //Do initializations
     for (i = 0; i < N; i++)
@@ -3042,12 +3659,15 @@ int FinalizeSystem(
         if (assignments[i] == my_rank || getting[i])
         {
             //Discontinuity information
-            if (system[i].num_parents)
+            if (system[i].num_parents && !system[i].my->pooled)
                 system[i].discont = (double*)malloc(globals->discont_size * sizeof(double));
             if (system[i].child && my_rank != assignments[system[i].child->location])
             {
-                system[i].discont_send = (double*)malloc(globals->discont_size * sizeof(double));
-                system[i].discont_order_send = (unsigned int*)malloc(globals->discont_size * sizeof(unsigned int));
+                if (!system[i].my->pooled)
+                {
+                    system[i].discont_send = (double*)malloc(globals->discont_size * sizeof(double));
+                    system[i].discont_order_send = (unsigned int*)malloc(globals->discont_size * sizeof(unsigned int));
+                }
                 system[i].discont_send_count = 0;
             }
 
@@ -3059,7 +3679,8 @@ int FinalizeSystem(
             system[i].peak_time = globals->t_0;
             //system[i].save_flag = 0;
             //system[i].peak_flag = 0;
-            system[i].peak_value = malloc(system[i].dim * sizeof(double));
+            if (!system[i].my->pooled)
+                system[i].peak_value = malloc(system[i].dim * sizeof(double));
             dcopy(system[i].my->list.head->y_approx, system[i].peak_value, 0, system[i].dim);
             if (system[i].num_parents)	system[i].ready = 0;
             else				system[i].ready = 1;
@@ -3077,7 +3698,7 @@ int FinalizeSystem(
                 system[i].JMatrix = m_get(system[i].dim, system[i].dim);
                 system[i].CoefMat = m_get(globals->max_s*system[i].dim, globals->max_s*system[i].dim);
                 system[i].Z_i = malloc(globals->max_s * sizeof(VEC*));
-                for (j = 0; j < globals->max_s; j++)
+                for (unsigned int j = 0; j < globals->max_s; j++)
                     system[i].Z_i[j] = v_init(system[i].dim);
                 system[i].sol_diff = v_init(system[i].dim);
                 system[i].h_old = -1.0;
@@ -26,7 +26,8 @@ int Partition_Network(
     const GlobalVars * const globals,
     Link ***my_sys, unsigned int* my_N,
     int** assignments,
-    TransData** my_data, short int** getting, AsynchModel* model);
+    TransData** my_data, short int** getting,
+    const Lookup * const id_to_loc, AsynchModel* model);
 
 int Load_Local_Parameters(
     Link *system, unsigned int N,
@@ -37,6 +38,12 @@ int Load_Local_Parameters(
     AsynchModel* model,
     void* external);
 
+int Save_Network_Bundle(
+    const char* filename,
+    Link *system, unsigned int N, const Lookup * const id_to_loc,
+    const GlobalVars * const globals,
+    const ConnData* db_connections);
+
 int Build_RKData(
     Link *system, unsigned int N,
     Link **my_sys, unsigned int my_N,
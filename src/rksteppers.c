@@ -29,6 +29,128 @@ void store_k(const double * const full_k, unsigned int num_dof, double *k, unsig
 }
 
 
+//Computes the coefficients of the dense output of the step from node->prev->t to node->t in powers of theta,
+//dense [dense_degree + 1][num_dense]. Row 0 is the state at node->prev. The k values of node must already be stored.
+//The coefficients are rounded to float if the history of the list is stored in single precision.
+void store_dense(RKSolutionNode* node, const RKMethod* method, const unsigned int * const dense_indices, unsigned int num_dense)
+{
+    unsigned int num_stages = method->num_stages;
+    double h = node->t - node->prev->t;
+    const double *y_0 = node->prev->y_approx;
+
+    if (node->dense_f)
+    {
+        for (unsigned int m = 0; m < num_dense; m++)
+            node->dense_f[m] = (float)y_0[dense_indices[m]];
+    }
+    else
+    {
+        for (unsigned int m = 0; m < num_dense; m++)
+            node->dense[m] = y_0[dense_indices[m]];
+    }
+
+    for (unsigned int p = 0; p < method->dense_degree; p++)
+    {
+        const double *b_poly = method->b_poly + p * num_stages;
+
+        for (unsigned int m = 0; m < num_dense; m++)
+        {
+            double coeff = 0.0;
+            for (unsigned int l = 0; l < num_stages; l++)
+            {
+                if (b_poly[l] == 0.0)
+                    continue;
+                coeff += h * b_poly[l] * node->k[l * num_dense + m];
+            }
+
+            if (node->dense_f)
+                node->dense_f[(p + 1) * num_dense + m] = (float)coeff;
+            else
+                node->dense[(p + 1) * num_dense + m] = coeff;
+        }
+    }
+}
+
+//Evaluates the dense output stored in node at theta with Horner's rule.
+void dense_output(const RKSolutionNode* node, unsigned short int dense_degree, double theta, const unsigned int * const dense_indices, unsigned int num_dense, double *y)
+{
+    if (node->dense_f)
+    {
+        const float *dense = node->dense_f;
+
+        for (unsigned int m = 0; m < num_dense; m++)
+        {
+            double approx = dense[dense_degree * num_dense + m];
+            for (int p = dense_degree - 1; p >= 0; p--)
+                approx = approx * theta + dense[p * num_dense + m];
+
+            y[dense_indices[m]] = approx;
+        }
+        return;
+    }
+
+    const double *dense = node->dense;
+
+    for (unsigned int m = 0; m < num_dense; m++)
+    {
+        double approx = dense[dense_degree * num_dense + m];
+        for (int p = dense_degree - 1; p >= 0; p--)
+            approx = approx * theta + dense[p * num_dense + m];
+
+        y[dense_indices[m]] = approx;
+    }
+}
+
+
+//Returns the factor to scale the step size by, from the scaled error err of a step with an error estimator of order
+//order. err_prev is the error of the previous accepted step, or 0.0 if there is none, and h_ratio is the ratio of the
+//current to the previous accepted step size. After a rejection, the standard controller is always used.
+static double StepSizeFactor(const ErrorData* error, double err, double err_prev, double h_ratio, unsigned short int order, bool accepted)
+{
+    double factor = error->fac * pow(1.0 / err, 1.0 / order);
+
+    if (accepted && err_prev > 0.0 && error->controller != 0)
+    {
+        //PI controller (Gustafsson, Lundh and Soderlind)
+        double factor_pi = error->fac * pow(err, -error->alpha / order) * pow(err_prev, error->beta / order);
+
+        if (error->controller == 1)
+            factor = factor_pi;
+        else
+            //Predictive controller (Gustafsson), as in RADAU5
+            factor = min(factor, factor_pi * h_ratio);
+    }
+
+    return min(error->facmax, max(error->facmin, factor));
+}
+
+//Returns the size of the step to take after a step of size h with scaled local error err_1 and dense error err_d.
+//The step is accepted if both errors are below 1. Updates the step counters and the error history of link_i.
+double NextStepSize(Link* link_i, double h, double err_1, double err_d)
+{
+    const RKMethod* meth = link_i->method;
+    LinkData* my = link_i->my;
+    bool accepted = err_1 < 1.0 && err_d < 1.0;
+    double h_ratio = (my->h_prev > 0.0) ? h / my->h_prev : 1.0;
+
+    double step_1 = h * StepSizeFactor(my->error_data, err_1, my->err_prev[0], h_ratio, meth->e_order, accepted);
+    double step_d = h * StepSizeFactor(my->error_data, err_d, my->err_prev[1], h_ratio, meth->d_order, accepted);
+
+    if (accepted)
+    {
+        //Keep the errors away from 0, so the PI term stays bounded
+        my->err_prev[0] = max(err_1, 1e-4);
+        my->err_prev[1] = max(err_d, 1e-4);
+        my->h_prev = h;
+        my->num_accepted++;
+    }
+    else
+        my->num_rejected++;
+
+    return min(step_1, step_d);
+}
+
+
 double InitialStepSize(double t, Link* link_i, const GlobalVars * const globals, Workspace* workspace)
 {
     unsigned int start = link_i->diff_start;
@@ -41,7 +163,6 @@ double InitialStepSize(double t, Link* link_i, const GlobalVars * const globals,
     unsigned int p = link_i->method->localorder;
     RKSolutionNode* curr_node;
     double d0, d1, d2, h0, h1, largest, timediff, current_theta;
-    unsigned int idx;
     unsigned int dim = link_i->dim;
     unsigned int num_dense = link_i->num_dense;
     unsigned int* dense_indices = link_i->dense_indices;
@@ -49,6 +170,10 @@ double InitialStepSize(double t, Link* link_i, const GlobalVars * const globals,
     ErrorData* error = link_i->my->error_data;
 	bool from_reservoir;
 
+    //The error history of the step size controller does not carry over a restart
+    link_i->my->err_prev[0] = link_i->my->err_prev[1] = 0.0;
+    link_i->my->h_prev = 0.0;
+
     //Build SC for this link
     for (unsigned int i = 0; i < dim; i++)
         SC[i] = fabs(y_0[i]) * error->reltol[i] + error->abstol[i];
@@ -59,7 +184,6 @@ double InitialStepSize(double t, Link* link_i, const GlobalVars * const globals,
         Link *curr_parent = link_i->parents[i];
         curr_node = curr_parent->my->list.head;
 
-        unsigned int num_stages = curr_parent->method->num_stages;
         unsigned int num_dense = curr_parent->num_dense;
 
         double *curr_parent_approx = workspace->parents_approx + i * globals->max_dim;
@@ -77,17 +201,9 @@ double InitialStepSize(double t, Link* link_i, const GlobalVars * const globals,
             timediff = curr_node->next->t - curr_node->t;
             current_theta = (t - curr_node->t) / timediff;
 
-            curr_parent->method->dense_b(current_theta, curr_parent->method->b_theta);
 
             // !!!! Note: this varies with num_print. Consider doing a linear interpolation. !!!!
-            for (unsigned int m = 0; m < num_dense; m++)
-            {
-                idx = curr_parent->dense_indices[m];
-                curr_parent_approx[idx] = curr_node->y_approx[idx];
-
-                for (unsigned int l = 0; l < num_stages; l++)
-                    curr_parent_approx[idx] += timediff * curr_parent->method->b_theta[l] * curr_node->next->k[l * num_dense + m];
-            }
+            dense_output(curr_node->next, curr_parent->method->dense_degree, current_theta, curr_parent->dense_indices, num_dense, curr_parent_approx);
             link_i->check_consistency(curr_parent_approx, curr_parent->dim, globals->global_params, globals->num_global_params, curr_parent->params, link_i->num_params, curr_parent->user);
 
             if (link_i->algebraic)
@@ -12,13 +12,32 @@
 //Copies contents of the vectors full_k with dim entries into the vectors k with num_dense entries.
 void store_k(const double * const full_k, unsigned int num_dof, double *k, unsigned int num_stages, const unsigned int * const dense_indices, unsigned int num_dense);
 
+//Builds the dense output coefficients of the step ending at node from its k values and the state at node->prev.
+void store_dense(RKSolutionNode* node, const RKMethod* method, const unsigned int * const dense_indices, unsigned int num_dense);
+
+//Evaluates the dense output of the step ending at node at theta in [0,1]. Only the entries of y in dense_indices are set.
+void dense_output(const RKSolutionNode* node, unsigned short int dense_degree, double theta, const unsigned int * const dense_indices, unsigned int num_dense, double *y);
+
 double InitialStepSize(double t, Link* link_i, const GlobalVars * const globals, Workspace* workspace);
 
+//Selects the size of the step after a step of size h with scaled errors err_1 and err_d, with the step size
+//controller of the link. Counts the step as accepted or rejected.
+double NextStepSize(Link* link_i, double h, double err_1, double err_d);
+
 // Steppers methods
 int ExplicitRKSolver(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace);
+
+//Returns ExplicitRKSolver specialized for the RK method and number of states of link_i, or ExplicitRKSolver itself.
+//The RK method and dim of link_i must be set.
+RKSolverFunc* Select_ExplicitRKSolver(const Link* link_i);
+
+//Returns true if link_i->solver is ExplicitRKSolver or one of its specialized versions.
+bool Is_ExplicitRKSolver(const Link* link_i);
 int ExplicitRKIndex1SolverDam(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace);
 int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace);
 int ExplicitRKSolverDiscont(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace);
+int ExplicitRKSolverChain(Link** chain, unsigned int length, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace, BatchWorkspace* batch);
+void ExplicitRKSolverBatch(Link** links, unsigned int num_links, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace, BatchWorkspace* batch);
 
 //Forced solution methods
 int ForcedSolutionSolver(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace);
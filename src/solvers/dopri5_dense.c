@@ -5,12 +5,14 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 //#include <math.h>
 //#if defined(HAVE_UNISTD_H)
 //#include <unistd.h>
 //#endif
 
 #include <rkmethods.h>
+#include <solvers/tableaus.h>
 #include <solvers/lagrange.h>
 
 
@@ -34,6 +36,7 @@ void DOPRI5_dense(RKMethod* method)
     //method->c = v_get(method->num_stages);
     method->dense_b = &DOPRI5_b;
     method->dense_bderiv = &DOPRI5_bderiv;
+    method->dense_degree = 5;
     //method->e = v_get(method->num_stages);
     //method->d = v_get(method->num_stages);
     method->e_order = 5;
@@ -48,71 +51,25 @@ void DOPRI5_dense(RKMethod* method)
     method->localorder = 5;
 
     //Build the parameters for the method
-    static const double A[][7] = {
-        { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
-        { 1.0 / 5.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
-        { 3.0 / 40.0, 9.0 / 40.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
-        { 44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0, 0.0, 0.0, 0.0, 0.0 },
-        { 19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0, 0.0, 0.0, 0.0 },
-        { 9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0, 0.0, 0.0 },
-        { 35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0, 0.0 }
-    };
-    //A[1][0] = 1.0 / 5.0;
-    //A[2][0] = 3.0 / 40.0;
-    //A[2][1] = 9.0 / 40.0;
-    //A[3][0] = 44.0 / 45.0;
-    //A[3][1] = -56.0 / 15.0;
-    //A[3][2] = 32.0 / 9.0;
-    //A[4][0] = 19372.0 / 6561.0;
-    //A[4][1] = -25360.0 / 2187.0;
-    //A[4][2] = 64448.0 / 6561.0;
-    //A[4][3] = -212.0 / 729.0;
-    //A[5][0] = 9017.0 / 3168.0;
-    //A[5][1] = -355.0 / 33.0;
-    //A[5][2] = 46732.0 / 5247.0;
-    //A[5][3] = 49.0 / 176.0;
-    //A[5][4] = -5103.0 / 18656.0;
-    //A[6][0] = 35.0 / 384.0;
-    //A[6][1] = 0.0;
-    //A[6][2] = 500.0 / 1113.0;
-    //A[6][3] = 125.0 / 192.0;
-    //A[6][4] = -2187.0 / 6784.0;
-    //A[6][5] = 11.0 / 84.0;
-    method->A = A[0];
-
-    method->dense_b(1.0, method->b);
+    method->A = DOPRI5_A[0];
+
+    memcpy(method->b, DOPRI5_weights, method->num_stages * sizeof(double));
     method->dense_b(1.0, method->b_theta);
     method->dense_bderiv(1.0, method->b_theta_deriv);
 
-    static const double c[] = { 0.0, 0.2, 0.3, 0.8, 8.0 / 9.0, 1.0, 1.0 };
-    //c[0] = 0.0;
-    //c[1] = .2;
-    //c[2] = .3;
-    //c[3] = .8;
-    //c[4] = 8.0 / 9.0;
-    //c[5] = 1.0;
-    //c[6] = 1.0;
-    method->c = c;
-
-    static const double e[] = { 71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0 };
-    //e[0] = 71.0 / 57600.0;
-    //e[1] = 0.0;
-    //e[2] = -71.0 / 16695.0;
-    //e[3] = 71.0 / 1920.0;
-    //e[4] = -17253.0 / 339200.0;
-    //e[5] = 22.0 / 525.0;
-    //e[6] = -1.0 / 40.0;
-    method->e = e;
-
-    static const double d[] = { .610351562499951, 0.0, -2.105795148247852, 18.310546874999346, -25.185639003536881, 20.749496981890658, -12.378961267605213 };
-    //d[0] = .610351562499951;
-    //d[1] = 0.0;
-    //d[2] = -2.105795148247852;
-    //d[3] = 18.310546874999346;
-    //d[4] = -25.185639003536881;
-    //d[5] = 20.749496981890658;
-    //d[6] = -12.378961267605213;
-    method->d = d;
+    method->c = DOPRI5_c;
+    method->e = DOPRI5_e;
+    method->d = DOPRI5_d;
+
+    //b(theta) in powers of theta, expanded from DOPRI5_b()
+    static const double b_poly[][7] = {
+        { 1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+        { -2.8605386690370884, 0.0, 4.0471414996427857, -3.9411600711126589, 2.8419447015870345, -1.6109886359167997, 1.5236011748367271 },
+        { 3.099577878709121, 0.0, -6.345354046938926, 10.904003027940295, -7.5476758629593856, 4.2189158390395178, -4.3294668357906216 },
+        { -1.1618105836403092, 0.0, 2.7954650864140049, -6.7293175092092783, 4.9576367249312527, -2.950103865566732, 3.0881301470710616 },
+        { 0.013917207301610328, 0.0, -0.048016240824962857, 0.41751621904830982, -0.57428174280418465, 0.47312904339639456, -0.2822644861171672 }
+    };
+    method->b_poly = b_poly[0];
 
     method->w = malloc(method->num_stages * sizeof(double));
     lagrange_weights(method->c, method->num_stages, method->w);
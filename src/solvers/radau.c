@@ -32,6 +32,7 @@ void RadauIIA3_dense(RKMethod *method)
     
     method->dense_b = &RadauIIA3_b;
     method->dense_bderiv = NULL;
+    method->dense_degree = 3;
     
     method->e_order = 4;
     method->e_order_ratio = 4.0 / 3.0;
@@ -96,6 +97,14 @@ void RadauIIA3_dense(RKMethod *method)
 
     */
 
+    //b(theta) in powers of theta, same polynomials as RadauIIA3_b()
+    static const double b_poly[][3] = {
+        { 1.558078204724922, -0.891411538058256, 0.3333333333333333 },
+        { -1.986947221348443, 3.320280554681776, -1.333333333333333 },
+        { 0.805272079323988, -1.916383190435099, 1.111111111111111 }
+    };
+    method->b_poly = b_poly[0];
+
     method->w = malloc(method->num_stages * sizeof(double));
     lagrange_weights(method->c, method->num_stages, method->w);
 }
@@ -5,12 +5,14 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 //#include <math.h>
 //#if defined(HAVE_UNISTD_H)
 //#include <unistd.h>
 //#endif
 
 #include <rkmethods.h>
+#include <solvers/tableaus.h>
 
 void RKDense3_2_b(double theta, double *b);
 void RKDense3_2_bderiv(double theta, double *b);
@@ -29,6 +31,7 @@ void RKDense3_2(RKMethod* method)
     //method->c = v_get(method->num_stages);
     method->dense_b = &RKDense3_2_b;
     method->dense_bderiv = &RKDense3_2_bderiv;
+    method->dense_degree = 3;
     //method->e = v_get(method->num_stages);
     //method->d = v_get(method->num_stages);
     method->e_order = 3;
@@ -41,36 +44,22 @@ void RKDense3_2(RKMethod* method)
     method->localorder = 3;
 
     //Build the coefficients for the method
-    const double A[][3] = {
-        { 0.0, 0.0, 0.0 },
-        { 0.5, 0.0, 0.0 },
-        { -1.0, 2.0, 0.0 }
-    };
-    //A[1][0] = .5;
-    //A[2][0] = -1;
-    //A[2][1] = 2;
-    method->A = A[0];
+    method->A = RKDense3_2_A[0];
 
-    method->dense_b(1.0, method->b);
+    memcpy(method->b, RKDense3_2_weights, method->num_stages * sizeof(double));
     method->dense_b(1.0, method->b_theta);
 
-    const double c[] = { 0.0, 0.5, 1.0 };
-    //c[0] = 0.0;
-    //c[1] = .5;
-    //c[2] = 1.0;
-    method->c = c;
-
-    const double e[] = { 2.0 / 3.0, -4.0 / 3.0, 2.0 / 3.0 };
-    //e[0] = 2.0 / 3.0;
-    //e[1] = -4.0 / 3.0;
-    //e[2] = 2.0 / 3.0;
-    method->e = e;
+    method->c = RKDense3_2_c;
+    method->e = RKDense3_2_e;
+    method->d = RKDense3_2_d;
 
-    const double d[] = { 1.0 / 3.0, -2.0 / 3.0, 1.0 / 3.0 };
-    //d[0] = 1.0 / 3.0;
-    //d[1] = -2.0 / 3.0;
-    //d[2] = 1.0 / 3.0;
-    method->d = d;
+    //b(theta) in powers of theta, same polynomials as RKDense3_2_b()
+    static const double b_poly[][3] = {
+        { 1.0, 0.0, 0.0 },
+        { -3.0 / 2.0, 2.0, -1.0 / 2.0 },
+        { 2.0 / 3.0, -4.0 / 3.0, 2.0 / 3.0 }
+    };
+    method->b_poly = b_poly[0];
 
     method->w = NULL;
 }
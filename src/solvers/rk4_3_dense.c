@@ -5,12 +5,14 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 //#include <math.h>
 //#if defined(HAVE_UNISTD_H)
 //#include <unistd.h>
 //#endif
 
 #include <rkmethods.h>
+#include <solvers/tableaus.h>
 
 void TheRKDense4_3_b(double theta, double *b);
 
@@ -28,6 +30,7 @@ void TheRKDense4_3(RKMethod* method)
     
     method->dense_b = &TheRKDense4_3_b;
     method->dense_bderiv = NULL;
+    method->dense_degree = 3;
     
     //method->e = v_get(method->num_stages);
     //method->d = v_get(method->num_stages);
@@ -42,46 +45,24 @@ void TheRKDense4_3(RKMethod* method)
     method->localorder = 4;
 
     //Build the parameters for the method
-    const double A[][4] = {
-        { 0.0, 0.0, 0.0, 0.0 },
-        { 0.5, 0.0, 0.0, 0.0 },
-        { 0.0, 0.5, 0.0, 0.0 },
-        { 0.0, 0.0, 1.0, 0.0 }
-    };
-    //A[1][0] = .5;
-    //A[2][1] = .5;
-    //A[3][2] = 1;
-    method->A = A[0];
+    method->A = TheRKDense4_3_A[0];
 
-    double b[] = { 1.0 / 6.0, 2.0 / 6.0, 2.0 / 6.0, 1.0 / 6.0 };
-    //b[0] = 1.0 / 6.0;
-    //b[1] = 2.0 / 6.0;
-    //b[2] = 2.0 / 6.0;
-    //b[3] = 1.0 / 6.0;
-    method->b = b;
+    method->b = malloc(method->num_stages * sizeof(double));
+    memcpy(method->b, TheRKDense4_3_weights, method->num_stages * sizeof(double));
 
     method->dense_b(1.0, method->b_theta);
 
-    const double c[] = { 0.0, 0.5 , 0.5, 1.0 };
-    //c[0] = 0;
-    //c[1] = .5;
-    //c[2] = .5;
-    //c[3] = 1;
-    method->c = c;
-
-    const double e[] = { 2.0 / 3.0, 0.0, -4.0 / 3.0, 2.0 / 3.0 };
-    //e[0] = 2.0 / 3.0;
-    //e[1] = 0.0;
-    //e[2] = -4.0 / 3.0;
-    //e[3] = 2.0 / 3.0;
-    method->e = e;
+    method->c = TheRKDense4_3_c;
+    method->e = TheRKDense4_3_e;
+    method->d = TheRKDense4_3_d;
 
-    const double d[] = { 2.0 / 9.0, 0.0, -4.0 / 9.0, 2.0 / 9.0 };
-    //d[0] = 2.0 / 9.0;
-    //d[1] = 0.0;
-    //d[2] = -4.0 / 9.0;
-    //d[3] = 2.0 / 9.0;
-    method->d = d;
+    //b(theta) in powers of theta, same polynomials as TheRKDense4_3_b()
+    static const double b_poly[][4] = {
+        { 1.0, 0.0, 0.0, 0.0 },
+        { -3.0 / 2.0, 1.0, 1.0, -1.0 / 2.0 },
+        { 2.0 / 3.0, -2.0 / 3.0, -2.0 / 3.0, 2.0 / 3.0 }
+    };
+    method->b_poly = b_poly[0];
 
     method->w = NULL;
 }
@@ -0,0 +1,57 @@
+#if !defined(ASYNCH_SOLVER_TABLEAUS_H)
+#define ASYNCH_SOLVER_TABLEAUS_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+// Butcher tableaus of the explicit RK methods. These are shared by the method builders and by the steppers that are
+// specialized for a method, so the coefficients are compile time constants there.
+
+/// RKDense3_2(): order 3, order 2 dense output
+#define RKDENSE3_2_STAGES 3
+
+static const double RKDense3_2_A[RKDENSE3_2_STAGES][RKDENSE3_2_STAGES] = {
+    { 0.0, 0.0, 0.0 },
+    { 0.5, 0.0, 0.0 },
+    { -1.0, 2.0, 0.0 }
+};
+static const double RKDense3_2_weights[RKDENSE3_2_STAGES] = { 1.0 / 6.0, 2.0 / 3.0, 1.0 / 6.0 };
+static const double RKDense3_2_c[RKDENSE3_2_STAGES] = { 0.0, 0.5, 1.0 };
+static const double RKDense3_2_e[RKDENSE3_2_STAGES] = { 2.0 / 3.0, -4.0 / 3.0, 2.0 / 3.0 };
+static const double RKDense3_2_d[RKDENSE3_2_STAGES] = { 1.0 / 3.0, -2.0 / 3.0, 1.0 / 3.0 };
+
+
+/// TheRKDense4_3(): order 4, order 3 dense output
+#define THERKDENSE4_3_STAGES 4
+
+static const double TheRKDense4_3_A[THERKDENSE4_3_STAGES][THERKDENSE4_3_STAGES] = {
+    { 0.0, 0.0, 0.0, 0.0 },
+    { 0.5, 0.0, 0.0, 0.0 },
+    { 0.0, 0.5, 0.0, 0.0 },
+    { 0.0, 0.0, 1.0, 0.0 }
+};
+static const double TheRKDense4_3_weights[THERKDENSE4_3_STAGES] = { 1.0 / 6.0, 2.0 / 6.0, 2.0 / 6.0, 1.0 / 6.0 };
+static const double TheRKDense4_3_c[THERKDENSE4_3_STAGES] = { 0.0, 0.5, 0.5, 1.0 };
+static const double TheRKDense4_3_e[THERKDENSE4_3_STAGES] = { 2.0 / 3.0, 0.0, -4.0 / 3.0, 2.0 / 3.0 };
+static const double TheRKDense4_3_d[THERKDENSE4_3_STAGES] = { 2.0 / 9.0, 0.0, -4.0 / 9.0, 2.0 / 9.0 };
+
+
+/// DOPRI5_dense(): Dormand-Prince 5(4), order 4 dense output
+#define DOPRI5_STAGES 7
+
+static const double DOPRI5_A[DOPRI5_STAGES][DOPRI5_STAGES] = {
+    { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+    { 1.0 / 5.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+    { 3.0 / 40.0, 9.0 / 40.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+    { 44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0, 0.0, 0.0, 0.0, 0.0 },
+    { 19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0, 0.0, 0.0, 0.0 },
+    { 9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0, 0.0, 0.0 },
+    { 35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0, 0.0 }
+};
+static const double DOPRI5_weights[DOPRI5_STAGES] = { 35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0, 0.0 };
+static const double DOPRI5_c[DOPRI5_STAGES] = { 0.0, 0.2, 0.3, 0.8, 8.0 / 9.0, 1.0, 1.0 };
+static const double DOPRI5_e[DOPRI5_STAGES] = { 71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0 };
+static const double DOPRI5_d[DOPRI5_STAGES] = { .610351562499951, 0.0, -2.105795148247852, 18.310546874999346, -25.185639003536881, 20.749496981890658, -12.378961267605213 };
+
+#endif //!defined(ASYNCH_SOLVER_TABLEAUS_H)
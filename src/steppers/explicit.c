@@ -4,6 +4,7 @@
 #include <config_msvc.h>
 #endif
 
+#include <assert.h>
 #include <math.h>
 #include <memory.h>
 
@@ -12,41 +13,174 @@
 #include <blas.h>
 #include <io.h>
 #include <rksteppers.h>
+#include <solvers/tableaus.h>
 
 
-//Computes one step of a method to solve the ODE at a link. Assumes parents have enough computed solutions.
-//Link* link_i: the link to apply a numerical method to.
-//Returns 1 if the step was successfully taken, 0 if the step was rejected.
-int ExplicitRKSolver(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace)
+//Selects the next step size of link_i from the error estimates err_1 and err_d of the step from t to t + h, then either
+//keeps the step in new_node or trashes it. curr_node[i] is the oldest node of parent i still needed by link_i.
+//workspace->temp_k must hold the internal stages of the step.
+//Returns 1 if the step was accepted, 0 if the step was rejected.
+static int Finish_Step(Link* link_i, double t, double h, double err_1, double err_d, RKSolutionNode* new_node, RKSolutionNode** curr_node, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, Forcing* forcings, Workspace* workspace)
 {
-    unsigned int idx;
-    
-    RKSolutionNode *curr_node[ASYNCH_LINK_MAX_PARENTS], *node, *new_node;
-    double t_needed, current_theta;
+    double current_theta;
 
-    //Some variables to make things easier to read
-    double *y_0 = link_i->my->list.tail->y_approx;
-    double h = link_i->h;
-    double t = link_i->my->list.tail->t;
-    const double * const A = link_i->method->A;
-    double *b = link_i->method->b;
-    const double * const c = link_i->method->c;
-    const double * const e = link_i->method->e;
-    const double * const d = link_i->method->d;
-    unsigned int num_stages = link_i->method->num_stages;
     RKMethod* meth = link_i->method;
-    ErrorData* error = link_i->my->error_data;
-    unsigned int dim = link_i->dim;
+    unsigned int num_stages = meth->num_stages;
     unsigned int num_dense = link_i->num_dense;
     unsigned int* dense_indices = link_i->dense_indices;
-    double *temp = workspace->temp;
+    double *new_y = new_node->y_approx;
     double *sum = workspace->sum;
-    double **temp_k = workspace->temp_k_slices;  
 
-	// adlz
-	// printf("+Using ExplicitRKSolver...\n");
+    //Determine a new step size for the next step
+    link_i->h = NextStepSize(link_i, h, err_1, err_d);
+
+    if (err_1 < 1.0 && err_d < 1.0)
+    {
+        //Check if a discontinuity has been stepped on
+        if (link_i->discont_count > 0 && (t + h) >= link_i->discont[link_i->discont_start])
+        {
+            (link_i->discont_count)--;
+            link_i->discont_start = (link_i->discont_start + 1) % globals->discont_size;
+            link_i->h = InitialStepSize(link_i->last_t, link_i, globals, workspace);
+        }
+
+        //Save the new data
+		// adlz
+		// printf("+Saving the data as (%f < 1.0) and (%f < 1.0)...\n", err_1, err_d);
+        link_i->last_t = t + h;
+        link_i->current_iterations++;
+        store_k(workspace->temp_k, globals->max_dim, new_node->k, num_stages, dense_indices, num_dense);
+        store_dense(new_node, meth, dense_indices, num_dense);
+
+        //Check if new data should be written to disk
+        if (print_flag)
+        {
+            //while(t <= link_i->next_save && link_i->next_save <= link_i->last_t)
+            while (t <= link_i->next_save && (link_i->next_save < link_i->last_t || fabs(link_i->next_save - link_i->last_t) / link_i->next_save < 1e-12))
+            {
+                if (link_i->disk_iterations == link_i->expected_file_vals)
+                {
+                    printf("[%i]: Warning: Too many steps computed for link id %u. Expected no more than %u. No more values will be stored for this link.\n", my_rank, link_i->ID, link_i->expected_file_vals);
+                    break;
+                }
+                (link_i->disk_iterations)++;
+                current_theta = (link_i->next_save - t) / h;
+                dense_output(new_node, meth->dense_degree, current_theta, dense_indices, num_dense, sum);
+
+                link_i->check_consistency(sum, link_i->dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+
+                //Write to a file
+                WriteStep(globals->outputs, globals->num_outputs, outputfile, link_i->ID, link_i->next_save, sum, link_i->dim, &(link_i->pos_offset));
+
+                link_i->next_save += link_i->print_time;
+            }
+        }
+
+        //Check if this is a peak value
+        if (link_i->peak_flag && (new_y[0] > link_i->peak_value[0]))
+        {
+            dcopy(new_y, link_i->peak_value, 0, link_i->dim);
+            link_i->peak_time = link_i->last_t;
+        }
+
+        //Check if the newest step is on a change in rainfall
+        short int propagated = 0;	//Set to 1 when last_t has been propagated
+        for (unsigned int j = 0; j < globals->num_forcings; j++)
+        {
+            if (forcings[j].active && (link_i->my->forcing_data[j].num_points > 0) && (fabs(link_i->last_t - link_i->my->forcing_change_times[j]) < 1e-8))
+            {
+                //Propagate the discontinuity to downstream links
+                if (!propagated)
+                {
+                    propagated = 1;
+                    Link* next = link_i->child;
+                    Link* prev = link_i;
+                    for (unsigned int i = 0; i < globals->max_localorder && next != NULL; i++)
+                    {
+                        if (assignments[next->location] == my_rank && i < next->method->localorder)
+                        {
+                            //Insert the time into the discontinuity list
+                            next->discont_end = Insert_Discontinuity(link_i->my->forcing_change_times[j], next->discont_start, next->discont_end, &(next->discont_count), globals->discont_size, next->discont, next->ID);
+                        }
+                        else if (next != NULL && assignments[next->location] != my_rank)
+                        {
+                            //Store the time to send to another process
+                            Insert_SendDiscontinuity(link_i->my->forcing_change_times[j], i, &(prev->discont_send_count), globals->discont_size, prev->discont_send, prev->discont_order_send, prev->ID);
+                            break;
+                        }
+
+                        prev = next;
+                        next = next->child;
+                    }
+                }
+
+                //Find the right index in rainfall
+                //for(l=1;l<link_i->my->forcing_data[j].n_times;l++)
+                unsigned int l;
+                for (l = link_i->my->forcing_indices[j] + 1; l < link_i->my->forcing_data[j].num_points; l++)
+                    if (fabs(link_i->my->forcing_change_times[j] - link_i->my->forcing_data[j].data[l].time) < 1e-8)
+                        break;
+                link_i->my->forcing_indices[j] = l;
+
+                double forcing_buffer = link_i->my->forcing_data[j].data[l].value;
+                link_i->my->forcing_values[j] = forcing_buffer;
+
+                //Find and set the new change in rainfall
+                unsigned int i;
+                for (i = l + 1; i < link_i->my->forcing_data[j].num_points; i++)
+                {
+                    //if(link_i->my->forcing_data[j].rainfall[i].value != forcing_buffer)
+                    if (fabs(link_i->my->forcing_data[j].data[i].value - forcing_buffer) > 1e-8)
+                    {
+                        link_i->my->forcing_change_times[j] = link_i->my->forcing_data[j].data[i].time;
+                        break;
+                    }
+                }
+                if (i == link_i->my->forcing_data[j].num_points)
+                    link_i->my->forcing_change_times[j] = link_i->my->forcing_data[j].data[i - 1].time;
+            }
+        }
+
+        //Select new step size, if forcings changed
+        if (propagated)
+            link_i->h = InitialStepSize(link_i->last_t, link_i, globals, workspace);
+
+        //Free up parents' old data
+        for (unsigned int i = 0; i < link_i->num_parents; i++)
+        {
+            Link *curr_parent = link_i->parents[i];
+            while (curr_parent->my->list.head != curr_node[i])
+            {
+                Remove_Head_Node(&curr_parent->my->list);
+                curr_parent->current_iterations--;
+                curr_parent->iters_removed++;
+            }
+        }
+
+        return 1;
+    }
+    else
+    {
+		// adlz
+		// printf("+Trashing the data as (%f > 1.0) or (%f > 1.0)...\n", err_1, err_d);
+
+        //Trash the data from the failed step
+        Undo_Step(&link_i->my->list);
+
+        return 0;
+    }
+}
+
+
+//Computes the approximate solutions of the parents of link_i at each stage of the step from t to t + h, using the
+//dense output of the parents. The approximations are stored in workspace->stages_parents_approx.
+//curr_node[i] is set to the oldest node of parent i still needed by link_i.
+static void Approximate_Parents(Link* link_i, double t, double h, RKSolutionNode** curr_node, GlobalVars* globals, Workspace* workspace)
+{
+    double t_needed, current_theta;
+    const double * const c = link_i->method->c;
+    unsigned int num_stages = link_i->method->num_stages;
 
-    //Get the approximate solutions from each parent
     for (unsigned int i = 0; i < link_i->num_parents; i++)
     {
         Link* curr_parent = link_i->parents[i];
@@ -66,28 +200,48 @@ int ExplicitRKSolver(Link* link_i, GlobalVars* globals, int* assignments, bool p
 
             double dt = curr_node[i]->next->t - curr_node[i]->t;
             current_theta = (t_needed - curr_node[i]->t) / dt;
-            curr_parent->method->dense_b(current_theta, curr_parent->method->b_theta);
 
             //[num_stages][max_parents][max_dim] -> [max_dim]
             double *parent_approx = workspace->stages_parents_approx
                 + j * globals->max_parents * globals->max_dim
                 + i * globals->max_dim;
 
-            for (unsigned int m = 0; m < curr_parent->num_dense; m++)
-            {
-                idx = curr_parent->dense_indices[m];
-                double approx = curr_node[i]->y_approx[idx];
-
-                for (int l = 0; l < curr_parent->method->num_stages; l++)
-                    approx += dt * curr_parent->method->b_theta[l] *
-                        curr_node[i]->next->k[l * curr_parent->num_dense + m];
-
-                parent_approx[idx] = approx;
-            }
+            dense_output(curr_node[i]->next, curr_parent->method->dense_degree, current_theta, curr_parent->dense_indices, curr_parent->num_dense, parent_approx);
 
             link_i->check_consistency(parent_approx, curr_parent->dim, globals->global_params, globals->num_global_params, curr_parent->params, link_i->num_params, curr_parent->user);
         }
     }
+}
+
+
+//Computes one step of a method to solve the ODE at a link. Assumes parents have enough computed solutions.
+//Link* link_i: the link to apply a numerical method to.
+//Returns 1 if the step was successfully taken, 0 if the step was rejected.
+int ExplicitRKSolver(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace)
+{
+    RKSolutionNode **curr_node = workspace->parents_node, *new_node;
+
+    //Some variables to make things easier to read
+    double *y_0 = link_i->my->list.tail->y_approx;
+    double h = link_i->h;
+    double t = link_i->my->list.tail->t;
+    const double * const A = link_i->method->A;
+    double *b = link_i->method->b;
+    const double * const c = link_i->method->c;
+    const double * const e = link_i->method->e;
+    const double * const d = link_i->method->d;
+    unsigned int num_stages = link_i->method->num_stages;
+    ErrorData* error = link_i->my->error_data;
+    unsigned int dim = link_i->dim;
+    double *temp = workspace->temp;
+    double *sum = workspace->sum;
+    double **temp_k = workspace->temp_k_slices;  
+
+	// adlz
+	// printf("+Using ExplicitRKSolver...\n");
+
+    //Get the approximate solutions from each parent
+    Approximate_Parents(link_i, t, h, curr_node, globals, workspace);
 
     //Do the RK method to get the next approximation
 
@@ -172,8 +326,6 @@ int ExplicitRKSolver(Link* link_i, GlobalVars* globals, int* assignments, bool p
 		printf("[%f, %f], ", sum[i], temp[i]);
 	printf("got %f.\n", err_1); */
 
-    double value_1 = pow(1.0 / err_1, 1.0 / meth->e_order);
-
     //Check the dense error (in inf norm) to determine if the step can be accepted
     double err_d;
     dcopy(temp_k[0], sum, 0, link_i->dim);
@@ -192,155 +344,474 @@ int ExplicitRKSolver(Link* link_i, GlobalVars* globals, int* assignments, bool p
 		printf("[%f, %f], ", sum[i], temp[i]);
 	printf("got %f.\n", err_d); */
 
-    double value_d = pow(1.0 / err_d, 1.0 / meth->d_order);
+    return Finish_Step(link_i, t, h, err_1, err_d, new_node, curr_node, globals, assignments, print_flag, outputfile, forcings, workspace);
+}
 
-    //Determine a new step size for the next step
-    double step_1 = h * min(error->facmax, max(error->facmin, error->fac * value_1));
-    double step_d = h * min(error->facmax, max(error->facmin, error->fac * value_d));
-    link_i->h = min(step_1, step_d);
 
-    if (err_1 < 1.0 && err_d < 1.0)
+#if defined(_MSC_VER)
+#define ASYNCH_FORCE_INLINE __forceinline
+#else
+#define ASYNCH_FORCE_INLINE __inline __attribute__((always_inline))
+#endif
+
+//Same step as ExplicitRKSolver, for a link with dim states solved with the RK method given by the tableau
+//(num_stages, A, b, c, e, d). Every caller passes these as compile time constants, so once this is inlined the loops
+//over the stages and states are unrolled and the terms with a zero coefficient drop out.
+static ASYNCH_FORCE_INLINE int ExplicitRKSolverFixed(
+    Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, Forcing* forcings, Workspace* workspace,
+    const unsigned int num_stages, const double * const A, const double * const b, const double * const c, const double * const e, const double * const d,
+    const unsigned int dim)
+{
+    RKSolutionNode **curr_node = workspace->parents_node, *new_node;
+
+    //Some variables to make things easier to read
+    double *y_0 = link_i->my->list.tail->y_approx;
+    double h = link_i->h;
+    double t = link_i->my->list.tail->t;
+    ErrorData* error = link_i->my->error_data;
+    double *sum = workspace->sum;
+    double **temp_k = workspace->temp_k_slices;
+
+    assert(link_i->dim == dim && link_i->method->num_stages == num_stages);
+
+    //Get the approximate solutions from each parent
+    Approximate_Parents(link_i, t, h, curr_node, globals, workspace);
+
+    //Setup variables for the new data
+    new_node = New_Step(&link_i->my->list);
+    new_node->t = t + h;
+    double *new_y = new_node->y_approx;
+
+    //Compute the k's
+    for (unsigned int i = 0; i < num_stages; i++)
     {
-        //Check if a discontinuity has been stepped on
-        if (link_i->discont_count > 0 && (t + h) >= link_i->discont[link_i->discont_start])
+        for (unsigned int m = 0; m < dim; m++)
+            sum[m] = y_0[m];
+
+        for (unsigned int j = 0; j < i; j++)
         {
-            (link_i->discont_count)--;
-            link_i->discont_start = (link_i->discont_start + 1) % globals->discont_size;
-            link_i->h = InitialStepSize(link_i->last_t, link_i, globals, workspace);
+            if (A[i * num_stages + j] == 0.0)
+                continue;
+
+            double alpha = h * A[i * num_stages + j];
+            for (unsigned int m = 0; m < dim; m++)
+                sum[m] += alpha * temp_k[j][m];
         }
 
-        //Save the new data
-		// adlz
-		// printf("+Saving the data as (%f < 1.0) and (%f < 1.0)...\n", err_1, err_d);
-        link_i->last_t = t + h;
-        link_i->current_iterations++;
-        store_k(workspace->temp_k, globals->max_dim, new_node->k, num_stages, dense_indices, num_dense);
+        link_i->check_consistency(sum, dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
 
-        //Check if new data should be written to disk
-        if (print_flag)
-        {
-            //while(t <= link_i->next_save && link_i->next_save <= link_i->last_t)
-            while (t <= link_i->next_save && (link_i->next_save < link_i->last_t || fabs(link_i->next_save - link_i->last_t) / link_i->next_save < 1e-12))
-            {
-                if (link_i->disk_iterations == link_i->expected_file_vals)
-                {
-                    printf("[%i]: Warning: Too many steps computed for link id %u. Expected no more than %u. No more values will be stored for this link.\n", my_rank, link_i->ID, link_i->expected_file_vals);
-                    break;
-                }
-                (link_i->disk_iterations)++;
-                node = link_i->my->list.tail->prev;
-                current_theta = (link_i->next_save - t) / h;
-                link_i->method->dense_b(current_theta, link_i->method->b_theta);
-                for (unsigned int m = 0; m < num_dense; m++)
-                {
-                    idx = dense_indices[m];
-                    double approx = node->y_approx[idx];
-                    for (unsigned int l = 0; l < link_i->method->num_stages; l++)
-                        approx += h * link_i->method->b_theta[l] * node->next->k[l * num_dense + m];
+        //[num_stages][max_parents][max_dim]
+        double *y_p = workspace->stages_parents_approx + i * globals->max_parents * globals->max_dim;
 
-                    sum[idx] = approx;
-                }
+        link_i->differential(
+            t + c[i] * h,
+            sum, dim,
+            y_p, link_i->num_parents, globals->max_dim,
+            globals->global_params,
+            link_i->params,
+            link_i->my->forcing_values,
+            link_i->qvs,
+            link_i->state,
+            link_i->user,
+            temp_k[i]);
+    }
 
-                link_i->check_consistency(sum, link_i->dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+    //Build the solution
+    for (unsigned int m = 0; m < dim; m++)
+        new_y[m] = y_0[m];
 
-                //Write to a file
-                WriteStep(globals->outputs, globals->num_outputs, outputfile, link_i->ID, link_i->next_save, sum, link_i->dim, &(link_i->pos_offset));
+    for (unsigned int i = 0; i < num_stages; i++)
+    {
+        if (b[i] == 0.0)
+            continue;
 
-                link_i->next_save += link_i->print_time;
-            }
+        double alpha = h * b[i];
+        for (unsigned int m = 0; m < dim; m++)
+            new_y[m] += alpha * temp_k[i][m];
+    }
+
+    link_i->check_consistency(new_y, dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+
+    new_node->state = link_i->state;
+
+    //Check the error of y_1 and the dense error (in inf norm) to determine if the step can be accepted
+    double err_1 = 0.0, err_d = 0.0;
+    for (unsigned int m = 0; m < dim; m++)
+    {
+        double sum_1 = temp_k[0][m] * (h * e[0]);
+        double sum_d = temp_k[0][m] * (h * d[0]);
+        for (unsigned int i = 1; i < num_stages; i++)
+        {
+            if (e[i] != 0.0)
+                sum_1 += h * e[i] * temp_k[i][m];
+            if (d[i] != 0.0)
+                sum_d += h * d[i] * temp_k[i][m];
         }
 
-        //Check if this is a peak value
-        if (link_i->peak_flag && (new_y[0] > link_i->peak_value[0]))
+        double scale = max(fabs(new_y[m]), fabs(y_0[m]));
+        double val_1 = fabs(sum_1 / (scale * error->reltol[m] + error->abstol[m]));
+        double val_d = fabs(sum_d / (scale * error->reltol_dense[m] + error->abstol_dense[m]));
+
+        //Same comparisons as nrminf2, so a NaN in the first state is kept and the step rejected
+        if (m == 0 || val_1 > err_1)
+            err_1 = val_1;
+        if (m == 0 || val_d > err_d)
+            err_d = val_d;
+    }
+
+    return Finish_Step(link_i, t, h, err_1, err_d, new_node, curr_node, globals, assignments, print_flag, outputfile, forcings, workspace);
+}
+
+//Defines ExplicitRKSolver_<METHOD>_<DIM>, ExplicitRKSolver for the tableau METHOD_* of solvers/tableaus.h and DIM states
+#define EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, DIM) \
+    static int ExplicitRKSolver_##METHOD##_##DIM(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace) \
+    { \
+        return ExplicitRKSolverFixed(link_i, globals, assignments, print_flag, outputfile, forcings, workspace, \
+            NUM_STAGES, METHOD##_A[0], METHOD##_weights, METHOD##_c, METHOD##_e, METHOD##_d, DIM); \
+    }
+
+//Defines the solvers for METHOD with 1 to ASYNCH_FIXED_MAX_DIM states, and the table ExplicitRKSolvers_<METHOD>
+//indexed by the number of states
+#define ASYNCH_FIXED_MAX_DIM 10
+#define EXPLICIT_RK_SOLVERS_FIXED(METHOD, NUM_STAGES) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 1) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 2) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 3) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 4) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 5) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 6) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 7) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 8) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 9) \
+    EXPLICIT_RK_SOLVER_FIXED(METHOD, NUM_STAGES, 10) \
+    static RKSolverFunc* const ExplicitRKSolvers_##METHOD[ASYNCH_FIXED_MAX_DIM + 1] = { \
+        NULL, \
+        &ExplicitRKSolver_##METHOD##_1, &ExplicitRKSolver_##METHOD##_2, &ExplicitRKSolver_##METHOD##_3, \
+        &ExplicitRKSolver_##METHOD##_4, &ExplicitRKSolver_##METHOD##_5, &ExplicitRKSolver_##METHOD##_6, \
+        &ExplicitRKSolver_##METHOD##_7, &ExplicitRKSolver_##METHOD##_8, &ExplicitRKSolver_##METHOD##_9, \
+        &ExplicitRKSolver_##METHOD##_10 \
+    };
+
+EXPLICIT_RK_SOLVERS_FIXED(RKDense3_2, RKDENSE3_2_STAGES)
+EXPLICIT_RK_SOLVERS_FIXED(TheRKDense4_3, THERKDENSE4_3_STAGES)
+EXPLICIT_RK_SOLVERS_FIXED(DOPRI5, DOPRI5_STAGES)
+
+//Returns true if method has the tableau (num_stages, A, b, c, e, d)
+static bool Has_Tableau(const RKMethod* method, unsigned int num_stages, const double *A, const double *b, const double *c, const double *e, const double *d)
+{
+    return method->num_stages == num_stages
+        && memcmp(method->A, A, num_stages * num_stages * sizeof(double)) == 0
+        && memcmp(method->b, b, num_stages * sizeof(double)) == 0
+        && memcmp(method->c, c, num_stages * sizeof(double)) == 0
+        && memcmp(method->e, e, num_stages * sizeof(double)) == 0
+        && memcmp(method->d, d, num_stages * sizeof(double)) == 0;
+}
+
+//Returns the version of ExplicitRKSolver specialized for the RK method and number of states of link_i, or
+//ExplicitRKSolver if there is none.
+RKSolverFunc* Select_ExplicitRKSolver(const Link* link_i)
+{
+    const RKMethod* method = link_i->method;
+
+    if (method == NULL || method->exp_imp != 0 || link_i->dim == 0 || link_i->dim > ASYNCH_FIXED_MAX_DIM)
+        return &ExplicitRKSolver;
+
+    if (Has_Tableau(method, RKDENSE3_2_STAGES, RKDense3_2_A[0], RKDense3_2_weights, RKDense3_2_c, RKDense3_2_e, RKDense3_2_d))
+        return ExplicitRKSolvers_RKDense3_2[link_i->dim];
+    if (Has_Tableau(method, THERKDENSE4_3_STAGES, TheRKDense4_3_A[0], TheRKDense4_3_weights, TheRKDense4_3_c, TheRKDense4_3_e, TheRKDense4_3_d))
+        return ExplicitRKSolvers_TheRKDense4_3[link_i->dim];
+    if (Has_Tableau(method, DOPRI5_STAGES, DOPRI5_A[0], DOPRI5_weights, DOPRI5_c, DOPRI5_e, DOPRI5_d))
+        return ExplicitRKSolvers_DOPRI5[link_i->dim];
+
+    return &ExplicitRKSolver;
+}
+
+//Returns true if link_i is solved with ExplicitRKSolver or one of its specialized versions
+bool Is_ExplicitRKSolver(const Link* link_i)
+{
+    return link_i->solver == &ExplicitRKSolver || link_i->solver == Select_ExplicitRKSolver(link_i);
+}
+
+
+
+//Computes one step of a method to solve the ODE at several leaves at once. The leaves must have no parents, and share
+//the same RK method and number of states. The stages are combined for all the leaves together, in the structure-of-
+//arrays layout of batch, so the loops over the leaves can be vectorized. The step of each leaf is accepted or
+//rejected on its own, as ExplicitRKSolver would do it.
+//Link** links: the leaves to apply the numerical method to.
+//unsigned int num_links: number of leaves in links. Must be at most batch->width.
+//Sets links[i]->rejected to 1 if the step of leaf i was successfully taken, 0 if it was rejected.
+void ExplicitRKSolverBatch(Link** links, unsigned int num_links, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace, BatchWorkspace* batch)
+{
+    //Some variables to make things easier to read
+    const RKMethod * const meth = links[0]->method;
+    const double * const A = meth->A;
+    const double * const b = meth->b;
+    const double * const c = meth->c;
+    const double * const e = meth->e;
+    const double * const d = meth->d;
+    unsigned int num_stages = meth->num_stages;
+    unsigned int dim = links[0]->dim;
+    unsigned int width = num_links;
+    double * restrict t = batch->t;
+    double * restrict h = batch->h;
+    double * restrict y_0 = batch->y_0;
+    double * restrict sum = batch->sum;
+    double * restrict new_y = batch->new_y;
+    double * restrict k = batch->k;
+    double *temp = workspace->temp;
+    double *err = workspace->temp2;
+    double **temp_k = workspace->temp_k_slices;
+    RKSolutionNode* new_node;
+
+    assert(num_links <= batch->width);
+
+    //Gather the initial states
+    for (unsigned int l = 0; l < width; l++)
+    {
+        Link* link_i = links[l];
+        assert(link_i->num_parents == 0 && link_i->method == meth && link_i->dim == dim);
+
+        t[l] = link_i->my->list.tail->t;
+        h[l] = link_i->h;
+        for (unsigned int m = 0; m < dim; m++)
+            y_0[m * width + l] = link_i->my->list.tail->y_approx[m];
+    }
+
+    //Compute the k's
+    for (unsigned int i = 0; i < num_stages; i++)
+    {
+        memcpy(sum, y_0, dim * width * sizeof(double));
+        for (unsigned int j = 0; j < i; j++)
         {
-            dcopy(new_y, link_i->peak_value, 0, link_i->dim);
-            link_i->peak_time = link_i->last_t;
+            double a = A[i * num_stages + j];
+            double *k_j = k + j * dim * width;
+            for (unsigned int m = 0; m < dim; m++)
+                for (unsigned int l = 0; l < width; l++)
+                    sum[m * width + l] += h[l] * a * k_j[m * width + l];
         }
 
-        //Check if the newest step is on a change in rainfall
-        short int propagated = 0;	//Set to 1 when last_t has been propagated
-        for (unsigned int j = 0; j < globals->num_forcings; j++)
+        //[num_stages][max_parents][max_dim]
+        double *y_p = workspace->stages_parents_approx + i * globals->max_parents * globals->max_dim;
+        double *k_i = k + i * dim * width;
+
+        for (unsigned int l = 0; l < width; l++)
         {
-            if (forcings[j].active && (link_i->my->forcing_data[j].num_points > 0) && (fabs(link_i->last_t - link_i->my->forcing_change_times[j]) < 1e-8))
-            {
-                //Propagate the discontinuity to downstream links
-                if (!propagated)
-                {
-                    propagated = 1;
-                    Link* next = link_i->child;
-                    Link* prev = link_i;
-                    for (unsigned int i = 0; i < globals->max_localorder && next != NULL; i++)
-                    {
-                        if (assignments[next->location] == my_rank && i < next->method->localorder)
-                        {
-                            //Insert the time into the discontinuity list
-                            next->discont_end = Insert_Discontinuity(link_i->my->forcing_change_times[j], next->discont_start, next->discont_end, &(next->discont_count), globals->discont_size, next->discont, next->ID);
-                        }
-                        else if (next != NULL && assignments[next->location] != my_rank)
-                        {
-                            //Store the time to send to another process
-                            Insert_SendDiscontinuity(link_i->my->forcing_change_times[j], i, &(prev->discont_send_count), globals->discont_size, prev->discont_send, prev->discont_order_send, prev->ID);
-                            break;
-                        }
+            Link* link_i = links[l];
+            double *y = workspace->sum;
+
+            for (unsigned int m = 0; m < dim; m++)
+                y[m] = sum[m * width + l];
+
+            link_i->check_consistency(y, dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+
+            link_i->differential(
+                t[l] + c[i] * h[l],
+                y, dim,
+                y_p, 0, globals->max_dim,
+                globals->global_params,
+                link_i->params,
+                link_i->my->forcing_values,
+                link_i->qvs,
+                link_i->state,
+                link_i->user,
+                temp_k[0]);
+
+            for (unsigned int m = 0; m < dim; m++)
+                k_i[m * width + l] = temp_k[0][m];
+        }
+    }
 
-                        prev = next;
-                        next = next->child;
-                    }
-                }
+    //Build the solutions
+    memcpy(new_y, y_0, dim * width * sizeof(double));
+    for (unsigned int i = 0; i < num_stages; i++)
+    {
+        double *k_i = k + i * dim * width;
+        for (unsigned int m = 0; m < dim; m++)
+            for (unsigned int l = 0; l < width; l++)
+                new_y[m * width + l] += h[l] * b[i] * k_i[m * width + l];
+    }
 
-                //Find the right index in rainfall
-                //for(l=1;l<link_i->my->forcing_data[j].n_times;l++)
-                unsigned int l;
-                for (l = link_i->my->forcing_indices[j] + 1; l < link_i->my->forcing_data[j].num_points; l++)
-                    if (fabs(link_i->my->forcing_change_times[j] - link_i->my->forcing_data[j].data[l].time) < 1e-8)
-                        break;
-                link_i->my->forcing_indices[j] = l;
+    //Error estimation and step size selection, one leaf at a time
+    for (unsigned int l = 0; l < width; l++)
+    {
+        Link* link_i = links[l];
+        ErrorData* error = link_i->my->error_data;
+        double *y = workspace->sum;
+        double *y0 = link_i->my->list.tail->y_approx;
+
+        new_node = New_Step(&link_i->my->list);
+        new_node->t = t[l] + h[l];
+        for (unsigned int m = 0; m < dim; m++)
+            new_node->y_approx[m] = new_y[m * width + l];
+
+        link_i->check_consistency(new_node->y_approx, dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+        new_node->state = link_i->state;
+
+        //Internal stages of this leaf, as ExplicitRKSolver leaves them in the workspace
+        for (unsigned int i = 0; i < num_stages; i++)
+            for (unsigned int m = 0; m < dim; m++)
+                temp_k[i][m] = k[(i * dim + m) * width + l];
+
+        //Check the error of y_1 (in inf norm) to determine if the step can be accepted
+        for (unsigned int m = 0; m < dim; m++)
+            err[m] = temp_k[0][m] * (h[l] * e[0]);
+        for (unsigned int i = 1; i < num_stages; i++)
+            daxpy(h[l] * e[i], temp_k[i], err, 0, dim);
+        for (unsigned int m = 0; m < dim; m++)
+            temp[m] = max(fabs(new_node->y_approx[m]), fabs(y0[m])) * error->reltol[m] + error->abstol[m];
+        double err_1 = nrminf2(err, temp, 0, dim);
+
+        //Check the dense error (in inf norm) to determine if the step can be accepted
+        for (unsigned int m = 0; m < dim; m++)
+            y[m] = temp_k[0][m] * (h[l] * d[0]);
+        for (unsigned int i = 1; i < num_stages; i++)
+            daxpy(h[l] * d[i], temp_k[i], y, 0, dim);
+        for (unsigned int m = 0; m < dim; m++)
+            temp[m] = max(fabs(new_node->y_approx[m]), fabs(y0[m])) * error->reltol_dense[m] + error->abstol_dense[m];
+        double err_d = nrminf2(y, temp, 0, dim);
+
+        link_i->rejected = Finish_Step(link_i, t[l], h[l], err_1, err_d, new_node, NULL, globals, assignments, print_flag, outputfile, forcings, workspace);
+    }
+}
 
-                double forcing_buffer = link_i->my->forcing_data[j].data[l].value;
-                link_i->my->forcing_values[j] = forcing_buffer;
 
-                //Find and set the new change in rainfall
-                unsigned int i;
-                for (i = l + 1; i < link_i->my->forcing_data[j].num_points; i++)
-                {
-                    //if(link_i->my->forcing_data[j].rainfall[i].value != forcing_buffer)
-                    if (fabs(link_i->my->forcing_data[j].data[i].value - forcing_buffer) > 1e-8)
-                    {
-                        link_i->my->forcing_change_times[j] = link_i->my->forcing_data[j].data[i].time;
-                        break;
-                    }
-                }
-                if (i == link_i->my->forcing_data[j].num_points)
-                    link_i->my->forcing_change_times[j] = link_i->my->forcing_data[j].data[i - 1].time;
-            }
-        }
+//Computes one step of a method to solve the ODEs of a chain of links as one coupled system. chain[0] may have any
+//parent, and chain[j] must have chain[j - 1] as its only parent. All the links share the same RK method, the same
+//time and the step size chain[0]->h. The parent of chain[j] is evaluated at the same stage as chain[j] instead of
+//through its dense output. The step is accepted only if it is accepted for every link of the chain.
+//Link** chain: the links to apply a numerical method to, from upstream to downstream.
+//unsigned int length: number of links in the chain. Must be at most batch->width.
+//Returns 1 if the step was successfully taken, 0 if the step was rejected.
+int ExplicitRKSolverChain(Link** chain, unsigned int length, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace, BatchWorkspace* batch)
+{
+    RKSolutionNode **curr_node = workspace->parents_node, *new_node;
 
-        //Select new step size, if forcings changed
-        if (propagated)
-            link_i->h = InitialStepSize(link_i->last_t, link_i, globals, workspace);
+    //Some variables to make things easier to read
+    Link* head = chain[0];
+    double h = head->h;
+    double t = head->my->list.tail->t;
+    const RKMethod * const meth = head->method;
+    const double * const A = meth->A;
+    const double * const b = meth->b;
+    const double * const c = meth->c;
+    const double * const e = meth->e;
+    const double * const d = meth->d;
+    unsigned int num_stages = meth->num_stages;
+    unsigned int max_dim = globals->max_dim;
+    double *temp = workspace->temp;
+    double *err = workspace->temp2;
+    double **temp_k = workspace->temp_k_slices;
+    double err_1 = 0.0, err_d = 0.0;
+    int accepted = 1;
 
-        //Free up parents' old data
-        for (unsigned int i = 0; i < link_i->num_parents; i++)
+    //Stage arguments are stored in batch->sum as [length][max_dim], internal stages in batch->k as [num_stages][length][max_dim]
+    double *sum = batch->sum;
+    double *k = batch->k;
+
+    assert(length <= batch->width);
+
+    //Get the approximate solutions from the parents of the head
+    Approximate_Parents(head, t, h, curr_node, globals, workspace);
+
+    //Compute the k's, one link at a time from upstream to downstream
+    for (unsigned int i = 0; i < num_stages; i++)
+    {
+        for (unsigned int j = 0; j < length; j++)
         {
-            Link *curr_parent = link_i->parents[i];
-            while (curr_parent->my->list.head != curr_node[i])
-            {
-                Remove_Head_Node(&curr_parent->my->list);
-                curr_parent->current_iterations--;
-                curr_parent->iters_removed++;
-            }
+            Link* link_i = chain[j];
+            unsigned int dim = link_i->dim;
+            double *y_0 = link_i->my->list.tail->y_approx;
+            double *sum_j = sum + j * max_dim;
+            double *y_p;
+            assert(link_i->method == meth && fabs(link_i->my->list.tail->t - t) < 1e-12);
+
+            memcpy(sum_j, y_0, dim * sizeof(double));
+            for (unsigned int l = 0; l < i; l++)
+                daxpy(h * A[i * num_stages + l], k + (l * length + j) * max_dim, sum_j, 0, dim);
+
+            link_i->check_consistency(sum_j, dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+
+            //The parent of a link in the chain is at the same stage
+            if (j == 0)
+                y_p = workspace->stages_parents_approx + i * globals->max_parents * max_dim;
+            else
+                y_p = sum + (j - 1) * max_dim;
+
+            link_i->differential(
+                t + c[i] * h,
+                sum_j, dim,
+                y_p, link_i->num_parents, max_dim,
+                globals->global_params,
+                link_i->params,
+                link_i->my->forcing_values,
+                link_i->qvs,
+                link_i->state,
+                link_i->user,
+                k + (i * length + j) * max_dim);
         }
+    }
 
-        return 1;
+    //Build the solutions and estimate the errors of the whole chain
+    for (unsigned int j = 0; j < length; j++)
+    {
+        Link* link_i = chain[j];
+        ErrorData* error = link_i->my->error_data;
+        unsigned int dim = link_i->dim;
+        double *y_0 = link_i->my->list.tail->y_approx;
+
+        new_node = New_Step(&link_i->my->list);
+        new_node->t = t + h;
+        double *new_y = new_node->y_approx;
+
+        dcopy(y_0, new_y, 0, dim);
+        for (unsigned int i = 0; i < num_stages; i++)
+            daxpy(h * b[i], k + (i * length + j) * max_dim, new_y, 0, dim);
+
+        link_i->check_consistency(new_y, dim, globals->global_params, globals->num_global_params, link_i->params, link_i->num_params, link_i->user);
+        new_node->state = link_i->state;
+
+        //Error of y_1 (in inf norm)
+        dcopy(k + j * max_dim, err, 0, dim);
+        dscal(h * e[0], err, 0, dim);
+        for (unsigned int i = 1; i < num_stages; i++)
+            daxpy(h * e[i], k + (i * length + j) * max_dim, err, 0, dim);
+        for (unsigned int m = 0; m < dim; m++)
+            temp[m] = max(fabs(new_y[m]), fabs(y_0[m])) * error->reltol[m] + error->abstol[m];
+        err_1 = max(err_1, nrminf2(err, temp, 0, dim));
+
+        //Dense error (in inf norm)
+        dcopy(k + j * max_dim, err, 0, dim);
+        dscal(h * d[0], err, 0, dim);
+        for (unsigned int i = 1; i < num_stages; i++)
+            daxpy(h * d[i], k + (i * length + j) * max_dim, err, 0, dim);
+        for (unsigned int m = 0; m < dim; m++)
+            temp[m] = max(fabs(new_y[m]), fabs(y_0[m])) * error->reltol_dense[m] + error->abstol_dense[m];
+        err_d = max(err_d, nrminf2(err, temp, 0, dim));
     }
-    else
+
+    //Keep or trash the step of each link. As the errors are shared, either all or none of the steps are kept.
+    for (unsigned int j = 0; j < length; j++)
     {
-		// adlz
-		// printf("+Trashing the data as (%f > 1.0) or (%f > 1.0)...\n", err_1, err_d);
+        Link* link_i = chain[j];
+        RKSolutionNode* parent_node = NULL;
 
-        //Trash the data from the failed step
-        Undo_Step(&link_i->my->list);
+        //Internal stages of this link, as ExplicitRKSolver leaves them in the workspace
+        for (unsigned int i = 0; i < num_stages; i++)
+            memcpy(temp_k[i], k + (i * length + j) * max_dim, link_i->dim * sizeof(double));
 
-        return 0;
+        //The previous link of the chain only needs to keep its newest step
+        if (j > 0)
+            parent_node = chain[j - 1]->my->list.tail;
+
+        accepted = Finish_Step(link_i, t, h, err_1, err_d, link_i->my->list.tail, (j == 0) ? curr_node : &parent_node, globals, assignments, print_flag, outputfile, forcings, workspace);
     }
+
+    //Share the smallest proposed step size
+    for (unsigned int j = 1; j < length; j++)
+        head->h = min(head->h, chain[j]->h);
+    for (unsigned int j = 1; j < length; j++)
+        chain[j]->h = head->h;
+
+    return accepted;
 }
@@ -22,7 +22,7 @@ int ExplicitRKSolverDiscont(Link* link_i, GlobalVars* GlobalVars, int* assignmen
 {
     unsigned int i, j, l, m, idx;
     VEC new_y;
-    RKSolutionNode *curr_node[ASYNCH_LINK_MAX_PARENTS], *node, *new_node;
+    RKSolutionNode **curr_node = workspace->parents_node, *node, *new_node;
     Link* currentp;
     double t_needed, timediff, current_theta;
 
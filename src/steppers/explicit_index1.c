@@ -18,9 +18,8 @@
 //Returns 1 if the step was successfully taken, 0 if the step was rejected.
 int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments, bool print_flag, FILE* outputfile, ConnData* conninfo, Forcing* forcings, Workspace* workspace)
 {
-    unsigned int idx;
     
-    RKSolutionNode *curr_node[ASYNCH_LINK_MAX_PARENTS], *node, *new_node;
+    RKSolutionNode **curr_node = workspace->parents_node, *new_node;
     double t_needed, current_theta;
 
     //Some variables to make things easier to read
@@ -33,7 +32,6 @@ int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments,
     const double * const e = link_i->method->e;
     const double * const d = link_i->method->d;
     unsigned int num_stages = link_i->method->num_stages;
-    RKMethod* meth = link_i->method;
     ErrorData* error = link_i->my->error_data;
     unsigned int dim = link_i->dim;
     unsigned int num_dense = link_i->num_dense;
@@ -63,24 +61,13 @@ int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments,
 
             double dt = curr_node[i]->next->t - curr_node[i]->t;
             current_theta = (t_needed - curr_node[i]->t) / dt;
-            curr_parent->method->dense_b(current_theta, curr_parent->method->b_theta);
 
             //[num_stages][max_parents][max_dim] -> [max_dim]
             double *parent_approx = workspace->stages_parents_approx
                 + j * globals->max_parents * globals->max_dim
                 + i * globals->max_dim;
 
-            for (unsigned int m = 0; m < curr_parent->num_dense; m++)
-            {
-                idx = curr_parent->dense_indices[m];
-                double approx = curr_node[i]->y_approx[idx];
-
-                for (int l = 0; l < curr_parent->method->num_stages; l++)
-                    approx += dt * curr_parent->method->b_theta[l] *
-                        curr_node[i]->next->k[l * curr_parent->num_dense + m];
-
-                parent_approx[idx] = approx;
-            }
+            dense_output(curr_node[i]->next, curr_parent->method->dense_degree, current_theta, curr_parent->dense_indices, curr_parent->num_dense, parent_approx);
 
             link_i->check_consistency(parent_approx, curr_parent->dim, globals->global_params, globals->num_global_params, curr_parent->params, link_i->num_params, curr_parent->user);
             
@@ -155,7 +142,6 @@ int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments,
         temp[i] = max(fabs(new_y[i]), fabs(y_0[i])) * error->reltol[i] + error->abstol[i];
 
     err_1 = nrminf2(sum, temp, 1, link_i->dim);
-    double value_1 = pow(1.0 / err_1, 1.0 / meth->e_order);
 
     //Check the dense error (in inf norm) to determine if the step can be accepted
     double err_d;
@@ -169,12 +155,9 @@ int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments,
         temp[i] = max(fabs(new_y[i]), fabs(y_0[i])) * error->reltol_dense[i] + error->abstol_dense[i];
 
     err_d = nrminf2(sum, temp, 1, link_i->dim);
-    double value_d = pow(1.0 / err_d, 1.0 / meth->d_order);
 
     //Determine a new step size for the next step
-    double step_1 = h * min(error->facmax, max(error->facmin, error->fac * value_1));
-    double step_d = h * min(error->facmax, max(error->facmin, error->fac * value_d));
-    link_i->h = min(step_1, step_d);
+    link_i->h = NextStepSize(link_i, h, err_1, err_d);
 
     if (err_1 < 1.0 && err_d < 1.0)
     {
@@ -190,6 +173,7 @@ int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments,
         link_i->last_t = t + h;
         link_i->current_iterations++;
         store_k(workspace->temp_k, globals->max_dim, new_node->k, num_stages, dense_indices, num_dense);
+        store_dense(new_node, link_i->method, dense_indices, num_dense);
 
         //Check if new data should be written to disk
         if (print_flag)
@@ -203,18 +187,8 @@ int ExplicitRKIndex1Solver(Link* link_i, GlobalVars* globals, int* assignments,
                     break;
                 }
                 (link_i->disk_iterations)++;
-                node = link_i->my->list.tail->prev;
                 current_theta = (link_i->next_save - t) / h;
-                link_i->method->dense_b(current_theta, link_i->method->b_theta);
-                for (unsigned int m = 0; m < num_dense; m++)
-                {
-                    idx = dense_indices[m];
-                    double approx = node->y_approx[idx];
-                    for (unsigned int l = 0; l < link_i->method->num_stages; l++)
-                        approx += h * link_i->method->b_theta[l] * node->next->k[l * num_dense + m];
-
-                    sum[idx] = approx;
-                }
+                dense_output(new_node, link_i->method->dense_degree, current_theta, dense_indices, num_dense, sum);
 
                 link_i->algebraic(sum, link_i->dim, globals->global_params, link_i->params, link_i->qvs, link_i->state, link_i->user, sum);
 
@@ -20,7 +20,7 @@ int ForcedSolutionSolver(Link* link_i, GlobalVars* globals, int* assignments, bo
 {
     unsigned int i, j, l;
     double *new_y;
-    RKSolutionNode *curr_node[ASYNCH_LINK_MAX_PARENTS], *new_node;
+    RKSolutionNode **curr_node = workspace->parents_node, *new_node;
     Link* currentp;
     double t_needed;
     short int change_value = 0;
@@ -163,6 +163,7 @@ int ForcedSolutionSolver(Link* link_i, GlobalVars* globals, int* assignments, bo
     link_i->last_t = t + h;
     link_i->current_iterations++;
     store_k(workspace->temp_k, globals->max_dim, new_node->k, num_stages, dense_indices, num_dense);
+    store_dense(new_node, meth, dense_indices, num_dense);
 
     //Check if new data should be written to disk
     if (print_flag)
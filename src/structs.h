@@ -19,6 +19,10 @@
 #include <mpi.h>
 #endif
 
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
+
 #include <libpq_fwd.h>
 
 #include <asynch_interface.h>
@@ -32,9 +36,12 @@ struct Workspace
 
     double *stages_parents_approx;      //!< Matrix of vectors to hold temporary work from parent links. [num_stages][max_parents][max_dim]
     double *parents_approx;             //!< Matrix of vectors to hold temporary work from parent links. [max_parents][max_dim]
+    RKSolutionNode **parents_node;      //!< Nodes of the solutions of the parent links used by a step. [max_parents]
     double *temp_k;                     //!< Vector of vectors to hold temporary internal stage values.[num_stages][max_dim]    
 
     double *temp_k_slices[ASYNCH_MAX_SOLVER_STAGES];
+    double *b_theta;                    //!< Dense output weights. [num_stages]
+    double *b_theta_deriv;              //!< Derivatives of the dense output weights. [num_stages]
 
 #if defined(ASYNCH_HAVE_IMPLICIT_SOLVER)
      //Memory for Implicit Solvers
@@ -47,6 +54,19 @@ struct Workspace
 #endif // defined(ASYNCH_HAVE_IMPLICIT_SOLVER)
 };
 
+/// Memory for solving several leaves with the same RK method at once (ExplicitRKSolverBatch).
+/// Arrays are stored as structures of arrays: entry [i][l] of an array with n leaves is at i * n + l.
+/// ExplicitRKSolverChain uses the same memory for the links of a chain, with one vector of max_dim entries per link.
+struct BatchWorkspace
+{
+    unsigned int width;     //!< Maximum number of leaves solved at once
+    double *t, *h;          //!< Time and step size of each leaf. [width]
+    double *y_0;            //!< Initial states. [max_dim][width]
+    double *sum;            //!< Stage arguments. [max_dim][width]
+    double *new_y;          //!< New states. [max_dim][width]
+    double *k;              //!< Internal stage values. [num_stages][max_dim][width]
+};
+
 /// Holds all information for an RK method.
 /// These are intended for dense output methods, but regular RK methods could be stored here as well.
 struct RKMethod
@@ -63,6 +83,8 @@ struct RKMethod
 
     void(*dense_b)(double, double *);        //!< Function to evaluate b at a value theta in [0,1]
     void(*dense_bderiv)(double, double *);   //!< Derivative of b polynomials
+    unsigned short int dense_degree;    //!< Degree of the b polynomials
+    const double *b_poly;               //!< b coefficients in powers of theta [dense_degree][num_stages], row p multiplies theta^(p+1)
     
     unsigned short int unique_c;        //!< Number of unique values in c
     unsigned short int e_order;         //!< Error order + 1
@@ -82,6 +104,9 @@ struct ErrorData
     double facmax;          //!< Parameter for error estimation
     double facmin;          //!< Parameter for error estimation
     double fac;             //!< Parameter for error estimation
+    unsigned short int controller; //!< Step size controller: 0 standard, 1 PI, 2 Gustafsson predictive
+    double alpha;           //!< Exponent of the current error for the PI and predictive controllers, times the order
+    double beta;            //!< Exponent of the previous error for the PI and predictive controllers, times the order
     double *abstol;         //!< Absolute tolerance [num_dof]
     double *reltol;         //!< Relative tolerance [num_dof]
     double *abstol_dense;   //!< Absolute tolerance for dense output [num_dof]
@@ -95,6 +120,8 @@ struct RKSolutionNode
 {
     double *k;              //!< Array of all k values at time t [num_stages][num_dense]
     double *y_approx;       //!< Approximate solution at time t [num_dof]
+    double *dense;          //!< Dense output from prev->t to t in powers of theta [dense_degree + 1][num_dense]
+    float *dense_f;         //!< Same as dense, in single precision, when the history is stored in float. dense is NULL then.
     double t;               //!< The time to which the data in this node corresponds
     struct RKSolutionNode* next;    //!< Next node in the linked list
     struct RKSolutionNode* prev;    //!< Previous node in the linked list
@@ -109,9 +136,25 @@ struct RKSolutionList
     RKSolutionNode* head;       //!< The beginning of the list. This node has the small t value.
     RKSolutionNode* tail;       //!< The end of the list. This node has the largest t value.
     unsigned short int num_stages;       //!< The number of stages in the RK method used to create these approximations.
+    unsigned short int dense_degree;     //!< The degree of the dense output of the RK method.
 
     double *y_storage;         //!< Storage for all the states [list_length][num_dof]
-    double *k_storage;         //!< Storage for all the k nodes [list_length][num_stages][num_dense_dof]
+    double *k_storage;         //!< Storage for all the k nodes [list_length][num_stages][num_dense_dof], a single row shared by all nodes if the history is stored in float
+    double *dense_storage;     //!< Storage for all the dense output coefficients [list_length][dense_degree + 1][num_dense_dof]
+    float *dense_f_storage;    //!< Storage for the dense output coefficients if the history is stored in float, instead of dense_storage
+    bool pooled;               //!< true if the nodes and storage belong to an Arena and are not freed with the list
+};
+
+/// Bump allocator for the per link storage of the links of a process. Memory is zeroed, aligned on cache lines and
+/// only released all at once.
+///
+struct Arena
+{
+    void **blocks;              //!< Blocks of memory as returned by malloc [num_blocks]
+    unsigned int num_blocks;    //!< Number of blocks
+    size_t block_size;          //!< Minimum size of a new block in bytes
+    char *next;                 //!< Next free byte in the last block
+    char *end;                  //!< End of the last block
 };
 
 
@@ -208,7 +251,7 @@ struct GlobalVars
     unsigned int max_localorder;    //!< Max local order of implemented numerical methods
     unsigned short max_rk_stages;   //!< The largest number of internal stages of any RK method used    !!!! Is this needed? !!!!
     unsigned short max_parents;     //!< The largest number of parents any link has
-    int iter_limit;                 //!< If a link has >= iter_limit of steps stored, no new computations occur
+    int iter_limit;                 //!< If a link has >= iter_limit of steps stored, no new computations occur. With adaptive lists, the largest capacity of a list
     int max_transfer_steps;         //!< Maximum number of steps to communicate at once between processes
     //unsigned int dim;             //!< The dimension of the ODE to solve at each link
     //unsigned int problem_dim;     //!< Same as dim when not using data assimilation. Otherwise, it's the model dimension
@@ -216,6 +259,20 @@ struct GlobalVars
     //unsigned int first_file;      //!< The index of the first rainfall file
     //unsigned int last_file;       //!< The index of the last rainfall file
     unsigned int discont_size;      //!< Size of discont, discont_send, discont_order_send at each link
+    unsigned short int scheduler_flag;  //!< How Advance picks the next link to compute (ASYNCH_SCHEDULER_SCAN or ASYNCH_SCHEDULER_QUEUE)
+    unsigned int num_threads;       //!< Number of threads solving the links of a process
+    unsigned short int comm_thread; //!< 1 if a dedicated thread progresses the MPI communication, 0 if not
+    unsigned short int shared_transfer; //!< 1 if the data exchanged with processes on the same node goes through shared memory, 0 if it is sent as messages
+    unsigned int leaf_batch;        //!< Maximum number of leaves taking their steps together, 0 or 1 to solve leaves one at a time
+    unsigned int chain_length;      //!< Maximum number of links of an unbranched reach solved as one system, 0 or 1 to solve links one at a time
+    unsigned short int float_history;   //!< 1 if the dense output of the solution lists is stored and sent in single precision, 0 for double
+    unsigned short int prefetch_forcings;   //!< 1 if the forcing data of the next pass is read in the background during the current pass, 0 if it is read at the pass boundary
+    unsigned short int adaptive_lists;  //!< 1 if the capacity of the solution lists is adapted to each link, 0 if every list holds iter_limit steps
+    char* cost_save_filename;       //!< File where Advance writes the measured cost of each link, NULL for none
+    char* cost_load_filename;       //!< File with the costs of the links measured in a previous run, used to partition the network. NULL for none
+    double rebalance_threshold;     //!< Imbalance of the work of the processes over a forcing pass above which links are moved between processes. 0 to never move links
+    unsigned short int arena_flag;  //!< 1 if the per link storage is carved from one arena in the order of my_sys, 0 if every array is allocated on its own
+    Arena arena;                    //!< Holds the per link storage of this process when arena_flag is set
     //double file_time;             //!< The time duration that a rainfall file lasts    
     //unsigned int diff_start;      //!< Starting index of differential variables in solution vectors
     //unsigned int no_ini_start;    //!< Starting index of differential variables not read from disk
@@ -236,8 +293,8 @@ struct GlobalVars
     char* rvr_filename;
     char* prm_filename;
     unsigned short int init_flag;   //!< 0 if reading .ini file, 1 if reading .uini file, 2 if reading .rec file
-    unsigned short int rvr_flag;    //!< 0 if reading .rvr file, 1 if using database
-    unsigned short int prm_flag;    //!< 0 if reading .prm file, 1 if using database
+    unsigned short int rvr_flag;    //!< 0 if reading .rvr file, 1 if using database, 2 if reading a network bundle
+    unsigned short int prm_flag;    //!< 0 if reading .prm file, 1 if using database, 2 if reading a network bundle
     //unsigned short int output_flag;   //0 for matlab (.dat), 1 for .csv
     //char* results_folder;
     //char* temp_folder;
@@ -328,6 +385,15 @@ typedef struct LinkData
     RKSolutionList list;            //!< The list for the calculated numerical solution
     ErrorData *error_data;          //!< Error estimation information for this link
 
+    //Step size control history. error_data is shared by all the links unless a .rkd file is used, so it is kept here.
+    double err_prev[2];             //!< Scaled local and dense errors of the last accepted step, 0 if there is none
+    double h_prev;                  //!< Size of the last accepted step
+    unsigned int num_accepted;      //!< Number of accepted steps
+    unsigned int num_rejected;      //!< Number of rejected steps
+    double solve_time;              //!< Time spent computing the steps of this link, in seconds. Only measured when the costs are saved
+
+    int peak_iterations;            //!< Largest number of steps stored in the list since its capacity was last adapted
+
     //Forcings data
     //TODO merge into one struct
     //ForcingData *forcing_data;          //!< Array of forcing data for this link [num_forcing]
@@ -336,6 +402,10 @@ typedef struct LinkData
     double *forcing_change_times;       //!< Next time in which there is a change in rainfall, relative to last_t [num_forcing]
     double *forcing_values;             //!< The current forcing values for this link at time last_t [num_forcing]
     unsigned int *forcing_indices;      //!< forcing_indices[i] has index of forcing_buff[i]->rainfall[*][0] that is currently used [num_forcing]
+
+    //Arena storage
+    bool pooled;                        //!< true if the solution list, forcing arrays, discontinuities and peak values of this link belong to the process arena
+    void *list_storage;                 //!< Storage reserved in the arena for the solution list, NULL if pooled is not set
     
 } LinkData;
 
@@ -344,11 +414,23 @@ typedef struct LinkData
 ///
 struct Link
 {
-    unsigned int ID;                    //!< ID for the link. This is how a link is referenced in data files
-    unsigned int location;              //!< Index of this link in the system array
-
+    //Scheduling state. These are read for every link (and its parents) each time the scheduler looks for work, so they
+    //are kept together at the start of the struct where they fit in a single 64 byte cache line. Everything else is
+    //only touched once a step is actually taken.
+    double last_t;                      //!< Last time in which a numerical solution was calculated
+    double h;                           //!< Current step size
+    Link **parents;                     //!< An array of all upstream links (parents)
+    Link *child;                        //!< The downstream link (child)
     LinkData *my;                       //!< Link data that are used only if the link belongs to the current proc
+    int current_iterations;             //!< Number of stored iterations in list
+    unsigned int location;              //!< Index of this link in the system array
+    unsigned int discont_count;         //!< Number of times in discont
+    unsigned short int num_parents;     //!< Number of upstream links
+    short int ready;                    //!< Flag that is 1 if a step can be taken, 0 if not
+    short rejected;                     //!< 0 if the previous step was accepted, 1 if rejected, 2 for discontinuity
+    int iter_limit;                     //!< Number of steps the list can hold. If current_iterations reaches it, no new computations occur
 
+    unsigned int ID;                    //!< ID for the link. This is how a link is referenced in data files
     RKMethod *method;                   //!< Pointer to a RK method to use for solving the ODEs for this link
     //RKSolutionList *list;               //!< The list for the calculated numerical solution
     //ErrorData* error_data;              //!< Error estimation information for this link
@@ -363,28 +445,18 @@ struct Link
     RKSolverFunc *solver;               //!< RK solver to use
     CheckConsistencyFunc *check_consistency; //!< Function to check state variables
 
-    double h;                           //!< Current step size
-    double last_t;                      //!< Last time in which a numerical solution was calculated
     double print_time;                  //!< Numerical solution is written to disk in increments of print_time
     double next_save;                   //!< Next time to write numerical solution to disk
-    short int ready;                    //!< Flag that is 1 if a step can be taken, 0 if not
-    
-    //Topology
-    unsigned short int num_parents;     //!< Number of upstream links
-    Link **parents;                     //!< An array of all upstream links (parents)
-    Link *child;                        //!< The downstream link (child)
 
     unsigned int disk_iterations;       //!< Number of iterations stored on disk
 
     double peak_time;                   //!< The time at which the largest discharge has occurred for this link
     double *peak_value;                 //!< The value of the largest discharge for this link [num_dof]
     
-    int current_iterations;             //!< Number of stored iterations in list
     int steps_on_diff_proc;             //!< Number of steps for this link that are stored on another process
     int iters_removed;                  //!< Total number of iterations removed that has not been sent
     unsigned int distance;              //!< Maximum number of links upstream to get to an external link
-    
-    short rejected;                       //!< 0 if the previous step was accepted, 1 if rejected, 2 for discontinuity
+    double work;                        //!< Work of this link measured in a previous run, used to partition the network. 0 if unknown
     
     unsigned short int save_flag;       //!< 1 if saving data for this link, 0 if not
     unsigned short int peak_flag;       //!< 1 if saving peak flow data for this link, 0 if not
@@ -430,7 +502,6 @@ struct Link
     //Discontinuity tracking
     int state;                          //!< The current state of the solution
     double* discont;                    //!< List of discontinuity times to step on
-    unsigned int discont_count;         //!< Number of times in discont
     unsigned int discont_start;         //!< Starting index in discont
     unsigned int discont_end;           //!< Last index of a time in discont
     unsigned int discont_send_count;    //!< Number of times in discont_send and discont_order_send
@@ -454,6 +525,35 @@ typedef double (ForcingGetNextCallback)(
     const Lookup * const id_to_loc,
     unsigned int forcing_idx);
 
+typedef int (ForcingWindowReadCallback)(ForcingWindow* window);
+
+
+/// This structure holds a window of forcing data, read from the files or the database of a forcing before it is
+/// stored at the links. With forcing prefetch, the next window is read by a background thread while the links are
+/// integrated over the current one. Read makes no MPI calls.
+///
+struct ForcingWindow
+{
+    ForcingWindowReadCallback *Read;    //!< Reads the data of the window into values. Returns 0 if ok, otherwise sets error.
+    Forcing* forcing;                   //!< The forcing the window belongs to
+    ConnData* conninfo;                 //!< Connection to the database, for database forcings
+    char* prefix;                       //!< Filename of the forcing files, without the index
+    unsigned int N;                     //!< Number of links in the system
+    unsigned int first;                 //!< First file (or unix time) of the window
+    unsigned int last;                  //!< Last file (or unix time) of the window
+    unsigned int outletlink;            //!< For database forcings, the link whose upstream links are queried (0 for all)
+    void* values;                       //!< Data read, laid out by Read
+    size_t capacity;                    //!< Size of values in bytes
+    unsigned int count;                 //!< For database forcings, number of rows read
+    int status;                         //!< Value returned by the last call to Read
+    bool valid;                         //!< true if values holds the window first to last
+    bool reading;                       //!< true while a thread reads the window
+    char error[ASYNCH_MAX_PATH_LENGTH + 64];   //!< Message explaining why Read failed
+#if defined(HAVE_PTHREAD)
+    pthread_t thread;                   //!< Thread reading the window
+#endif
+};
+
 
 /// This structure holds all the data for a forcing in the river system.
 ///
@@ -464,6 +564,7 @@ struct Forcing
     
     unsigned short int flag;
     char* filename;
+    bool binary_storm;                  //!< For storm file forcings, true if the file is a binary storm file (.bstr)
     unsigned int increment;
     double file_time;
     unsigned int first_file;
@@ -487,8 +588,17 @@ struct Forcing
     unsigned int** grid_to_linkid;
     unsigned int* num_links_in_grid;
     char* received;
-    float* intensities;
     unsigned int num_cells;
+    DataPoint* cell_data;               //!< For grid cell forcings, the series of each cell with links on this process, shared by these links
+    unsigned int* cell_series;          //!< Index in cell_data of the series of each cell, or -1 if no link of the cell is on this process
+    unsigned int num_series;            //!< Number of series in cell_data, not counting the last one (no rain) for links in no cell
+    unsigned int series_length;         //!< Number of DataPoint in each series of cell_data
+    unsigned int* owned_runs;           //!< For binary forcings, pairs (first link, number of links) of the runs of consecutive links on this process
+    unsigned int num_owned_runs;        //!< Number of runs in owned_runs
+    unsigned int* scatter_links;        //!< For gzip binary forcings, the links ordered by the process they are assigned to
+    int* scatter_counts;                //!< Number of links in scatter_links for each process
+    int* scatter_displs;                //!< Index in scatter_links of the first link of each process
+    ForcingWindow window;               //!< Data of the files or database rows of the next pass, before they are stored at the links
 
     //For irregular timesteps
     unsigned int next_timestamp;        //!< Holds the next timestep to use for pulling data.
@@ -507,7 +617,7 @@ struct TransData
     unsigned int* send_size;        //!< send_size[i] has the number of entries in send_data[i].
     unsigned int* receive_size;     //!< receive_size[i] has the number of entries in receive_data[i].
     MPI_Request** send_requests;    //!< send_requests[i] has the request for data sent to process i.
-    MPI_Request** receive_requests; //!< receive_requests[i] has request for data received from process i.
+    MPI_Request** receive_requests; //!< receive_requests[i] has the persistent request for data received from process i, MPI_REQUEST_NULL if none is received.
     char** send_buffer;             //!< 2D array. send_buffer[i][j] is a buffer for sending data for link send_data[i][j].
     char** receive_buffer;          //!< A buffer for receiving data through MPI
     short int* sent_flag;           //!< sent_flag[i] is 1 if a message has been sent to process i, 0 if not.
@@ -517,6 +627,13 @@ struct TransData
     unsigned int* num_sent;         //!< num_sent[i] is number of messages sent to process i
     unsigned int* num_recv;         //!< num_recv[i] is number of messages received from process i
     unsigned int* totals;           //!< workspace for flushing of size np
+    struct CommProgress* progress;  //!< Communication thread progressing the messages, NULL if none is running
+    MPI_Comm comm;                  //!< Duplicate of MPI_COMM_WORLD for the messages between links, so no other message can match their receives
+    MPI_Comm node_comm;             //!< Processes sharing memory with this one, MPI_COMM_NULL if the data is only exchanged as messages
+    int* node_rank;                 //!< node_rank[i] is the rank of process i in node_comm, MPI_UNDEFINED if it is on another node
+    MPI_Win shared_win;             //!< Shared memory window holding the channels from the other processes of node_comm, MPI_WIN_NULL if none
+    struct SharedChannel** shared_send;     //!< shared_send[i] is the channel in shared memory to process i, NULL if the data is sent as a message
+    struct SharedChannel** shared_receive;  //!< shared_receive[i] is the channel in shared memory from process i, NULL if the data is received as a message
 };
 
 
@@ -17,10 +17,13 @@ typedef struct TimeSerie TimeSerie;
 typedef struct Link Link;
 typedef struct TransData TransData;
 typedef struct Workspace Workspace;
+typedef struct Arena Arena;
+typedef struct BatchWorkspace BatchWorkspace;
 typedef struct ConnData ConnData;
 
 typedef struct Forcing Forcing;
 typedef struct ForcingData ForcingData;
+typedef struct ForcingWindow ForcingWindow;
 
 typedef struct QVSData QVSData;
 
@@ -9,9 +9,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include <blas.h>
 #include <system.h>
 
+//Every array carved from an arena starts on its own cache line
+#define ARENA_ALIGNMENT 64
+
+//Returns size rounded up to a whole number of cache lines, the space an array of size bytes takes in an arena
+size_t Arena_Round(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
 //Frees link.
 //Link* link: link to be freed.
 //unsigned int list_length: the length of the list stored with link.
@@ -25,33 +39,39 @@ void Destroy_Link(Link* link, int rkd_flag, Forcing* forcings, GlobalVars* globa
 
     if (link->my != NULL)
     {
-        if (link->my->forcing_values)
+        bool pooled = link->my->pooled;
+
+        if (link->my->forcing_values && !pooled)
             free(link->my->forcing_values);
-        if (link->my->forcing_indices)
+        if (link->my->forcing_indices && !pooled)
             free(link->my->forcing_indices);
-        if (link->my->forcing_change_times)
+        if (link->my->forcing_change_times && !pooled)
             free(link->my->forcing_change_times);
         if (rkd_flag)
             Destroy_ErrorData(link->my->error_data);
         Destroy_List(&link->my->list);
         
-        free(link->peak_value);
-        if (link->discont != NULL)
-            free(link->discont);
-        if (link->discont_send != NULL)
+        if (!pooled)
         {
-            free(link->discont_send);
-            free(link->discont_order_send);
+            free(link->peak_value);
+            if (link->discont != NULL)
+                free(link->discont);
+            if (link->discont_send != NULL)
+            {
+                free(link->discont_send);
+                free(link->discont_order_send);
+            }
         }
 
         if (link->my->forcing_data)
         {
             for (i = 0; i < global->num_forcings; i++)
             {
-                if (forcings[i].flag != 4 && forcings[i].flag != 7)
+                if (forcings[i].flag != 4 && forcings[i].flag != 7 && forcings[i].flag != 8)
                     Destroy_ForcingData(&(link->my->forcing_data[i]));
             }
-            free(link->my->forcing_data);
+            if (!pooled)
+                free(link->my->forcing_data);
         }
         //if (link->qvs != NULL)
         //{
@@ -103,6 +123,16 @@ void Destroy_ForcingData(TimeSerie* forcing_buff)
 }
 
 
+//Sizes in bytes of the nodes, states, k values and dense output coefficients of a list. With the history stored in
+//float, the k values of a step are only needed until store_dense runs, so all the nodes share one row.
+static void List_Sizes(unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned short int dense_degree, unsigned int list_length, bool float_history, size_t sizes[4])
+{
+    sizes[0] = list_length * sizeof(RKSolutionNode);
+    sizes[1] = list_length * num_dof * sizeof(double);
+    sizes[2] = (float_history ? 1 : list_length) * num_stages * num_dense_dof * sizeof(double);
+    sizes[3] = list_length * (dense_degree + 1) * num_dense_dof * (float_history ? sizeof(float) : sizeof(double));
+}
+
 /// Creates a list to hold the data for an ODE.
 ///
 /// \param t0: the initial time.
@@ -111,14 +141,45 @@ void Destroy_ForcingData(TimeSerie* forcing_buff)
 /// \param num_dense_dof
 /// \param num_stages: the number of stages in the RKMethod.
 /// \param list_length: the maximum number of steps to store in the list.
-void Init_List(RKSolutionList* list, double t0, double *y0, unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned int list_length)
+/// \param float_history: true to store the dense output coefficients in single precision.
+/// \param storage: memory of List_Storage_Size() bytes to carve the list from, or NULL to allocate it.
+void Init_List(RKSolutionList* list, double t0, double *y0, unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned short int dense_degree, unsigned int list_length, bool float_history, void *storage)
 {
+    size_t sizes[4];
+    void *dense_storage;
+
     assert(list_length > 0);
     if (list_length < 2)
         printf("Warning in Create_List: list_length is %u.\n", list_length);
 
+    List_Sizes(num_dof, num_dense_dof, num_stages, dense_degree, list_length, float_history, sizes);
+
     memset(list, 0, sizeof(RKSolutionList));
-    list->nodes = (RKSolutionNode*)calloc(list_length, sizeof(RKSolutionNode));
+    if (storage)
+    {
+        char *next = (char*)storage;
+        list->nodes = (RKSolutionNode*)next;
+        memset(list->nodes, 0, sizes[0]);
+        next += Arena_Round(sizes[0]);
+        list->y_storage = (double*)next;
+        next += Arena_Round(sizes[1]);
+        list->k_storage = (double*)next;
+        next += Arena_Round(sizes[2]);
+        dense_storage = next;
+        list->pooled = true;
+    }
+    else
+    {
+        list->nodes = (RKSolutionNode*)calloc(list_length, sizeof(RKSolutionNode));
+        list->y_storage = malloc(sizes[1]);
+        list->k_storage = malloc(sizes[2]);
+        dense_storage = malloc(sizes[3]);
+    }
+
+    if (float_history)
+        list->dense_f_storage = (float*)dense_storage;
+    else
+        list->dense_storage = (double*)dense_storage;
 
     //Set the next and prev ptrs for each node
     list->nodes[0].next = &list->nodes[1];
@@ -133,32 +194,144 @@ void Init_List(RKSolutionList* list, double t0, double *y0, unsigned int num_dof
     list->nodes[list_length - 1].next = &list->nodes[0];
     list->nodes[list_length - 1].prev = &list->nodes[list_length - 2];
 
-    //Allocate space for all the vectors
-    list->y_storage = malloc(list_length * num_dof * sizeof(double));
-    list->k_storage = malloc(list_length * num_stages * num_dense_dof * sizeof(double));
-
+    //Set the vectors of each node
     for (unsigned int i = 0; i < list_length; i++)
     {
         list->nodes[i].y_approx = list->y_storage + i * num_dof;
-        list->nodes[i].k = list->k_storage + i * num_stages * num_dense_dof;
+        if (float_history)
+        {
+            list->nodes[i].k = list->k_storage;
+            list->nodes[i].dense_f = list->dense_f_storage + i * (dense_degree + 1) * num_dense_dof;
+        }
+        else
+        {
+            list->nodes[i].k = list->k_storage + i * num_stages * num_dense_dof;
+            list->nodes[i].dense = list->dense_storage + i * (dense_degree + 1) * num_dense_dof;
+        }
     }
 
     //Set remaining fields
     list->head = &list->nodes[0];
     list->tail = &list->nodes[0];
     list->num_stages = num_stages;
+    list->dense_degree = dense_degree;
 
     //Store the initial step
     list->head->t = t0;
     dcopy(y0, list->head->y_approx, 0, num_dof);
 }
 
-//Frees the data list.
+/// Returns the number of bytes Init_List carves from its storage for a list with these dimensions.
+size_t List_Storage_Size(unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned short int dense_degree, unsigned int list_length, bool float_history)
+{
+    size_t sizes[4];
+    List_Sizes(num_dof, num_dense_dof, num_stages, dense_degree, list_length, float_history, sizes);
+    return Arena_Round(sizes[0]) + Arena_Round(sizes[1]) + Arena_Round(sizes[2]) + Arena_Round(sizes[3]);
+}
+
+/// Moves the num_nodes steps of list, from head to tail, to new storage that holds list_length steps.
+///
+/// \param num_dof: the number of degree of freedom of the ODE.
+/// \param num_dense_dof: the number of states with dense output.
+/// \param num_nodes: the number of steps stored in list. Must be less than list_length.
+/// \param list_length: the new maximum number of steps to store in the list.
+void Resize_List(RKSolutionList* list, unsigned int num_dof, unsigned int num_dense_dof, unsigned int num_nodes, unsigned int list_length)
+{
+    RKSolutionList resized;
+    bool float_history = list->dense_f_storage != NULL;
+    unsigned int num_k = list->num_stages * num_dense_dof;
+    unsigned int num_coeffs = (list->dense_degree + 1) * num_dense_dof;
+
+    assert(num_nodes > 0 && num_nodes < list_length);
+
+    Init_List(&resized, list->head->t, list->head->y_approx, num_dof, num_dense_dof, list->num_stages, list->dense_degree, list_length, float_history, NULL);
+
+    RKSolutionNode *node = list->head, *copy = resized.head;
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        if (i > 0)
+            copy = New_Step(&resized);
+        copy->t = node->t;
+        copy->state = node->state;
+        memcpy(copy->y_approx, node->y_approx, num_dof * sizeof(double));
+        memcpy(copy->k, node->k, num_k * sizeof(double));
+        if (float_history)
+            memcpy(copy->dense_f, node->dense_f, num_coeffs * sizeof(float));
+        else
+            memcpy(copy->dense, node->dense, num_coeffs * sizeof(double));
+        node = node->next;
+    }
+
+    Destroy_List(list);
+    *list = resized;
+}
+
+//Smallest capacity of an adaptive list. A link in a fused chain holds up to 2 steps when the chain takes a step.
+#define ASYNCH_MIN_LIST_LENGTH 4
+
+/// Returns the number of steps the solution list of link holds when it is created.
+/// Without adaptive lists, this is iter_limit for every link. Links whose steps are exchanged with another process
+/// always get iter_limit, as the sender bounds the steps in flight with it. The other links start from a fraction of
+/// iter_limit that depends on how long their history is kept: a root trashes its steps after every visit, a leaf
+/// keeps them until its child catches up, and an interior link also waits on its own parents.
+int List_Length(const Link* link, const int* assignments, const GlobalVars* globals)
+{
+    int length = globals->iter_limit;
+
+    if (!globals->adaptive_lists || assignments[link->location] != my_rank)
+        return length;
+    if (link->child && assignments[link->child->location] != my_rank)
+        return length;
+
+    if (link->child == NULL)
+        length /= 8;
+    else if (link->num_parents == 0)
+        length /= 4;
+    else
+        length /= 2;
+
+    if (length < ASYNCH_MIN_LIST_LENGTH)
+        length = ASYNCH_MIN_LIST_LENGTH;
+    return (length < globals->iter_limit) ? length : globals->iter_limit;
+}
+
+/// Adapts the capacity of the solution list of link to the largest number of steps it held since the last call.
+/// A list that filled up doubles, up to iter_limit, and a list that stayed below a quarter of its capacity halves.
+/// Must not be called while other threads may read the list.
+void Adapt_List(Link* link, const int* assignments, const GlobalVars* globals)
+{
+    LinkData* my = link->my;
+    int length = link->iter_limit;
+
+    if (!globals->adaptive_lists || assignments[link->location] != my_rank)
+        return;
+    if (link->child && assignments[link->child->location] != my_rank)
+        return;
+
+    if (my->peak_iterations >= link->iter_limit)
+        length = (2 * length < globals->iter_limit) ? 2 * length : globals->iter_limit;
+    else if (4 * my->peak_iterations <= link->iter_limit)
+        length = (length / 2 > ASYNCH_MIN_LIST_LENGTH) ? length / 2 : ASYNCH_MIN_LIST_LENGTH;
+
+    if (length != link->iter_limit && link->current_iterations > 0 && link->current_iterations < length)
+    {
+        Resize_List(&my->list, link->dim, link->num_dense, link->current_iterations, length);
+        link->iter_limit = length;
+    }
+    my->peak_iterations = link->current_iterations;
+}
+
+//Frees the data list. Lists carved from an arena are released with the arena.
 void Destroy_List(RKSolutionList* list)
 {
+    if (list->pooled)
+        return;
+
     free(list->nodes);
     free(list->y_storage);
     free(list->k_storage);
+    free(list->dense_storage);
+    free(list->dense_f_storage);
 }
 
 //Removes the first node in list.
@@ -220,6 +393,7 @@ void Create_Workspace(Workspace *workspace, unsigned int max_dim, unsigned short
 
     workspace->parents_approx = malloc(max_parents * max_dim * sizeof(double));
     workspace->stages_parents_approx = malloc(num_stages * max_parents * max_dim * sizeof(double));
+    workspace->parents_node = malloc(max_parents * sizeof(RKSolutionNode*));
 
     //workspace->temp_k = (VEC*)malloc(num_stages * sizeof(VEC));
     //for (unsigned int i = 0; i < num_stages; i++)
@@ -230,6 +404,9 @@ void Create_Workspace(Workspace *workspace, unsigned int max_dim, unsigned short
     for (unsigned int i = 0; i < num_stages; i++)
         workspace->temp_k_slices[i] = workspace->temp_k + i * max_dim;
 
+    workspace->b_theta = malloc(num_stages * sizeof(double));
+    workspace->b_theta_deriv = malloc(num_stages * sizeof(double));
+
 #if defined(ASYNCH_HAVE_IMPLICIT_SOLVER)
     workspace->ipiv = (int*)malloc(s*dim * sizeof(int));
     workspace->rhs = v_init(s*dim);
@@ -257,6 +434,9 @@ void Destroy_Workspace(Workspace* workspace, unsigned short int num_stages, unsi
     //}
     free(workspace->parents_approx);
     free(workspace->stages_parents_approx);
+    free(workspace->parents_node);
+    free(workspace->b_theta);
+    free(workspace->b_theta_deriv);
 
     //for (unsigned int i = 0; i < num_stages; i++)
     //    v_free(&workspace->temp_k[i]);
@@ -274,6 +454,83 @@ void Destroy_Workspace(Workspace* workspace, unsigned short int num_stages, unsi
 #endif // defined(ASYNCH_HAVE_IMPLICIT_SOLVER)
 }
 
+//Allocates workspace for solving up to width leaves at once
+void Create_BatchWorkspace(BatchWorkspace *batch, unsigned int width, unsigned int max_dim, unsigned short num_stages)
+{
+    batch->width = width;
+    batch->t = malloc(width * sizeof(double));
+    batch->h = malloc(width * sizeof(double));
+    batch->y_0 = malloc(max_dim * width * sizeof(double));
+    batch->sum = malloc(max_dim * width * sizeof(double));
+    batch->new_y = malloc(max_dim * width * sizeof(double));
+    batch->k = malloc(num_stages * max_dim * width * sizeof(double));
+}
+
+//Deallocates workspace for solving leaves at once
+void Destroy_BatchWorkspace(BatchWorkspace* batch)
+{
+    free(batch->t);
+    free(batch->h);
+    free(batch->y_0);
+    free(batch->sum);
+    free(batch->new_y);
+    free(batch->k);
+}
+
+//Prepares an arena whose blocks are at least block_size bytes. No memory is allocated until the first Arena_Alloc.
+void Arena_Init(Arena* arena, size_t block_size)
+{
+    memset(arena, 0, sizeof(Arena));
+    arena->block_size = block_size;
+}
+
+//Returns size bytes of zeroed memory from arena, aligned on a cache line. Returns NULL if out of memory.
+void* Arena_Alloc(Arena* arena, size_t size)
+{
+    size = Arena_Round(size);
+    if (arena->next == NULL || (size_t)(arena->end - arena->next) < size)
+    {
+        size_t block_size = (arena->block_size > size) ? arena->block_size : size;
+        void *block = calloc(block_size + ARENA_ALIGNMENT, 1);
+        if (block == NULL)
+            return NULL;
+
+        void **blocks = realloc(arena->blocks, (arena->num_blocks + 1) * sizeof(void*));
+        if (blocks == NULL)
+        {
+            free(block);
+            return NULL;
+        }
+        arena->blocks = blocks;
+        arena->blocks[arena->num_blocks++] = block;
+
+        arena->next = (char*)block + (ARENA_ALIGNMENT - (size_t)block % ARENA_ALIGNMENT) % ARENA_ALIGNMENT;
+        arena->end = arena->next + block_size;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        //Large blocks are worth backing with transparent huge pages. This is only a hint.
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        char *first = (char*)(((size_t)arena->next + page - 1) / page * page);
+        char *last = (char*)((size_t)arena->end / page * page);
+        if (last > first)
+            madvise(first, last - first, MADV_HUGEPAGE);
+#endif
+    }
+
+    void *ptr = arena->next;
+    arena->next += size;
+    return ptr;
+}
+
+//Releases all the memory of arena
+void Arena_Destroy(Arena* arena)
+{
+    for (unsigned int i = 0; i < arena->num_blocks; i++)
+        free(arena->blocks[i]);
+    free(arena->blocks);
+    memset(arena, 0, sizeof(Arena));
+}
+
 
 void Destroy_Outputs(Output* outputs, unsigned int num_outputs)
 {
@@ -323,10 +580,15 @@ void Destroy_UnivVars(GlobalVars* global)
         free(global->dump_table);
     if (global->dump_loc_filename)
         free(global->dump_loc_filename);
+    if (global->cost_save_filename)
+        free(global->cost_save_filename);
+    if (global->cost_load_filename)
+        free(global->cost_load_filename);
     //if (global->global_params)
     //    free(&global->global_params);
     if (global->print_indices)
         free(global->print_indices);
+    Arena_Destroy(&global->arena);
     free(global);
 }
 
@@ -18,7 +18,27 @@ extern int np;
 /// \param num_dense_dof
 /// \param num_stages: the number of stages in the RKMethod.
 /// \param list_length: the maximum number of steps to store in the list.
-void Init_List(RKSolutionList* list, double t0, double *y0, unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned int list_length);
+/// \param float_history: true to store the dense output coefficients in single precision.
+/// \param storage: memory of List_Storage_Size() bytes to carve the list from, or NULL to allocate it.
+void Init_List(RKSolutionList* list, double t0, double *y0, unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned short int dense_degree, unsigned int list_length, bool float_history, void *storage);
+
+/// Moves the num_nodes steps of list, from head to tail, to new storage that holds list_length steps.
+///
+/// \param num_dof: the number of degree of freedom of the ODE.
+/// \param num_dense_dof: the number of states with dense output.
+/// \param num_nodes: the number of steps stored in list. Must be less than list_length.
+/// \param list_length: the new maximum number of steps to store in the list.
+void Resize_List(RKSolutionList* list, unsigned int num_dof, unsigned int num_dense_dof, unsigned int num_nodes, unsigned int list_length);
+
+/// Returns the number of steps the solution list of link holds when it is created.
+int List_Length(const Link* link, const int* assignments, const GlobalVars* globals);
+
+/// Adapts the capacity of the solution list of link to the largest number of steps it held since the last call.
+/// Must not be called while other threads may read the list.
+void Adapt_List(Link* link, const int* assignments, const GlobalVars* globals);
+
+/// Returns the number of bytes Init_List carves from its storage for a list with these dimensions.
+size_t List_Storage_Size(unsigned int num_dof, unsigned int num_dense_dof, unsigned short int num_stages, unsigned short int dense_degree, unsigned int list_length, bool float_history);
 
 //Destructors
 void Destroy_Link(Link* link_i, int rkd_flag, Forcing* forcings, GlobalVars* GlobalVars);
@@ -40,5 +60,13 @@ void Remove_Head_Node(RKSolutionList* list);
 //Workspace methods
 void Create_Workspace(Workspace *workspace, unsigned int dim, unsigned short num_stages, unsigned short max_parents);
 void Destroy_Workspace(Workspace* workspace, unsigned short int s, unsigned short int max_parents);
+void Create_BatchWorkspace(BatchWorkspace *batch, unsigned int width, unsigned int max_dim, unsigned short num_stages);
+void Destroy_BatchWorkspace(BatchWorkspace* batch);
+
+//Arena methods
+void Arena_Init(Arena* arena, size_t block_size);
+size_t Arena_Round(size_t size);
+void* Arena_Alloc(Arena* arena, size_t size);
+void Arena_Destroy(Arena* arena);
 
 #endif
\ No newline at end of file
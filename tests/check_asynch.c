@@ -1,7 +1,31 @@
+#if !defined(_MSC_VER)
+#include <config.h>
+#else
+#include <config_msvc.h>
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <dirent.h>
+#include <unistd.h>
+
 #include <check.h>
+#include <mpi.h>
+#include <zlib.h>
 
 #include <date_manip.h>
+#include <asynch_interface.h>
+#include <compression.h>
+#include <rksteppers.h>
+
+// Global variables
+int my_rank = 0;
+int np = 0;
 
 START_TEST (test_date_manip_days_in_month)
 {
@@ -15,10 +39,1313 @@ START_TEST (test_date_manip_days_in_month)
 END_TEST
 
 
+//True if the field of Link lies in the first 64 bytes of the struct
+#define IN_FIRST_CACHE_LINE(field) (offsetof(Link, field) + sizeof(((Link*)0)->field) <= 64)
+
+START_TEST (test_link_scheduling_fields)
+{
+    //The fields the schedulers read for a link and its parents share one cache line
+    ck_assert(IN_FIRST_CACHE_LINE(last_t));
+    ck_assert(IN_FIRST_CACHE_LINE(h));
+    ck_assert(IN_FIRST_CACHE_LINE(parents));
+    ck_assert(IN_FIRST_CACHE_LINE(child));
+    ck_assert(IN_FIRST_CACHE_LINE(my));
+    ck_assert(IN_FIRST_CACHE_LINE(current_iterations));
+    ck_assert(IN_FIRST_CACHE_LINE(location));
+    ck_assert(IN_FIRST_CACHE_LINE(discont_count));
+    ck_assert(IN_FIRST_CACHE_LINE(num_parents));
+    ck_assert(IN_FIRST_CACHE_LINE(ready));
+    ck_assert(IN_FIRST_CACHE_LINE(rejected));
+    ck_assert(IN_FIRST_CACHE_LINE(iter_limit));
+}
+END_TEST
+
+
+//Solver runs
+//The solver is run on a small network written in a temporary directory, once with the default options and once with
+//the options under test. The hydrographs of every link, written every 30 minutes, must then match.
+
+#define TEST_NUM_LINKS 15
+
+//Numbers in the output of a run: the number of links and of components, then for each link its id, the number of
+//times written (every 30 minutes for a day) and the time, id and discharge at each of them
+#define TEST_NUM_OUTPUTS (2 + TEST_NUM_LINKS * (2 + 3 * 49))
+
+//Parents of the links of the test network. Link i + 1 has the parents test_parents[i], up to the first 0.
+static const unsigned int test_parents[TEST_NUM_LINKS][4] =
+{
+    { 2, 3 }, { 4, 5 }, { 6 }, { 0 }, { 11, 12 }, { 7 }, { 8 }, { 9, 10 }, { 0 }, { 13, 14, 15 },
+    { 0 }, { 0 }, { 0 }, { 0 }, { 0 }
+};
+
+//Sets the options of a run, after the global file is read and before the network is loaded
+typedef void (ConfigureFunc)(AsynchSolver* asynch);
+
+static char test_dir[ASYNCH_MAX_PATH_LENGTH];
+
+//Steps taken by all the links in the last run
+static unsigned long long steps_accepted, steps_rejected;
+
+//Writes a text file in the working directory. Process 0 writes it, the others wait.
+static void write_file(const char* filename, const char* contents)
+{
+    if (my_rank == 0)
+    {
+        FILE* file = fopen(filename, "w");
+        if (!file)
+        {
+            printf("Error: cannot create %s\n", filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        fputs(contents, file);
+        fclose(file);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+//Writes the topology, parameters, initial states and rainfall of the test network
+static void write_network()
+{
+    char contents[4096];
+    size_t l;
+
+    l = sprintf(contents, "%u\n\n", TEST_NUM_LINKS);
+    for (unsigned int i = 0; i < TEST_NUM_LINKS; i++)
+    {
+        unsigned int n = 0;
+        while (n < 4 && test_parents[i][n])
+            n++;
+        l += sprintf(contents + l, "%u\n%u", i + 1, n);
+        for (unsigned int j = 0; j < n; j++)
+            l += sprintf(contents + l, " %u", test_parents[i][j]);
+        l += sprintf(contents + l, "\n\n");
+    }
+    write_file("net.rvr", contents);
+
+    l = sprintf(contents, "%u\n\n", TEST_NUM_LINKS);
+    for (unsigned int i = 1; i <= TEST_NUM_LINKS; i++)
+        l += sprintf(contents + l, "%u\n%f %f %f\n\n", i, 0.2 + 0.05 * i, 0.3 + 0.02 * i, 0.05 + 0.01 * i);
+    write_file("net.prm", contents);
+
+    l = sprintf(contents, "%u\n\n", TEST_NUM_LINKS);
+    for (unsigned int i = 1; i <= TEST_NUM_LINKS; i++)
+        l += sprintf(contents + l, "%u\n3\n0.0 %f\n120.0 %f\n600.0 0.0\n\n", i, 10.0 + i, 5.0 + 0.5 * i);
+    write_file("net.str", contents);
+
+    write_file("net.uini", "190\n0.0\n\n1e-6 0.0 0.0\n");
+
+    //Link 6 is a reservoir, whose discharge is given. Every link needs a series.
+    l = sprintf(contents, "%u\n\n", TEST_NUM_LINKS);
+    for (unsigned int i = 1; i <= TEST_NUM_LINKS; i++)
+    {
+        if (i == 6)
+            l += sprintf(contents + l, "%u\n3\n0.0 0.5\n300.0 2.0\n900.0 1.0\n\n", i);
+        else
+            l += sprintf(contents + l, "%u\n1\n0.0 0.0\n\n", i);
+    }
+    write_file("res.str", contents);
+    write_file("net.rsv", "6\n");
+    write_file("res.uini", "196\n0.0\n\n1e-6 0.0 0.0\n");
+}
+
+//Writes the rainfall of the binary files prefix0 to prefix(num_files - 1), one file every 60 minutes, and the same
+//rainfall in the storm file prefix.str. It rains for the first 12 hours.
+static void write_binary_rain(const char* prefix, unsigned int num_files)
+{
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    char contents[32768];
+    size_t l;
+
+    if (my_rank == 0)
+    {
+        for (unsigned int k = 0; k < num_files; k++)
+        {
+            sprintf(filename, "%s%u", prefix, k);
+            FILE* file = fopen(filename, "wb");
+            if (!file)
+            {
+                printf("Error: cannot create %s\n", filename);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+
+            //Values are big endian, in the order of the links in net.rvr
+            for (unsigned int i = 1; i <= TEST_NUM_LINKS; i++)
+            {
+                float value = (k < 12) ? 2.0f + 0.5f * i + (k % 3) : 0.0f;
+                unsigned char bytes[4], *p = (unsigned char*)&value;
+                for (unsigned int j = 0; j < 4; j++)
+                    bytes[j] = p[3 - j];
+                fwrite(bytes, 1, 4, file);
+            }
+            fclose(file);
+        }
+    }
+
+    l = sprintf(contents, "%u\n\n", TEST_NUM_LINKS);
+    for (unsigned int i = 1; i <= TEST_NUM_LINKS; i++)
+    {
+        l += sprintf(contents + l, "%u\n%u\n", i, num_files);
+        for (unsigned int k = 0; k < num_files; k++)
+            l += sprintf(contents + l, "%.1f %f\n", 60.0 * k, (k < 12) ? 2.0 + 0.5 * i + (k % 3) : 0.0);
+        l += sprintf(contents + l, "\n");
+    }
+    sprintf(filename, "%s.str", prefix);
+    write_file(filename, contents);
+}
+
+//Compresses the binary files prefix0 to prefix(num_files - 1) of write_binary_rain to prefix0.gz to
+//prefix(num_files - 1).gz
+static void write_gzip_rain(const char* prefix, unsigned int num_files)
+{
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    char values[4 * TEST_NUM_LINKS];
+
+    if (my_rank == 0)
+    {
+        for (unsigned int k = 0; k < num_files; k++)
+        {
+            sprintf(filename, "%s%u", prefix, k);
+            FILE* file = fopen(filename, "rb");
+            size_t size = file ? fread(values, 1, sizeof(values), file) : 0;
+            if (file)
+                fclose(file);
+
+            sprintf(filename, "%s%u.gz", prefix, k);
+            gzFile gzfile = gzopen(filename, "wb");
+            if (size != sizeof(values) || !gzfile || gzwrite(gzfile, values, (unsigned int)size) != (int)size)
+            {
+                printf("Error: cannot create %s\n", filename);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            gzclose(gzfile);
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+//Writes the series of the storm file str_filename to the binary storm file bstr_filename. Only the series of the link
+//id is written, or of every link if id is 0.
+static void write_bstr(const char* str_filename, const char* bstr_filename, unsigned int id)
+{
+    //Entry of the index of the file: link id, number of points and offset of the series
+    struct { uint32_t link_id, num_points; uint64_t offset; } index[TEST_NUM_LINKS];
+    double times[TEST_NUM_LINKS][32];
+    float values[TEST_NUM_LINKS][32];
+
+    if (my_rank == 0)
+    {
+        unsigned int num_links, n = 0, ok = 0;
+        FILE* str = fopen(str_filename, "r");
+        if (str && fscanf(str, "%u", &num_links) == 1 && num_links == TEST_NUM_LINKS)
+        {
+            ok = 1;
+            for (unsigned int i = 0; ok && i < num_links; i++)
+            {
+                ok = (fscanf(str, "%u %u", &index[n].link_id, &index[n].num_points) == 2 && index[n].num_points <= 32);
+                for (unsigned int j = 0; ok && j < index[n].num_points; j++)
+                    ok = (fscanf(str, "%lf %f", &times[n][j], &values[n][j]) == 2);
+                if (!id || index[n].link_id == id)
+                    n++;
+            }
+        }
+        if (str)
+            fclose(str);
+
+        FILE* bstr = fopen(bstr_filename, "wb");
+        if (!ok || !bstr)
+        {
+            printf("Error: cannot write %s\n", bstr_filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        uint32_t header[4] = { 0, 1, n, 0 };
+        memcpy(header, "BSTR", 4);
+        uint64_t offset = sizeof(header) + n * sizeof(index[0]);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            index[i].offset = offset;
+            offset += index[i].num_points * (sizeof(double) + sizeof(float));
+        }
+
+        fwrite(header, sizeof(header), 1, bstr);
+        fwrite(index, sizeof(index[0]), n, bstr);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            fwrite(times[i], sizeof(double), index[i].num_points, bstr);
+            fwrite(values[i], sizeof(float), index[i].num_points, bstr);
+        }
+        fclose(bstr);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+//Cell of the grid of write_grid_rain of the link at location i of net.rvr. The last link is in no cell, and no link is
+//in cell TEST_NUM_CELLS - 1.
+#define TEST_NUM_CELLS 5
+#define GRID_CELL(i) (((i) + 1 < TEST_NUM_LINKS) ? (i) % (TEST_NUM_CELLS - 1) : TEST_NUM_CELLS)
+
+//Writes the rainfall of the grid cell files prefix0 to prefix(num_files - 1), one file every 60 minutes, with the index
+//file prefix.idx and the lookup file prefix.lkp. It rains on the cells for the first 12 hours. Also writes the rainfall
+//of each link in the binary files prefixbin0 to prefixbin(num_files - 1).
+static void write_grid_rain(const char* prefix, unsigned int num_files)
+{
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    char contents[1024];
+    size_t l;
+
+    if (my_rank == 0)
+    {
+        for (unsigned int k = 0; k < num_files; k++)
+        {
+            //Intensities are native endian and scaled by 0.5 in the index file. Cells without rain are left out.
+            sprintf(filename, "%s%u", prefix, k);
+            FILE* file = fopen(filename, "wb");
+            sprintf(filename, "%sbin%u", prefix, k);
+            FILE* binary = fopen(filename, "wb");
+            if (!file || !binary)
+            {
+                printf("Error: cannot create %s\n", filename);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+
+            unsigned int flag = 0x1;
+            fwrite(&flag, sizeof(unsigned int), 1, file);
+            for (unsigned int cell = 0; k < 12 && cell < TEST_NUM_CELLS; cell++)
+            {
+                unsigned short intensity = (unsigned short)(4 + cell + 2 * (k % 3));
+                fwrite(&cell, sizeof(unsigned int), 1, file);
+                fwrite(&intensity, sizeof(unsigned short), 1, file);
+            }
+            fclose(file);
+
+            for (unsigned int i = 0; i < TEST_NUM_LINKS; i++)
+            {
+                unsigned int cell = GRID_CELL(i);
+                float value = (k < 12 && cell < TEST_NUM_CELLS) ? 2.0f + 0.5f * cell + (k % 3) : 0.0f;
+                unsigned char bytes[4], *p = (unsigned char*)&value;
+                for (unsigned int j = 0; j < 4; j++)
+                    bytes[j] = p[3 - j];
+                fwrite(bytes, 1, 4, binary);
+            }
+            fclose(binary);
+        }
+    }
+
+    l = 0;
+    for (unsigned int i = 0; i < TEST_NUM_LINKS; i++)
+        if (GRID_CELL(i) < TEST_NUM_CELLS)
+            l += sprintf(contents + l, "%u %u\n", i, GRID_CELL(i));
+    sprintf(filename, "%s.lkp", prefix);
+    write_file(filename, contents);
+
+    sprintf(contents, "60.0 0.5 %u %s %s.lkp\n", TEST_NUM_CELLS, prefix, prefix);
+    sprintf(filename, "%s.idx", prefix);
+    write_file(filename, contents);
+}
+
+//Sections of the global files that depend on the model
+typedef struct TestModel
+{
+    const char* uid;
+    const char* global_params;
+    const char* initial_state;
+    const char* reservoirs;
+    const char* tolerances;
+} TestModel;
+
+//Model 190, with rainfall as its first forcing
+static const TestModel model_190 =
+{
+    "190",
+    "6 0.33 0.20 -0.1 0.33 0.1 2.2917e-5",
+    "1 net.uini",
+    "0",
+    "1e-3 1e-3 1e-3\n1e-6 1e-6 1e-6\n1e-3 1e-3 1e-3\n1e-6 1e-6 1e-6"
+};
+
+//Model 196, with the discharge of link 6 given by the reservoir forcing of res.str
+static const TestModel model_196 =
+{
+    "196",
+    "5 0.33 0.20 -0.1 0.1 2.2917e-5",
+    "1 res.uini",
+    "1 net.rsv 3",
+    "1e-3 1e-3 1e-3 1e-3 1e-3\n1e-6 1e-6 1e-6 1e-3 1e-3\n1e-3 1e-3 1e-3 1e-3 1e-3\n1e-6 1e-6 1e-6 1e-3 1e-3"
+};
+
+//Writes the global file name.gbl for model on the test network. The run writes the hydrographs of the links given by
+//hydrosave in name.dat. topology, parameters, forcings and hydrosave are the corresponding sections of the file.
+static void write_gbl_saving(const char* name, const TestModel* model, const char* topology, const char* parameters, const char* forcings, const char* hydrosave)
+{
+    char contents[4096];
+    sprintf(contents,
+        "%s\n"
+        "2017-01-01 00:00\n2017-01-02 00:00\n"
+        "0\n"
+        "3\nTime\nLinkID\nState0\n"
+        "Classic\n"
+        "%s\n"
+        "30 10 30\n"
+        "%s\n"
+        "%s\n"
+        "%s\n"
+        "%s\n"
+        "0\n"
+        "%s\n"
+        "1 30.0 %s.dat\n"
+        "0\n"
+        "%s\n0\n"
+        "0\n"
+        "tmp\n"
+        ".1 10.0 .9\n"
+        "0\n2\n"
+        "%s\n"
+        "#\n",
+        model->uid, model->global_params, topology, parameters, model->initial_state, forcings, model->reservoirs, name,
+        hydrosave, model->tolerances);
+
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    sprintf(filename, "%s.gbl", name);
+    write_file(filename, contents);
+}
+
+//Writes the global file name.gbl for model on the test network. The run writes the hydrographs of all the links in
+//name.dat. topology, parameters and forcings are the corresponding sections of the file.
+static void write_gbl(const char* name, const TestModel* model, const char* topology, const char* parameters, const char* forcings)
+{
+    write_gbl_saving(name, model, topology, parameters, forcings, "3");
+}
+
+//Writes the global file name.gbl for the model 190, with the rainfall of net.str
+static void write_default_gbl(const char* name)
+{
+    write_gbl(name, &model_190, "0 net.rvr", "0 net.prm", "2\n1 net.str\n0");
+}
+
+//Runs the solver on the global file name.gbl. configure sets the options of the run, if not NULL. prepare changes
+//the links of the process once the network is finalized, if not NULL.
+static void run_prepared(const char* name, ConfigureFunc* configure, ConfigureFunc* prepare)
+{
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    sprintf(filename, "%s.gbl", name);
+
+    AsynchSolver* asynch = Asynch_Init(MPI_COMM_WORLD, false);
+    Asynch_Parse_GBL(asynch, filename);
+    if (configure)
+        configure(asynch);
+    Asynch_Load_Network(asynch);
+    Asynch_Partition_Network(asynch);
+    Asynch_Load_Network_Parameters(asynch);
+    Asynch_Load_Dams(asynch);
+    Asynch_Load_Numerical_Error_Data(asynch);
+    Asynch_Initialize_Model(asynch);
+    Asynch_Load_Initial_Conditions(asynch);
+    Asynch_Load_Forcings(asynch);
+    Asynch_Load_Save_Lists(asynch);
+    Asynch_Finalize_Network(asynch);
+    if (prepare)
+        prepare(asynch);
+    Asynch_Calculate_Step_Sizes(asynch);
+
+    Asynch_Prepare_Temp_Files(asynch);
+    Asynch_Write_Current_Step(asynch);
+    Asynch_Prepare_Peakflow_Output(asynch);
+    Asynch_Prepare_Output(asynch);
+
+    Asynch_Advance(asynch, 1);
+    Asynch_Get_Step_Counts(asynch, &steps_accepted, &steps_rejected);
+
+    Asynch_Create_Output(asynch, NULL);
+    Asynch_Delete_Temporary_Files(asynch);
+    Asynch_Free(asynch);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+//Runs the solver on the global file name.gbl. configure sets the options of the run, if not NULL.
+static void run(const char* name, ConfigureFunc* configure)
+{
+    run_prepared(name, configure, NULL);
+}
+
+//Reads all the numbers of the output file name.dat. Returns the number of values read in num_values.
+static double* read_output(const char* name, unsigned int* num_values)
+{
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    sprintf(filename, "%s.dat", name);
+
+    *num_values = 0;
+    FILE* file = fopen(filename, "r");
+    if (!file)
+        return NULL;
+
+    unsigned int size = 1024;
+    double* values = malloc(size * sizeof(double));
+    while (fscanf(file, "%lf", &values[*num_values]) == 1)
+    {
+        if (++*num_values == size)
+        {
+            size *= 2;
+            values = realloc(values, size * sizeof(double));
+        }
+    }
+    fclose(file);
+
+    return values;
+}
+
+//Checks that the outputs of the runs name and reference match, to a relative tolerance rtol. Values smaller than 1
+//are compared to an absolute tolerance of rtol. An rtol of 0 requires identical outputs.
+static void assert_same_output(const char* name, const char* reference, double rtol)
+{
+    int same = 1;
+    double max_diff = 0.0;
+
+    if (my_rank == 0)
+    {
+        unsigned int num_values, num_ref;
+        double* values = read_output(name, &num_values);
+        double* ref = read_output(reference, &num_ref);
+
+        same = values && ref && num_values == TEST_NUM_OUTPUTS && num_ref == TEST_NUM_OUTPUTS;
+        for (unsigned int i = 0; same && i < num_values; i++)
+            max_diff = fmax(max_diff, fabs(values[i] - ref[i]) / fmax(fmax(fabs(values[i]), fabs(ref[i])), 1.0));
+        if (max_diff > rtol)
+            same = 0;
+
+        free(values);
+        free(ref);
+    }
+
+    MPI_Bcast(&same, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&max_diff, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    ck_assert_msg(same, "%s.dat differs from %s.dat (relative difference %e)", name, reference, max_diff);
+}
+
+
+//Checks the discharges of the link id in the output name.dat, every 2 hours, against expected, to a relative tolerance
+//rtol. Values smaller than 1 are compared to an absolute tolerance of rtol.
+static void assert_discharges(const char* name, unsigned int id, const double* expected, double rtol)
+{
+    int same = 0;
+    double max_diff = 0.0;
+
+    if (my_rank == 0)
+    {
+        unsigned int num_values;
+        double* values = read_output(name, &num_values);
+
+        for (unsigned int i = 0; num_values == TEST_NUM_OUTPUTS && i < TEST_NUM_LINKS; i++)
+        {
+            double* link = values + 2 + i * (2 + 3 * 49);
+            if (link[0] != id)
+                continue;
+
+            for (unsigned int j = 0; j < 13; j++)
+            {
+                double value = link[2 + 3 * 4 * j + 2];
+                max_diff = fmax(max_diff, fabs(value - expected[j]) / fmax(fmax(fabs(value), fabs(expected[j])), 1.0));
+            }
+            same = (max_diff <= rtol);
+        }
+
+        free(values);
+    }
+
+    MPI_Bcast(&same, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&max_diff, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    ck_assert_msg(same, "link %u of %s.dat differs from the expected discharges (relative difference %e)", id, name, max_diff);
+}
+
+//Finds the hydrograph of the link id in the output values of a run. Returns NULL if the output is incomplete or does
+//not hold the link.
+static double* find_link_output(double* values, unsigned int num_values, unsigned int id)
+{
+    if (num_values < 2 || num_values != 2 + (unsigned int)values[0] * (2 + 3 * 49))
+        return NULL;
+
+    for (unsigned int i = 0; i < (unsigned int)values[0]; i++)
+        if (values[2 + i * (2 + 3 * 49)] == id)
+            return values + 2 + i * (2 + 3 * 49);
+    return NULL;
+}
+
+//Checks that the hydrographs of the link id match in the outputs of the runs name and reference, to a relative
+//tolerance rtol. The networks of the runs and the links they save may differ.
+static void assert_same_link(const char* name, const char* reference, unsigned int id, double rtol)
+{
+    int same = 0;
+    double max_diff = 0.0;
+
+    if (my_rank == 0)
+    {
+        unsigned int num_values, num_ref;
+        double* values = read_output(name, &num_values);
+        double* ref = read_output(reference, &num_ref);
+        double* link = values ? find_link_output(values, num_values, id) : NULL;
+        double* ref_link = ref ? find_link_output(ref, num_ref, id) : NULL;
+
+        if (link && ref_link)
+        {
+            for (unsigned int j = 0; j < 2 + 3 * 49; j++)
+                max_diff = fmax(max_diff, fabs(link[j] - ref_link[j]) / fmax(fmax(fabs(link[j]), fabs(ref_link[j])), 1.0));
+            same = (max_diff <= rtol);
+        }
+
+        free(values);
+        free(ref);
+    }
+
+    MPI_Bcast(&same, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&max_diff, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    ck_assert_msg(same, "link %u of %s.dat differs from %s.dat (relative difference %e)", id, name, reference, max_diff);
+}
+
+//Tolerance for runs taking the same steps. With several processes, when the lists of the links fill up depends on
+//when the messages arrive, and so do a few steps: the outputs then match to the error tolerances only, up to 1e-5
+//with the third order method.
+static double same_steps_tolerance()
+{
+    return (np > 1) ? 1e-4 : 0.0;
+}
+
+
+static void set_queue_scheduler(AsynchSolver* asynch)
+{
+    Asynch_Set_Scheduler(asynch, ASYNCH_SCHEDULER_QUEUE);
+}
+
+START_TEST (test_scheduler_queue)
+{
+    write_default_gbl("scan");
+    write_default_gbl("queue");
+
+    run("scan", NULL);
+    run("queue", set_queue_scheduler);
+
+    //The links are solved in a different order. When a solution list fills up depends on it, and so a few steps.
+    assert_same_output("queue", "scan", 1e-6);
+}
+END_TEST
+
+
+static void set_threads(AsynchSolver* asynch)
+{
+    Asynch_Set_Num_Threads(asynch, 4);
+}
+
+static void set_threads_queue(AsynchSolver* asynch)
+{
+    Asynch_Set_Num_Threads(asynch, 4);
+    Asynch_Set_Scheduler(asynch, ASYNCH_SCHEDULER_QUEUE);
+}
+
+START_TEST (test_threads)
+{
+    write_default_gbl("one_thread");
+    write_default_gbl("threads");
+    write_default_gbl("threads_queue");
+
+    run("one_thread", NULL);
+    run("threads", set_threads);
+    run("threads_queue", set_threads_queue);
+
+    //As with the queue, the links are solved in a different order, and a few steps change
+    assert_same_output("threads", "one_thread", 1e-6);
+    assert_same_output("threads_queue", "one_thread", 1e-6);
+}
+END_TEST
+
+
+static void set_comm_thread(AsynchSolver* asynch)
+{
+    Asynch_Set_Comm_Thread(asynch, 1);
+    ck_assert_int_eq(Asynch_Get_Comm_Thread(asynch), 1);
+}
+
+static void set_comm_thread_queue(AsynchSolver* asynch)
+{
+    set_comm_thread(asynch);
+    Asynch_Set_Scheduler(asynch, ASYNCH_SCHEDULER_QUEUE);
+}
+
+START_TEST (test_comm_thread)
+{
+    write_default_gbl("no_thread");
+    write_default_gbl("comm_thread");
+    write_default_gbl("comm_thread_queue");
+
+    run("no_thread", NULL);
+    run("comm_thread", set_comm_thread);
+    run("comm_thread_queue", set_comm_thread_queue);
+
+    //The thread only runs with several processes. The messages arrive at other times, and so do a few steps.
+    assert_same_output("comm_thread", "no_thread", fmax(1e-6, same_steps_tolerance()));
+    assert_same_output("comm_thread_queue", "no_thread", fmax(1e-6, same_steps_tolerance()));
+}
+END_TEST
+
+
+START_TEST (test_passes)
+{
+    write_binary_rain("rain", 25);
+    write_gbl("one_pass", &model_190, "0 net.rvr", "0 net.prm", "2\n1 rain.str\n0");
+    write_gbl("passes", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+
+    //The binary files are read two at a time, so the run is split in 12 passes. Each pass starts with new step
+    //sizes, so the outputs match to the error tolerances only.
+    run("one_pass", NULL);
+    run("passes", NULL);
+
+    assert_same_output("passes", "one_pass", 1e-4);
+}
+END_TEST
+
+
+//Discharges of the outlet and of link 3, downstream of the reservoir, every 2 hours. Computed before the dense output
+//was stored with the steps.
+static const double reservoir_outlet[13] =
+{
+    1.000000e-06, 3.078717e+00, 2.565736e+00, 3.741112e+00, 3.747195e+00, 3.748982e+00, 2.521266e+00,
+    2.111843e+00, 1.079647e+00, 1.030801e+00, 1.028329e+00, 1.027861e+00, 1.027731e+00
+};
+static const double reservoir_child[13] =
+{
+    1.000000e-06, 7.713656e-01, 6.540290e-01, 2.137595e+00, 2.146392e+00, 2.146772e+00, 2.010523e+00,
+    2.002673e+00, 1.011096e+00, 1.002341e+00, 1.002334e+00, 1.002328e+00, 1.002321e+00
+};
+
+START_TEST (test_reservoir_dense_output)
+{
+    write_gbl("reservoir", &model_196, "0 net.rvr", "0 net.prm", "4\n1 net.str\n1 net.str\n0\n1 res.str");
+
+    run("reservoir", NULL);
+
+    //The forced stepper of the reservoir builds the dense output its child is interpolated with
+    assert_discharges("reservoir", 3, reservoir_child, 1e-4);
+    assert_discharges("reservoir", 1, reservoir_outlet, 1e-4);
+}
+END_TEST
+
+
+static int test_method;
+static unsigned int num_specialized;
+
+static void set_method(AsynchSolver* asynch)
+{
+    asynch->globals->method = test_method;
+}
+
+static void use_generic_solver(AsynchSolver* asynch)
+{
+    for (unsigned int i = 0; i < asynch->my_N; i++)
+    {
+        Link* link = asynch->my_sys[i];
+        if (Is_ExplicitRKSolver(link) && link->solver != ExplicitRKSolver)
+        {
+            link->solver = ExplicitRKSolver;
+            num_specialized++;
+        }
+    }
+}
+
+START_TEST (test_specialized_solvers)
+{
+    char name[32], generic[32];
+
+    //The three explicit RK methods, with 3 states
+    for (test_method = 0; test_method < 3; test_method++)
+    {
+        sprintf(name, "method%i", test_method);
+        sprintf(generic, "generic%i", test_method);
+        write_default_gbl(name);
+        write_default_gbl(generic);
+
+        num_specialized = 0;
+        run(name, set_method);
+        run_prepared(generic, set_method, use_generic_solver);
+
+        MPI_Allreduce(MPI_IN_PLACE, &num_specialized, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+        ck_assert_uint_eq(num_specialized, TEST_NUM_LINKS);
+        assert_same_output(name, generic, same_steps_tolerance());
+    }
+}
+END_TEST
+
+
+static unsigned short test_controller;
+
+static void set_controller(AsynchSolver* asynch)
+{
+    asynch->errors_tol.controller = test_controller;
+}
+
+START_TEST (test_step_size_controllers)
+{
+    unsigned long long rejected[3];
+    char name[32];
+
+    for (test_controller = 0; test_controller < 3; test_controller++)
+    {
+        sprintf(name, "controller%hu", test_controller);
+        write_default_gbl(name);
+        run(name, set_controller);
+
+        ck_assert(steps_accepted > 0);
+        rejected[test_controller] = steps_rejected;
+    }
+
+    //The PI and predictive controllers reject fewer steps, for solutions within the error tolerances
+    ck_assert(rejected[1] < rejected[0]);
+    ck_assert(rejected[2] < rejected[0]);
+    assert_same_output("controller1", "controller0", 1e-4);
+    assert_same_output("controller2", "controller0", 1e-4);
+}
+END_TEST
+
+
+static void set_leaf_batch(AsynchSolver* asynch)
+{
+    Asynch_Set_Leaf_Batch(asynch, 4);
+}
+
+START_TEST (test_leaf_batch)
+{
+    write_default_gbl("leaves");
+    write_default_gbl("leaf_batch");
+
+    run("leaves", NULL);
+    run("leaf_batch", set_leaf_batch);
+
+    //Each leaf of a batch keeps its own step size, and accepts or rejects its steps on its own
+    assert_same_output("leaf_batch", "leaves", same_steps_tolerance());
+}
+END_TEST
+
+
+static void set_chain_length(AsynchSolver* asynch)
+{
+    Asynch_Set_Chain_Length(asynch, 8);
+}
+
+START_TEST (test_chains)
+{
+    write_default_gbl("reaches");
+    write_default_gbl("chains");
+
+    run("reaches", NULL);
+    run("chains", set_chain_length);
+
+    //The links 7, 6 and 3 form a chain. They all take the smallest of their step sizes, so their outputs match to
+    //the error tolerances only.
+    assert_same_output("chains", "reaches", 1e-5);
+}
+END_TEST
+
+
+static unsigned int num_pooled;
+
+static void set_link_arena(AsynchSolver* asynch)
+{
+    Asynch_Set_Link_Arena(asynch, 1);
+}
+
+static void count_pooled_lists(AsynchSolver* asynch)
+{
+    for (unsigned int i = 0; i < asynch->my_N; i++)
+        num_pooled += asynch->my_sys[i]->my->list.pooled;
+}
+
+START_TEST (test_link_arena)
+{
+    write_default_gbl("malloc");
+    write_default_gbl("arena");
+
+    num_pooled = 0;
+    run("malloc", NULL);
+    run_prepared("arena", set_link_arena, count_pooled_lists);
+
+    //Every list is carved from the arena, with the same steps
+    MPI_Allreduce(MPI_IN_PLACE, &num_pooled, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+    ck_assert_uint_eq(num_pooled, TEST_NUM_LINKS);
+    assert_same_output("arena", "malloc", same_steps_tolerance());
+}
+END_TEST
+
+
+static unsigned int list_capacity;
+
+static void set_adaptive_lists(AsynchSolver* asynch)
+{
+    Asynch_Set_Adaptive_Lists(asynch, 1);
+}
+
+static void sum_list_capacities(AsynchSolver* asynch)
+{
+    for (unsigned int i = 0; i < asynch->my_N; i++)
+        list_capacity += asynch->my_sys[i]->iter_limit;
+}
+
+START_TEST (test_adaptive_lists)
+{
+    //The capacities adapt between passes, so the rainfall comes from binary files
+    write_binary_rain("rain", 25);
+    write_gbl("fixed_lists", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+    write_gbl("adaptive_lists", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+
+    list_capacity = 0;
+    run("fixed_lists", NULL);
+    run_prepared("adaptive_lists", set_adaptive_lists, sum_list_capacities);
+
+    //Most lists start below the 30 steps of the global file. A list that fills up before its child can use its
+    //steps stops its link earlier, so a few steps change.
+    MPI_Allreduce(MPI_IN_PLACE, &list_capacity, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+    ck_assert(list_capacity < 30 * TEST_NUM_LINKS);
+    assert_same_output("adaptive_lists", "fixed_lists", fmax(1e-6, same_steps_tolerance()));
+}
+END_TEST
+
+
+static void set_float_history(AsynchSolver* asynch)
+{
+    Asynch_Set_Float_History(asynch, 1);
+}
+
+START_TEST (test_float_history)
+{
+    write_default_gbl("double_history");
+    write_default_gbl("float_history");
+
+    run("double_history", NULL);
+    run("float_history", set_float_history);
+
+    //The parents are interpolated from the rounded dense output, and the hydrographs are written from it, so the
+    //outputs match to the precision of a float. The steps taken change little: about 1e-6 here.
+    assert_same_output("float_history", "double_history", fmax(1e-5, same_steps_tolerance()));
+}
+END_TEST
+
+
+START_TEST (test_delete_temporary_files)
+{
+    write_default_gbl("temp_files");
+
+    AsynchSolver* asynch = Asynch_Init(MPI_COMM_WORLD, false);
+    Asynch_Parse_GBL(asynch, "temp_files.gbl");
+    Asynch_Load_Network(asynch);
+    Asynch_Partition_Network(asynch);
+    Asynch_Load_Network_Parameters(asynch);
+    Asynch_Load_Dams(asynch);
+    Asynch_Load_Numerical_Error_Data(asynch);
+    Asynch_Initialize_Model(asynch);
+    Asynch_Load_Initial_Conditions(asynch);
+    Asynch_Load_Forcings(asynch);
+    Asynch_Load_Save_Lists(asynch);
+    Asynch_Finalize_Network(asynch);
+    Asynch_Calculate_Step_Sizes(asynch);
+    Asynch_Prepare_Temp_Files(asynch);
+    Asynch_Prepare_Output(asynch);
+    Asynch_Advance(asynch, 1);
+    Asynch_Create_Output(asynch, NULL);
+
+    //Deleting the temporary files closes the temporary output file. Asynch_Free must not close it again.
+    ck_assert_int_eq(Asynch_Delete_Temporary_Files(asynch), 0);
+    ck_assert(asynch->outputfile == NULL);
+    Asynch_Free(asynch);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+END_TEST
+
+
+START_TEST (test_grid_cells)
+{
+    write_grid_rain("grid", 25);
+    write_gbl("binary", &model_190, "0 net.rvr", "0 net.prm", "2\n2 gridbin\n2 60.0 0 23\n0");
+    write_gbl("grid_cells", &model_190, "0 net.rvr", "0 net.prm", "2\n8 grid.idx\n2 0 23\n0");
+
+    //The links of a cell share its series, and the links in no cell a series without rain. They get the same
+    //rainfall as from the binary files.
+    run("binary", NULL);
+    run("grid_cells", NULL);
+
+    assert_same_output("grid_cells", "binary", same_steps_tolerance());
+}
+END_TEST
+
+
+static unsigned int num_owned_runs;
+
+static void count_owned_runs(AsynchSolver* asynch)
+{
+    for (unsigned int i = 0; i < asynch->N; i++)
+        if (asynch->assignments[i] == my_rank && (i == 0 || asynch->assignments[i - 1] != my_rank))
+            num_owned_runs++;
+}
+
+START_TEST (test_binary_owned_links)
+{
+    //The files are read in a single pass, so the steps are the same as with the storm file
+    write_binary_rain("rain", 25);
+    write_gbl("storm_file", &model_190, "0 net.rvr", "0 net.prm", "2\n1 rain.str\n0");
+    write_gbl("binary_files", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n30 60.0 0 23\n0");
+
+    num_owned_runs = 0;
+    run("storm_file", NULL);
+    run_prepared("binary_files", NULL, count_owned_runs);
+
+    //With several processes, the links of a process are not consecutive in the files, so each process reads several
+    //runs of values
+    MPI_Allreduce(MPI_IN_PLACE, &num_owned_runs, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+    if (np > 1)
+        ck_assert(num_owned_runs > (unsigned int)np);
+    assert_same_output("binary_files", "storm_file", same_steps_tolerance());
+}
+END_TEST
+
+
+START_TEST (test_gzip_files)
+{
+    write_binary_rain("rain", 25);
+    write_gzip_rain("rain", 25);
+    write_gbl("binary_files", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+    write_gbl("gzip_files", &model_190, "0 net.rvr", "0 net.prm", "2\n6 rain\n2 60.0 0 23\n0");
+
+    //The files of each pass are inflated by the processes in turn and scattered, and give the same rainfall
+    run("binary_files", NULL);
+    run("gzip_files", NULL);
+
+    assert_same_output("gzip_files", "binary_files", same_steps_tolerance());
+}
+END_TEST
+
+
+//Inflates a gzip file of num_values values into a buffer of TEST_NUM_LINKS values. Returns the code of
+//uncompress_gzfile_buffer, and the number of values inflated in num_inflated.
+static int inflate_values(unsigned int num_values, size_t* num_inflated)
+{
+    char filename[ASYNCH_MAX_PATH_LENGTH];
+    uint32_t values[TEST_NUM_LINKS + 1] = { 0 };
+    size_t size = 0;
+
+    sprintf(filename, "values%u_%i.gz", num_values, my_rank);
+    gzFile gzfile = gzopen(filename, "wb");
+    ck_assert(gzfile != NULL);
+    ck_assert_int_eq(gzwrite(gzfile, values, num_values * sizeof(uint32_t)), num_values * sizeof(uint32_t));
+    gzclose(gzfile);
+
+    FILE* file = fopen(filename, "rb");
+    ck_assert(file != NULL);
+    int ret = uncompress_gzfile_buffer(file, values, TEST_NUM_LINKS * sizeof(uint32_t), &size);
+    fclose(file);
+
+    *num_inflated = size / sizeof(uint32_t);
+    return ret;
+}
+
+START_TEST (test_gzip_file_sizes)
+{
+    size_t num_inflated;
+
+    //A file with one value per link fills the buffer exactly
+    ck_assert_int_eq(inflate_values(TEST_NUM_LINKS, &num_inflated), Z_OK);
+    ck_assert_int_eq(num_inflated, TEST_NUM_LINKS);
+
+    //A short file is inflated and left to the caller to check, a long one is an error
+    ck_assert_int_eq(inflate_values(TEST_NUM_LINKS - 1, &num_inflated), Z_OK);
+    ck_assert_int_eq(num_inflated, TEST_NUM_LINKS - 1);
+    ck_assert_int_eq(inflate_values(TEST_NUM_LINKS + 1, &num_inflated), Z_DATA_ERROR);
+}
+END_TEST
+
+static void set_forcing_prefetch(AsynchSolver* asynch)
+{
+    Asynch_Set_Forcing_Prefetch(asynch, 1);
+}
+
+START_TEST (test_forcing_prefetch)
+{
+    write_binary_rain("rain", 25);
+    write_gzip_rain("rain", 25);
+    write_grid_rain("grid", 25);
+    write_gbl("binary_files", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+    write_gbl("binary_prefetch", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+    write_gbl("gzip_files", &model_190, "0 net.rvr", "0 net.prm", "2\n6 rain\n2 60.0 0 23\n0");
+    write_gbl("gzip_prefetch", &model_190, "0 net.rvr", "0 net.prm", "2\n6 rain\n2 60.0 0 23\n0");
+    write_gbl("grid_cells", &model_190, "0 net.rvr", "0 net.prm", "2\n8 grid.idx\n2 0 23\n0");
+    write_gbl("grid_prefetch", &model_190, "0 net.rvr", "0 net.prm", "2\n8 grid.idx\n2 0 23\n0");
+
+    //The files of the next pass are read while the current pass is solved, and give the same rainfall
+    run("binary_files", NULL);
+    run("binary_prefetch", set_forcing_prefetch);
+    run("gzip_files", NULL);
+    run("gzip_prefetch", set_forcing_prefetch);
+    run("grid_cells", NULL);
+    run("grid_prefetch", set_forcing_prefetch);
+
+    assert_same_output("binary_prefetch", "binary_files", same_steps_tolerance());
+    assert_same_output("gzip_prefetch", "gzip_files", same_steps_tolerance());
+    assert_same_output("grid_prefetch", "grid_cells", same_steps_tolerance());
+}
+END_TEST
+
+
+START_TEST (test_binary_storm_files)
+{
+    write_bstr("net.str", "net.bstr", 0);
+    write_bstr("res.str", "res.bstr", 6);
+    write_default_gbl("storm_file");
+    write_gbl("binary_storm_file", &model_190, "0 net.rvr", "0 net.prm", "2\n1 net.bstr\n0");
+    write_gbl("reservoir", &model_196, "0 net.rvr", "0 net.prm", "4\n1 net.str\n1 net.str\n0\n1 res.str");
+    write_gbl("binary_reservoir", &model_196, "0 net.rvr", "0 net.prm", "4\n1 net.bstr\n1 net.bstr\n0\n1 res.bstr");
+
+    //Every process reads the series of its own links and gets the same forcings as from the storm files. The reservoir
+    //forcing only holds the series of the reservoir.
+    run("storm_file", NULL);
+    run("binary_storm_file", NULL);
+    run("reservoir", NULL);
+    run("binary_reservoir", NULL);
+
+    assert_same_output("binary_storm_file", "storm_file", same_steps_tolerance());
+    assert_same_output("binary_reservoir", "reservoir", same_steps_tolerance());
+}
+END_TEST
+
+
+START_TEST (test_network_bundle)
+{
+    write_default_gbl("text_files");
+    write_gbl("bundle", &model_190, "2 net.nbd", "2 net.nbd", "2\n1 net.str\n0");
+
+    //Write the topology and parameters of the text files to a bundle, as asynch_bundle does
+    AsynchSolver* asynch = Asynch_Init(MPI_COMM_WORLD, false);
+    Asynch_Parse_GBL(asynch, "text_files.gbl");
+    Asynch_Load_Network(asynch);
+    ck_assert_int_eq(Asynch_Save_Network_Bundle(asynch, "net.nbd"), 0);
+    Asynch_Free(asynch);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    //The bundle gives the same network, so the runs are the same
+    run("text_files", NULL);
+    run("bundle", NULL);
+
+    assert_same_output("bundle", "text_files", same_steps_tolerance());
+}
+END_TEST
+
+
+//Model 196 with the reservoirs of wide.rsv
+static const TestModel model_196_wide =
+{
+    "196",
+    "5 0.33 0.20 -0.1 0.1 2.2917e-5",
+    "1 res.uini",
+    "1 wide.rsv 3",
+    "1e-3 1e-3 1e-3 1e-3 1e-3\n1e-6 1e-6 1e-6 1e-3 1e-3\n1e-3 1e-3 1e-3 1e-3 1e-3\n1e-6 1e-6 1e-6 1e-3 1e-3"
+};
+
+START_TEST (test_wide_junction)
+{
+    char contents[4096];
+    size_t l;
+
+    //Link 1 has 12 parents, links 2 to 13, which are reservoirs releasing the same discharge. Links 14 and 15 flow
+    //into link 2.
+    l = sprintf(contents, "%u\n\n1\n12", TEST_NUM_LINKS);
+    for (unsigned int i = 2; i <= 13; i++)
+        l += sprintf(contents + l, " %u", i);
+    l += sprintf(contents + l, "\n\n2\n2 14 15\n\n");
+    for (unsigned int i = 3; i <= TEST_NUM_LINKS; i++)
+        l += sprintf(contents + l, "%u\n0\n\n", i);
+    write_file("wide.rvr", contents);
+
+    l = sprintf(contents, "12\n");
+    for (unsigned int i = 2; i <= 13; i++)
+        l += sprintf(contents + l, "%u\n", i);
+    write_file("wide.rsv", contents);
+
+    l = sprintf(contents, "12\n\n");
+    for (unsigned int i = 2; i <= 13; i++)
+        l += sprintf(contents + l, "%u\n3\n0.0 0.5\n300.0 2.0\n900.0 1.0\n\n", i);
+    write_file("wide_res.str", contents);
+
+    //The same inflow into link 1 from its only parent, link 2, a reservoir releasing 12 times as much. The other
+    //links form a separate network.
+    l = sprintf(contents, "%u\n\n1\n1 2\n\n2\n0\n\n3\n2 4 5\n\n", TEST_NUM_LINKS);
+    for (unsigned int i = 4; i <= TEST_NUM_LINKS; i++)
+        l += sprintf(contents + l, "%u\n0\n\n", i);
+    write_file("narrow.rvr", contents);
+    write_file("narrow.rsv", "2\n");
+    write_file("narrow_res.str", "1\n\n2\n3\n0.0 6.0\n300.0 24.0\n900.0 12.0\n");
+
+    TestModel model_196_narrow = model_196_wide;
+    model_196_narrow.reservoirs = "1 narrow.rsv 3";
+    write_gbl("wide", &model_196_wide, "0 wide.rvr", "0 net.prm", "4\n1 net.str\n1 net.str\n0\n1 wide_res.str");
+    write_gbl("narrow", &model_196_narrow, "0 narrow.rvr", "0 net.prm", "4\n1 net.str\n1 net.str\n0\n1 narrow_res.str");
+
+    run("wide", NULL);
+    run("narrow", NULL);
+
+    assert_same_link("wide", "narrow", 1, same_steps_tolerance());
+}
+END_TEST
+
+
+static unsigned int num_decreasing;
+
+static void set_subtree_partitioning(AsynchSolver* asynch)
+{
+    Asynch_Custom_Partitioning(asynch, Partition_System_By_Subtrees);
+}
+
+static void count_decreasing_processes(AsynchSolver* asynch)
+{
+    for (unsigned int i = 0; i < asynch->N; i++)
+    {
+        Link* child = asynch->sys[i].child;
+        if (child && asynch->assignments[child->location] < asynch->assignments[i])
+            num_decreasing++;
+    }
+}
+
+START_TEST (test_subtree_partitioning)
+{
+    write_default_gbl("leaves");
+    write_default_gbl("subtrees");
+
+    num_decreasing = 0;
+    run("leaves", NULL);
+    run_prepared("subtrees", set_subtree_partitioning, count_decreasing_processes);
+
+    //Process numbers never decrease going downstream
+    ck_assert_int_eq(num_decreasing, 0);
+    assert_same_output("subtrees", "leaves", same_steps_tolerance());
+}
+END_TEST
+
+
+static unsigned int num_weighed;
+
+static void set_cost_save_file(AsynchSolver* asynch)
+{
+    Asynch_Set_Cost_Save_File(asynch, "costs.txt");
+}
+
+static void set_cost_load_file(AsynchSolver* asynch)
+{
+    Asynch_Set_Cost_Load_File(asynch, "costs.txt");
+}
+
+static void count_weighed_links(AsynchSolver* asynch)
+{
+    for (unsigned int i = 0; i < asynch->my_N; i++)
+        if (asynch->my_sys[i]->work > 0.0)
+            num_weighed++;
+}
+
+START_TEST (test_link_costs)
+{
+    write_default_gbl("save_costs");
+    write_default_gbl("load_costs");
+
+    run("save_costs", set_cost_save_file);
+
+    //The cost file has a line for every link, and their accepted steps add up to the steps of the run
+    int ok = 1;
+    if (my_rank == 0)
+    {
+        unsigned int num_links = 0, id;
+        unsigned long long accepted, rejected, evaluations, total = 0;
+        double seconds;
+        FILE* file = fopen("costs.txt", "r");
+        ok = (file && fscanf(file, "%u", &num_links) == 1 && num_links == TEST_NUM_LINKS);
+        for (unsigned int i = 0; ok && i < num_links; i++)
+        {
+            ok = (fscanf(file, "%u %llu %llu %llu %lf", &id, &accepted, &rejected, &evaluations, &seconds) == 5);
+            total += accepted;
+        }
+        ok = ok && (total == steps_accepted);
+        if (file)
+            fclose(file);
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    ck_assert_msg(ok, "costs.txt does not hold the steps of the %u links", TEST_NUM_LINKS);
+
+    //Every link weighs its recorded cost, and the network is split by subtrees
+    num_weighed = 0;
+    run_prepared("load_costs", set_cost_load_file, count_weighed_links);
+    MPI_Allreduce(MPI_IN_PLACE, &num_weighed, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+    ck_assert_int_eq(num_weighed, TEST_NUM_LINKS);
+    assert_same_output("load_costs", "save_costs", same_steps_tolerance());
+}
+END_TEST
+
+
+static void set_rebalance(AsynchSolver* asynch)
+{
+    Asynch_Set_Rebalance_Threshold(asynch, 0.01);
+}
+
+START_TEST (test_rebalance)
+{
+    //Links with saved output stay on their process, so only link 3 is saved: several links upstream of it can move.
+    //The links are moved at the boundaries of the 12 passes of the binary files.
+    write_binary_rain("rain", 25);
+    write_file("link3.sav", "3\n");
+    write_gbl_saving("fixed", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0", "1 link3.sav");
+    write_gbl_saving("rebalanced", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0", "1 link3.sav");
+
+    run("fixed", NULL);
+    run("rebalanced", set_rebalance);
+
+    //A moved link keeps only its last state, so its parents and child step as on a new process
+    assert_same_link("rebalanced", "fixed", 3, fmax(1e-6, same_steps_tolerance()));
+}
+END_TEST
+
+
+START_TEST (test_persistent_receives)
+{
+    //The receives stay posted from one of the 12 passes to the next, and are closed when the solver is freed
+    write_binary_rain("rain", 25);
+    write_gbl("one_pass", &model_190, "0 net.rvr", "0 net.prm", "2\n1 rain.str\n0");
+    write_gbl("passes", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+    write_gbl("passes_thread", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+
+    run("one_pass", NULL);
+    run("passes", NULL);
+    run("passes_thread", set_comm_thread);
+
+    assert_same_output("passes", "one_pass", 1e-4);
+    assert_same_output("passes_thread", "passes", fmax(1e-6, same_steps_tolerance()));
+}
+END_TEST
+
+static void set_shared_transfer(AsynchSolver* asynch)
+{
+    Asynch_Set_Shared_Transfer(asynch, 1);
+}
+
+START_TEST (test_shared_transfer)
+{
+    //All the processes of the test are on one node, so with shared transfer no step goes through a message
+    write_binary_rain("rain", 25);
+    write_gbl("messages", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+    write_gbl("shared", &model_190, "0 net.rvr", "0 net.prm", "2\n2 rain\n2 60.0 0 23\n0");
+
+    run("messages", NULL);
+    run("shared", set_shared_transfer);
+
+    assert_same_output("shared", "messages", fmax(1e-6, same_steps_tolerance()));
+}
+END_TEST
+
 Suite * asynch_suite(void)
 {
     Suite *s;
     TCase *tc_date_manip;
+    TCase *tc_link;
+    TCase *tc_solver;
 
     s = suite_create("Asynch");
 
@@ -28,21 +1355,115 @@ Suite * asynch_suite(void)
     tcase_add_test(tc_date_manip , test_date_manip_days_in_month);
     suite_add_tcase(s, tc_date_manip );
 
+    /* Link layout test case */
+    tc_link = tcase_create("Link layout ");
+
+    tcase_add_test(tc_link, test_link_scheduling_fields);
+    suite_add_tcase(s, tc_link);
+
+    /* Solver test case */
+    tc_solver = tcase_create("Solver ");
+    tcase_set_timeout(tc_solver, 120);
+
+    tcase_add_test(tc_solver, test_scheduler_queue);
+    tcase_add_test(tc_solver, test_threads);
+    tcase_add_test(tc_solver, test_comm_thread);
+    tcase_add_test(tc_solver, test_passes);
+    tcase_add_test(tc_solver, test_leaf_batch);
+    tcase_add_test(tc_solver, test_chains);
+    tcase_add_test(tc_solver, test_reservoir_dense_output);
+    tcase_add_test(tc_solver, test_specialized_solvers);
+    tcase_add_test(tc_solver, test_step_size_controllers);
+    tcase_add_test(tc_solver, test_link_arena);
+    tcase_add_test(tc_solver, test_adaptive_lists);
+    tcase_add_test(tc_solver, test_float_history);
+    tcase_add_test(tc_solver, test_delete_temporary_files);
+    tcase_add_test(tc_solver, test_grid_cells);
+    tcase_add_test(tc_solver, test_binary_owned_links);
+    tcase_add_test(tc_solver, test_gzip_files);
+    tcase_add_test(tc_solver, test_gzip_file_sizes);
+    tcase_add_test(tc_solver, test_forcing_prefetch);
+    tcase_add_test(tc_solver, test_binary_storm_files);
+    tcase_add_test(tc_solver, test_network_bundle);
+    tcase_add_test(tc_solver, test_wide_junction);
+    tcase_add_test(tc_solver, test_subtree_partitioning);
+    tcase_add_test(tc_solver, test_link_costs);
+    tcase_add_test(tc_solver, test_rebalance);
+    tcase_add_test(tc_solver, test_persistent_receives);
+    tcase_add_test(tc_solver, test_shared_transfer);
+    suite_add_tcase(s, tc_solver);
+
     return s;
 }
 
 
-int main(void)
+//Removes the files of the temporary directory, and the directory
+static void remove_test_dir()
+{
+    DIR* dir = opendir(test_dir);
+    if (dir)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            char filename[2 * ASYNCH_MAX_PATH_LENGTH];
+            if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+            {
+                sprintf(filename, "%s/%s", test_dir, entry->d_name);
+                remove(filename);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(test_dir);
+}
+
+
+int main(int argc, char* argv[])
 {
     int number_failed;
     Suite *s;
     SRunner *sr;
 
+    //The solver runs may use a communication thread
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &np);
+
+    //Every process works in the same temporary directory
+    if (my_rank == 0)
+    {
+        strcpy(test_dir, "/tmp/check_asynch_XXXXXX");
+        if (!mkdtemp(test_dir))
+        {
+            printf("Error: cannot create a temporary directory\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Bcast(test_dir, ASYNCH_MAX_PATH_LENGTH, MPI_CHAR, 0, MPI_COMM_WORLD);
+    if (chdir(test_dir))
+    {
+        printf("Error: cannot change to %s\n", test_dir);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    write_network();
+
     s = asynch_suite();
     sr = srunner_create(s);
 
-    srunner_run_all(sr, CK_NORMAL);
+    //The processes run the tests together, they cannot be forked
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, my_rank == 0 ? CK_NORMAL : CK_SILENT);
     number_failed = srunner_ntests_failed(sr);
     srunner_free(sr);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (my_rank == 0)
+        remove_test_dir();
+
+    MPI_Finalize();
+
     return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
-}
\ No newline at end of file
+}
@@ -0,0 +1,4 @@
+#!/bin/sh
+# Runs the tests on 3 processes, so the links of the test network are split between them and exchange their steps.
+# Set MPIEXEC to change how they are launched, e.g. MPIEXEC="mpiexec --oversubscribe".
+exec ${MPIEXEC:-mpiexec} -n 3 ./check_asynch
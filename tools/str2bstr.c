@@ -0,0 +1,124 @@
+//Converts a storm file (.str) to a binary storm file (.bstr), which every process reads directly for its own links.
+//The binary file starts with a header (the characters BSTR, the version, the number of links and a zero, as 32 bit
+//integers), followed by an entry for each link (link id and number of points as 32 bit integers, and the offset in
+//the file of its series as a 64 bit integer) and the series. A series holds the times of the points as doubles, then
+//their values as floats. Numbers are written in the byte order of this machine.
+
+#if !defined(_MSC_VER)
+#include <config.h>
+#else
+#include <config_msvc.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BSTR_VERSION 1
+
+typedef struct BstrEntry
+{
+    uint32_t link_id;
+    uint32_t num_points;
+    uint64_t offset;
+} BstrEntry;
+
+int main(int argc, char* argv[])
+{
+    unsigned int i, j, limit, capacity = 0;
+    FILE *input, *output;
+
+    if (argc < 3)
+    {
+        printf("Usage: %s <input .str file> <output .bstr file>\n", argv[0]);
+        return 1;
+    }
+
+    input = fopen(argv[1], "r");
+    if (!input)
+    {
+        printf("Error: cannot open storm file %s.\n", argv[1]);
+        return 1;
+    }
+    if (fscanf(input, "%u", &limit) != 1)
+    {
+        printf("Error: cannot read the number of links from %s.\n", argv[1]);
+        fclose(input);
+        return 1;
+    }
+
+    output = fopen(argv[2], "wb");
+    if (!output)
+    {
+        printf("Error: cannot create binary storm file %s.\n", argv[2]);
+        fclose(input);
+        return 1;
+    }
+
+    //The index is written once the offsets of the series are known
+    uint32_t header[4] = { 0, BSTR_VERSION, limit, 0 };
+    memcpy(header, "BSTR", 4);
+    BstrEntry* index = calloc(limit, sizeof(BstrEntry));
+    uint64_t offset = sizeof(header) + (uint64_t)limit * sizeof(BstrEntry);
+    fwrite(header, sizeof(uint32_t), 4, output);
+    fwrite(index, sizeof(BstrEntry), limit, output);
+
+    double* times = NULL;
+    float* values = NULL;
+    int error = 0;
+    for (i = 0; i < limit && !error; i++)
+    {
+        unsigned int m;
+        if (fscanf(input, "%u %u", &index[i].link_id, &m) != 2)
+        {
+            printf("Error: cannot read link %u of %u from %s.\n", i + 1, limit, argv[1]);
+            error = 1;
+            break;
+        }
+        if (m > capacity)
+        {
+            capacity = m;
+            times = realloc(times, capacity * sizeof(double));
+            values = realloc(values, capacity * sizeof(float));
+        }
+        for (j = 0; j < m; j++)
+        {
+            if (fscanf(input, "%lf %f", &times[j], &values[j]) != 2)
+            {
+                printf("Error: cannot read point %u of link id %u from %s.\n", j + 1, index[i].link_id, argv[1]);
+                error = 1;
+                break;
+            }
+        }
+
+        index[i].num_points = m;
+        index[i].offset = offset;
+        if (fwrite(times, sizeof(double), m, output) != m || fwrite(values, sizeof(float), m, output) != m)
+        {
+            printf("Error: cannot write to %s.\n", argv[2]);
+            error = 1;
+        }
+        offset += m * (sizeof(double) + sizeof(float));
+    }
+
+    //Write the index
+    if (!error && (fseek(output, sizeof(header), SEEK_SET) || fwrite(index, sizeof(BstrEntry), limit, output) != limit))
+    {
+        printf("Error: cannot write to %s.\n", argv[2]);
+        error = 1;
+    }
+
+    if (!error)
+        printf("Wrote %u links to %s.\n", limit, argv[2]);
+
+    //Clean up
+    fclose(input);
+    if (fclose(output))
+        error = 1;
+    free(index);
+    free(times);
+    free(values);
+
+    return error;
+}